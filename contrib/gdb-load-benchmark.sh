@@ -0,0 +1,52 @@
+#!/bin/sh
+
+# Measure the GDB "load" throughput of a running OpenOCD instance.
+#
+# The same ELF file is loaded several times through the GDB remote protocol
+# and the transfer rate reported by GDB is printed for each run, followed by
+# the average. Comparing the result with the raw adapter bandwidth, e.g. as
+# measured by "load_image <file> 0x20000000 bin" in the telnet console, shows
+# the overhead of the GDB server.
+#
+# Usage:
+# contrib/gdb-load-benchmark.sh <elf-file> [gdb-port [runs]]
+#
+# The GDB executable can be selected with the GDB environment variable, for
+# example GDB=arm-none-eabi-gdb. The target should be halted and the ELF file
+# must be loadable to RAM (or to flash, in which case the flash programming
+# time dominates the result).
+
+set -e
+
+ELF=$1
+PORT=${2:-3333}
+RUNS=${3:-5}
+GDB=${GDB:-gdb-multiarch}
+
+if [ -z "$ELF" ]; then
+	echo "usage: $0 <elf-file> [gdb-port [runs]]" >&2
+	exit 1
+fi
+
+i=0
+total=0
+
+while [ $i -lt "$RUNS" ]; do
+	rate=$("$GDB" -batch -nx \
+		-ex "set confirm off" \
+		-ex "target extended-remote :$PORT" \
+		-ex "load" \
+		-ex "disconnect" \
+		"$ELF" 2>&1 | sed -n 's/.*Transfer rate: \([0-9]*\) KB\/sec.*/\1/p')
+
+	if [ -z "$rate" ]; then
+		echo "run $i: no transfer rate reported by $GDB" >&2
+		exit 1
+	fi
+
+	echo "run $i: $rate KB/s"
+	total=$((total + rate))
+	i=$((i + 1))
+done
+
+echo "average: $((total / RUNS)) KB/s"
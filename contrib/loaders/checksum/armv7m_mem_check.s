@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+	Blank check, CRC32 and compare of a list of memory regions, in a
+	single run. The code does not modify itself and may stay resident in
+	the working area between runs.
+
+	parameters:
+	r0 - pointer to an array of struct region, terminated by op 0:
+
+	struct region {
+		uint32_t op;
+		uint32_t address;
+		uint32_t size;		in bytes
+		uint32_t arg_result;
+	};
+
+	op 1 - blank check: arg is the erased word, result is 1 when the
+	       region only holds it, 0 otherwise. size is a multiple of 4.
+	op 2 - CRC32: arg is the initial CRC, result the CRC of the region.
+	op 3 - compare: arg is the address of a second region of the same
+	       size, result is 0 if both are equal, otherwise the offset of
+	       the first difference plus one.
+
+	The op of each region is cleared once it is done, so the regions
+	completed before an interrupted run are known.
+*/
+
+	.text
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+	.thumb_func
+
+	.align	2
+
+OP_BLANK		= 1
+OP_CRC32		= 2
+OP_COMPARE		= 3
+
+REGION_OP		= 0
+REGION_ADDRESS		= 4
+REGION_SIZE		= 8
+REGION_ARG_RESULT	= 12
+SIZEOF_STRUCT_REGION	= 16
+
+start:
+region_loop:
+	ldr	r1, [r0, #REGION_OP]
+	ldr	r2, [r0, #REGION_ADDRESS]
+	ldr	r3, [r0, #REGION_SIZE]
+	ldr	r4, [r0, #REGION_ARG_RESULT]
+	cmp	r1, #OP_BLANK
+	beq	blank_check
+	cmp	r1, #OP_CRC32
+	beq	crc32
+	cmp	r1, #OP_COMPARE
+	beq	compare
+	b	done		/* op 0 ends the list */
+
+blank_check:
+	movs	r5, #1		/* erased until proven otherwise */
+blank_loop:
+	subs	r3, r3, #4
+	bcc	save_r5
+	ldr	r6, [r2]
+	adds	r2, r2, #4
+	cmp	r6, r4
+	beq	blank_loop
+	movs	r5, #0		/* not erased */
+save_r5:
+	str	r5, [r0, #REGION_ARG_RESULT]
+next_region:
+	movs	r1, #0
+	str	r1, [r0, #REGION_OP]
+	adds	r0, r0, #SIZEOF_STRUCT_REGION
+	b	region_loop
+
+crc32:
+	ldr	r7, CRC32XOR
+crc_byte:
+	subs	r3, r3, #1
+	bcc	save_r4
+	ldrb	r1, [r2]
+	adds	r2, r2, #1
+	lsls	r1, r1, #24
+	eors	r4, r4, r1
+	movs	r5, #8
+crc_bit:
+	lsls	r4, r4, #1	/* the bit shifted out goes to carry */
+	bcc	crc_no_xor
+	eors	r4, r4, r7
+crc_no_xor:
+	subs	r5, r5, #1
+	bne	crc_bit
+	b	crc_byte
+save_r4:
+	str	r4, [r0, #REGION_ARG_RESULT]
+	b	next_region
+
+compare:
+	movs	r5, #0
+compare_loop:
+	cmp	r5, r3
+	beq	compare_equal
+	ldrb	r1, [r2, r5]
+	ldrb	r6, [r4, r5]
+	adds	r5, r5, #1
+	cmp	r1, r6
+	beq	compare_loop
+	b	save_r5		/* offset of the difference + 1 */
+compare_equal:
+	movs	r5, #0
+	b	save_r5
+
+	.align	2
+
+CRC32XOR:	.word	0x04c11db7
+
+done:
+	bkpt	#0
+
+	.end
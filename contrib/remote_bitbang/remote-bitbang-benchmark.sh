@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# Measure the remote_bitbang throughput with and without the protocol
+# extensions, against the loopback server in this directory.
+#
+# The loopback server is built and started on a UNIX socket, then an SVF
+# file of long SDR scans that capture TDO is played through OpenOCD once
+# with "remote_bitbang extensions off" (one byte per TCK edge on the wire)
+# and once with the extensions on (packed scan records). The time used as
+# reported by the svf command is printed for both runs.
+#
+# Usage:
+# contrib/remote_bitbang/remote-bitbang-benchmark.sh [scans [openocd-executable]]
+
+set -e
+
+SCANS=${1:-2000}
+OPENOCD=${2:-openocd}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d /tmp/remote-bitbang-benchmark.XXXXXX)
+SOCKET=$TMP/socket
+SVF=$TMP/bench.svf
+
+trap 'kill $SERVER 2>/dev/null; rm -rf "$TMP"' EXIT
+
+${CC:-cc} -Wall -O2 -std=gnu99 -o "$TMP/loopback" "$DIR/remote_bitbang_loopback.c"
+"$TMP/loopback" "$SOCKET" &
+SERVER=$!
+sleep 1
+
+# BYPASS is selected. TDO is captured but not compared, so every scan
+# needs its reply from the server.
+HEX=$(printf '0123456789ABCDEF%.0s' $(seq 64))
+{
+	echo "TRST OFF;"
+	echo "ENDIR IDLE;"
+	echo "ENDDR IDLE;"
+	echo "STATE RESET;"
+	echo "STATE IDLE;"
+	echo "SIR 4 TDI (F);"
+	yes "SDR 4096 TDI ($HEX) TDO (0) MASK (0);" | head -n "$SCANS"
+} > "$SVF"
+
+for ext in off on; do
+	time=$("$OPENOCD" \
+		-c "adapter driver remote_bitbang" \
+		-c "remote_bitbang port 0" \
+		-c "remote_bitbang host $SOCKET" \
+		-c "remote_bitbang extensions $ext" \
+		-c "jtag newtap loop tap -irlen 4 -expected-id 0x1badb0b1" \
+		-c "init" \
+		-c "svf -quiet $SVF" \
+		-c "shutdown" 2>&1 | sed -n 's/.*Time used: \([0-9ms]*\).*/\1/p')
+
+	echo "extensions $ext: ${time:-failed}"
+done
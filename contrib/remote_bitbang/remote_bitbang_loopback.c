@@ -0,0 +1,546 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+  This is a remote bitbang server for the OpenOCD remote_bitbang interface
+  driver that emulates in software:
+  - for JTAG, a single TAP: IR length 4, IDCODE instruction 0001 (selected
+    after reset) with a 32 bit IDCODE, and BYPASS for every other instruction;
+  - for SWD, a SW-DP with one MEM-AP giving access to 64 KiB of RAM at
+    0x20000000.
+
+  It implements the stock protocol as well as the protocol extensions ('V',
+  'X', 'S' and 'T' records) described in
+  doc/manual/jtag/drivers/remote_bitbang.txt, which makes it useful to test
+  and benchmark the driver without hardware.
+
+  To compile run:
+  gcc -Wall -O2 -std=gnu99 -o remote_bitbang_loopback remote_bitbang_loopback.c
+
+  Usage example:
+
+  ./remote_bitbang_loopback 3335
+  openocd -c "adapter driver remote_bitbang; remote_bitbang port 3335" \
+	  -c "jtag newtap loop tap -irlen 4 -expected-id 0x1badb0b1"
+
+  For SWD:
+  openocd -c "adapter driver remote_bitbang; remote_bitbang port 3335" \
+	  -c "transport select swd; swd newdap loop cpu -expected-id 0x2ba01477" \
+	  -c "dap create loop.dap -chain-position loop.cpu; init" \
+	  -c "loop.dap apreg 0 0xfc"
+
+  Or with a UNIX socket:
+  ./remote_bitbang_loopback /tmp/remotebitbang-socket
+  openocd -c "adapter driver remote_bitbang; remote_bitbang port 0" \
+	  -c "remote_bitbang host /tmp/remotebitbang-socket" ...
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define IDCODE		0x1badb0b1
+#define IR_LEN		4
+#define IR_IDCODE	0x1
+
+#define PROTOCOL_VERSION	1
+#define CAP_SCAN		0x0001
+#define CAP_SWD			0x0002
+#define MAX_SCAN_BITS		(1024 * 1024)
+#define SCAN_CAPTURE		0x01
+
+enum tap_state {
+	TLR, IDLE,
+	SELECT_DR, CAPTURE_DR, SHIFT_DR, EXIT1_DR, PAUSE_DR, EXIT2_DR, UPDATE_DR,
+	SELECT_IR, CAPTURE_IR, SHIFT_IR, EXIT1_IR, PAUSE_IR, EXIT2_IR, UPDATE_IR,
+};
+
+/* next state for TMS = 0 and TMS = 1 */
+static const enum tap_state next_state[][2] = {
+	[TLR]        = { IDLE,       TLR },
+	[IDLE]       = { IDLE,       SELECT_DR },
+	[SELECT_DR]  = { CAPTURE_DR, SELECT_IR },
+	[CAPTURE_DR] = { SHIFT_DR,   EXIT1_DR },
+	[SHIFT_DR]   = { SHIFT_DR,   EXIT1_DR },
+	[EXIT1_DR]   = { PAUSE_DR,   UPDATE_DR },
+	[PAUSE_DR]   = { PAUSE_DR,   EXIT2_DR },
+	[EXIT2_DR]   = { SHIFT_DR,   UPDATE_DR },
+	[UPDATE_DR]  = { IDLE,       SELECT_DR },
+	[SELECT_IR]  = { CAPTURE_IR, TLR },
+	[CAPTURE_IR] = { SHIFT_IR,   EXIT1_IR },
+	[SHIFT_IR]   = { SHIFT_IR,   EXIT1_IR },
+	[EXIT1_IR]   = { PAUSE_IR,   UPDATE_IR },
+	[PAUSE_IR]   = { PAUSE_IR,   EXIT2_IR },
+	[EXIT2_IR]   = { SHIFT_IR,   UPDATE_IR },
+	[UPDATE_IR]  = { IDLE,       SELECT_DR },
+};
+
+static struct {
+	enum tap_state state;
+	uint32_t ir;
+	uint32_t shift;
+	unsigned int shift_len;
+	int tck;
+} tap;
+
+#define DPIDR		0x2ba01477
+#define AP_IDR		0x24770011
+#define RAM_BASE	0x20000000
+#define RAM_SIZE	(64 * 1024)
+
+#define SWD_ACK_OK	0x1
+
+static struct {
+	uint32_t ctrl_stat;
+	uint32_t select;
+	uint32_t rdbuff;
+	uint32_t csw;
+	uint32_t tar;
+	uint8_t ram[RAM_SIZE];
+} dap;
+
+static int client_fd;
+
+static uint8_t in_buf[64 * 1024];
+static size_t in_pos, in_len;
+static uint8_t out_buf[64 * 1024];
+static size_t out_len;
+
+static void tap_reset(void)
+{
+	tap.state = TLR;
+	tap.ir = IR_IDCODE;
+}
+
+static int tap_tdo(void)
+{
+	if (tap.state == SHIFT_DR || tap.state == SHIFT_IR)
+		return tap.shift & 1;
+	return 0;
+}
+
+/* One TCK cycle: the caller has already set TMS and TDI, this is the
+ * rising edge. */
+static void tap_clock(int tms, int tdi)
+{
+	switch (tap.state) {
+	case CAPTURE_DR:
+		if (tap.ir == IR_IDCODE) {
+			tap.shift = IDCODE;
+			tap.shift_len = 32;
+		} else {
+			tap.shift = 0;
+			tap.shift_len = 1;
+		}
+		break;
+	case CAPTURE_IR:
+		tap.shift = 0x1;
+		tap.shift_len = IR_LEN;
+		break;
+	case SHIFT_DR:
+	case SHIFT_IR:
+		tap.shift = (tap.shift >> 1) | ((uint32_t)tdi << (tap.shift_len - 1));
+		break;
+	default:
+		break;
+	}
+
+	tap.state = next_state[tap.state][tms];
+
+	if (tap.state == TLR)
+		tap_reset();
+	else if (tap.state == UPDATE_IR)
+		tap.ir = tap.shift & ((1 << IR_LEN) - 1);
+}
+
+static uint32_t ram_access(bool write, uint32_t addr, uint32_t data)
+{
+	unsigned int size = 1 << (dap.csw & 0x7);
+	uint32_t value = 0;
+
+	if (size > 4)
+		size = 4;
+	addr &= ~(size - 1);
+
+	for (unsigned int i = 0; i < size; i++) {
+		uint32_t a = addr + i - RAM_BASE;
+		unsigned int lane = ((addr + i) & 3) * 8;
+		if (a >= RAM_SIZE)
+			continue;
+		if (write)
+			dap.ram[a] = data >> lane;
+		else
+			value |= (uint32_t)dap.ram[a] << lane;
+	}
+
+	/* single auto-increment */
+	if ((dap.csw & 0x30) == 0x10)
+		dap.tar += size;
+
+	return value;
+}
+
+static uint32_t ap_access(bool rnw, unsigned int addr, uint32_t data)
+{
+	uint32_t value = 0;
+
+	addr |= dap.select & 0xf0;
+	if (dap.select >> 24)
+		return 0;
+
+	switch (addr) {
+	case 0x00:
+		if (rnw)
+			value = dap.csw;
+		else
+			dap.csw = data;
+		break;
+	case 0x04:
+		if (rnw)
+			value = dap.tar;
+		else
+			dap.tar = data;
+		break;
+	case 0x0c:
+		value = ram_access(!rnw, dap.tar, data);
+		break;
+	case 0x10: case 0x14: case 0x18: case 0x1c: {
+		uint32_t saved_csw = dap.csw;
+		dap.csw = (dap.csw & ~0x37) | 0x2;
+		value = ram_access(!rnw, (dap.tar & ~0xf) | (addr & 0xc), data);
+		dap.csw = saved_csw;
+		break;
+	}
+	case 0xfc:
+		value = AP_IDR;
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+static uint32_t dp_access(bool rnw, unsigned int addr, uint32_t data)
+{
+	switch (addr) {
+	case 0x0:
+		/* DPIDR / ABORT */
+		return rnw ? DPIDR : 0;
+	case 0x4:
+		if (!rnw) {
+			dap.ctrl_stat = data;
+			return 0;
+		}
+		/* acknowledge the power-up requests */
+		return (dap.ctrl_stat & ~0xa0000000) | ((dap.ctrl_stat & 0x50000000) << 1);
+	case 0x8:
+		/* RESEND / SELECT */
+		if (!rnw)
+			dap.select = data;
+		return 0;
+	default:
+		/* RDBUFF / TARGETSEL */
+		return rnw ? dap.rdbuff : 0;
+	}
+}
+
+static int flush_out(void)
+{
+	size_t offset = 0;
+
+	while (offset < out_len) {
+		ssize_t n = write(client_fd, out_buf + offset, out_len - offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return -1;
+		}
+		offset += n;
+	}
+	out_len = 0;
+	return 0;
+}
+
+static int put_byte(uint8_t c)
+{
+	if (out_len == sizeof(out_buf) && flush_out() < 0)
+		return -1;
+	out_buf[out_len++] = c;
+	return 0;
+}
+
+/* Returns the next input byte, -1 on error and -2 on end of connection.
+ * Pending output is sent before waiting for more input. */
+static int get_byte(void)
+{
+	if (in_pos == in_len) {
+		if (flush_out() < 0)
+			return -1;
+		ssize_t n;
+		do {
+			n = read(client_fd, in_buf, sizeof(in_buf));
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			perror("read");
+			return -1;
+		}
+		if (n == 0)
+			return -2;
+		in_pos = 0;
+		in_len = n;
+	}
+	return in_buf[in_pos++];
+}
+
+static int get_bytes(uint8_t *buf, size_t len)
+{
+	while (len--) {
+		int c = get_byte();
+		if (c < 0)
+			return c;
+		*buf++ = c;
+	}
+	return 0;
+}
+
+static int handle_version(void)
+{
+	uint8_t reply[8] = { 'V', PROTOCOL_VERSION,
+		(CAP_SCAN | CAP_SWD) & 0xff, (CAP_SCAN | CAP_SWD) >> 8,
+		MAX_SCAN_BITS & 0xff, (MAX_SCAN_BITS >> 8) & 0xff,
+		(MAX_SCAN_BITS >> 16) & 0xff, (MAX_SCAN_BITS >> 24) & 0xff };
+
+	for (size_t i = 0; i < sizeof(reply); i++)
+		if (put_byte(reply[i]) < 0)
+			return -1;
+	return 0;
+}
+
+static int handle_scan(void)
+{
+	static uint8_t tms[MAX_SCAN_BITS / 8], tdi[MAX_SCAN_BITS / 8];
+	uint8_t header[5];
+	int retval = get_bytes(header, sizeof(header));
+	if (retval < 0)
+		return retval;
+
+	bool capture = header[0] & SCAN_CAPTURE;
+	uint32_t bits = header[1] | header[2] << 8 | header[3] << 16 |
+		(uint32_t)header[4] << 24;
+	if (bits == 0 || bits > MAX_SCAN_BITS) {
+		fprintf(stderr, "invalid scan record length %u\n", bits);
+		return -1;
+	}
+
+	size_t bytes = (bits + 7) / 8;
+	retval = get_bytes(tms, bytes);
+	if (retval == 0)
+		retval = get_bytes(tdi, bytes);
+	if (retval < 0)
+		return retval;
+
+	uint8_t tdo = 0;
+	for (uint32_t i = 0; i < bits; i++) {
+		int tms_bit = (tms[i / 8] >> (i % 8)) & 1;
+		int tdi_bit = (tdi[i / 8] >> (i % 8)) & 1;
+
+		tdo |= tap_tdo() << (i % 8);
+		tap_clock(tms_bit, tdi_bit);
+		tap.tck = 1;
+
+		if (capture && (i % 8 == 7 || i == bits - 1)) {
+			if (put_byte(tdo) < 0)
+				return -1;
+			tdo = 0;
+		}
+	}
+	return 0;
+}
+
+/* Whole SWD transaction: request, turnaround, ack, data with parity and the
+ * idle cycles after it. The emulated DP never answers WAIT or FAULT. */
+static int handle_swd_transfer(void)
+{
+	uint8_t record[10];
+	int retval = get_bytes(record, sizeof(record));
+	if (retval < 0)
+		return retval;
+
+	uint8_t request = record[0];
+	bool apndp = request & 0x02;
+	bool rnw = request & 0x04;
+	unsigned int addr = (request >> 1) & 0xc;
+	uint32_t data = record[2] | record[3] << 8 | record[4] << 16 |
+		(uint32_t)record[5] << 24;
+	uint32_t value;
+
+	if (apndp) {
+		value = ap_access(rnw, addr, data);
+		if (rnw) {
+			/* AP reads are posted */
+			uint32_t previous = dap.rdbuff;
+			dap.rdbuff = value;
+			value = previous;
+		}
+	} else {
+		value = dp_access(rnw, addr, data);
+	}
+
+	if (put_byte(SWD_ACK_OK) < 0)
+		return -1;
+	if (rnw) {
+		for (unsigned int i = 0; i < 32; i += 8)
+			if (put_byte(value >> i) < 0)
+				return -1;
+		if (put_byte(__builtin_parity(value)) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int handle_swd_sequence(void)
+{
+	static uint8_t bits[MAX_SCAN_BITS / 8];
+	uint8_t header[4];
+	int retval = get_bytes(header, sizeof(header));
+	if (retval < 0)
+		return retval;
+
+	uint32_t count = header[0] | header[1] << 8 | header[2] << 16 |
+		(uint32_t)header[3] << 24;
+	if (count > MAX_SCAN_BITS) {
+		fprintf(stderr, "invalid sequence length %u\n", count);
+		return -1;
+	}
+
+	/* the bits are clocked out and have no effect on the emulated DP */
+	return get_bytes(bits, (count + 7) / 8);
+}
+
+static int serve(void)
+{
+	tap_reset();
+	memset(&dap, 0, sizeof(dap));
+	tap.tck = 0;
+	in_pos = in_len = out_len = 0;
+
+	for (;;) {
+		int c = get_byte();
+		if (c == -2)
+			return 0;
+		if (c < 0)
+			return -1;
+
+		switch (c) {
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7': {
+			int tck = (c - '0') & 4;
+			if (tck && !tap.tck)
+				tap_clock(!!((c - '0') & 2), (c - '0') & 1);
+			tap.tck = !!tck;
+			break;
+		}
+		case 'R':
+			if (put_byte('0' + tap_tdo()) < 0)
+				return -1;
+			break;
+		case 'r': case 's': case 't': case 'u':
+			/* TRST */
+			if ((c - 'r') & 2)
+				tap_reset();
+			break;
+		case 'B': case 'b':
+			break;
+		case 'V':
+			if (handle_version() < 0)
+				return -1;
+			break;
+		case 'X':
+		case 'S':
+		case 'T': {
+			int retval = c == 'X' ? handle_scan() :
+				c == 'S' ? handle_swd_sequence() : handle_swd_transfer();
+			if (retval == -2)
+				return 0;
+			if (retval < 0)
+				return -1;
+			break;
+		}
+		case 'Q':
+			flush_out();
+			return 0;
+		default:
+			fprintf(stderr, "unknown command '%c'\n", c);
+			break;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int listen_fd;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s port|socket-path\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char *end;
+	unsigned long port = strtoul(argv[1], &end, 0);
+	if (*end == '\0') {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		int one = 1;
+
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("bind");
+			return EXIT_FAILURE;
+		}
+	} else {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+		strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+		unlink(argv[1]);
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("bind");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (listen(listen_fd, 1) < 0) {
+		perror("listen");
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd < 0) {
+			perror("accept");
+			return EXIT_FAILURE;
+		}
+
+		int one = 1;
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		int retval = serve();
+		close(client_fd);
+		if (retval < 0)
+			fprintf(stderr, "connection closed on error\n");
+	}
+}
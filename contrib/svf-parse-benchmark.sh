@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# Measure how fast OpenOCD parses and executes a large SVF file.
+#
+# A synthetic SVF file of the given size (500 MB by default) made of long
+# SDR scans is generated and then played twice against the dummy adapter:
+# once with "-nil", which only parses the file, and once for real, which
+# also shifts every scan through the dummy adapter. The time used as
+# reported by the svf command is printed for both runs.
+#
+# Usage:
+# contrib/svf-parse-benchmark.sh [size-in-MB [openocd-executable]]
+
+set -e
+
+SIZE_MB=${1:-500}
+OPENOCD=${2:-openocd}
+SVF=$(mktemp /tmp/svf-benchmark.XXXXXX)
+
+trap 'rm -f "$SVF"' EXIT
+
+# 1024 hex digits, 4096 bits per scan
+HEX=$(printf '0123456789ABCDEF%.0s' $(seq 64))
+LINE="SDR 4096 TDI ($HEX);"
+LINES=$((SIZE_MB * 1024 * 1024 / (${#LINE} + 1)))
+
+{
+	echo "TRST OFF;"
+	echo "ENDIR IDLE;"
+	echo "ENDDR IDLE;"
+	echo "STATE RESET;"
+	echo "STATE IDLE;"
+	echo "SIR 8 TDI (01);"
+	yes "$LINE" | head -n "$LINES"
+} > "$SVF"
+
+echo "generated $(($(wc -c < "$SVF") / 1024 / 1024)) MB, $LINES scans"
+
+for mode in -nil ""; do
+	time=$("$OPENOCD" \
+		-c "adapter driver dummy" \
+		-c "adapter speed 1000" \
+		-c "transport select jtag" \
+		-c "jtag newtap bench tap -irlen 8" \
+		-c "init" \
+		-c "svf -quiet $mode $SVF" \
+		-c "shutdown" 2>&1 | sed -n 's/.*Time used: \([0-9ms]*\).*/\1/p')
+
+	echo "svf ${mode:-(execute)}: ${time:-failed}"
+done
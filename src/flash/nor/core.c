@@ -27,6 +27,7 @@
 #include <flash/nor/core.h>
 #include <flash/nor/imp.h>
 #include <target/image.h>
+#include <helper/time_support.h>
 
 /**
  * @file
@@ -456,13 +457,13 @@ int default_flash_blank_check(struct flash_bank *bank)
  * sectors will be added to the range, and that reason string is used when
  * warning about those additions.
  */
-static int flash_iterate_address_range_inner(struct target *target,
+/* Find the sectors (or protection blocks) covering addr .. addr + length - 1
+ * in bank c, padding the range to whole sectors if pad_reason is set. */
+static int flash_range_to_blocks(struct flash_bank *c,
 	char *pad_reason, target_addr_t addr, uint32_t length,
-	bool iterate_protect_blocks,
-	int (*callback)(struct flash_bank *bank, unsigned int first,
-		unsigned int last))
+	bool iterate_protect_blocks, unsigned int *first_block,
+	unsigned int *last_block)
 {
-	struct flash_bank *c;
 	struct flash_sector *block_array;
 	target_addr_t last_addr = addr + length - 1;	/* the last address of range */
 	int first = -1;
@@ -470,25 +471,6 @@ static int flash_iterate_address_range_inner(struct target *target,
 	int i;
 	int num_blocks;
 
-	int retval = get_flash_bank_by_addr(target, addr, true, &c);
-	if (retval != ERROR_OK)
-		return retval;
-
-	if (c->size == 0 || c->num_sectors == 0) {
-		LOG_ERROR("Bank is invalid");
-		return ERROR_FLASH_BANK_INVALID;
-	}
-
-	if (length == 0) {
-		/* special case, erase whole bank when length is zero */
-		if (addr != c->base) {
-			LOG_ERROR("Whole bank access must start at beginning of bank.");
-			return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
-		}
-
-		return callback(c, 0, c->num_sectors - 1);
-	}
-
 	/* check whether it all fits in this bank */
 	if (last_addr > c->base + c->size - 1) {
 		LOG_ERROR("Flash access does not fit into bank.");
@@ -576,6 +558,44 @@ static int flash_iterate_address_range_inner(struct target *target,
 		return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
 	}
 
+	*first_block = first;
+	*last_block = last;
+	return ERROR_OK;
+}
+
+static int flash_iterate_address_range_inner(struct target *target,
+	char *pad_reason, target_addr_t addr, uint32_t length,
+	bool iterate_protect_blocks,
+	int (*callback)(struct flash_bank *bank, unsigned int first,
+		unsigned int last))
+{
+	struct flash_bank *c;
+	unsigned int first, last;
+
+	int retval = get_flash_bank_by_addr(target, addr, true, &c);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (c->size == 0 || c->num_sectors == 0) {
+		LOG_ERROR("Bank is invalid");
+		return ERROR_FLASH_BANK_INVALID;
+	}
+
+	if (length == 0) {
+		/* special case, erase whole bank when length is zero */
+		if (addr != c->base) {
+			LOG_ERROR("Whole bank access must start at beginning of bank.");
+			return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
+		}
+
+		return callback(c, 0, c->num_sectors - 1);
+	}
+
+	retval = flash_range_to_blocks(c, pad_reason, addr, length,
+			iterate_protect_blocks, &first, &last);
+	if (retval != ERROR_OK)
+		return retval;
+
 	/* The NOR driver may trim this range down, based on what
 	 * sectors are already erased/unprotected.  GDB currently
 	 * blocks such optimizations.
@@ -738,6 +758,316 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 }
 
 
+/* One contiguous part of the image, within a single flash bank */
+struct flash_write_run {
+	struct flash_bank *bank;
+	target_addr_t address;
+	uint32_t size;
+	uint8_t *buffer;
+	/* erased in the background with flash_driver::erase_start() */
+	bool erase_async;
+	enum {
+		FLASH_ERASE_PENDING,
+		FLASH_ERASE_RUNNING,
+		FLASH_ERASE_DONE,
+	} erase_state;
+	unsigned int erase_first;
+	unsigned int erase_last;
+	int64_t erase_start_ms;
+};
+
+/* Time spent in each phase of flash_write_unlock_verify(), per bank */
+struct flash_write_timing {
+	struct flash_bank *bank;
+	uint32_t bytes;
+	int64_t unlock_ms;
+	/* erase_ms is how long the erases took, erase_wait_ms how long
+	 * programming was held up by them */
+	int64_t erase_ms;
+	int64_t erase_wait_ms;
+	int64_t write_ms;
+	int64_t verify_ms;
+};
+
+static bool flash_pipeline_enabled = true;
+static bool flash_differential_enabled;
+
+void flash_set_pipeline(bool enable)
+{
+	flash_pipeline_enabled = enable;
+}
+
+bool flash_get_pipeline(void)
+{
+	return flash_pipeline_enabled;
+}
+
+void flash_set_differential(bool enable)
+{
+	flash_differential_enabled = enable;
+}
+
+bool flash_get_differential(void)
+{
+	return flash_differential_enabled;
+}
+
+/* Whether a sector of the run's bank lies entirely within the run */
+static bool flash_write_run_covers(struct flash_write_run *run, unsigned int sector)
+{
+	target_addr_t start = run->bank->base + run->bank->sectors[sector].offset;
+
+	return start >= run->address &&
+		start + run->bank->sectors[sector].size <= run->address + run->size;
+}
+
+/* Replace each run by the runs of its sectors which differ from the image.
+ * The CRCs of all the sectors are computed in a single batch; sectors only
+ * partially covered by a run are always kept. On return, *out_runs aliases
+ * the buffers of runs. */
+static int flash_write_diff_runs(struct target *target,
+	struct flash_write_run *runs, unsigned int num_runs,
+	struct flash_write_run **out_runs, unsigned int *out_num_runs,
+	uint32_t *skipped)
+{
+	struct target_memory_check_region *regions;
+	unsigned int num_regions = 0;
+	struct flash_write_run *out = NULL;
+	unsigned int num_out = 0;
+	unsigned int max_out = 0;
+
+	*skipped = 0;
+
+	for (unsigned int r = 0; r < num_runs; r++)
+		for (unsigned int i = 0; i < runs[r].bank->num_sectors; i++)
+			if (flash_write_run_covers(&runs[r], i))
+				num_regions++;
+
+	regions = calloc(MAX(num_regions, 1), sizeof(*regions));
+	if (!regions) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	unsigned int k = 0;
+	for (unsigned int r = 0; r < num_runs; r++) {
+		struct flash_bank *bank = runs[r].bank;
+		for (unsigned int i = 0; i < bank->num_sectors; i++) {
+			if (!flash_write_run_covers(&runs[r], i))
+				continue;
+			regions[k].op = TARGET_MEMORY_CRC32;
+			regions[k].address = bank->base + bank->sectors[i].offset;
+			regions[k].size = bank->sectors[i].size;
+			k++;
+		}
+	}
+
+	bool checked = num_regions &&
+		target_check_memory_regions(target, regions, num_regions) == ERROR_OK;
+	if (num_regions && !checked)
+		LOG_WARNING("checksum failed, programming the whole image");
+
+	k = 0;
+	for (unsigned int r = 0; r < num_runs; r++) {
+		struct flash_write_run *run = &runs[r];
+		struct flash_bank *bank = run->bank;
+		target_addr_t run_end = run->address + run->size;
+		unsigned int run_first_out = num_out;
+
+		for (unsigned int i = 0; i < bank->num_sectors; i++) {
+			target_addr_t start = bank->base + bank->sectors[i].offset;
+			target_addr_t end = start + bank->sectors[i].size;
+			if (end <= run->address || start >= run_end)
+				continue;
+
+			if (flash_write_run_covers(run, i)) {
+				uint32_t image_crc;
+				bool unchanged = checked &&
+					image_calculate_checksum(run->buffer + (start - run->address),
+						bank->sectors[i].size, &image_crc) == ERROR_OK &&
+					image_crc == regions[k].result;
+				k++;
+				if (unchanged) {
+					LOG_DEBUG("flash sector %u at " TARGET_ADDR_FMT " unchanged",
+						i, start);
+					*skipped += bank->sectors[i].size;
+					continue;
+				}
+			}
+
+			/* extend the previous run when the sectors are consecutive */
+			start = MAX(start, run->address);
+			end = MIN(end, run_end);
+			if (num_out > run_first_out &&
+					out[num_out - 1].address + out[num_out - 1].size == start) {
+				out[num_out - 1].size += end - start;
+				continue;
+			}
+
+			if (num_out == max_out) {
+				max_out = max_out ? 2 * max_out : 16;
+				struct flash_write_run *p = realloc(out, max_out * sizeof(*out));
+				if (!p) {
+					LOG_ERROR("Out of memory");
+					free(out);
+					free(regions);
+					return ERROR_FAIL;
+				}
+				out = p;
+			}
+
+			memset(&out[num_out], 0, sizeof(*out));
+			out[num_out].bank = bank;
+			out[num_out].address = start;
+			out[num_out].size = end - start;
+			out[num_out].buffer = run->buffer + (start - run->address);
+			num_out++;
+		}
+	}
+
+	free(regions);
+
+	*out_runs = out;
+	*out_num_runs = num_out;
+	return ERROR_OK;
+}
+
+static struct flash_write_timing *flash_write_get_timing(
+	struct flash_write_timing *timings, unsigned int *num_timings,
+	struct flash_bank *bank)
+{
+	for (unsigned int i = 0; i < *num_timings; i++)
+		if (timings[i].bank == bank)
+			return &timings[i];
+
+	struct flash_write_timing *t = &timings[(*num_timings)++];
+	memset(t, 0, sizeof(*t));
+	t->bank = bank;
+	return t;
+}
+
+/* Start the background erase of every run which is the next one of its bank,
+ * unless the bank is the one of run "current", which is about to be or is
+ * being programmed. Runs before "current" are done. */
+static int flash_write_start_erases(struct flash_write_run *runs,
+	unsigned int num_runs, unsigned int current)
+{
+	for (unsigned int i = current; i < num_runs; i++) {
+		struct flash_write_run *run = &runs[i];
+
+		if (!run->erase_async || run->erase_state != FLASH_ERASE_PENDING)
+			continue;
+		if (i != current && run->bank == runs[current].bank)
+			continue;
+
+		bool bank_busy = false;
+		for (unsigned int j = current; j < i; j++) {
+			if (runs[j].bank == run->bank && runs[j].erase_state != FLASH_ERASE_DONE) {
+				bank_busy = true;
+				break;
+			}
+		}
+		if (bank_busy)
+			continue;
+
+		LOG_DEBUG("starting erase of sectors %u to %u in bank %s",
+			run->erase_first, run->erase_last, run->bank->name);
+		run->erase_start_ms = timeval_ms();
+		int retval = run->bank->driver->erase_start(run->bank,
+				run->erase_first, run->erase_last);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("failed erasing sectors %u to %u",
+				run->erase_first, run->erase_last);
+			run->erase_state = FLASH_ERASE_DONE;
+			return retval;
+		}
+		run->erase_state = FLASH_ERASE_RUNNING;
+	}
+
+	return ERROR_OK;
+}
+
+/* Let the running background erases make progress. */
+static int flash_write_poll_erases(struct flash_write_run *runs,
+	unsigned int num_runs, struct flash_write_timing *timings,
+	unsigned int *num_timings, bool *running)
+{
+	int retval = ERROR_OK;
+
+	*running = false;
+	for (unsigned int i = 0; i < num_runs; i++) {
+		struct flash_write_run *run = &runs[i];
+		bool done;
+
+		if (run->erase_state != FLASH_ERASE_RUNNING)
+			continue;
+
+		int retval2 = run->bank->driver->erase_poll(run->bank, &done);
+		if (!done && retval2 == ERROR_OK) {
+			*running = true;
+			continue;
+		}
+
+		run->erase_state = FLASH_ERASE_DONE;
+		flash_write_get_timing(timings, num_timings, run->bank)->erase_ms +=
+			timeval_ms() - run->erase_start_ms;
+		if (retval2 != ERROR_OK) {
+			LOG_ERROR("failed erasing sectors %u to %u",
+				run->erase_first, run->erase_last);
+			if (retval == ERROR_OK)
+				retval = retval2;
+		}
+	}
+
+	return retval;
+}
+
+/* Program a run. While other banks are being erased in the background, the
+ * run is written one sector at a time so that their erase keeps going. */
+static int flash_write_run_program(struct flash_write_run *run,
+	struct flash_write_run *runs, unsigned int num_runs,
+	struct flash_write_timing *timings, unsigned int *num_timings)
+{
+	struct flash_bank *bank = run->bank;
+	uint32_t offset = run->address - bank->base;
+	uint32_t end = offset + run->size;
+	bool running = false;
+	int retval;
+
+	for (unsigned int i = 0; i < num_runs; i++)
+		if (runs[i].erase_state == FLASH_ERASE_RUNNING)
+			running = true;
+
+	if (!running)
+		return flash_driver_write(bank, run->buffer, offset, run->size);
+
+	while (offset < end) {
+		uint32_t chunk_end = end;
+		for (unsigned int i = 0; i < bank->num_sectors; i++) {
+			uint32_t sector_end = bank->sectors[i].offset + bank->sectors[i].size;
+			if (sector_end > offset) {
+				chunk_end = MIN(sector_end, end);
+				break;
+			}
+		}
+
+		retval = flash_driver_write(bank, run->buffer + (offset - (run->address - bank->base)),
+				offset, chunk_end - offset);
+		if (retval != ERROR_OK)
+			return retval;
+		offset = chunk_end;
+
+		retval = flash_write_poll_erases(runs, num_runs, timings, num_timings, &running);
+		if (retval != ERROR_OK)
+			return retval;
+		if (!running && offset < end)
+			return flash_driver_write(bank, run->buffer + (offset - (run->address - bank->base)),
+					offset, end - offset);
+	}
+
+	return ERROR_OK;
+}
+
 int flash_write_unlock_verify(struct target *target, struct image *image,
 	uint32_t *written, bool erase, bool unlock, bool write, bool verify)
 {
@@ -747,6 +1077,13 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	uint32_t section_offset;
 	struct flash_bank *c;
 	int *padding;
+	struct flash_write_run *runs = NULL;
+	unsigned int num_runs = 0;
+	struct flash_write_run *image_runs = NULL;
+	unsigned int num_image_runs = 0;
+	struct flash_write_timing *timings = NULL;
+	unsigned int num_timings = 0;
+	bool running;
 
 	section = 0;
 	section_offset = 0;
@@ -769,12 +1106,28 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	struct imagesection **sections = malloc(sizeof(struct imagesection *) *
 			image->num_sections);
 
+	/* There are at most as many runs as sections, plus one for each bank
+	 * boundary a section crosses. */
+	unsigned int max_runs = image->num_sections;
+	for (struct flash_bank *p = flash_banks; p; p = p->next)
+		max_runs++;
+	runs = calloc(max_runs, sizeof(*runs));
+	timings = calloc(max_runs, sizeof(*timings));
+	if (!padding || !sections || !runs || !timings) {
+		LOG_ERROR("Out of memory");
+		retval = ERROR_FAIL;
+		goto done;
+	}
+
 	for (unsigned int i = 0; i < image->num_sections; i++)
 		sections[i] = &image->sections[i];
 
 	qsort(sections, image->num_sections, sizeof(struct imagesection *),
 		compare_section);
 
+	/* First collect the runs to program, with their data, then program
+	 * them. Knowing all the runs ahead lets the erase of a bank run in the
+	 * background while other banks are programmed. */
 	/* loop until we reach end of the image */
 	while (section < image->num_sections) {
 		uint32_t buffer_idx;
@@ -960,44 +1313,152 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			}
 		}
 
-		retval = ERROR_OK;
+		assert(num_runs < max_runs);
+		runs[num_runs].bank = c;
+		runs[num_runs].address = run_address;
+		runs[num_runs].size = run_size;
+		runs[num_runs].buffer = buffer;
+		num_runs++;
+	}
 
-		if (unlock)
-			retval = flash_unlock_address_range(target, run_address, run_size);
-		if (retval == ERROR_OK) {
-			if (erase) {
-				/* calculate and erase sectors */
-				retval = flash_erase_address_range(target,
-						true, run_address, run_size);
-			}
+	retval = ERROR_OK;
+
+	/* the runs own the buffers, the ones programmed may only alias them */
+	image_runs = runs;
+	num_image_runs = num_runs;
+
+	if (write && flash_differential_enabled && num_runs) {
+		struct flash_write_run *diff_runs;
+		unsigned int num_diff_runs;
+		uint32_t skipped;
+
+		retval = flash_write_diff_runs(target, image_runs, num_image_runs,
+				&diff_runs, &num_diff_runs, &skipped);
+		if (retval != ERROR_OK)
+			goto done;
+
+		LOG_INFO("%" PRIu32 " bytes of flash already up to date, skipped", skipped);
+
+		/* timings are per bank, their array is still large enough */
+		runs = diff_runs;
+		num_runs = num_diff_runs;
+	}
+
+	for (unsigned int i = 0; i < num_runs; i++) {
+		struct flash_write_run *run = &runs[i];
+		struct flash_write_timing *t = flash_write_get_timing(timings, &num_timings, run->bank);
+		int64_t start_ms = timeval_ms();
+
+		if (unlock) {
+			retval = flash_unlock_address_range(target, run->address, run->size);
+			if (retval != ERROR_OK)
+				goto done;
 		}
+		t->unlock_ms += timeval_ms() - start_ms;
 
-		if (retval == ERROR_OK) {
-			if (write) {
-				/* write flash sectors */
-				retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
-			}
+		if (erase && flash_pipeline_enabled && run->bank->driver->erase_start &&
+				run->bank->driver->erase_poll) {
+			retval = flash_range_to_blocks(run->bank, "erase", run->address,
+					run->size, false, &run->erase_first, &run->erase_last);
+			if (retval != ERROR_OK)
+				goto done;
+			run->erase_async = true;
 		}
+	}
 
-		if (retval == ERROR_OK) {
-			if (verify) {
-				/* verify flash sectors */
-				retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
+	for (unsigned int i = 0; i < num_runs; i++) {
+		struct flash_write_run *run = &runs[i];
+		struct flash_write_timing *t = flash_write_get_timing(timings, &num_timings, run->bank);
+		int64_t start_ms = timeval_ms();
+
+		if (erase) {
+			retval = flash_write_start_erases(runs, num_runs, i);
+			if (retval != ERROR_OK)
+				goto done;
+
+			if (run->erase_async) {
+				while (run->erase_state != FLASH_ERASE_DONE) {
+					retval = flash_write_poll_erases(runs, num_runs, timings,
+							&num_timings, &running);
+					if (retval != ERROR_OK)
+						goto done;
+					if (run->erase_state != FLASH_ERASE_DONE)
+						alive_sleep(1);
+				}
+			} else {
+				/* calculate and erase sectors */
+				retval = flash_erase_address_range(target,
+						true, run->address, run->size);
+				if (retval != ERROR_OK)
+					goto done;
+				t->erase_ms += timeval_ms() - start_ms;
 			}
+			t->erase_wait_ms += timeval_ms() - start_ms;
+
+			/* get the erase of the other banks going; the following runs
+			 * of this bank wait until this one is written */
+			retval = flash_write_start_erases(runs, num_runs, i);
+			if (retval != ERROR_OK)
+				goto done;
 		}
 
-		free(buffer);
+		if (write) {
+			/* write flash sectors */
+			start_ms = timeval_ms();
+			retval = flash_write_run_program(run, runs, num_runs, timings, &num_timings);
+			if (retval != ERROR_OK)
+				goto done;
+			t->write_ms += timeval_ms() - start_ms;
+		}
 
-		if (retval != ERROR_OK) {
-			/* abort operation */
-			goto done;
+		if (verify) {
+			/* verify flash sectors */
+			start_ms = timeval_ms();
+			retval = flash_driver_verify(run->bank, run->buffer,
+					run->address - run->bank->base, run->size);
+			if (retval != ERROR_OK)
+				goto done;
+			t->verify_ms += timeval_ms() - start_ms;
 		}
 
+		t->bytes += run->size;
 		if (written)
-			*written += run_size;	/* add run size to total written counter */
+			*written += run->size;	/* add run size to total written counter */
+	}
+
+	for (unsigned int i = 0; i < num_timings; i++) {
+		struct flash_write_timing *t = &timings[i];
+		LOG_INFO("flash bank %s: %" PRIu32 " bytes, unlock %" PRId64 " ms, "
+			"erase %" PRId64 " ms (%" PRId64 " ms waited), write %" PRId64 " ms, "
+			"verify %" PRId64 " ms",
+			t->bank->name, t->bytes, t->unlock_ms, t->erase_ms, t->erase_wait_ms,
+			t->write_ms, t->verify_ms);
 	}
 
 done:
+	/* an erase cannot be aborted, let the ones still running end */
+	if (runs) {
+		do {
+			if (flash_write_poll_erases(runs, num_runs, timings, &num_timings,
+						&running) != ERROR_OK)
+				retval = (retval == ERROR_OK) ? ERROR_FAIL : retval;
+			if (running)
+				alive_sleep(1);
+		} while (running);
+	}
+
+	if (!image_runs) {
+		image_runs = runs;
+		num_image_runs = num_runs;
+	}
+	if (image_runs) {
+		for (unsigned int i = 0; i < num_image_runs; i++)
+			free(image_runs[i].buffer);
+		if (image_runs != runs)
+			free(image_runs);
+	}
+	free(runs);
+	free(timings);
 	free(sections);
 	free(padding);
 
@@ -186,6 +186,24 @@ target_addr_t flash_write_align_end(struct flash_bank *bank, target_addr_t addr)
 int flash_write(struct target *target,
 		struct image *image, uint32_t *written, bool erase);
 
+/**
+ * Enables or disables the background erase of flash banks during
+ * flash_write(), for drivers supporting it (see flash_driver::erase_start).
+ */
+void flash_set_pipeline(bool enable);
+
+/** @returns Whether banks are erased in the background during flash_write(). */
+bool flash_get_pipeline(void);
+
+/**
+ * Enables or disables differential flash_write(): the flash sectors whose
+ * CRC already matches the image are neither erased nor programmed.
+ */
+void flash_set_differential(bool enable);
+
+/** @returns Whether flash_write() skips the sectors already up to date. */
+bool flash_get_differential(void);
+
 /**
  * Forces targets to re-examine their erase/protection state.
  * This routine must be called when the system may modify the status.
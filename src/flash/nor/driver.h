@@ -107,6 +107,33 @@ struct flash_driver {
 	int (*erase)(struct flash_bank *bank, unsigned int first,
 		unsigned int last);
 
+	/**
+	 * Start erasing a range of sectors without waiting for the end of the
+	 * erase (optional).
+	 *
+	 * Only drivers whose banks are erased by independent controllers
+	 * should implement it: while the erase runs, the flash core programs
+	 * and verifies other banks. It then calls erase_poll() until the
+	 * erase is done, before accessing this bank again.
+	 *
+	 * @param bank The bank of flash to be erased.
+	 * @param first The number of the first sector to erase.
+	 * @param last The number of the last sector to erase.
+	 * @returns ERROR_OK if the erase was started; otherwise, an error code.
+	 */
+	int (*erase_start)(struct flash_bank *bank, unsigned int first,
+		unsigned int last);
+
+	/**
+	 * Check the progress of an erase started by erase_start(), and
+	 * move it on to the next sector if needed. Must not block for long.
+	 *
+	 * @param bank The bank being erased.
+	 * @param done Set to true once the erase has ended, successfully or not.
+	 * @returns ERROR_OK unless the erase failed.
+	 */
+	int (*erase_poll)(struct flash_bank *bank, bool *done);
+
 	/**
 	 * Bank/sector protection routine (target-specific).
 	 *
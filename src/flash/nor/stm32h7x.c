@@ -20,6 +20,7 @@
 
 #include "imp.h"
 #include <helper/binarybuffer.h>
+#include <helper/time_support.h>
 #include <target/algorithm.h>
 #include <target/cortex_m.h>
 
@@ -136,6 +137,10 @@ struct stm32h7x_flash_bank {
 	uint32_t user_bank_size;
 	uint32_t flash_regs_base;    /* Address of flash reg controller */
 	const struct stm32h7x_part_info *part_info;
+	/* sector erase started by stm32x_erase_start() */
+	unsigned int erase_sector;
+	unsigned int erase_last;
+	int64_t erase_deadline;
 };
 
 enum stm32h7x_opt_rdp {
@@ -271,6 +276,26 @@ static inline int stm32x_get_flash_status(struct flash_bank *bank, uint32_t *sta
 	return stm32x_read_flash_reg(bank, FLASH_SR, status);
 }
 
+/* Report and clear the errors of the completed flash operation */
+static int stm32x_check_flash_op_status(struct flash_bank *bank, uint32_t status)
+{
+	int retval = ERROR_OK;
+
+	if (status & FLASH_WRPERR) {
+		LOG_ERROR("wait_flash_op_queue, WRPERR detected");
+		retval = ERROR_FAIL;
+	}
+
+	/* Clear error + EOP flags but report errors */
+	if (status & FLASH_ERROR) {
+		if (retval == ERROR_OK)
+			retval = ERROR_FAIL;
+		/* If this operation fails, we ignore it and report the original retval */
+		stm32x_write_flash_reg(bank, FLASH_CCR, status);
+	}
+	return retval;
+}
+
 static int stm32x_wait_flash_op_queue(struct flash_bank *bank, int timeout)
 {
 	uint32_t status;
@@ -292,19 +317,7 @@ static int stm32x_wait_flash_op_queue(struct flash_bank *bank, int timeout)
 		alive_sleep(1);
 	}
 
-	if (status & FLASH_WRPERR) {
-		LOG_ERROR("wait_flash_op_queue, WRPERR detected");
-		retval = ERROR_FAIL;
-	}
-
-	/* Clear error + EOP flags but report errors */
-	if (status & FLASH_ERROR) {
-		if (retval == ERROR_OK)
-			retval = ERROR_FAIL;
-		/* If this operation fails, we ignore it and report the original retval */
-		stm32x_write_flash_reg(bank, FLASH_CCR, status);
-	}
-	return retval;
+	return stm32x_check_flash_op_status(bank, status);
 }
 
 static int stm32x_unlock_reg(struct flash_bank *bank)
@@ -471,10 +484,26 @@ static int stm32x_protect_check(struct flash_bank *bank)
 	return ERROR_OK;
 }
 
+static int stm32x_erase_sector_start(struct flash_bank *bank, unsigned int sector)
+{
+	struct stm32h7x_flash_bank *stm32x_info = bank->driver_priv;
+	int retval;
+
+	LOG_DEBUG("erase sector %u", sector);
+	retval = stm32x_write_flash_reg(bank, FLASH_CR,
+			stm32x_info->part_info->compute_flash_cr(FLASH_SER | FLASH_PSIZE_64, sector));
+	if (retval == ERROR_OK)
+		retval = stm32x_write_flash_reg(bank, FLASH_CR,
+				stm32x_info->part_info->compute_flash_cr(FLASH_SER | FLASH_PSIZE_64 | FLASH_START, sector));
+	if (retval != ERROR_OK)
+		LOG_ERROR("Error erase sector %u", sector);
+
+	return retval;
+}
+
 static int stm32x_erase(struct flash_bank *bank, unsigned int first,
 		unsigned int last)
 {
-	struct stm32h7x_flash_bank *stm32x_info = bank->driver_priv;
 	int retval, retval2;
 
 	assert(first < bank->num_sectors);
@@ -498,19 +527,9 @@ static int stm32x_erase(struct flash_bank *bank, unsigned int first,
 	4. Wait for flash operations completion
 	 */
 	for (unsigned int i = first; i <= last; i++) {
-		LOG_DEBUG("erase sector %u", i);
-		retval = stm32x_write_flash_reg(bank, FLASH_CR,
-				stm32x_info->part_info->compute_flash_cr(FLASH_SER | FLASH_PSIZE_64, i));
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error erase sector %u", i);
-			goto flash_lock;
-		}
-		retval = stm32x_write_flash_reg(bank, FLASH_CR,
-				stm32x_info->part_info->compute_flash_cr(FLASH_SER | FLASH_PSIZE_64 | FLASH_START, i));
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error erase sector %u", i);
+		retval = stm32x_erase_sector_start(bank, i);
+		if (retval != ERROR_OK)
 			goto flash_lock;
-		}
 		retval = stm32x_wait_flash_op_queue(bank, FLASH_ERASE_TIMEOUT);
 
 		if (retval != ERROR_OK) {
@@ -527,6 +546,76 @@ flash_lock:
 	return (retval == ERROR_OK) ? retval2 : retval;
 }
 
+/* Each bank has its own controller, so the flash core can let the erase of
+ * one bank run while it programs the other. */
+static int stm32x_erase_start(struct flash_bank *bank, unsigned int first,
+		unsigned int last)
+{
+	struct stm32h7x_flash_bank *stm32x_info = bank->driver_priv;
+
+	assert(first <= last);
+	assert(last < bank->num_sectors);
+
+	if (bank->target->state != TARGET_HALTED)
+		return ERROR_TARGET_NOT_HALTED;
+
+	int retval = stm32x_unlock_reg(bank);
+	if (retval == ERROR_OK)
+		retval = stm32x_erase_sector_start(bank, first);
+	if (retval != ERROR_OK) {
+		stm32x_lock_reg(bank);
+		return retval;
+	}
+
+	stm32x_info->erase_sector = first;
+	stm32x_info->erase_last = last;
+	stm32x_info->erase_deadline = timeval_ms() + FLASH_ERASE_TIMEOUT;
+	return ERROR_OK;
+}
+
+static int stm32x_erase_poll(struct flash_bank *bank, bool *done)
+{
+	struct stm32h7x_flash_bank *stm32x_info = bank->driver_priv;
+	uint32_t status;
+
+	*done = false;
+
+	int retval = stm32x_get_flash_status(bank, &status);
+	if (retval != ERROR_OK)
+		goto flash_lock;
+
+	if (status & FLASH_QW) {
+		if (timeval_ms() < stm32x_info->erase_deadline)
+			return ERROR_OK;
+		LOG_ERROR("erase time-out sector %u, status: 0x%" PRIx32,
+				stm32x_info->erase_sector, status);
+		retval = ERROR_FAIL;
+		goto flash_lock;
+	}
+
+	retval = stm32x_check_flash_op_status(bank, status);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("erase operation error sector %u", stm32x_info->erase_sector);
+		goto flash_lock;
+	}
+
+	if (stm32x_info->erase_sector < stm32x_info->erase_last) {
+		stm32x_info->erase_sector++;
+		stm32x_info->erase_deadline = timeval_ms() + FLASH_ERASE_TIMEOUT;
+		retval = stm32x_erase_sector_start(bank, stm32x_info->erase_sector);
+		if (retval == ERROR_OK)
+			return ERROR_OK;
+	}
+
+flash_lock:
+	*done = true;
+	int retval2 = stm32x_lock_reg(bank);
+	if (retval2 != ERROR_OK)
+		LOG_ERROR("error during the lock of flash");
+
+	return (retval == ERROR_OK) ? retval2 : retval;
+}
+
 static int stm32x_protect(struct flash_bank *bank, int set, unsigned int first,
 		unsigned int last)
 {
@@ -1212,6 +1301,8 @@ const struct flash_driver stm32h7x_flash = {
 	.commands = stm32h7x_command_handlers,
 	.flash_bank_command = stm32x_flash_bank_command,
 	.erase = stm32x_erase,
+	.erase_start = stm32x_erase_start,
+	.erase_poll = stm32x_erase_poll,
 	.protect = stm32x_protect,
 	.write = stm32x_write,
 	.read = default_flash_read,
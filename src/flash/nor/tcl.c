@@ -1083,6 +1083,36 @@ COMMAND_HANDLER(handle_flash_padded_value_command)
 	return retval;
 }
 
+COMMAND_HANDLER(handle_flash_pipeline_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		flash_set_pipeline(enable);
+	}
+
+	command_print(CMD, "flash pipeline %s", flash_get_pipeline() ? "on" : "off");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_flash_differential_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		flash_set_differential(enable);
+	}
+
+	command_print(CMD, "flash differential %s", flash_get_differential() ? "on" : "off");
+	return ERROR_OK;
+}
+
 static const struct command_registration flash_exec_command_handlers[] = {
 	{
 		.name = "probe",
@@ -1239,6 +1269,22 @@ static const struct command_registration flash_exec_command_handlers[] = {
 		.usage = "bank_id value",
 		.help = "Set default flash padded value",
 	},
+	{
+		.name = "pipeline",
+		.handler = handle_flash_pipeline_command,
+		.mode = COMMAND_ANY,
+		.usage = "['on'|'off']",
+		.help = "Erase flash banks in the background while other banks "
+			"are programmed, when the flash driver supports it",
+	},
+	{
+		.name = "differential",
+		.handler = handle_flash_differential_command,
+		.mode = COMMAND_ANY,
+		.usage = "['on'|'off']",
+		.help = "Only erase and program the flash sectors whose "
+			"checksum differs from the image",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
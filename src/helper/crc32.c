@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * CRC-32 engines for the non-reflected 0x04C11DB7 polynomial.
+ *
+ * The portable engine uses slicing-by-16 tables. On x86 hosts with
+ * PCLMULQDQ the bulk of the data is folded with carry-less multiplies, on
+ * AArch64 hosts with the CRC32 extension the (reflected) CRC32X instruction
+ * is used on bit-reversed data. The engine is picked at first use.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#define CRC32_POLY	0x04c11db7
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_HAVE_PCLMUL
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC32_HAVE_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+static uint32_t crc32_table[16][256];
+
+static void crc32_init_tables(void)
+{
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t c = i << 24;
+		for (unsigned int j = 0; j < 8; j++)
+			c = c & 0x80000000 ? (c << 1) ^ CRC32_POLY : (c << 1);
+		crc32_table[0][i] = c;
+	}
+
+	for (unsigned int k = 1; k < 16; k++)
+		for (unsigned int i = 0; i < 256; i++) {
+			uint32_t c = crc32_table[k - 1][i];
+			crc32_table[k][i] = (c << 8) ^ crc32_table[0][c >> 24];
+		}
+}
+
+static inline uint32_t crc32_bytewise(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *p++) & 0xff];
+	return crc;
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 16) {
+		uint32_t a = crc ^ get_be32(p);
+		uint32_t b = get_be32(p + 4);
+		uint32_t c = get_be32(p + 8);
+		uint32_t d = get_be32(p + 12);
+
+		crc = crc32_table[15][a >> 24] ^ crc32_table[14][(a >> 16) & 0xff] ^
+			crc32_table[13][(a >> 8) & 0xff] ^ crc32_table[12][a & 0xff] ^
+			crc32_table[11][b >> 24] ^ crc32_table[10][(b >> 16) & 0xff] ^
+			crc32_table[9][(b >> 8) & 0xff] ^ crc32_table[8][b & 0xff] ^
+			crc32_table[7][c >> 24] ^ crc32_table[6][(c >> 16) & 0xff] ^
+			crc32_table[5][(c >> 8) & 0xff] ^ crc32_table[4][c & 0xff] ^
+			crc32_table[3][d >> 24] ^ crc32_table[2][(d >> 16) & 0xff] ^
+			crc32_table[1][(d >> 8) & 0xff] ^ crc32_table[0][d & 0xff];
+
+		p += 16;
+		len -= 16;
+	}
+
+	return crc32_bytewise(crc, p, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+/* x^n mod P, for the folding constants */
+static uint64_t crc32_xpow_mod(unsigned int n)
+{
+	uint64_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & 0x100000000ULL)
+			r ^= 0x100000000ULL | CRC32_POLY;
+	}
+	return r;
+}
+
+/* fold-by-4 (512 bit) and fold-by-1 (128 bit) constants: high half
+ * x^(n + 64) mod P, low half x^n mod P */
+static uint64_t crc32_k512[2];
+static uint64_t crc32_k128[2];
+
+static void crc32_init_pclmul(void)
+{
+	crc32_k512[0] = crc32_xpow_mod(512);
+	crc32_k512[1] = crc32_xpow_mod(512 + 64);
+	crc32_k128[0] = crc32_xpow_mod(128);
+	crc32_k128[1] = crc32_xpow_mod(128 + 64);
+}
+
+/*
+ * Each 16 byte block is loaded byte-reversed, so that bit 127 holds the
+ * first message bit, i.e. the highest polynomial coefficient. Folding a
+ * block forward by n bits replaces hi * x^(n + 64) + lo * x^n with the
+ * congruent hi * (x^(n + 64) mod P) + lo * (x^n mod P).
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+			_mm_clmulepi64_si128(x, k, 0x00));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+	if (len < 64)
+		return crc32_slice16(crc, p, len);
+
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+			8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i k512 = _mm_loadu_si128((const __m128i *)crc32_k512);
+	const __m128i k128 = _mm_loadu_si128((const __m128i *)crc32_k128);
+
+	__m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+	__m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap);
+	__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap);
+	__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap);
+
+	/* the CRC register goes over the first 32 message bits */
+	x0 = _mm_xor_si128(x0, _mm_set_epi32(crc, 0, 0, 0));
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(crc32_fold(x0, k512),
+				_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap));
+		x1 = _mm_xor_si128(crc32_fold(x1, k512),
+				_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap));
+		x2 = _mm_xor_si128(crc32_fold(x2, k512),
+				_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap));
+		x3 = _mm_xor_si128(crc32_fold(x3, k512),
+				_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap));
+		p += 64;
+		len -= 64;
+	}
+
+	x1 = _mm_xor_si128(x1, crc32_fold(x0, k128));
+	x2 = _mm_xor_si128(x2, crc32_fold(x1, k128));
+	x3 = _mm_xor_si128(x3, crc32_fold(x2, k128));
+
+	while (len >= 16) {
+		x3 = _mm_xor_si128(crc32_fold(x3, k128),
+				_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap));
+		p += 16;
+		len -= 16;
+	}
+
+	/* the remaining 128 bit polynomial, reduced by running it through
+	 * the tables with an empty CRC register */
+	uint8_t rest[16];
+	_mm_storeu_si128((__m128i *)rest, _mm_shuffle_epi8(x3, bswap));
+	crc = crc32_slice16(0, rest, sizeof(rest));
+
+	return crc32_slice16(crc, p, len);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+static inline uint32_t crc32_rbit32(uint32_t x)
+{
+	return __rbit(x);
+}
+
+/*
+ * The CRC32 instructions implement the reflected CRC. Reversing the bits
+ * of every data byte and of the CRC register turns it into the
+ * non-reflected one.
+ */
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint32_t rcrc = crc32_rbit32(crc);
+
+	while (len && ((uintptr_t)p & 7)) {
+		rcrc = __crc32b(rcrc, crc32_rbit32(*p++) >> 24);
+		len--;
+	}
+
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		/* bit-reverse each byte in place */
+		rcrc = __crc32d(rcrc, __revll(__rbitll(v)));
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		rcrc = __crc32b(rcrc, crc32_rbit32(*p++) >> 24);
+
+	return crc32_rbit32(rcrc);
+}
+#endif
+
+static uint32_t (*crc32_engine)(uint32_t crc, const uint8_t *p, size_t len);
+static const char *crc32_engine_str;
+
+static void crc32_select_engine(void)
+{
+	crc32_init_tables();
+
+	crc32_engine = crc32_slice16;
+	crc32_engine_str = "slicing-by-16";
+
+#ifdef CRC32_HAVE_PCLMUL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+		crc32_init_pclmul();
+		crc32_engine = crc32_pclmul;
+		crc32_engine_str = "pclmulqdq";
+	}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32_engine = crc32_armv8;
+		crc32_engine_str = "armv8-crc32";
+	}
+#endif
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+	if (!crc32_engine)
+		crc32_select_engine();
+
+	return crc32_engine(crc, buf, len);
+}
+
+uint32_t crc32_update_sw(uint32_t crc, const void *buf, size_t len)
+{
+	if (!crc32_engine)
+		crc32_select_engine();
+
+	return crc32_slice16(crc, buf, len);
+}
+
+const char *crc32_engine_name(void)
+{
+	if (!crc32_engine)
+		crc32_select_engine();
+
+	return crc32_engine_str;
+}
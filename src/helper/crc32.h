@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef OPENOCD_HELPER_CRC32_H
+#define OPENOCD_HELPER_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file
+ * CRC-32 as computed by GDB for the qCRC packet and by the on-target
+ * checksum algorithms: polynomial 0x04C11DB7, processed MSB first,
+ * no reflection and no final XOR.
+ *
+ * The CRC can be computed incrementally: start with CRC32_INIT and feed
+ * each piece of data to crc32_update() in order.
+ */
+
+#define CRC32_INIT	0xffffffff
+
+/** Update @a crc with @a len bytes, using the fastest engine on this host. */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+/** Update @a crc with @a len bytes, portable slicing-by-16 implementation. */
+uint32_t crc32_update_sw(uint32_t crc, const void *buf, size_t len);
+
+/** Name of the engine crc32_update() is using. */
+const char *crc32_engine_name(void);
+
+#endif /* OPENOCD_HELPER_CRC32_H */
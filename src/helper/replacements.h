@@ -224,6 +224,17 @@ static inline void socket_nonblock(int fd)
 #endif
 }
 
+/* non-zero when the last read or write on a non-blocking socket failed only
+ * because it would have blocked */
+static inline int socket_would_block(void)
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
 static inline int socket_select(int max_fd,
 	fd_set *rfds,
 	fd_set *wfds,
@@ -21,7 +21,11 @@
 #include "config.h"
 #endif
 
+#include <stdlib.h>
+
+#include "crc32.h"
 #include "log.h"
+#include "replacements.h"
 #include "time_support.h"
 
 static int jim_util_ms(Jim_Interp *interp,
@@ -40,6 +44,48 @@ static int jim_util_ms(Jim_Interp *interp,
 	return JIM_OK;
 }
 
+/* Host CRC-32 throughput, to compare the accelerated and portable engines */
+COMMAND_HANDLER(handle_crc32_benchmark_command)
+{
+	uint32_t size_kib = 16 * 1024;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], size_kib);
+	if (size_kib == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	size_t size = (size_t)size_kib * 1024;
+	uint8_t *buffer = malloc(size);
+	if (!buffer) {
+		LOG_ERROR("No memory for %" PRIu32 " KiB benchmark buffer", size_kib);
+		return ERROR_FAIL;
+	}
+	for (size_t i = 0; i < size; i++)
+		buffer[i] = i * 2654435761u >> 24;
+
+	int64_t start = timeval_ms();
+	uint32_t crc = crc32_update(CRC32_INIT, buffer, size);
+	int64_t fast_ms = MAX(timeval_ms() - start, 1);
+
+	start = timeval_ms();
+	uint32_t crc_sw = crc32_update_sw(CRC32_INIT, buffer, size);
+	int64_t sw_ms = MAX(timeval_ms() - start, 1);
+
+	free(buffer);
+
+	command_print(CMD, "%s: %" PRId64 " KiB/s, slicing-by-16: %" PRId64 " KiB/s",
+		crc32_engine_name(), size_kib * 1000 / fast_ms, size_kib * 1000 / sw_ms);
+
+	if (crc != crc_sw) {
+		LOG_ERROR("CRC mismatch: 0x%08" PRIx32 " != 0x%08" PRIx32, crc, crc_sw);
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
 static const struct command_registration util_command_handlers[] = {
 	/* jim handlers */
 	{
@@ -50,6 +96,13 @@ static const struct command_registration util_command_handlers[] = {
 			"Returns ever increasing milliseconds. Used to calculate differences in time.",
 		.usage = "",
 	},
+	{
+		.name = "crc32_benchmark",
+		.mode = COMMAND_ANY,
+		.handler = handle_crc32_benchmark_command,
+		.help = "Measure host CRC-32 throughput over a buffer of the given size.",
+		.usage = "[size_kib]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -30,10 +30,20 @@
 #include "config.h"
 #endif
 
+#include <limits.h>
+
 #include <jtag/jtag.h>
+#include <jtag/interface.h>
 #include <transport/transport.h>
 #include "commands.h"
 
+/*
+ * The command queue is allocated from an arena of pages. Nothing in the
+ * queue is freed individually, so an allocation just bumps the fill level
+ * of the current page. When the queue is reset, the pages are kept for the
+ * next queue and the arena is rewound in constant time; a page's fill level
+ * is only cleared when allocation moves on to it.
+ */
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
@@ -41,8 +51,16 @@ struct cmd_queue_page {
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
+/* all pages of the arena, in allocation order */
 static struct cmd_queue_page *cmd_queue_pages;
+/* page allocations are currently served from */
 static struct cmd_queue_page *cmd_queue_pages_tail;
+/* allocations larger than a page, released on every reset */
+static struct cmd_queue_page *cmd_queue_large;
+
+static struct cmd_queue_stats cmd_queue_stats;
+/* bytes allocated since the last reset */
+static size_t cmd_queue_bytes;
 
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
@@ -74,10 +92,27 @@ void jtag_queue_command(struct jtag_command *cmd)
 	next_command_pointer = &cmd->next;
 }
 
+static struct cmd_queue_page *cmd_queue_new_page(size_t size)
+{
+	struct cmd_queue_page *page = malloc(sizeof(struct cmd_queue_page));
+	if (!page)
+		return NULL;
+
+	page->address = malloc(size);
+	if (!page->address) {
+		free(page);
+		return NULL;
+	}
+
+	page->used = 0;
+	page->next = NULL;
+
+	return page;
+}
+
 void *cmd_queue_alloc(size_t size)
 {
-	struct cmd_queue_page **p_page = &cmd_queue_pages;
-	int offset;
+	struct cmd_queue_page *page;
 	uint8_t *t;
 
 	/*
@@ -112,42 +147,74 @@ void *cmd_queue_alloc(size_t size)
 	size = (size + ALIGN_SIZE - 1) & (~(ALIGN_SIZE - 1));
 	/* Done... */
 
-	if (*p_page) {
-		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
-			p_page = &((*p_page)->next);
+	cmd_queue_stats.allocations++;
+	cmd_queue_bytes += size;
+
+	if (size > CMD_QUEUE_PAGE_SIZE) {
+		/* does not fit any page, allocate it on its own */
+		page = cmd_queue_new_page(size);
+		if (!page) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		page->used = size;
+		page->next = cmd_queue_large;
+		cmd_queue_large = page;
+		cmd_queue_stats.large_allocations++;
+		return page->address;
 	}
 
-	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
-		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
-					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
-		(*p_page)->next = NULL;
-		cmd_queue_pages_tail = *p_page;
+	page = cmd_queue_pages_tail;
+
+	if (page && CMD_QUEUE_PAGE_SIZE - page->used < size) {
+		/* move on to the next page, reusing one from a previous queue */
+		page = page->next;
+		if (page)
+			page->used = 0;
+	}
+
+	if (!page) {
+		page = cmd_queue_new_page(CMD_QUEUE_PAGE_SIZE);
+		if (!page) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+
+		if (cmd_queue_pages_tail)
+			cmd_queue_pages_tail->next = page;
+		else
+			cmd_queue_pages = page;
+
+		cmd_queue_stats.pages++;
 	}
 
-	offset = (*p_page)->used;
-	(*p_page)->used += size;
+	cmd_queue_pages_tail = page;
+
+	t = page->address;
+	t += page->used;
+	page->used += size;
 
-	t = (*p_page)->address;
-	return t + offset;
+	return t;
 }
 
 static void cmd_queue_free(void)
 {
-	struct cmd_queue_page *page = cmd_queue_pages;
-
-	while (page) {
-		struct cmd_queue_page *last = page;
+	/* keep the pages, just rewind to the first one */
+	if (cmd_queue_pages)
+		cmd_queue_pages->used = 0;
+	cmd_queue_pages_tail = cmd_queue_pages;
+
+	while (cmd_queue_large) {
+		struct cmd_queue_page *page = cmd_queue_large;
+		cmd_queue_large = page->next;
 		free(page->address);
-		page = page->next;
-		free(last);
+		free(page);
 	}
 
-	cmd_queue_pages = NULL;
-	cmd_queue_pages_tail = NULL;
+	if (cmd_queue_bytes > cmd_queue_stats.high_water)
+		cmd_queue_stats.high_water = cmd_queue_bytes;
+	cmd_queue_bytes = 0;
+	cmd_queue_stats.resets++;
 }
 
 void jtag_command_queue_reset(void)
@@ -158,16 +225,219 @@ void jtag_command_queue_reset(void)
 	next_command_pointer = &jtag_command_queue;
 }
 
+void jtag_command_queue_get_stats(struct cmd_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
+	if (cmd_queue_bytes > stats->high_water)
+		stats->high_water = cmd_queue_bytes;
+}
+
+void jtag_command_queue_release(void)
+{
+	jtag_command_queue_reset();
+
+	while (cmd_queue_pages) {
+		struct cmd_queue_page *page = cmd_queue_pages;
+		cmd_queue_pages = page->next;
+		free(page->address);
+		free(page);
+	}
+
+	cmd_queue_pages_tail = NULL;
+	cmd_queue_stats.pages = 0;
+}
+
+static bool cmd_queue_optimize_enabled;
+
+void jtag_command_queue_set_optimize(bool enable)
+{
+	cmd_queue_optimize_enabled = enable;
+}
+
+bool jtag_command_queue_get_optimize(void)
+{
+	return cmd_queue_optimize_enabled;
+}
+
+/* Two IR scans load the same instructions if they shift the same bits. */
+static bool jtag_ir_scan_equal(const struct scan_command *a,
+		const struct scan_command *b)
+{
+	if (a->num_fields != b->num_fields)
+		return false;
+
+	for (int i = 0; i < a->num_fields; i++) {
+		const struct scan_field *fa = a->fields + i;
+		const struct scan_field *fb = b->fields + i;
+
+		if (fa->num_bits != fb->num_bits)
+			return false;
+		if (!fa->out_value || !fb->out_value)
+			return false;
+		if (buf_cmp(fa->out_value, fb->out_value, fa->num_bits))
+			return false;
+	}
+
+	return true;
+}
+
+static bool jtag_scan_has_input(const struct scan_command *scan)
+{
+	for (int i = 0; i < scan->num_fields; i++)
+		if (scan->fields[i].in_value)
+			return true;
+
+	return false;
+}
+
+/* Estimated TCK cycles spent by an IR scan moving from and back to state. */
+static unsigned int jtag_ir_scan_cycles(const struct scan_command *scan,
+		tap_state_t state)
+{
+	return tap_get_tms_path_len(state, TAP_IRSHIFT) + jtag_scan_size(scan) +
+		tap_get_tms_path_len(TAP_IRSHIFT, state);
+}
+
+/*
+ * Remove cmd, which follows prev (NULL if cmd is the first command), from
+ * the queue. The command memory stays in the queue arena.
+ */
+static void jtag_command_unlink(struct jtag_command *prev,
+		struct jtag_command *cmd)
+{
+	if (prev)
+		prev->next = cmd->next;
+	else
+		jtag_command_queue = cmd->next;
+
+	if (next_command_pointer == &cmd->next)
+		next_command_pointer = prev ? &prev->next : &jtag_command_queue;
+}
+
+/*
+ * Simplify the queue before it is handed to the driver:
+ *
+ *  - adjacent stableclocks commands, and runtest commands following a
+ *    runtest that ends in Run-Test/Idle, are merged into one,
+ *  - a TLR reset is dropped when an earlier command of this queue already
+ *    left the TAPs in Test-Logic-Reset,
+ *  - an IR scan is dropped when it shifts the same bits as the previous IR
+ *    scan of this queue, nothing in between can have changed the
+ *    instruction registers, nothing is captured and the scan would end in
+ *    the state it starts in.
+ *
+ * Only state established by commands of the same queue is trusted, so
+ * explicit resynchronization at the start of a queue is never removed.
+ */
+void jtag_command_queue_optimize(void)
+{
+	struct jtag_command *prev = NULL;
+	struct jtag_command *cmd = jtag_command_queue;
+	/* TAP state after the commands seen so far, if known */
+	tap_state_t state = TAP_INVALID;
+	/* last IR scan, NULL if the instruction registers may have changed */
+	const struct scan_command *last_ir = NULL;
+
+	if (!cmd_queue_optimize_enabled)
+		return;
+
+	while (cmd) {
+		struct jtag_command *next = cmd->next;
+		bool remove = false;
+
+		switch (cmd->type) {
+		case JTAG_SCAN:
+			if (!cmd->cmd.scan->ir_scan) {
+				state = cmd->cmd.scan->end_state;
+				break;
+			}
+
+			if (last_ir && tap_is_state_stable(state) &&
+					cmd->cmd.scan->end_state == state &&
+					!jtag_scan_has_input(cmd->cmd.scan) &&
+					jtag_ir_scan_equal(last_ir, cmd->cmd.scan)) {
+				cmd_queue_stats.saved_tck += jtag_ir_scan_cycles(cmd->cmd.scan, state);
+				remove = true;
+				break;
+			}
+
+			last_ir = cmd->cmd.scan;
+			state = cmd->cmd.scan->end_state;
+			break;
+		case JTAG_TLR_RESET:
+			if (state == TAP_RESET) {
+				cmd_queue_stats.saved_tck += tap_get_tms_path_len(TAP_IDLE, TAP_RESET);
+				remove = true;
+				break;
+			}
+
+			state = TAP_RESET;
+			last_ir = NULL;
+			break;
+		case JTAG_RUNTEST:
+			if (prev && prev->type == JTAG_RUNTEST &&
+					prev->cmd.runtest->end_state == TAP_IDLE &&
+					cmd->cmd.runtest->num_cycles <= INT_MAX - prev->cmd.runtest->num_cycles) {
+				prev->cmd.runtest->num_cycles += cmd->cmd.runtest->num_cycles;
+				prev->cmd.runtest->end_state = cmd->cmd.runtest->end_state;
+				remove = true;
+			}
+
+			state = cmd->cmd.runtest->end_state;
+			break;
+		case JTAG_STABLECLOCKS:
+			if (prev && prev->type == JTAG_STABLECLOCKS &&
+					cmd->cmd.stableclocks->num_cycles <=
+					INT_MAX - prev->cmd.stableclocks->num_cycles) {
+				prev->cmd.stableclocks->num_cycles += cmd->cmd.stableclocks->num_cycles;
+				remove = true;
+			}
+			break;
+		case JTAG_SLEEP:
+			break;
+		case JTAG_PATHMOVE:
+			state = cmd->cmd.pathmove->path[cmd->cmd.pathmove->num_states - 1];
+			last_ir = NULL;
+			break;
+		default:
+			/* resets and raw TMS sequences: state and IR unknown */
+			state = TAP_INVALID;
+			last_ir = NULL;
+			break;
+		}
+
+		if (remove) {
+			jtag_command_unlink(prev, cmd);
+			cmd_queue_stats.optimized_commands++;
+		} else {
+			prev = cmd;
+		}
+
+		cmd = next;
+	}
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
  * This allocates a new copy of out_value using cmd_queue_alloc.
+ * @returns ERROR_OK, or ERROR_FAIL if the copy cannot be allocated.
  */
-void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src)
+int jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src)
 {
 	dst->num_bits	= src->num_bits;
-	dst->out_value	= buf_cpy(src->out_value, cmd_queue_alloc(DIV_ROUND_UP(src->num_bits, 8)), src->num_bits);
+	dst->out_value	= NULL;
 	dst->in_value	= src->in_value;
+
+	if (!src->out_value)
+		return ERROR_OK;
+
+	uint8_t *out_value = cmd_queue_alloc(DIV_ROUND_UP(src->num_bits, 8));
+	if (!out_value)
+		return ERROR_FAIL;
+
+	dst->out_value = buf_cpy(src->out_value, out_value, src->num_bits);
+	return ERROR_OK;
 }
 
 enum scan_type jtag_scan_type(const struct scan_command *cmd)
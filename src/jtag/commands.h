@@ -163,12 +163,42 @@ struct jtag_command {
 /** The current queue of jtag_command_s structures. */
 extern struct jtag_command *jtag_command_queue;
 
+/** Allocation statistics of the command queue arena. */
+struct cmd_queue_stats {
+	/** Number of cmd_queue_alloc() calls. */
+	uint64_t allocations;
+	/** Number of allocations too large for a page. */
+	uint64_t large_allocations;
+	/** Number of queue resets. */
+	uint64_t resets;
+	/** Number of pages held by the arena. */
+	unsigned int pages;
+	/** Largest number of bytes allocated between two resets. */
+	size_t high_water;
+	/** Number of commands removed or merged by the queue optimizer. */
+	uint64_t optimized_commands;
+	/** Estimated number of TCK cycles saved by the queue optimizer. */
+	uint64_t saved_tck;
+};
+
 void *cmd_queue_alloc(size_t size);
 
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
+void jtag_command_queue_get_stats(struct cmd_queue_stats *stats);
+/** Reset the queue and return all arena memory to the system. */
+void jtag_command_queue_release(void);
+
+/** Enable or disable jtag_command_queue_optimize(). */
+void jtag_command_queue_set_optimize(bool enable);
+bool jtag_command_queue_get_optimize(void);
+/**
+ * Merge and remove redundant commands of the queue before it is executed,
+ * if enabled with jtag_command_queue_set_optimize().
+ */
+void jtag_command_queue_optimize(void);
 
-void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
+int jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
 enum scan_type jtag_scan_type(const struct scan_command *cmd);
 int jtag_scan_size(const struct scan_command *cmd);
 int jtag_read_buffer(uint8_t *buffer, const struct scan_command *cmd);
@@ -945,6 +945,8 @@ int default_interface_jtag_execute_queue(void)
 			return ERROR_OK;
 	}
 
+	jtag_command_queue_optimize();
+
 	int result = adapter_driver->jtag_ops->execute_queue();
 
 	struct jtag_command *cmd = jtag_command_queue;
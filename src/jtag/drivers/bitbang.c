@@ -166,11 +166,22 @@ static int bitbang_runtest(int num_cycles)
 	}
 
 	/* execute num_cycles */
-	for (i = 0; i < num_cycles; i++) {
-		if (bitbang_interface->write(0, 0, 0) != ERROR_OK)
+	if (bitbang_interface->scan && num_cycles > 0) {
+		/* TMS and TDI stay low */
+		uint8_t *zeros = calloc(1, DIV_ROUND_UP(num_cycles, 8));
+		if (!zeros)
 			return ERROR_FAIL;
-		if (bitbang_interface->write(1, 0, 0) != ERROR_OK)
+		int retval = bitbang_interface->scan(zeros, zeros, NULL, num_cycles);
+		free(zeros);
+		if (retval != ERROR_OK)
 			return ERROR_FAIL;
+	} else {
+		for (i = 0; i < num_cycles; i++) {
+			if (bitbang_interface->write(0, 0, 0) != ERROR_OK)
+				return ERROR_FAIL;
+			if (bitbang_interface->write(1, 0, 0) != ERROR_OK)
+				return ERROR_FAIL;
+		}
 	}
 	if (bitbang_interface->write(CLOCK_IDLE(), 0, 0) != ERROR_OK)
 		return ERROR_FAIL;
@@ -200,6 +211,40 @@ static int bitbang_stableclocks(int num_cycles)
 	return ERROR_OK;
 }
 
+/* Shift a whole scan with the interface's scan() callback. TMS is only set
+ * on the last bit, to leave the shift state. */
+static int bitbang_block_scan(enum scan_type type, uint8_t *buffer,
+		unsigned int scan_size)
+{
+	unsigned int num_bytes = DIV_ROUND_UP(scan_size, 8);
+	uint8_t *tms = calloc(1, num_bytes);
+	uint8_t *zeros = NULL;
+	const uint8_t *tdi = buffer;
+	int retval;
+
+	if (!tms)
+		return ERROR_FAIL;
+
+	/* if we're just reading the scan, output 'low' */
+	if (type == SCAN_IN) {
+		zeros = calloc(1, num_bytes);
+		if (!zeros) {
+			free(tms);
+			return ERROR_FAIL;
+		}
+		tdi = zeros;
+	}
+
+	tms[(scan_size - 1) / 8] |= 1 << ((scan_size - 1) % 8);
+
+	retval = bitbang_interface->scan(tms, tdi, type == SCAN_OUT ? NULL : buffer,
+		scan_size);
+
+	free(zeros);
+	free(tms);
+	return retval;
+}
+
 static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		unsigned scan_size)
 {
@@ -219,8 +264,17 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		bitbang_end_state(saved_end_state);
 	}
 
+	/* the whole scan goes out in one go if the interface can do it, the
+	 * bit loop below is then skipped */
+	bit_cnt = 0;
+	if (bitbang_interface->scan && scan_size > 0) {
+		if (bitbang_block_scan(type, buffer, scan_size) != ERROR_OK)
+			return ERROR_FAIL;
+		bit_cnt = scan_size;
+	}
+
 	size_t buffered = 0;
-	for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
+	for (; bit_cnt < scan_size; bit_cnt++) {
 		int tms = (bit_cnt == scan_size-1) ? 1 : 0;
 		int tdi;
 		int bytec = bit_cnt/8;
@@ -54,6 +54,13 @@ struct bitbang_interface {
 	/** Set TCK, TMS, and TDI to the given values. */
 	int (*write)(int tck, int tms, int tdi);
 
+	/** Clock out num_bits bits at once (optional). For each bit, TCK is
+	 * set low with the given TMS and TDI, TDO is sampled if tdo is not NULL,
+	 * and TCK is set high. Bit vectors are LSB first, tdo may be the same
+	 * buffer as tdi. */
+	int (*scan)(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+			unsigned int num_bits);
+
 	/** Blink led (optional). */
 	int (*blink)(int on);
 
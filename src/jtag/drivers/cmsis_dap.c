@@ -229,6 +229,10 @@ struct pending_transfer_result {
 struct pending_request_block {
 	struct pending_transfer_result *transfers;
 	int transfer_count;
+	/* all transfers access the same register in the same direction */
+	bool same_cmd;
+	/* CMD_DAP_TFER or CMD_DAP_TFER_BLOCK, once sent */
+	uint8_t command;
 };
 
 struct pending_scan_result {
@@ -242,13 +246,12 @@ struct pending_scan_result {
 	unsigned buffer_offset;
 };
 
-/* Up to MIN(packet_count, MAX_PENDING_REQUESTS) requests may be issued
- * until the first response arrives */
-#define MAX_PENDING_REQUESTS 3
-
 /* Pending requests are organized as a FIFO - circular buffer */
-/* Each block in FIFO can contain up to pending_queue_len transfers */
+/* Each block in FIFO can contain up to pending_queue_len transfers, or
+ * up to pending_block_len transfers of the same register, which are sent
+ * as a single DAP_TransferBlock */
 static int pending_queue_len;
+static int pending_block_len;
 static struct pending_request_block pending_fifo[MAX_PENDING_REQUESTS];
 static int pending_fifo_put_idx, pending_fifo_get_idx;
 static int pending_fifo_block_count;
@@ -784,10 +787,23 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 	if (block->transfer_count == 0)
 		goto skip;
 
-	command[0] = CMD_DAP_TFER;
-	command[1] = 0x00;	/* DAP Index */
-	command[2] = block->transfer_count;
-	size_t idx = 3;
+	/* runs of reads or writes of a single register, typically DRW,
+	 * carry the request byte once */
+	bool tfer_block = block->same_cmd && block->transfer_count > 1;
+	size_t idx;
+	if (tfer_block) {
+		command[0] = CMD_DAP_TFER_BLOCK;
+		command[1] = 0x00;	/* DAP Index */
+		h_u16_to_le(&command[2], block->transfer_count);
+		command[4] = (block->transfers[0].cmd >> 1) & 0x0f;
+		idx = 5;
+	} else {
+		command[0] = CMD_DAP_TFER;
+		command[1] = 0x00;	/* DAP Index */
+		command[2] = block->transfer_count;
+		idx = 3;
+	}
+	block->command = command[0];
 
 	for (int i = 0; i < block->transfer_count; i++) {
 		struct pending_transfer_result *transfer = &(block->transfers[i]);
@@ -818,7 +834,8 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 			data &= ~CORUNDETECT;
 		}
 
-		command[idx++] = (cmd >> 1) & 0x0f;
+		if (!tfer_block)
+			command[idx++] = (cmd >> 1) & 0x0f;
 		if (!(cmd & SWD_CMD_RNW)) {
 			h_u32_to_le(&command[idx], data);
 			idx += 4;
@@ -863,16 +880,29 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 	}
 
 	uint8_t *resp = dap->response;
-	if (resp[0] != CMD_DAP_TFER) {
+	if (resp[0] != block->command) {
 		LOG_ERROR("CMSIS-DAP command mismatch. Expected 0x%x received 0x%" PRIx8,
-			CMD_DAP_TFER, resp[0]);
+			block->command, resp[0]);
 		queued_retval = ERROR_FAIL;
 		goto skip;
 	}
 
-	uint8_t transfer_count = resp[1];
-	uint8_t ack = resp[2] & 0x07;
-	if (resp[2] & 0x08) {
+	/* DAP_TransferBlock has a 16 bit transfer count */
+	size_t idx;
+	int transfer_count;
+	uint8_t transfer_response;
+	if (block->command == CMD_DAP_TFER_BLOCK) {
+		transfer_count = le_to_h_u16(&resp[1]);
+		transfer_response = resp[3];
+		idx = 4;
+	} else {
+		transfer_count = resp[1];
+		transfer_response = resp[2];
+		idx = 3;
+	}
+
+	uint8_t ack = transfer_response & 0x07;
+	if (transfer_response & 0x08) {
 		LOG_DEBUG("CMSIS-DAP Protocol Error @ %d (wrong parity)", transfer_count);
 		queued_retval = ERROR_FAIL;
 		goto skip;
@@ -891,7 +921,6 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 
 	LOG_DEBUG_IO("Received results of %d queued transactions FIFO index %d",
 		 transfer_count, pending_fifo_get_idx);
-	size_t idx = 3;
 	for (int i = 0; i < transfer_count; i++) {
 		struct pending_transfer_result *transfer = &(block->transfers[i]);
 		if (transfer->cmd & SWD_CMD_RNW) {
@@ -942,9 +971,14 @@ static int cmsis_dap_swd_run_queue(void)
 static void cmsis_dap_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data)
 {
 	bool targetsel_cmd = swd_cmd(false, false, DP_TARGETSEL) == cmd;
+	struct pending_request_block *block = &pending_fifo[pending_fifo_put_idx];
 
-	if (pending_fifo[pending_fifo_put_idx].transfer_count == pending_queue_len
-			 || targetsel_cmd) {
+	/* a block of a single register fits more transfers */
+	bool same_cmd = block->transfer_count == 0 ||
+		(block->same_cmd && block->transfers[0].cmd == cmd);
+	int room = same_cmd ? pending_block_len : pending_queue_len;
+
+	if (block->transfer_count >= room || targetsel_cmd) {
 		if (pending_fifo_block_count)
 			cmsis_dap_swd_read_process(cmsis_dap_handle, 0);
 
@@ -963,7 +997,9 @@ static void cmsis_dap_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data)
 		return;
 	}
 
-	struct pending_request_block *block = &pending_fifo[pending_fifo_put_idx];
+	block = &pending_fifo[pending_fifo_put_idx];
+	block->same_cmd = block->transfer_count == 0 ||
+		(block->same_cmd && block->transfers[0].cmd == cmd);
 	struct pending_transfer_result *transfer = &(block->transfers[block->transfer_count]);
 	transfer->data = data;
 	transfer->cmd = cmd;
@@ -1210,6 +1246,7 @@ static int cmsis_dap_init(void)
 	 * until we get packet count info from the adaptor */
 	cmsis_dap_handle->packet_count = 1;
 	pending_queue_len = 12;
+	pending_block_len = 14;
 
 	/* INFO_ID_PKT_SZ - short */
 	retval = cmsis_dap_cmd_dap_info(INFO_ID_PKT_SZ, &data);
@@ -1224,6 +1261,10 @@ static int cmsis_dap_init(void)
 			 * write. For bulk read sequences just 4 bytes are
 			 * needed per transfer, so this is suboptimal. */
 			pending_queue_len = (pkt_sz - 4) / 5;
+			/* DAP_TransferBlock: 5 bytes of command header,
+			 * 4 bytes of response header, 4 bytes of data
+			 * per transfer */
+			pending_block_len = (pkt_sz - 5) / 4;
 
 			free(cmsis_dap_handle->packet_buffer);
 			retval = cmsis_dap_handle->backend->packet_buffer_alloc(cmsis_dap_handle, pkt_sz);
@@ -1249,7 +1290,8 @@ static int cmsis_dap_init(void)
 
 	LOG_DEBUG("Allocating FIFO for %d pending packets", cmsis_dap_handle->packet_count);
 	for (int i = 0; i < cmsis_dap_handle->packet_count; i++) {
-		pending_fifo[i].transfers = malloc(pending_queue_len * sizeof(struct pending_transfer_result));
+		pending_fifo[i].transfers = malloc(MAX(pending_queue_len, pending_block_len) *
+				sizeof(struct pending_transfer_result));
 		if (!pending_fifo[i].transfers) {
 			LOG_ERROR("Unable to allocate memory for CMSIS-DAP queue");
 			retval = ERROR_FAIL;
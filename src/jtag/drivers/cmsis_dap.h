@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+/* Up to MIN(packet_count, MAX_PENDING_REQUESTS) requests may be issued
+ * until the first response arrives */
+#define MAX_PENDING_REQUESTS 8
+
 struct cmsis_dap_backend;
 struct cmsis_dap_backend_data;
 struct command_registration;
@@ -26,7 +30,11 @@ struct cmsis_dap_backend {
 	const char *name;
 	int (*open)(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], const char *serial);
 	void (*close)(struct cmsis_dap *dap);
+	/* Returns the response to the oldest command written. With commands
+	 * in flight, a timeout_ms of 0 only polls for the response. */
 	int (*read)(struct cmsis_dap *dap, int timeout_ms);
+	/* May return before the command is sent; up to MAX_PENDING_REQUESTS
+	 * commands can be written before reading their responses. */
 	int (*write)(struct cmsis_dap *dap, int len, int timeout_ms);
 	int (*packet_buffer_alloc)(struct cmsis_dap *dap, unsigned int pkt_sz);
 };
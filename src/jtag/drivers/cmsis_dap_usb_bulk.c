@@ -39,8 +39,22 @@
 #include <libusb.h>
 #include <helper/log.h>
 #include <helper/replacements.h>
+#include <helper/time_support.h>
 
 #include "cmsis_dap.h"
+#include "libusb_helper.h"
+
+/* A command sent with asynchronous transfers, and its response. The IN
+ * transfer is submitted along with the OUT one, so the probe never waits
+ * for the host to ask for a response before handling the next command. */
+struct cmsis_dap_bulk_request {
+	struct libusb_transfer *transfer_out;
+	struct libusb_transfer *transfer_in;
+	uint8_t *buffer_out;
+	uint8_t *buffer_in;
+	int out_done;
+	int in_done;
+};
 
 struct cmsis_dap_backend_data {
 	struct libusb_context *usb_ctx;
@@ -48,6 +62,12 @@ struct cmsis_dap_backend_data {
 	unsigned int ep_out;
 	unsigned int ep_in;
 	int interface;
+
+	/* requests in flight, oldest at get_idx */
+	struct cmsis_dap_bulk_request requests[MAX_PENDING_REQUESTS];
+	unsigned int put_idx;
+	unsigned int get_idx;
+	unsigned int pending;
 };
 
 static int cmsis_dap_usb_interface = -1;
@@ -55,6 +75,96 @@ static int cmsis_dap_usb_interface = -1;
 static void cmsis_dap_usb_close(struct cmsis_dap *dap);
 static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz);
 
+static void LIBUSB_CALL cmsis_dap_usb_transfer_done(struct libusb_transfer *transfer)
+{
+	int *done = transfer->user_data;
+
+	*done = 1;
+}
+
+/* Handle libusb events until *completed is set or timeout_ms elapsed;
+ * with timeout_ms 0, only handle the events already there. */
+static int cmsis_dap_usb_wait(struct cmsis_dap_backend_data *bdata,
+	int *completed, int timeout_ms)
+{
+	int64_t deadline = timeval_ms() + timeout_ms;
+
+	while (!*completed) {
+		int64_t left = MAX(deadline - timeval_ms(), 0);
+		struct timeval tv = {
+			.tv_sec = left / 1000,
+			.tv_usec = (left % 1000) * 1000,
+		};
+
+		int err = libusb_handle_events_timeout_completed(bdata->usb_ctx, &tv, completed);
+		if (err && err != LIBUSB_ERROR_INTERRUPTED) {
+			LOG_ERROR("error handling USB events: %s", libusb_strerror(err));
+			return ERROR_FAIL;
+		}
+		if (!left)
+			break;
+	}
+
+	return *completed ? ERROR_OK : ERROR_TIMEOUT_REACHED;
+}
+
+/* Cancel the transfers of the oldest request and forget about it */
+static void cmsis_dap_usb_drop_request(struct cmsis_dap_backend_data *bdata)
+{
+	struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->get_idx];
+
+	if (!req->out_done)
+		libusb_cancel_transfer(req->transfer_out);
+	if (!req->in_done)
+		libusb_cancel_transfer(req->transfer_in);
+	cmsis_dap_usb_wait(bdata, &req->out_done, LIBUSB_TIMEOUT_MS);
+	cmsis_dap_usb_wait(bdata, &req->in_done, LIBUSB_TIMEOUT_MS);
+
+	bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->pending--;
+}
+
+static void cmsis_dap_usb_free_requests(struct cmsis_dap_backend_data *bdata)
+{
+	while (bdata->pending)
+		cmsis_dap_usb_drop_request(bdata);
+
+	for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		struct cmsis_dap_bulk_request *req = &bdata->requests[i];
+		libusb_free_transfer(req->transfer_out);
+		libusb_free_transfer(req->transfer_in);
+		free(req->buffer_out);
+		free(req->buffer_in);
+		memset(req, 0, sizeof(*req));
+	}
+}
+
+static int cmsis_dap_usb_alloc_requests(struct cmsis_dap_backend_data *bdata,
+	unsigned int pkt_sz)
+{
+	for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		struct cmsis_dap_bulk_request *req = &bdata->requests[i];
+
+		if (!req->transfer_out)
+			req->transfer_out = libusb_alloc_transfer(0);
+		if (!req->transfer_in)
+			req->transfer_in = libusb_alloc_transfer(0);
+
+		free(req->buffer_out);
+		free(req->buffer_in);
+		req->buffer_out = malloc(pkt_sz);
+		req->buffer_in = malloc(pkt_sz);
+
+		if (!req->transfer_out || !req->transfer_in ||
+				!req->buffer_out || !req->buffer_in) {
+			LOG_ERROR("unable to allocate CMSIS-DAP transfers");
+			return ERROR_FAIL;
+		}
+	}
+
+	return ERROR_OK;
+}
+
 static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], const char *serial)
 {
 	int err;
@@ -352,7 +462,7 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 			if (err)
 				LOG_WARNING("could not claim interface: %s", libusb_strerror(err));
 
-			dap->bdata = malloc(sizeof(struct cmsis_dap_backend_data));
+			dap->bdata = calloc(1, sizeof(struct cmsis_dap_backend_data));
 			if (!dap->bdata) {
 				LOG_ERROR("unable to allocate memory");
 				libusb_release_interface(dev_handle, interface_num);
@@ -370,7 +480,8 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 			dap->bdata->interface = interface_num;
 
 			dap->packet_buffer = malloc(dap->packet_buffer_size);
-			if (!dap->packet_buffer) {
+			if (!dap->packet_buffer ||
+					cmsis_dap_usb_alloc_requests(dap->bdata, dap->packet_buffer_size) != ERROR_OK) {
 				LOG_ERROR("unable to allocate memory");
 				cmsis_dap_usb_close(dap);
 				return ERROR_FAIL;
@@ -393,6 +504,7 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 
 static void cmsis_dap_usb_close(struct cmsis_dap *dap)
 {
+	cmsis_dap_usb_free_requests(dap->bdata);
 	libusb_release_interface(dap->bdata->dev_handle, dap->bdata->interface);
 	libusb_close(dap->bdata->dev_handle);
 	libusb_exit(dap->bdata->usb_ctx);
@@ -404,9 +516,48 @@ static void cmsis_dap_usb_close(struct cmsis_dap *dap)
 
 static int cmsis_dap_usb_read(struct cmsis_dap *dap, int timeout_ms)
 {
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
 	int transferred = 0;
 	int err;
 
+	if (bdata->pending) {
+		/* response to the oldest request in flight */
+		struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->get_idx];
+
+		int retval = cmsis_dap_usb_wait(bdata, &req->in_done, timeout_ms);
+		if (retval == ERROR_OK)
+			retval = cmsis_dap_usb_wait(bdata, &req->out_done, timeout_ms);
+		/* only polling: the request stays in flight until both of its
+		 * transfers are reaped, as the caller keeps its pending block */
+		if (retval == ERROR_TIMEOUT_REACHED && timeout_ms < LIBUSB_TIMEOUT_MS)
+			return retval;
+		if (retval != ERROR_OK) {
+			cmsis_dap_usb_drop_request(bdata);
+			return retval;
+		}
+
+		enum libusb_transfer_status status_out = req->transfer_out->status;
+		enum libusb_transfer_status status_in = req->transfer_in->status;
+		transferred = req->transfer_in->actual_length;
+		if (status_in == LIBUSB_TRANSFER_COMPLETED)
+			memcpy(dap->packet_buffer, req->buffer_in, transferred);
+		cmsis_dap_usb_drop_request(bdata);
+
+		if (status_out != LIBUSB_TRANSFER_COMPLETED) {
+			LOG_ERROR("error writing data: %s", libusb_error_name(status_out));
+			return ERROR_FAIL;
+		}
+		if (status_in == LIBUSB_TRANSFER_TIMED_OUT)
+			return ERROR_TIMEOUT_REACHED;
+		if (status_in != LIBUSB_TRANSFER_COMPLETED) {
+			LOG_ERROR("error reading data: %s", libusb_error_name(status_in));
+			return ERROR_FAIL;
+		}
+
+		memset(&dap->packet_buffer[transferred], 0, dap->packet_buffer_size - transferred);
+		return transferred;
+	}
+
 	err = libusb_bulk_transfer(dap->bdata->dev_handle, dap->bdata->ep_in,
 							dap->packet_buffer, dap->packet_size, &transferred, timeout_ms);
 	if (err) {
@@ -423,24 +574,48 @@ static int cmsis_dap_usb_read(struct cmsis_dap *dap, int timeout_ms)
 	return transferred;
 }
 
+/* Queue the command and the read of its response without waiting; the
+ * response is then returned by the next read() */
 static int cmsis_dap_usb_write(struct cmsis_dap *dap, int txlen, int timeout_ms)
 {
-	int transferred = 0;
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
 	int err;
 
-	/* skip the first byte that is only used by the HID backend */
-	err = libusb_bulk_transfer(dap->bdata->dev_handle, dap->bdata->ep_out,
-							dap->packet_buffer, txlen, &transferred, timeout_ms);
+	if (bdata->pending == MAX_PENDING_REQUESTS) {
+		LOG_ERROR("too many CMSIS-DAP requests in flight");
+		return ERROR_FAIL;
+	}
+
+	struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->put_idx];
+	memcpy(req->buffer_out, dap->packet_buffer, txlen);
+	req->out_done = 0;
+	req->in_done = 0;
+
+	libusb_fill_bulk_transfer(req->transfer_in, bdata->dev_handle, bdata->ep_in,
+			req->buffer_in, dap->packet_size, cmsis_dap_usb_transfer_done,
+			&req->in_done, timeout_ms);
+	libusb_fill_bulk_transfer(req->transfer_out, bdata->dev_handle, bdata->ep_out,
+			req->buffer_out, txlen, cmsis_dap_usb_transfer_done,
+			&req->out_done, timeout_ms);
+
+	err = libusb_submit_transfer(req->transfer_in);
 	if (err) {
-		if (err == LIBUSB_ERROR_TIMEOUT) {
-			return ERROR_TIMEOUT_REACHED;
-		} else {
-			LOG_ERROR("error writing data: %s", libusb_strerror(err));
-			return ERROR_FAIL;
-		}
+		LOG_ERROR("error reading data: %s", libusb_strerror(err));
+		return ERROR_FAIL;
 	}
 
-	return transferred;
+	err = libusb_submit_transfer(req->transfer_out);
+	if (err) {
+		LOG_ERROR("error writing data: %s", libusb_strerror(err));
+		libusb_cancel_transfer(req->transfer_in);
+		cmsis_dap_usb_wait(bdata, &req->in_done, LIBUSB_TIMEOUT_MS);
+		return ERROR_FAIL;
+	}
+
+	bdata->put_idx = (bdata->put_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->pending++;
+
+	return txlen;
 }
 
 static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz)
@@ -451,6 +626,12 @@ static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz)
 		return ERROR_FAIL;
 	}
 
+	if (cmsis_dap_usb_alloc_requests(dap->bdata, pkt_sz) != ERROR_OK) {
+		free(buf);
+		dap->packet_buffer = NULL;
+		return ERROR_FAIL;
+	}
+
 	dap->packet_buffer = buf;
 	dap->packet_size = pkt_sz;
 	dap->packet_buffer_size = pkt_sz;
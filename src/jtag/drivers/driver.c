@@ -67,8 +67,8 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
 	struct scan_command *scan = cmd_queue_alloc(sizeof(struct scan_command));
 	struct scan_field *out_fields = cmd_queue_alloc(num_taps  * sizeof(struct scan_field));
-
-	jtag_queue_command(cmd);
+	if (!cmd || !scan || !out_fields)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_SCAN;
 	cmd->cmd.scan = scan;
@@ -89,7 +89,8 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 			/* if TAP is listed in input fields, copy the value */
 			tap->bypass = 0;
 
-			jtag_scan_field_clone(field, in_fields);
+			if (jtag_scan_field_clone(field, in_fields) != ERROR_OK)
+				return ERROR_FAIL;
 		} else {
 			/* if a TAP isn't listed in input fields, set it to BYPASS */
 
@@ -98,6 +99,8 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 			field->num_bits = tap->ir_length;
 			field->out_value = buf_set_ones(cmd_queue_alloc(DIV_ROUND_UP(tap->ir_length, 8)), tap->ir_length);
 			field->in_value = NULL; /* do not collect input for tap's in bypass */
+			if (!field->out_value)
+				return ERROR_FAIL;
 		}
 
 		/* update device information */
@@ -108,6 +111,9 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 	/* paranoia: jtag_tap_count_enabled() and jtag_tap_next_enabled() not in sync */
 	assert(field == out_fields + num_taps);
 
+	/* queued only once complete, an allocation failure leaves the queue intact */
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -130,8 +136,8 @@ int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
 	struct scan_command *scan = cmd_queue_alloc(sizeof(struct scan_command));
 	struct scan_field *out_fields = cmd_queue_alloc((in_num_fields + bypass_devices) * sizeof(struct scan_field));
-
-	jtag_queue_command(cmd);
+	if (!cmd || !scan || !out_fields)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_SCAN;
 	cmd->cmd.scan = scan;
@@ -156,7 +162,8 @@ int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
 #endif /* NDEBUG */
 
 			for (int j = 0; j < in_num_fields; j++) {
-				jtag_scan_field_clone(field, in_fields + j);
+				if (jtag_scan_field_clone(field, in_fields + j) != ERROR_OK)
+					return ERROR_FAIL;
 
 				field++;
 			}
@@ -176,6 +183,8 @@ int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
 
 	assert(field == out_fields + scan->num_fields); /* no superfluous input fields permitted */
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -185,8 +194,9 @@ static int jtag_add_plain_scan(int num_bits, const uint8_t *out_bits,
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
 	struct scan_command *scan = cmd_queue_alloc(sizeof(struct scan_command));
 	struct scan_field *out_fields = cmd_queue_alloc(sizeof(struct scan_field));
-
-	jtag_queue_command(cmd);
+	uint8_t *out_value = cmd_queue_alloc(DIV_ROUND_UP(num_bits, 8));
+	if (!cmd || !scan || !out_fields || !out_value)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_SCAN;
 	cmd->cmd.scan = scan;
@@ -197,9 +207,11 @@ static int jtag_add_plain_scan(int num_bits, const uint8_t *out_bits,
 	scan->end_state = state;
 
 	out_fields->num_bits = num_bits;
-	out_fields->out_value = buf_cpy(out_bits, cmd_queue_alloc(DIV_ROUND_UP(num_bits, 8)), num_bits);
+	out_fields->out_value = buf_cpy(out_bits, out_value, num_bits);
 	out_fields->in_value = in_bits;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -219,14 +231,18 @@ int interface_jtag_add_tlr(void)
 
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_TLR_RESET;
 
 	cmd->cmd.statemove = cmd_queue_alloc(sizeof(struct statemove_command));
+	if (!cmd->cmd.statemove)
+		return ERROR_FAIL;
 	cmd->cmd.statemove->end_state = state;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -259,18 +275,24 @@ int interface_jtag_add_pathmove(int num_states, const tap_state_t *path)
 {
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_PATHMOVE;
 
 	cmd->cmd.pathmove = cmd_queue_alloc(sizeof(struct pathmove_command));
+	if (!cmd->cmd.pathmove)
+		return ERROR_FAIL;
 	cmd->cmd.pathmove->num_states = num_states;
 	cmd->cmd.pathmove->path = cmd_queue_alloc(sizeof(tap_state_t) * num_states);
+	if (!cmd->cmd.pathmove->path)
+		return ERROR_FAIL;
 
 	for (int i = 0; i < num_states; i++)
 		cmd->cmd.pathmove->path[i] = path[i];
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -278,15 +300,19 @@ int interface_jtag_add_runtest(int num_cycles, tap_state_t state)
 {
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_RUNTEST;
 
 	cmd->cmd.runtest = cmd_queue_alloc(sizeof(struct runtest_command));
+	if (!cmd->cmd.runtest)
+		return ERROR_FAIL;
 	cmd->cmd.runtest->num_cycles = num_cycles;
 	cmd->cmd.runtest->end_state = state;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -294,14 +320,18 @@ int interface_jtag_add_clocks(int num_cycles)
 {
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_STABLECLOCKS;
 
 	cmd->cmd.stableclocks = cmd_queue_alloc(sizeof(struct stableclocks_command));
+	if (!cmd->cmd.stableclocks)
+		return ERROR_FAIL;
 	cmd->cmd.stableclocks->num_cycles = num_cycles;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -309,15 +339,19 @@ int interface_jtag_add_reset(int req_trst, int req_srst)
 {
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_RESET;
 
 	cmd->cmd.reset = cmd_queue_alloc(sizeof(struct reset_command));
+	if (!cmd->cmd.reset)
+		return ERROR_FAIL;
 	cmd->cmd.reset->trst = req_trst;
 	cmd->cmd.reset->srst = req_srst;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -325,14 +359,18 @@ int interface_jtag_add_sleep(uint32_t us)
 {
 	/* allocate memory for a new list member */
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
-
-	jtag_queue_command(cmd);
+	if (!cmd)
+		return ERROR_FAIL;
 
 	cmd->type = JTAG_SLEEP;
 
 	cmd->cmd.sleep = cmd_queue_alloc(sizeof(struct sleep_command));
+	if (!cmd->cmd.sleep)
+		return ERROR_FAIL;
 	cmd->cmd.sleep->us = us;
 
+	jtag_queue_command(cmd);
+
 	return ERROR_OK;
 }
 
@@ -342,6 +380,11 @@ void interface_jtag_add_callback4(jtag_callback_t callback,
 		jtag_callback_data_t data2, jtag_callback_data_t data3)
 {
 	struct jtag_callback_entry *entry = cmd_queue_alloc(sizeof(struct jtag_callback_entry));
+	if (!entry) {
+		/* the callback would be lost, fail the next jtag_execute_queue() */
+		jtag_set_error(ERROR_FAIL);
+		return;
+	}
 
 	entry->next = NULL;
 	entry->callback = callback;
@@ -25,6 +25,7 @@
 #endif
 
 #include <jtag/interface.h>
+#include <jtag/swd.h>
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -48,6 +49,25 @@
 #define CMD_SCAN_CHAIN		2
 #define CMD_SCAN_CHAIN_FLIP_TMS	3
 #define CMD_STOP_SIMU		4
+#define CMD_SWD_SEQ		5
+#define CMD_SWD_TRANSFER	6
+
+/* CMD_SWD_SEQ carries nb_bits SWDIO values driven by OpenOCD and has no
+ * reply. CMD_SWD_TRANSFER carries nb_bits records (at most SWD_TRANSFER_MAX)
+ * of request (1 byte), flags (1 byte), write data (4 bytes) and idle cycles
+ * after the transaction (4 bytes). The reply packet holds for each one the
+ * ack (1 byte), read data (4 bytes) and read parity (1 byte) in buffer_in.
+ * Once a transaction expecting an ack fails, the following ones of the
+ * packet are not run and get SWD_ACK_SKIPPED. */
+#define SWD_RECORD_SIZE		10
+#define SWD_REPLY_SIZE		6
+#define SWD_TRANSFER_MAX	(XFERT_MAX_SIZE / SWD_RECORD_SIZE)
+
+/* CMD_SWD_TRANSFER record flags */
+#define SWD_FLAG_IGNORE_ACK	0x01
+
+/* Ack of a transaction the server skipped after a failed one */
+#define SWD_ACK_SKIPPED		0xff
 
 /* jtag_vpi server port and address to connect to */
 static int server_port = DEFAULT_SERVER_PORT;
@@ -77,6 +97,12 @@ struct vpi_cmd {
 	};
 };
 
+/* SWD transactions not sent yet, and where their read data goes */
+static struct vpi_cmd swd_packet;
+static uint8_t swd_packet_req[SWD_TRANSFER_MAX];
+static uint32_t *swd_packet_dst[SWD_TRANSFER_MAX];
+static int swd_queued_retval;
+
 static char *jtag_vpi_cmd_to_str(int cmd_num)
 {
 	switch (cmd_num) {
@@ -90,6 +116,10 @@ static char *jtag_vpi_cmd_to_str(int cmd_num)
 		return "CMD_SCAN_CHAIN_FLIP_TMS";
 	case CMD_STOP_SIMU:
 		return "CMD_STOP_SIMU";
+	case CMD_SWD_SEQ:
+		return "CMD_SWD_SEQ";
+	case CMD_SWD_TRANSFER:
+		return "CMD_SWD_TRANSFER";
 	default:
 		return "<unknown>";
 	}
@@ -578,6 +608,192 @@ static int jtag_vpi_init(void)
 	return ERROR_OK;
 }
 
+static int jtag_vpi_swd_init(void)
+{
+	memset(&swd_packet, 0, sizeof(swd_packet));
+	swd_queued_retval = ERROR_OK;
+	return ERROR_OK;
+}
+
+/**
+ * jtag_vpi_swd_seq - clock out a sequence of SWDIO bits driven by OpenOCD
+ * @param bits SWDIO bits to be written (bit0, bit1 .. bitN)
+ * @param nb_bits number of bits
+ */
+static int jtag_vpi_swd_seq(const uint8_t *bits, unsigned int nb_bits)
+{
+	struct vpi_cmd vpi;
+
+	while (nb_bits > 0) {
+		unsigned int chunk = MIN(nb_bits, XFERT_MAX_SIZE * 8);
+
+		memset(&vpi, 0, sizeof(struct vpi_cmd));
+		vpi.cmd = CMD_SWD_SEQ;
+		vpi.length = DIV_ROUND_UP(chunk, 8);
+		vpi.nb_bits = chunk;
+		memcpy(vpi.buffer_out, bits, vpi.length);
+
+		int retval = jtag_vpi_send_cmd(&vpi);
+		if (retval != ERROR_OK)
+			return retval;
+
+		nb_bits -= chunk;
+		bits += chunk / 8;
+	}
+
+	return ERROR_OK;
+}
+
+static void jtag_vpi_swd_flush(void);
+
+static int jtag_vpi_swd_switch_seq(enum swd_special_seq seq)
+{
+	/* the queued transactions must reach the target before the sequence */
+	jtag_vpi_swd_flush();
+	if (swd_queued_retval != ERROR_OK)
+		return swd_queued_retval;
+
+	switch (seq) {
+	case LINE_RESET:
+		LOG_DEBUG("SWD line reset");
+		return jtag_vpi_swd_seq(swd_seq_line_reset, swd_seq_line_reset_len);
+	case JTAG_TO_SWD:
+		LOG_DEBUG("JTAG-to-SWD");
+		return jtag_vpi_swd_seq(swd_seq_jtag_to_swd, swd_seq_jtag_to_swd_len);
+	case JTAG_TO_DORMANT:
+		LOG_DEBUG("JTAG-to-DORMANT");
+		return jtag_vpi_swd_seq(swd_seq_jtag_to_dormant, swd_seq_jtag_to_dormant_len);
+	case SWD_TO_JTAG:
+		LOG_DEBUG("SWD-to-JTAG");
+		return jtag_vpi_swd_seq(swd_seq_swd_to_jtag, swd_seq_swd_to_jtag_len);
+	case SWD_TO_DORMANT:
+		LOG_DEBUG("SWD-to-DORMANT");
+		return jtag_vpi_swd_seq(swd_seq_swd_to_dormant, swd_seq_swd_to_dormant_len);
+	case DORMANT_TO_SWD:
+		LOG_DEBUG("DORMANT-to-SWD");
+		return jtag_vpi_swd_seq(swd_seq_dormant_to_swd, swd_seq_dormant_to_swd_len);
+	case DORMANT_TO_JTAG:
+		LOG_DEBUG("DORMANT-to-JTAG");
+		return jtag_vpi_swd_seq(swd_seq_dormant_to_jtag, swd_seq_dormant_to_jtag_len);
+	default:
+		LOG_ERROR("Sequence %d not supported", seq);
+		return ERROR_FAIL;
+	}
+}
+
+/**
+ * jtag_vpi_swd_flush - send the pending SWD transactions in one
+ * CMD_SWD_TRANSFER packet and check their replies
+ */
+static void jtag_vpi_swd_flush(void)
+{
+	unsigned int count = swd_packet.nb_bits;
+
+	if (count == 0)
+		return;
+
+	swd_packet.cmd = CMD_SWD_TRANSFER;
+	swd_packet.length = count * SWD_RECORD_SIZE;
+
+	if (jtag_vpi_send_cmd(&swd_packet) != ERROR_OK ||
+			jtag_vpi_receive_cmd(&swd_packet) != ERROR_OK) {
+		swd_queued_retval = ERROR_FAIL;
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < count && swd_queued_retval == ERROR_OK; i++) {
+		const uint8_t *reply = swd_packet.buffer_in + i * SWD_REPLY_SIZE;
+		uint8_t cmd = swd_packet_req[i];
+		int ack = reply[0];
+		uint32_t data = le_to_h_u32(reply + 1);
+
+		LOG_DEBUG_IO("%s %s %s reg %X = %08" PRIx32,
+			  ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
+			  cmd & SWD_CMD_APNDP ? "AP" : "DP",
+			  cmd & SWD_CMD_RNW ? "read" : "write",
+			  (cmd & SWD_CMD_A32) >> 1,
+			  cmd & SWD_CMD_RNW ? data : 0);
+
+		if (!swd_cmd_returns_ack(cmd))
+			continue;
+
+		if (ack == SWD_ACK_SKIPPED) {
+			LOG_ERROR("jtag_vpi: SWD transaction skipped by the server");
+			swd_queued_retval = ERROR_FAIL;
+		} else if (ack != SWD_ACK_OK) {
+			swd_queued_retval = swd_ack_to_error_code(ack);
+		} else if (cmd & SWD_CMD_RNW) {
+			if ((reply[5] & 1) != parity_u32(data)) {
+				LOG_ERROR("Wrong parity detected");
+				swd_queued_retval = ERROR_FAIL;
+			} else if (swd_packet_dst[i]) {
+				*swd_packet_dst[i] = data;
+			}
+		}
+	}
+
+out:
+	memset(&swd_packet, 0, sizeof(swd_packet));
+}
+
+static void jtag_vpi_swd_queue_transfer(uint8_t cmd, uint32_t *dst, uint32_t data,
+		uint32_t ap_delay_clk)
+{
+	if (swd_queued_retval != ERROR_OK)
+		return;
+
+	unsigned int i = swd_packet.nb_bits;
+	uint8_t *record = swd_packet.buffer_out + i * SWD_RECORD_SIZE;
+
+	record[0] = cmd | SWD_CMD_START | SWD_CMD_PARK;
+	record[1] = swd_cmd_returns_ack(cmd) ? 0 : SWD_FLAG_IGNORE_ACK;
+	h_u32_to_le(record + 2, data);
+	h_u32_to_le(record + 6, (cmd & SWD_CMD_APNDP) ? ap_delay_clk : 0);
+	swd_packet_req[i] = cmd;
+	swd_packet_dst[i] = dst;
+	swd_packet.nb_bits = i + 1;
+
+	if (swd_packet.nb_bits == SWD_TRANSFER_MAX)
+		jtag_vpi_swd_flush();
+}
+
+static void jtag_vpi_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RNW);
+	jtag_vpi_swd_queue_transfer(cmd, value, 0, ap_delay_clk);
+}
+
+static void jtag_vpi_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RNW));
+	jtag_vpi_swd_queue_transfer(cmd, NULL, value, ap_delay_clk);
+}
+
+static int jtag_vpi_swd_run_queue(void)
+{
+	static const uint8_t idle;
+
+	jtag_vpi_swd_flush();
+
+	/* A transaction must be followed by another transaction or at least 8 idle cycles to
+	 * ensure that data is clocked through the AP. */
+	if (jtag_vpi_swd_seq(&idle, 8) != ERROR_OK)
+		swd_queued_retval = ERROR_FAIL;
+
+	int retval = swd_queued_retval;
+	swd_queued_retval = ERROR_OK;
+	LOG_DEBUG_IO("SWD queue return value: %02x", retval);
+	return retval;
+}
+
+static const struct swd_driver jtag_vpi_swd = {
+	.init = jtag_vpi_swd_init,
+	.switch_seq = jtag_vpi_swd_switch_seq,
+	.read_reg = jtag_vpi_swd_read_reg,
+	.write_reg = jtag_vpi_swd_write_reg,
+	.run = jtag_vpi_swd_run_queue,
+};
+
 static int jtag_vpi_stop_simulation(void)
 {
 	struct vpi_cmd cmd;
@@ -683,13 +899,16 @@ static struct jtag_interface jtag_vpi_interface = {
 	.execute_queue = jtag_vpi_execute_queue,
 };
 
+static const char * const jtag_vpi_transports[] = { "jtag", "swd", NULL };
+
 struct adapter_driver jtag_vpi_adapter_driver = {
 	.name = "jtag_vpi",
-	.transports = jtag_only,
+	.transports = jtag_vpi_transports,
 	.commands = jtag_vpi_command_handlers,
 
 	.init = jtag_vpi_init,
 	.quit = jtag_vpi_quit,
 
 	.jtag_ops = &jtag_vpi_interface,
+	.swd_ops = &jtag_vpi_swd,
 };
@@ -62,6 +62,29 @@
 #define SIO_RESET_PURGE_RX 1
 #define SIO_RESET_PURGE_TX 2
 
+/* Events are processed while queuing commands every time this many bytes
+ * have been added to the buffer being filled, to retire the buffer on the
+ * wire as soon as it is done. */
+#define MPSSE_POLL_INTERVAL 512
+
+/* Commands and responses of one flush. While one buffer is on the wire,
+ * the next commands are queued in the other one. */
+struct mpsse_buffer {
+	uint8_t *write_buffer;
+	unsigned write_count;
+	uint8_t *read_buffer;
+	unsigned read_count;
+	struct bit_copy_queue read_queue;
+};
+
+/* Context needed by the callbacks */
+struct transfer_result {
+	struct mpsse_ctx *ctx;
+	struct mpsse_buffer *buf;
+	bool done;
+	unsigned transferred;
+};
+
 struct mpsse_ctx {
 	struct libusb_context *usb_ctx;
 	struct libusb_device_handle *usb_dev;
@@ -73,15 +96,22 @@ struct mpsse_ctx {
 	uint16_t index;
 	uint8_t interface;
 	enum ftdi_chip_type type;
-	uint8_t *write_buffer;
 	unsigned write_size;
-	unsigned write_count;
-	uint8_t *read_buffer;
 	unsigned read_size;
-	unsigned read_count;
 	uint8_t *read_chunk;
 	unsigned read_chunk_size;
-	struct bit_copy_queue read_queue;
+	struct mpsse_buffer buffers[2];
+	/* Buffer the commands are queued to */
+	struct mpsse_buffer *fill;
+	/* Buffer on the wire, NULL if none */
+	struct mpsse_buffer *busy;
+	int64_t busy_start;
+	/* Write count of the fill buffer at the last event processing */
+	unsigned poll_count;
+	struct libusb_transfer *write_transfer;
+	struct libusb_transfer *read_transfer;
+	struct transfer_result write_result;
+	struct transfer_result read_result;
 	int retval;
 };
 
@@ -327,20 +357,33 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 	if (!ctx)
 		return 0;
 
-	bit_copy_queue_init(&ctx->read_queue);
 	ctx->read_chunk_size = 16384;
 	ctx->read_size = 16384;
 	ctx->write_size = 16384;
 	ctx->read_chunk = malloc(ctx->read_chunk_size);
-	ctx->read_buffer = malloc(ctx->read_size);
+	if (!ctx->read_chunk)
+		goto error;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(ctx->buffers); i++) {
+		struct mpsse_buffer *buf = &ctx->buffers[i];
 
-	/* Use calloc to make valgrind happy: buffer_write() sets payload
-	 * on bit basis, so some bits can be left uninitialized in write_buffer.
-	 * Although this is perfectly ok with MPSSE, valgrind reports
-	 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
-	ctx->write_buffer = calloc(1, ctx->write_size);
+		bit_copy_queue_init(&buf->read_queue);
+		buf->read_buffer = malloc(ctx->read_size);
 
-	if (!ctx->read_chunk || !ctx->read_buffer || !ctx->write_buffer)
+		/* Use calloc to make valgrind happy: buffer_write() sets payload
+		 * on bit basis, so some bits can be left uninitialized in write_buffer.
+		 * Although this is perfectly ok with MPSSE, valgrind reports
+		 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
+		buf->write_buffer = calloc(1, ctx->write_size);
+
+		if (!buf->read_buffer || !buf->write_buffer)
+			goto error;
+	}
+	ctx->fill = &ctx->buffers[0];
+
+	ctx->write_transfer = libusb_alloc_transfer(0);
+	ctx->read_transfer = libusb_alloc_transfer(0);
+	if (!ctx->write_transfer || !ctx->read_transfer)
 		goto error;
 
 	ctx->interface = channel;
@@ -398,16 +441,44 @@ error:
 	return 0;
 }
 
+/* Stop the transfers of the buffer on the wire, if any, and wait for their
+ * callbacks */
+static void mpsse_cancel(struct mpsse_ctx *ctx)
+{
+	if (!ctx->busy)
+		return;
+
+	if (!ctx->write_result.done)
+		libusb_cancel_transfer(ctx->write_transfer);
+	if (!ctx->read_result.done)
+		libusb_cancel_transfer(ctx->read_transfer);
+
+	while (!ctx->write_result.done || !ctx->read_result.done) {
+		struct timeval timeout_usb = { .tv_sec = 1, .tv_usec = 0 };
+
+		if (libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb,
+					NULL) != LIBUSB_SUCCESS)
+			break;
+	}
+
+	ctx->busy = NULL;
+}
+
 void mpsse_close(struct mpsse_ctx *ctx)
 {
+	mpsse_cancel(ctx);
 	if (ctx->usb_dev)
 		libusb_close(ctx->usb_dev);
 	if (ctx->usb_ctx)
 		libusb_exit(ctx->usb_ctx);
-	bit_copy_discard(&ctx->read_queue);
+	libusb_free_transfer(ctx->write_transfer);
+	libusb_free_transfer(ctx->read_transfer);
 
-	free(ctx->write_buffer);
-	free(ctx->read_buffer);
+	for (unsigned i = 0; i < ARRAY_SIZE(ctx->buffers); i++) {
+		bit_copy_discard(&ctx->buffers[i].read_queue);
+		free(ctx->buffers[i].write_buffer);
+		free(ctx->buffers[i].read_buffer);
+	}
 	free(ctx->read_chunk);
 	free(ctx);
 }
@@ -421,10 +492,14 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 {
 	int err;
 	LOG_DEBUG("-");
-	ctx->write_count = 0;
-	ctx->read_count = 0;
+	mpsse_cancel(ctx);
+	for (unsigned i = 0; i < ARRAY_SIZE(ctx->buffers); i++) {
+		ctx->buffers[i].write_count = 0;
+		ctx->buffers[i].read_count = 0;
+		bit_copy_discard(&ctx->buffers[i].read_queue);
+	}
+	ctx->fill = &ctx->buffers[0];
 	ctx->retval = ERROR_OK;
-	bit_copy_discard(&ctx->read_queue);
 	err = libusb_control_transfer(ctx->usb_dev, FTDI_DEVICE_OUT_REQTYPE, SIO_RESET_REQUEST,
 			SIO_RESET_PURGE_RX, ctx->index, NULL, 0, ctx->usb_write_timeout);
 	if (err < 0) {
@@ -443,42 +518,51 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 static unsigned buffer_write_space(struct mpsse_ctx *ctx)
 {
 	/* Reserve one byte for SEND_IMMEDIATE */
-	return ctx->write_size - ctx->write_count - 1;
+	return ctx->write_size - ctx->fill->write_count - 1;
 }
 
 static unsigned buffer_read_space(struct mpsse_ctx *ctx)
 {
-	return ctx->read_size - ctx->read_count;
+	return ctx->read_size - ctx->fill->read_count;
 }
 
 static void buffer_write_byte(struct mpsse_ctx *ctx, uint8_t data)
 {
+	struct mpsse_buffer *buf = ctx->fill;
+
 	LOG_DEBUG_IO("%02x", data);
-	assert(ctx->write_count < ctx->write_size);
-	ctx->write_buffer[ctx->write_count++] = data;
+	assert(buf->write_count < ctx->write_size);
+	buf->write_buffer[buf->write_count++] = data;
 }
 
 static unsigned buffer_write(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_offset,
 	unsigned bit_count)
 {
+	struct mpsse_buffer *buf = ctx->fill;
+
 	LOG_DEBUG_IO("%d bits", bit_count);
-	assert(ctx->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
-	bit_copy(ctx->write_buffer + ctx->write_count, 0, out, out_offset, bit_count);
-	ctx->write_count += DIV_ROUND_UP(bit_count, 8);
+	assert(buf->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
+	bit_copy(buf->write_buffer + buf->write_count, 0, out, out_offset, bit_count);
+	buf->write_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
 static unsigned buffer_add_read(struct mpsse_ctx *ctx, uint8_t *in, unsigned in_offset,
 	unsigned bit_count, unsigned offset)
 {
+	struct mpsse_buffer *buf = ctx->fill;
+
 	LOG_DEBUG_IO("%d bits, offset %d", bit_count, offset);
-	assert(ctx->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
-	bit_copy_queued(&ctx->read_queue, in, in_offset, ctx->read_buffer + ctx->read_count, offset,
+	assert(buf->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
+	bit_copy_queued(&buf->read_queue, in, in_offset, buf->read_buffer + buf->read_count, offset,
 		bit_count);
-	ctx->read_count += DIV_ROUND_UP(bit_count, 8);
+	buf->read_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
+static int mpsse_flush_buffer(struct mpsse_ctx *ctx);
+static void mpsse_poll(struct mpsse_ctx *ctx);
+
 void mpsse_clock_data_out(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_offset,
 	unsigned length, uint8_t mode)
 {
@@ -497,6 +581,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 	/* TODO: Fix MSB first modes */
 	LOG_DEBUG_IO("%s%s %d bits", in ? "in" : "", out ? "out" : "", length);
 
+	mpsse_poll(ctx);
 	if (ctx->retval != ERROR_OK) {
 		LOG_DEBUG_IO("Ignoring command due to previous error");
 		return;
@@ -512,7 +597,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
 				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_flush_buffer(ctx);
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -574,6 +659,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	LOG_DEBUG_IO("%sout %d bits, tdi=%d", in ? "in" : "", length, tdi);
 	assert(out);
 
+	mpsse_poll(ctx);
 	if (ctx->retval != ERROR_OK) {
 		LOG_DEBUG_IO("Ignoring command due to previous error");
 		return;
@@ -586,7 +672,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_flush_buffer(ctx);
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -629,7 +715,7 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -646,7 +732,7 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -663,7 +749,7 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -679,7 +765,7 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -694,7 +780,7 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -715,7 +801,7 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_flush_buffer(ctx);
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -775,17 +861,11 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency)
 	return frequency;
 }
 
-/* Context needed by the callbacks */
-struct transfer_result {
-	struct mpsse_ctx *ctx;
-	bool done;
-	unsigned transferred;
-};
-
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
 	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_buffer *buf = res->buf;
 
 	unsigned packet_size = ctx->max_packet_size;
 
@@ -799,21 +879,24 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 		unsigned this_size = packet_size - 2;
 		if (this_size > chunk_remains - 2)
 			this_size = chunk_remains - 2;
-		if (this_size > ctx->read_count - res->transferred)
-			this_size = ctx->read_count - res->transferred;
-		memcpy(ctx->read_buffer + res->transferred,
+		if (this_size > buf->read_count - res->transferred)
+			this_size = buf->read_count - res->transferred;
+		memcpy(buf->read_buffer + res->transferred,
 			ctx->read_chunk + packet_size * i + 2,
 			this_size);
 		res->transferred += this_size;
 		chunk_remains -= this_size + 2;
-		if (res->transferred == ctx->read_count) {
+		if (res->transferred == buf->read_count) {
 			res->done = true;
 			break;
 		}
 	}
 
 	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
-		ctx->read_count);
+		buf->read_count);
+
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED || transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
+		res->done = true;
 
 	if (!res->done)
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
@@ -823,134 +906,192 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_buffer *buf = res->buf;
 
 	res->transferred += transfer->actual_length;
 
-	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
+	LOG_DEBUG_IO("transferred %d of %d", res->transferred, buf->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
+	if (res->transferred == buf->write_count
+			|| transfer->status == LIBUSB_TRANSFER_CANCELLED
+			|| transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
 		res->done = true;
 	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
+		transfer->length = buf->write_count - res->transferred;
+		transfer->buffer = buf->write_buffer + res->transferred;
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
 			res->done = true;
 	}
 }
 
-int mpsse_flush(struct mpsse_ctx *ctx)
+/* Put the buffer being filled on the wire and queue the next commands to the
+ * other buffer, which must be idle. */
+static int mpsse_submit(struct mpsse_ctx *ctx)
 {
-	int retval = ctx->retval;
+	struct mpsse_buffer *buf = ctx->fill;
+	int retval;
 
-	if (retval != ERROR_OK) {
-		LOG_DEBUG_IO("Ignoring flush due to previous error");
-		assert(ctx->write_count == 0 && ctx->read_count == 0);
-		ctx->retval = ERROR_OK;
-		return retval;
-	}
+	assert(!ctx->busy);
 
-	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
-			ctx->read_count);
-	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
+	LOG_DEBUG_IO("write %d%s, read %d", buf->write_count, buf->read_count ? "+1" : "",
+			buf->read_count);
+	assert(buf->write_count > 0 || buf->read_count == 0); /* No read data without write data */
 
-	if (ctx->write_count == 0)
-		return retval;
+	if (buf->write_count == 0)
+		return ERROR_OK;
 
-	struct libusb_transfer *read_transfer = 0;
-	struct transfer_result read_result = { .ctx = ctx, .done = true };
-	if (ctx->read_count) {
+	if (buf->read_count) {
 		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
-		read_result.done = false;
 		/* delay read transaction to ensure the FTDI chip can support us with data
 		   immediately after processing the MPSSE commands in the write transaction */
 	}
 
-	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
+	ctx->write_result = (struct transfer_result){ .ctx = ctx, .buf = buf, .done = false };
+	ctx->read_result = (struct transfer_result){ .ctx = ctx, .buf = buf, .done = !buf->read_count };
+
+	libusb_fill_bulk_transfer(ctx->write_transfer, ctx->usb_dev, ctx->out_ep, buf->write_buffer,
+		buf->write_count, write_cb, &ctx->write_result, ctx->usb_write_timeout);
+	retval = libusb_submit_transfer(ctx->write_transfer);
 	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
+		goto error;
+
+	ctx->busy = buf;
+	ctx->busy_start = timeval_ms();
+	ctx->fill = buf == &ctx->buffers[0] ? &ctx->buffers[1] : &ctx->buffers[0];
+	ctx->poll_count = 0;
 
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
+	if (buf->read_count) {
+		libusb_fill_bulk_transfer(ctx->read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
+			ctx->read_chunk_size, read_cb, &ctx->read_result,
 			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
+		retval = libusb_submit_transfer(ctx->read_transfer);
+		if (retval != LIBUSB_SUCCESS) {
+			ctx->read_result.done = true;
+			goto error;
+		}
 	}
 
+	return ERROR_OK;
+
+error:
+	LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+	mpsse_purge(ctx);
+	return ERROR_FAIL;
+}
+
+/* Process the USB events of the buffer on the wire, until it is done if
+ * block is set. Once done, the data read is copied to its destinations and
+ * the buffer can be filled again. */
+static int mpsse_complete(struct mpsse_ctx *ctx, bool block)
+{
+	struct mpsse_buffer *buf = ctx->busy;
+	int retval = LIBUSB_SUCCESS;
+
+	if (!buf)
+		return ERROR_OK;
+
 	/* Polling loop, more or less taken from libftdi */
-	int64_t start = timeval_ms();
 	int64_t warn_after = 2000;
-	while (!write_result.done || !read_result.done) {
+	while (!ctx->write_result.done || !ctx->read_result.done) {
 		struct timeval timeout_usb;
 
-		timeout_usb.tv_sec = 1;
+		timeout_usb.tv_sec = block ? 1 : 0;
 		timeout_usb.tv_usec = 0;
 
 		retval = libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL);
-		keep_alive();
-		if (retval == LIBUSB_ERROR_NO_DEVICE || retval == LIBUSB_ERROR_INTERRUPTED)
+		if (retval != LIBUSB_SUCCESS)
 			break;
 
-		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
-				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
-								&timeout_usb, NULL);
-				if (retval != LIBUSB_SUCCESS)
-					break;
-			}
+		if (!block) {
+			if (!ctx->write_result.done || !ctx->read_result.done)
+				return ERROR_OK;
+			break;
 		}
 
-		int64_t now = timeval_ms();
-		if (now - start > warn_after) {
+		keep_alive();
+
+		int64_t elapsed = timeval_ms() - ctx->busy_start;
+		if (elapsed > warn_after) {
 			LOG_WARNING("Haven't made progress in mpsse_flush() for %" PRId64
-					"ms.", now - start);
+					"ms.", elapsed);
 			warn_after *= 2;
 		}
 	}
 
-error_check:
 	if (retval != LIBUSB_SUCCESS) {
 		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
 		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
+	} else if (ctx->write_result.transferred < buf->write_count) {
 		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
-			write_result.transferred,
-			ctx->write_count);
+			ctx->write_result.transferred,
+			buf->write_count);
 		retval = ERROR_FAIL;
-	} else if (read_result.transferred < ctx->read_count) {
+	} else if (ctx->read_result.transferred < buf->read_count) {
 		LOG_ERROR("ftdi device did not return all data: %d, expected %d",
-			read_result.transferred,
-			ctx->read_count);
+			ctx->read_result.transferred,
+			buf->read_count);
 		retval = ERROR_FAIL;
-	} else if (ctx->read_count) {
-		ctx->write_count = 0;
-		ctx->read_count = 0;
-		bit_copy_execute(&ctx->read_queue);
-		retval = ERROR_OK;
 	} else {
-		ctx->write_count = 0;
-		bit_copy_discard(&ctx->read_queue);
-		retval = ERROR_OK;
+		if (buf->read_count)
+			bit_copy_execute(&buf->read_queue);
+		else
+			bit_copy_discard(&buf->read_queue);
+		buf->write_count = 0;
+		buf->read_count = 0;
+		ctx->busy = NULL;
+		return ERROR_OK;
 	}
 
+	mpsse_purge(ctx);
+	return retval;
+}
+
+/* Retire the buffer on the wire if it is done, without waiting for it. Called
+ * while queuing commands, so that the next buffer can be sent as soon as it
+ * is full. */
+static void mpsse_poll(struct mpsse_ctx *ctx)
+{
+	if (!ctx->busy || ctx->retval != ERROR_OK
+			|| ctx->fill->write_count - ctx->poll_count < MPSSE_POLL_INTERVAL)
+		return;
+
+	ctx->poll_count = ctx->fill->write_count;
+	int retval = mpsse_complete(ctx, false);
+	if (retval != ERROR_OK)
+		ctx->retval = retval;
+}
+
+/* Send the buffer being filled as soon as the one on the wire is done, and
+ * return without waiting for it: the commands that follow are queued to the
+ * other buffer meanwhile. */
+static int mpsse_flush_buffer(struct mpsse_ctx *ctx)
+{
+	if (ctx->retval != ERROR_OK)
+		return ctx->retval;
+
+	int retval = mpsse_complete(ctx, true);
 	if (retval != ERROR_OK)
-		mpsse_purge(ctx);
+		return retval;
 
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
+	return mpsse_submit(ctx);
+}
 
-	return retval;
+int mpsse_flush(struct mpsse_ctx *ctx)
+{
+	int retval = ctx->retval;
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("Ignoring flush due to previous error");
+		assert(!ctx->busy && ctx->fill->write_count == 0 && ctx->fill->read_count == 0);
+		ctx->retval = ERROR_OK;
+		return retval;
+	}
+
+	retval = mpsse_flush_buffer(ctx);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return mpsse_complete(ctx, true);
 }
@@ -71,7 +71,9 @@ int mpsse_rtck_config(struct mpsse_ctx *ctx, bool enable);
  * Frequency 0 means RTCK. */
 int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency);
 
-/* Queue handling */
+/* Queue handling. Commands are sent in the background each time a buffer fills up, while the
+ * next ones are queued to a second buffer. mpsse_flush() sends what is left and waits for the
+ * whole queue to complete. */
 int mpsse_flush(struct mpsse_ctx *ctx);
 void mpsse_purge(struct mpsse_ctx *ctx);
 
@@ -27,7 +27,9 @@
 #endif
 #include "helper/system.h"
 #include "helper/replacements.h"
+#include "helper/bits.h"
 #include <jtag/interface.h>
+#include <transport/transport.h>
 #include "bitbang.h"
 
 /* arbitrary limit on host name length: */
@@ -36,12 +38,50 @@
 static char *remote_bitbang_host;
 static char *remote_bitbang_port;
 
+/* Capabilities reported in the reply to 'V', see
+ * doc/manual/jtag/drivers/remote_bitbang.txt */
+#define REMOTE_BITBANG_CAP_SCAN		BIT(0)
+#define REMOTE_BITBANG_CAP_SWD		BIT(1)
+
+/* Flags of an 'X' scan record */
+#define REMOTE_BITBANG_SCAN_CAPTURE	BIT(0)
+
+/* Upper limit on the bits in one scan record. It keeps the TDO reply well
+ * within the socket buffers, so the server never blocks writing a reply
+ * while openocd is still sending the record. */
+#define REMOTE_BITBANG_MAX_SCAN_BITS	(4096 * 8)
+
+/* Flags of a 'T' SWD transaction record */
+#define REMOTE_BITBANG_SWD_IGNORE_ACK	BIT(0)
+
+/* Ack reported for a transaction the server skipped after a failed one */
+#define REMOTE_BITBANG_SWD_ACK_SKIPPED	0xff
+
+/* Number of SWD transactions queued before their replies are collected.
+ * The replies, at most 6 bytes each, must fit in the socket buffers. */
+#define REMOTE_BITBANG_SWD_QUEUE_SIZE	1024
+
+static bool remote_bitbang_use_extensions = true;
+static unsigned int remote_bitbang_caps;
+static unsigned int remote_bitbang_max_scan_bits;
+
+struct remote_bitbang_swd_transfer {
+	uint8_t cmd;
+	uint32_t *dst;
+};
+
+static struct remote_bitbang_swd_transfer remote_bitbang_swd_queue[REMOTE_BITBANG_SWD_QUEUE_SIZE];
+static unsigned int remote_bitbang_swd_queued;
+static int remote_bitbang_swd_retval;
+
 static int remote_bitbang_fd;
-static uint8_t remote_bitbang_send_buf[512];
+static uint8_t remote_bitbang_send_buf[64 * 1024];
 static unsigned int remote_bitbang_send_buf_used;
 
-/* Circular buffer. When start == end, the buffer is empty. */
-static char remote_bitbang_recv_buf[256];
+/* Circular buffer. When start == end, the buffer is empty.
+ * It also bounds the number of outstanding read requests, so it must stay
+ * small enough for the replies to fit in the socket buffers. */
+static char remote_bitbang_recv_buf[8 * 1024];
 static unsigned int remote_bitbang_recv_buf_start;
 static unsigned int remote_bitbang_recv_buf_end;
 
@@ -77,18 +117,28 @@ static int remote_bitbang_flush(void)
 		return ERROR_OK;
 
 	unsigned int offset = 0;
+	bool blocking = false;
+	int retval = ERROR_OK;
 	while (offset < remote_bitbang_send_buf_used) {
 		ssize_t written = write_socket(remote_bitbang_fd, remote_bitbang_send_buf + offset,
 									   remote_bitbang_send_buf_used - offset);
 		if (written < 0) {
+			if (!blocking && socket_would_block()) {
+				/* The socket is full, wait for the server to catch up. */
+				socket_block(remote_bitbang_fd);
+				blocking = true;
+				continue;
+			}
 			log_socket_error("remote_bitbang_putc");
-			remote_bitbang_send_buf_used = 0;
-			return ERROR_FAIL;
+			retval = ERROR_FAIL;
+			break;
 		}
 		offset += written;
 	}
+	if (blocking)
+		socket_nonblock(remote_bitbang_fd);
 	remote_bitbang_send_buf_used = 0;
-	return ERROR_OK;
+	return retval;
 }
 
 enum block_bool {
@@ -129,11 +179,7 @@ static int remote_bitbang_fill_buf(enum block_bool block)
 		} else if (count == 0) {
 			return ERROR_OK;
 		} else if (count < 0) {
-#ifdef _WIN32
-			if (WSAGetLastError() == WSAEWOULDBLOCK) {
-#else
-			if (errno == EAGAIN) {
-#endif
+			if (socket_would_block()) {
 				return ERROR_OK;
 			} else {
 				log_socket_error("remote_bitbang_fill_buf");
@@ -159,6 +205,43 @@ static int remote_bitbang_queue(int c, flush_bool_t flush)
 	return ERROR_OK;
 }
 
+static int remote_bitbang_queue_buf(const uint8_t *buf, unsigned int len)
+{
+	while (len > 0) {
+		unsigned int count = MIN(len,
+				sizeof(remote_bitbang_send_buf) - remote_bitbang_send_buf_used);
+		memcpy(remote_bitbang_send_buf + remote_bitbang_send_buf_used, buf, count);
+		remote_bitbang_send_buf_used += count;
+		buf += count;
+		len -= count;
+		if (remote_bitbang_send_buf_used == sizeof(remote_bitbang_send_buf)) {
+			if (remote_bitbang_flush() != ERROR_OK)
+				return ERROR_FAIL;
+		}
+	}
+	return ERROR_OK;
+}
+
+/* Read exactly len bytes of reply, blocking as needed. */
+static int remote_bitbang_read_bytes(uint8_t *buf, unsigned int len)
+{
+	while (len > 0) {
+		if (remote_bitbang_recv_buf_empty()) {
+			if (remote_bitbang_fill_buf(BLOCK) != ERROR_OK)
+				return ERROR_FAIL;
+			if (remote_bitbang_recv_buf_empty()) {
+				LOG_ERROR("remote_bitbang: connection closed by the server");
+				return ERROR_FAIL;
+			}
+		}
+		*buf++ = remote_bitbang_recv_buf[remote_bitbang_recv_buf_start];
+		remote_bitbang_recv_buf_start =
+			(remote_bitbang_recv_buf_start + 1) % sizeof(remote_bitbang_recv_buf);
+		len--;
+	}
+	return ERROR_OK;
+}
+
 static int remote_bitbang_quit(void)
 {
 	if (remote_bitbang_queue('Q', FLUSH_SEND_BUF) == ERROR_FAIL)
@@ -231,6 +314,44 @@ static int remote_bitbang_blink(int on)
 	return remote_bitbang_queue(c, FLUSH_SEND_BUF);
 }
 
+/* Send the scan as 'X' records of at most remote_bitbang_max_scan_bits bits,
+ * collecting the TDO reply of each record before sending the next one. */
+static int remote_bitbang_scan(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int num_bits)
+{
+	unsigned int offset = 0;
+
+	while (offset < num_bits) {
+		unsigned int bits = MIN(num_bits - offset, remote_bitbang_max_scan_bits);
+		unsigned int bytes = DIV_ROUND_UP(bits, 8);
+		unsigned int first = offset / 8;
+		uint8_t header[6];
+
+		header[0] = 'X';
+		header[1] = tdo ? REMOTE_BITBANG_SCAN_CAPTURE : 0;
+		h_u32_to_le(header + 2, bits);
+
+		if (remote_bitbang_queue_buf(header, sizeof(header)) != ERROR_OK ||
+				remote_bitbang_queue_buf(tms + first, bytes) != ERROR_OK ||
+				remote_bitbang_queue_buf(tdi + first, bytes) != ERROR_OK)
+			return ERROR_FAIL;
+
+		if (tdo) {
+			/* leave the bits past the end of the scan alone */
+			uint8_t last;
+			if (remote_bitbang_read_bytes(tdo + first, bytes - 1) != ERROR_OK ||
+					remote_bitbang_read_bytes(&last, 1) != ERROR_OK)
+				return ERROR_FAIL;
+			uint8_t mask = 0xff >> (8 * bytes - bits);
+			tdo[first + bytes - 1] = (tdo[first + bytes - 1] & ~mask) | (last & mask);
+		}
+
+		offset += bits;
+	}
+
+	return ERROR_OK;
+}
+
 static struct bitbang_interface remote_bitbang_bitbang = {
 	.buf_size = sizeof(remote_bitbang_recv_buf) - 1,
 	.sample = &remote_bitbang_sample,
@@ -239,6 +360,182 @@ static struct bitbang_interface remote_bitbang_bitbang = {
 	.blink = &remote_bitbang_blink,
 };
 
+/* Called by "transport select swd", before the server is connected: the
+ * SWD capability is checked in remote_bitbang_init(). */
+static int remote_bitbang_swd_init(void)
+{
+	remote_bitbang_swd_queued = 0;
+	remote_bitbang_swd_retval = ERROR_OK;
+	return ERROR_OK;
+}
+
+/* Queue an 'S' record, SWDIO driven by openocd for num_bits clocks. */
+static int remote_bitbang_swd_sequence(const uint8_t *bits, unsigned int num_bits)
+{
+	uint8_t header[5];
+
+	header[0] = 'S';
+	h_u32_to_le(header + 1, num_bits);
+	if (remote_bitbang_queue_buf(header, sizeof(header)) != ERROR_OK)
+		return ERROR_FAIL;
+	return remote_bitbang_queue_buf(bits, DIV_ROUND_UP(num_bits, 8));
+}
+
+static int remote_bitbang_swd_switch_seq(enum swd_special_seq seq)
+{
+	switch (seq) {
+	case LINE_RESET:
+		LOG_DEBUG("SWD line reset");
+		return remote_bitbang_swd_sequence(swd_seq_line_reset, swd_seq_line_reset_len);
+	case JTAG_TO_SWD:
+		LOG_DEBUG("JTAG-to-SWD");
+		return remote_bitbang_swd_sequence(swd_seq_jtag_to_swd, swd_seq_jtag_to_swd_len);
+	case JTAG_TO_DORMANT:
+		LOG_DEBUG("JTAG-to-DORMANT");
+		return remote_bitbang_swd_sequence(swd_seq_jtag_to_dormant, swd_seq_jtag_to_dormant_len);
+	case SWD_TO_JTAG:
+		LOG_DEBUG("SWD-to-JTAG");
+		return remote_bitbang_swd_sequence(swd_seq_swd_to_jtag, swd_seq_swd_to_jtag_len);
+	case SWD_TO_DORMANT:
+		LOG_DEBUG("SWD-to-DORMANT");
+		return remote_bitbang_swd_sequence(swd_seq_swd_to_dormant, swd_seq_swd_to_dormant_len);
+	case DORMANT_TO_SWD:
+		LOG_DEBUG("DORMANT-to-SWD");
+		return remote_bitbang_swd_sequence(swd_seq_dormant_to_swd, swd_seq_dormant_to_swd_len);
+	case DORMANT_TO_JTAG:
+		LOG_DEBUG("DORMANT-to-JTAG");
+		return remote_bitbang_swd_sequence(swd_seq_dormant_to_jtag, swd_seq_dormant_to_jtag_len);
+	default:
+		LOG_ERROR("Sequence %d not supported", seq);
+		return ERROR_FAIL;
+	}
+}
+
+/* Collect the replies of all queued transactions. */
+static void remote_bitbang_swd_process_replies(void)
+{
+	for (unsigned int i = 0; i < remote_bitbang_swd_queued; i++) {
+		struct remote_bitbang_swd_transfer *transfer = &remote_bitbang_swd_queue[i];
+		bool rnw = transfer->cmd & SWD_CMD_RNW;
+		uint8_t reply[6];
+
+		if (remote_bitbang_read_bytes(reply, rnw ? 6 : 1) != ERROR_OK) {
+			remote_bitbang_swd_retval = ERROR_FAIL;
+			break;
+		}
+
+		/* replies after a failure only keep the stream in sync */
+		if (remote_bitbang_swd_retval != ERROR_OK)
+			continue;
+
+		int ack = reply[0];
+		uint32_t data = le_to_h_u32(reply + 1);
+
+		LOG_DEBUG_IO("%s %s %s reg %X = %08" PRIx32,
+			  ack == SWD_ACK_OK ? "OK" : ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK",
+			  transfer->cmd & SWD_CMD_APNDP ? "AP" : "DP",
+			  rnw ? "read" : "write",
+			  (transfer->cmd & SWD_CMD_A32) >> 1,
+			  rnw ? data : 0);
+
+		if (!swd_cmd_returns_ack(transfer->cmd))
+			continue;
+
+		if (ack == REMOTE_BITBANG_SWD_ACK_SKIPPED) {
+			LOG_ERROR("remote_bitbang: SWD transaction skipped by the server");
+			remote_bitbang_swd_retval = ERROR_FAIL;
+			continue;
+		}
+
+		if (ack != SWD_ACK_OK) {
+			remote_bitbang_swd_retval = swd_ack_to_error_code(ack);
+			continue;
+		}
+
+		if (rnw) {
+			if ((reply[5] & 1) != parity_u32(data)) {
+				LOG_ERROR("Wrong parity detected");
+				remote_bitbang_swd_retval = ERROR_FAIL;
+				continue;
+			}
+			if (transfer->dst)
+				*transfer->dst = data;
+		}
+	}
+
+	remote_bitbang_swd_queued = 0;
+}
+
+static void remote_bitbang_swd_queue_transfer(uint8_t cmd, uint32_t *dst,
+		uint32_t data, uint32_t ap_delay_clk)
+{
+	if (remote_bitbang_swd_retval != ERROR_OK)
+		return;
+
+	if (remote_bitbang_swd_queued == REMOTE_BITBANG_SWD_QUEUE_SIZE) {
+		remote_bitbang_swd_process_replies();
+		if (remote_bitbang_swd_retval != ERROR_OK)
+			return;
+	}
+
+	uint8_t record[11];
+	record[0] = 'T';
+	record[1] = cmd | SWD_CMD_START | SWD_CMD_PARK;
+	record[2] = swd_cmd_returns_ack(cmd) ? 0 : REMOTE_BITBANG_SWD_IGNORE_ACK;
+	h_u32_to_le(record + 3, data);
+	h_u32_to_le(record + 7, (cmd & SWD_CMD_APNDP) ? ap_delay_clk : 0);
+
+	if (remote_bitbang_queue_buf(record, sizeof(record)) != ERROR_OK) {
+		remote_bitbang_swd_retval = ERROR_FAIL;
+		return;
+	}
+
+	remote_bitbang_swd_queue[remote_bitbang_swd_queued].cmd = cmd;
+	remote_bitbang_swd_queue[remote_bitbang_swd_queued].dst = dst;
+	remote_bitbang_swd_queued++;
+}
+
+static void remote_bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RNW);
+	remote_bitbang_swd_queue_transfer(cmd, value, 0, ap_delay_clk);
+}
+
+static void remote_bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RNW));
+	remote_bitbang_swd_queue_transfer(cmd, NULL, value, ap_delay_clk);
+}
+
+static int remote_bitbang_swd_run_queue(void)
+{
+	static const uint8_t idle;
+
+	/* A transaction must be followed by another transaction or at least 8 idle cycles to
+	 * ensure that data is clocked through the AP. The sequence also ends the
+	 * server's skipping after a failed transaction. */
+	if (remote_bitbang_swd_sequence(&idle, 8) != ERROR_OK)
+		remote_bitbang_swd_retval = ERROR_FAIL;
+
+	if (remote_bitbang_flush() != ERROR_OK)
+		remote_bitbang_swd_retval = ERROR_FAIL;
+
+	remote_bitbang_swd_process_replies();
+
+	int retval = remote_bitbang_swd_retval;
+	remote_bitbang_swd_retval = ERROR_OK;
+	LOG_DEBUG_IO("SWD queue return value: %02x", retval);
+	return retval;
+}
+
+static const struct swd_driver remote_bitbang_swd = {
+	.init = remote_bitbang_swd_init,
+	.switch_seq = remote_bitbang_swd_switch_seq,
+	.read_reg = remote_bitbang_swd_read_reg,
+	.write_reg = remote_bitbang_swd_write_reg,
+	.run = remote_bitbang_swd_run_queue,
+};
+
 static int remote_bitbang_init_tcp(void)
 {
 	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
@@ -316,6 +613,66 @@ static int remote_bitbang_init_unix(void)
 	return fd;
 }
 
+/* Ask the server for its protocol extensions. A stock server ignores the
+ * 'V' and only answers the 'R' that follows it. */
+static int remote_bitbang_negotiate(void)
+{
+	uint8_t c, info[7];
+
+	remote_bitbang_bitbang.scan = NULL;
+	remote_bitbang_caps = 0;
+	remote_bitbang_max_scan_bits = 0;
+
+	if (!remote_bitbang_use_extensions)
+		return ERROR_OK;
+
+	if (remote_bitbang_queue('V', NO_FLUSH) != ERROR_OK ||
+			remote_bitbang_queue('R', FLUSH_SEND_BUF) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (remote_bitbang_read_bytes(&c, 1) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (c == '0' || c == '1') {
+		LOG_INFO("remote_bitbang: server has no protocol extensions");
+		return ERROR_OK;
+	}
+
+	if (c != 'V') {
+		LOG_ERROR("remote_bitbang: invalid version response: %c(%i)", c, c);
+		return ERROR_FAIL;
+	}
+
+	if (remote_bitbang_read_bytes(info, sizeof(info)) != ERROR_OK ||
+			remote_bitbang_read_bytes(&c, 1) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (c != '0' && c != '1') {
+		LOG_ERROR("remote_bitbang: invalid read response: %c(%i)", c, c);
+		return ERROR_FAIL;
+	}
+
+	unsigned int caps = le_to_h_u16(info + 1);
+	uint32_t max_bits = le_to_h_u32(info + 3);
+	LOG_INFO("remote_bitbang: server protocol version %u, capabilities 0x%04x",
+			info[0], caps);
+	remote_bitbang_caps = caps;
+
+	if (caps & REMOTE_BITBANG_CAP_SCAN) {
+		/* records other than the last one of a scan must be byte aligned */
+		max_bits = MIN(max_bits, REMOTE_BITBANG_MAX_SCAN_BITS) & ~7u;
+		if (max_bits == 0) {
+			LOG_WARNING("remote_bitbang: server scan records are too short, not using them");
+			return ERROR_OK;
+		}
+		remote_bitbang_max_scan_bits = max_bits;
+		remote_bitbang_bitbang.scan = &remote_bitbang_scan;
+		LOG_INFO("remote_bitbang: using scan records of up to %u bits", max_bits);
+	}
+
+	return ERROR_OK;
+}
+
 static int remote_bitbang_init(void)
 {
 	bitbang_interface = &remote_bitbang_bitbang;
@@ -334,6 +691,14 @@ static int remote_bitbang_init(void)
 
 	socket_nonblock(remote_bitbang_fd);
 
+	if (remote_bitbang_negotiate() != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (transport_is_swd() && !(remote_bitbang_caps & REMOTE_BITBANG_CAP_SWD)) {
+		LOG_ERROR("remote_bitbang: SWD needs a server with the SWD protocol extension");
+		return ERROR_FAIL;
+	}
+
 	LOG_INFO("remote_bitbang driver initialized");
 	return ERROR_OK;
 }
@@ -360,6 +725,19 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_extensions_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], remote_bitbang_use_extensions);
+
+	command_print(CMD, "remote_bitbang protocol extensions are %s",
+			remote_bitbang_use_extensions ? "enabled" : "disabled");
+	return ERROR_OK;
+}
+
 static const struct command_registration remote_bitbang_subcommand_handlers[] = {
 	{
 		.name = "port",
@@ -377,6 +755,14 @@ static const struct command_registration remote_bitbang_subcommand_handlers[] =
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "extensions",
+		.handler = remote_bitbang_handle_remote_bitbang_extensions_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Enable or disable negotiation of the protocol extensions "
+			"(multi-bit scan records, SWD transactions).",
+		.usage = "['on'|'off']",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
@@ -410,9 +796,11 @@ static struct jtag_interface remote_bitbang_interface = {
 	.execute_queue = &remote_bitbang_execute_queue,
 };
 
+static const char * const remote_bitbang_transports[] = { "jtag", "swd", NULL };
+
 struct adapter_driver remote_bitbang_adapter_driver = {
 	.name = "remote_bitbang",
-	.transports = jtag_only,
+	.transports = remote_bitbang_transports,
 	.commands = remote_bitbang_command_handlers,
 
 	.init = &remote_bitbang_init,
@@ -420,4 +808,5 @@ struct adapter_driver remote_bitbang_adapter_driver = {
 	.reset = &remote_bitbang_reset,
 
 	.jtag_ops = &remote_bitbang_interface,
+	.swd_ops = &remote_bitbang_swd,
 };
@@ -859,6 +859,43 @@ COMMAND_HANDLER(handle_jtag_init_command)
 	return jtag_init(CMD_CTX);
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats_command)
+{
+	struct cmd_queue_stats stats;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	jtag_command_queue_get_stats(&stats);
+
+	command_print(CMD, "allocations: %" PRIu64 " (%" PRIu64 " larger than a page)",
+		stats.allocations, stats.large_allocations);
+	command_print(CMD, "queue resets: %" PRIu64, stats.resets);
+	command_print(CMD, "pages held: %u", stats.pages);
+	command_print(CMD, "largest queue: %zu bytes", stats.high_water);
+	command_print(CMD, "optimized commands: %" PRIu64 ", saved TCK cycles: %" PRIu64,
+		stats.optimized_commands, stats.saved_tck);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_queue_optimize_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		jtag_command_queue_set_optimize(enable);
+	}
+
+	command_print(CMD, "JTAG queue optimization is %s",
+		jtag_command_queue_get_optimize() ? "on" : "off");
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -867,6 +904,20 @@ static const struct command_registration jtag_subcommand_handlers[] = {
 		.help = "initialize jtag scan chain",
 		.usage = ""
 	},
+	{
+		.name = "queue_stats",
+		.mode = COMMAND_EXEC,
+		.handler = handle_jtag_queue_stats_command,
+		.help = "show allocation statistics of the JTAG command queue",
+		.usage = ""
+	},
+	{
+		.name = "queue_optimize",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_queue_optimize_command,
+		.help = "merge and remove redundant JTAG commands before execution",
+		.usage = "[on|off]"
+	},
 	{
 		.name = "arp_init",
 		.mode = COMMAND_ANY,
@@ -127,6 +127,7 @@ enum freertos_symbol_values {
 	FREERTOS_VAL_X_SUSPENDED_TASK_LIST = 8,
 	FREERTOS_VAL_UX_CURRENT_NUMBER_OF_TASKS = 9,
 	FREERTOS_VAL_UX_TOP_USED_PRIORITY = 10,
+	FREERTOS_VAL_UX_TASK_NUMBER = 11,
 };
 
 struct symbols {
@@ -146,6 +147,7 @@ static const struct symbols freertos_symbol_list[] = {
 	{ "xSuspendedTaskList", true }, /* Only if INCLUDE_vTaskSuspend */
 	{ "uxCurrentNumberOfTasks", false },
 	{ "uxTopUsedPriority", true }, /* Unavailable since v7.5.3 */
+	{ "uxTaskNumber", true }, /* Static, needs debug information */
 	{ NULL, false }
 };
 
@@ -154,6 +156,20 @@ static const struct symbols freertos_symbol_list[] = {
 /* may be problems reading if sizes are not 32 bit long integers. */
 /* test mallocs for failure */
 
+/* Mark the running thread in a thread list kept from the previous update:
+ * the scheduler may have switched tasks without the list changing. */
+static void freertos_update_running_thread(struct rtos *rtos)
+{
+	for (int i = 0; i < rtos->thread_count; i++) {
+		struct thread_detail *detail = &rtos->thread_details[i];
+
+		free(detail->extra_info_str);
+		detail->extra_info_str = NULL;
+		if (detail->threadid == rtos->current_thread)
+			detail->extra_info_str = strdup("State: Running");
+	}
+}
+
 static int freertos_update_threads(struct rtos *rtos)
 {
 	int retval;
@@ -176,7 +192,7 @@ static int freertos_update_threads(struct rtos *rtos)
 	}
 
 	uint32_t thread_list_size = 0;
-	retval = target_read_u32(rtos->target,
+	retval = rtos_snapshot_read_u32(rtos,
 			rtos->symbols[FREERTOS_VAL_UX_CURRENT_NUMBER_OF_TASKS].address,
 			&thread_list_size);
 	LOG_DEBUG("FreeRTOS: Read uxCurrentNumberOfTasks at 0x%" PRIx64 ", value %" PRIu32,
@@ -188,22 +204,45 @@ static int freertos_update_threads(struct rtos *rtos)
 		return retval;
 	}
 
-	/* wipe out previous thread details if any */
-	rtos_free_threadlist(rtos);
-
 	/* read the current thread */
 	uint32_t pointer_casts_are_bad;
-	retval = target_read_u32(rtos->target,
+	retval = rtos_snapshot_read_u32(rtos,
 			rtos->symbols[FREERTOS_VAL_PX_CURRENT_TCB].address,
 			&pointer_casts_are_bad);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Error reading current thread in FreeRTOS thread list");
 		return retval;
 	}
-	rtos->current_thread = pointer_casts_are_bad;
+	threadid_t current_thread = pointer_casts_are_bad;
 	LOG_DEBUG("FreeRTOS: Read pxCurrentTCB at 0x%" PRIx64 ", value 0x%" PRIx64,
 										rtos->symbols[FREERTOS_VAL_PX_CURRENT_TCB].address,
-										rtos->current_thread);
+										current_thread);
+
+	/* uxTaskNumber is incremented each time a task is created, and the
+	 * thread count changes when one is deleted: if neither moved, the
+	 * thread list is the same as on the previous update. */
+	bool have_key = rtos->symbols[FREERTOS_VAL_UX_TASK_NUMBER].address != 0;
+	uint32_t key[3] = { thread_list_size, 0, current_thread == 0 };
+	if (have_key) {
+		retval = rtos_snapshot_read_u32(rtos,
+				rtos->symbols[FREERTOS_VAL_UX_TASK_NUMBER].address,
+				&key[1]);
+		if (retval != ERROR_OK)
+			have_key = false;
+	}
+
+	if (have_key && rtos_snapshot_unchanged(rtos, key, sizeof(key))) {
+		LOG_DEBUG("FreeRTOS: thread list unchanged, task number %" PRIu32, key[1]);
+		rtos->current_thread = current_thread;
+		rtos->current_threadid = -1;
+		freertos_update_running_thread(rtos);
+		return ERROR_OK;
+	}
+
+	/* wipe out previous thread details if any */
+	rtos_free_threadlist(rtos);
+
+	rtos->current_thread = current_thread;
 
 	if ((thread_list_size  == 0) || (rtos->current_thread == 0)) {
 		/* Either : No RTOS threads - there is always at least the current execution though */
@@ -226,6 +265,8 @@ static int freertos_update_threads(struct rtos *rtos)
 
 		if (thread_list_size == 1) {
 			rtos->thread_count = 1;
+			if (have_key)
+				rtos_snapshot_commit(rtos, key, sizeof(key));
 			return ERROR_OK;
 		}
 	} else {
@@ -244,7 +285,7 @@ static int freertos_update_threads(struct rtos *rtos)
 		return ERROR_FAIL;
 	}
 	uint32_t top_used_priority = 0;
-	retval = target_read_u32(rtos->target,
+	retval = rtos_snapshot_read_u32(rtos,
 			rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address,
 			&top_used_priority);
 	if (retval != ERROR_OK)
@@ -265,6 +306,15 @@ static int freertos_update_threads(struct rtos *rtos)
 	 * Here we restore the original configMAX_PRIORITIES value */
 	unsigned int config_max_priorities = top_used_priority + 1;
 
+	/* all the ready list heads in one go */
+	retval = rtos_snapshot_prefetch(rtos,
+			rtos->symbols[FREERTOS_VAL_PX_READY_TASKS_LISTS].address,
+			config_max_priorities * param->list_width);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading FreeRTOS ready lists");
+		return retval;
+	}
+
 	symbol_address_t *list_of_lists =
 		malloc(sizeof(symbol_address_t) * (config_max_priorities + 5));
 	if (!list_of_lists) {
@@ -289,7 +339,7 @@ static int freertos_update_threads(struct rtos *rtos)
 
 		/* Read the number of threads in this list */
 		uint32_t list_thread_count = 0;
-		retval = target_read_u32(rtos->target,
+		retval = rtos_snapshot_read_u32(rtos,
 				list_of_lists[i],
 				&list_thread_count);
 		if (retval != ERROR_OK) {
@@ -306,7 +356,7 @@ static int freertos_update_threads(struct rtos *rtos)
 		/* Read the location of first list item */
 		uint32_t prev_list_elem_ptr = -1;
 		uint32_t list_elem_ptr = 0;
-		retval = target_read_u32(rtos->target,
+		retval = rtos_snapshot_read_u32(rtos,
 				list_of_lists[i] + param->list_next_offset,
 				&list_elem_ptr);
 		if (retval != ERROR_OK) {
@@ -322,7 +372,7 @@ static int freertos_update_threads(struct rtos *rtos)
 				(tasks_found < thread_list_size)) {
 			/* Get the location of the thread structure. */
 			rtos->thread_details[tasks_found].threadid = 0;
-			retval = target_read_u32(rtos->target,
+			retval = rtos_snapshot_read_u32(rtos,
 					list_elem_ptr + param->list_elem_content_offset,
 					&pointer_casts_are_bad);
 			if (retval != ERROR_OK) {
@@ -341,7 +391,7 @@ static int freertos_update_threads(struct rtos *rtos)
 			char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
 
 			/* Read the thread name */
-			retval = target_read_buffer(rtos->target,
+			retval = rtos_snapshot_read(rtos,
 					rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
 					FREERTOS_THREAD_NAME_STR_SIZE,
 					(uint8_t *)&tmp_str);
@@ -377,7 +427,7 @@ static int freertos_update_threads(struct rtos *rtos)
 
 			prev_list_elem_ptr = list_elem_ptr;
 			list_elem_ptr = 0;
-			retval = target_read_u32(rtos->target,
+			retval = rtos_snapshot_read_u32(rtos,
 					prev_list_elem_ptr + param->list_elem_next_offset,
 					&list_elem_ptr);
 			if (retval != ERROR_OK) {
@@ -393,9 +443,12 @@ static int freertos_update_threads(struct rtos *rtos)
 
 	free(list_of_lists);
 	rtos->thread_count = tasks_found;
+	if (have_key)
+		rtos_snapshot_commit(rtos, key, sizeof(key));
 	return 0;
 }
 
+
 static int freertos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 		struct rtos_reg **reg_list, int *num_regs)
 {
@@ -416,7 +469,7 @@ static int freertos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 
 	/* Read the stack pointer */
 	uint32_t pointer_casts_are_bad;
-	retval = target_read_u32(rtos->target,
+	retval = rtos_snapshot_read_u32(rtos,
 			thread_id + param->thread_stack_offset,
 			&pointer_casts_are_bad);
 	if (retval != ERROR_OK) {
@@ -453,7 +506,7 @@ static int freertos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 	if (cm4_fpu_enabled == 1) {
 		/* Read the LR to decide between stacking with or without FPU */
 		uint32_t lr_svc = 0;
-		retval = target_read_u32(rtos->target,
+		retval = rtos_snapshot_read_u32(rtos,
 				stack_ptr + 0x20,
 				&lr_svc);
 		if (retval != ERROR_OK) {
@@ -172,10 +172,11 @@ static int rcmd_offset(const char *cmd, const char *name)
 static int nuttx_thread_packet(struct connection *connection,
 	char const *packet, int packet_size)
 {
-	char cmd[GDB_BUFFER_SIZE / 2 + 1] = ""; /* Extra byte for null-termination */
+	char cmd[64] = ""; /* longer than any of the nuttx.* monitor commands */
 
 	if (!strncmp(packet, "qRcmd", 5)) {
-		size_t len = unhexify((uint8_t *)cmd, packet + 6, sizeof(cmd));
+		/* keep the last byte for null-termination */
+		size_t len = unhexify((uint8_t *)cmd, packet + 6, sizeof(cmd) - 1);
 		int offset;
 
 		if (len <= 0)
@@ -23,6 +23,7 @@
 #include "rtos.h"
 #include "target/target.h"
 #include "helper/log.h"
+#include "helper/align.h"
 #include "helper/binarybuffer.h"
 #include "server/gdb_server.h"
 
@@ -60,6 +61,8 @@ static struct rtos_type *rtos_types[] = {
 };
 
 static int rtos_try_next(struct target *target);
+static void rtos_flush_thread_regs(struct rtos *os);
+static int rtos_target_event(struct target *target, enum target_event event, void *priv);
 
 int rtos_thread_packet(struct connection *connection, const char *packet, int packet_size);
 
@@ -96,6 +99,8 @@ static int os_alloc(struct target *target, struct rtos_type *ostype)
 	os->gdb_thread_packet = rtos_thread_packet;
 	os->gdb_target_for_threadid = rtos_target_for_threadid;
 
+	target_register_event_callback(rtos_target_event, os);
+
 	return JIM_OK;
 }
 
@@ -104,6 +109,11 @@ static void os_free(struct target *target)
 	if (!target->rtos)
 		return;
 
+	target_unregister_event_callback(rtos_target_event, target->rtos);
+	rtos_flush_thread_regs(target->rtos);
+	rtos_snapshot_end(target->rtos);
+	free(target->rtos->snapshot.blocks);
+	free(target->rtos->snapshot.key);
 	free(target->rtos->symbols);
 	free(target->rtos);
 	target->rtos = NULL;
@@ -233,11 +243,23 @@ int rtos_qsymbol(struct connection *connection, char const *packet, int packet_s
 	int rtos_detected = 0;
 	uint64_t addr = 0;
 	size_t reply_len;
-	char reply[GDB_BUFFER_SIZE + 1], cur_sym[GDB_BUFFER_SIZE / 2 + 1] = ""; /* Extra byte for null-termination */
+	/* Extra byte for null-termination. On the heap, as GDB_BUFFER_SIZE is large */
+	const size_t reply_size = GDB_BUFFER_SIZE + 1;
+	char *reply, *cur_sym;
 	struct symbol_table_elem *next_sym;
 	struct target *target = get_target_from_connection(connection);
 	struct rtos *os = target->rtos;
 
+	reply = malloc(reply_size);
+	cur_sym = calloc(1, GDB_BUFFER_SIZE / 2 + 1);
+	if (!reply || !cur_sym) {
+		LOG_ERROR("Out of memory");
+		free(reply);
+		free(cur_sym);
+		gdb_put_packet(connection, "OK", 2);
+		return 0;
+	}
+
 	reply_len = sprintf(reply, "OK");
 
 	if (!os)
@@ -295,20 +317,22 @@ int rtos_qsymbol(struct connection *connection, char const *packet, int packet_s
 		}
 	}
 
-	if (8 + (strlen(next_sym->symbol_name) * 2) + 1 > sizeof(reply)) {
+	if (8 + (strlen(next_sym->symbol_name) * 2) + 1 > reply_size) {
 		LOG_ERROR("ERROR: RTOS symbol '%s' name is too long for GDB!", next_sym->symbol_name);
 		goto done;
 	}
 
 	LOG_DEBUG("RTOS: Requesting symbol lookup of '%s' from the debugger", next_sym->symbol_name);
 
-	reply_len = snprintf(reply, sizeof(reply), "qSymbol:");
+	reply_len = snprintf(reply, reply_size, "qSymbol:");
 	reply_len += hexify(reply + reply_len,
 		(const uint8_t *)next_sym->symbol_name, strlen(next_sym->symbol_name),
-		sizeof(reply) - reply_len);
+		reply_size - reply_len);
 
 done:
 	gdb_put_packet(connection, reply, reply_len);
+	free(reply);
+	free(cur_sym);
 	return rtos_detected;
 }
 
@@ -377,6 +401,8 @@ int rtos_thread_packet(struct connection *connection, char const *packet, int pa
 				target->rtos_auto_detect = false;
 				target->rtos->type->create(target);
 			}
+			rtos_flush_thread_regs(target->rtos);
+			rtos_snapshot_begin(target->rtos);
 			target->rtos->type->update_threads(target->rtos);
 		}
 		return ERROR_OK;
@@ -483,6 +509,91 @@ static int rtos_put_gdb_reg_list(struct connection *connection,
 	return ERROR_OK;
 }
 
+/**
+ * Get the registers of a thread through the RTOS driver. They are read on
+ * the first request after the target halted and kept until it resumes, so
+ * that GDB walking all the threads (thread view, backtraces) reads each
+ * saved context once. @a reg_list is a copy, to be freed by the caller.
+ */
+static int rtos_get_thread_regs(struct rtos *os, threadid_t threadid,
+		struct rtos_reg **reg_list, int *num_regs)
+{
+	struct rtos_thread_regs *regs = NULL;
+
+	/* drivers with get_thread_reg return the live registers of a core */
+	if (os->type->get_thread_reg)
+		return os->type->get_thread_reg_list(os, threadid, reg_list, num_regs);
+
+	for (unsigned int i = 0; i < os->num_thread_regs; i++) {
+		if (os->thread_regs[i].threadid == threadid) {
+			regs = &os->thread_regs[i];
+			break;
+		}
+	}
+
+	if (!regs) {
+		struct rtos_reg *list;
+		int num;
+		int retval = os->type->get_thread_reg_list(os, threadid, &list, &num);
+		if (retval != ERROR_OK)
+			return retval;
+
+		struct rtos_thread_regs *thread_regs = realloc(os->thread_regs,
+				(os->num_thread_regs + 1) * sizeof(*thread_regs));
+		if (!thread_regs) {
+			/* not cached, hand it over as is */
+			*reg_list = list;
+			*num_regs = num;
+			return ERROR_OK;
+		}
+		os->thread_regs = thread_regs;
+		regs = &os->thread_regs[os->num_thread_regs++];
+		regs->threadid = threadid;
+		regs->reg_list = list;
+		regs->num_regs = num;
+	} else {
+		LOG_DEBUG("RTOS: registers of thread 0x%" PRIx64 " from cache", threadid);
+	}
+
+	*reg_list = malloc(regs->num_regs * sizeof(**reg_list));
+	if (!*reg_list && regs->num_regs) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	memcpy(*reg_list, regs->reg_list, regs->num_regs * sizeof(**reg_list));
+	*num_regs = regs->num_regs;
+	return ERROR_OK;
+}
+
+static void rtos_flush_thread_regs(struct rtos *os)
+{
+	for (unsigned int i = 0; i < os->num_thread_regs; i++)
+		free(os->thread_regs[i].reg_list);
+	free(os->thread_regs);
+	os->thread_regs = NULL;
+	os->num_thread_regs = 0;
+}
+
+/* The saved thread contexts and the memory snapshot are only valid while
+ * the target stays halted */
+static int rtos_target_event(struct target *target, enum target_event event, void *priv)
+{
+	struct rtos *os = priv;
+
+	switch (event) {
+	case TARGET_EVENT_RESUME_START:
+	case TARGET_EVENT_RESUMED:
+	case TARGET_EVENT_RESET_ASSERT:
+		rtos_flush_thread_regs(os);
+		rtos_snapshot_end(os);
+		break;
+	default:
+		break;
+	}
+
+	return ERROR_OK;
+}
+
 /** Look through all registers to find this register. */
 int rtos_get_gdb_reg(struct connection *connection, int reg_num)
 {
@@ -512,7 +623,7 @@ int rtos_get_gdb_reg(struct connection *connection, int reg_num)
 				return retval;
 			}
 		} else {
-			retval = target->rtos->type->get_thread_reg_list(target->rtos,
+			retval = rtos_get_thread_regs(target->rtos,
 					current_threadid,
 					&reg_list,
 					&num_regs);
@@ -552,7 +663,7 @@ int rtos_get_gdb_reg_list(struct connection *connection)
 										current_threadid,
 										target->rtos->current_thread);
 
-		int retval = target->rtos->type->get_thread_reg_list(target->rtos,
+		int retval = rtos_get_thread_regs(target->rtos,
 				current_threadid,
 				&reg_list,
 				&num_regs);
@@ -578,6 +689,7 @@ int rtos_set_reg(struct connection *connection, int reg_num,
 			(target->rtos->type->set_reg) &&
 			(current_threadid != -1) &&
 			(current_threadid != 0)) {
+		rtos_flush_thread_regs(target->rtos);
 		return target->rtos->type->set_reg(target->rtos, reg_num, reg_value);
 	}
 	return ERROR_FAIL;
@@ -601,7 +713,11 @@ int rtos_generic_stack_read(struct target *target,
 
 	if (stacking->stack_growth_direction == 1)
 		address -= stacking->stack_registers_size;
-	retval = target_read_buffer(target, address, stacking->stack_registers_size, stack_data);
+	if (target->rtos)
+		retval = rtos_snapshot_read(target->rtos, address, stacking->stack_registers_size,
+				stack_data);
+	else
+		retval = target_read_buffer(target, address, stacking->stack_registers_size, stack_data);
 	if (retval != ERROR_OK) {
 		free(stack_data);
 		LOG_ERROR("Error reading stack frame from thread");
@@ -660,6 +776,7 @@ static int rtos_try_next(struct target *target)
 
 	os->type = *type;
 
+	rtos_flush_thread_regs(os);
 	free(os->symbols);
 	os->symbols = NULL;
 
@@ -668,8 +785,11 @@ static int rtos_try_next(struct target *target)
 
 int rtos_update_threads(struct target *target)
 {
-	if ((target->rtos) && (target->rtos->type))
+	if ((target->rtos) && (target->rtos->type)) {
+		rtos_flush_thread_regs(target->rtos);
+		rtos_snapshot_begin(target->rtos);
 		target->rtos->type->update_threads(target->rtos);
+	}
 	return ERROR_OK;
 }
 
@@ -689,6 +809,150 @@ void rtos_free_threadlist(struct rtos *rtos)
 		rtos->current_threadid = -1;
 		rtos->current_thread = 0;
 	}
+
+	free(rtos->snapshot.key);
+	rtos->snapshot.key = NULL;
+	rtos->snapshot.key_size = 0;
+}
+
+/* Target memory is read by aligned blocks of this size */
+#define RTOS_SNAPSHOT_BLOCK_SIZE 256
+
+void rtos_snapshot_begin(struct rtos *rtos)
+{
+	rtos_snapshot_end(rtos);
+}
+
+void rtos_snapshot_end(struct rtos *rtos)
+{
+	struct rtos_snapshot *snapshot = &rtos->snapshot;
+
+	for (unsigned int i = 0; i < snapshot->num_blocks; i++)
+		free(snapshot->blocks[i].data);
+	snapshot->num_blocks = 0;
+}
+
+void rtos_memory_changed(void)
+{
+	/* the memory may be shared with the other targets */
+	for (struct target *target = all_targets; target; target = target->next) {
+		struct rtos *os = target->rtos;
+		if (!os)
+			continue;
+
+		rtos_flush_thread_regs(os);
+		rtos_snapshot_end(os);
+		free(os->snapshot.key);
+		os->snapshot.key = NULL;
+		os->snapshot.key_size = 0;
+	}
+}
+
+static struct rtos_snapshot_block *rtos_snapshot_find(struct rtos_snapshot *snapshot,
+		target_addr_t address, uint32_t size)
+{
+	/* lookups usually hit the blocks read last */
+	for (unsigned int i = snapshot->num_blocks; i > 0; i--) {
+		struct rtos_snapshot_block *block = &snapshot->blocks[i - 1];
+		if (address >= block->address && size <= block->size
+				&& address - block->address <= block->size - size)
+			return block;
+	}
+	return NULL;
+}
+
+static int rtos_snapshot_add(struct rtos *rtos, target_addr_t address, uint32_t size,
+		struct rtos_snapshot_block **block)
+{
+	struct rtos_snapshot *snapshot = &rtos->snapshot;
+
+	if (snapshot->num_blocks == snapshot->max_blocks) {
+		unsigned int max_blocks = snapshot->max_blocks ? 2 * snapshot->max_blocks : 32;
+		struct rtos_snapshot_block *blocks = realloc(snapshot->blocks,
+				max_blocks * sizeof(*blocks));
+		if (!blocks) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		snapshot->blocks = blocks;
+		snapshot->max_blocks = max_blocks;
+	}
+
+	uint8_t *data = malloc(size);
+	if (!data) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	int retval = target_read_buffer(rtos->target, address, size, data);
+	if (retval != ERROR_OK) {
+		free(data);
+		return retval;
+	}
+
+	*block = &snapshot->blocks[snapshot->num_blocks++];
+	(*block)->address = address;
+	(*block)->size = size;
+	(*block)->data = data;
+	return ERROR_OK;
+}
+
+int rtos_snapshot_prefetch(struct rtos *rtos, target_addr_t address, uint32_t size)
+{
+	struct rtos_snapshot_block *block = rtos_snapshot_find(&rtos->snapshot, address, size);
+
+	if (block || size == 0)
+		return ERROR_OK;
+
+	return rtos_snapshot_add(rtos, address, size, &block);
+}
+
+int rtos_snapshot_read(struct rtos *rtos, target_addr_t address, uint32_t size,
+		uint8_t *buffer)
+{
+	struct rtos_snapshot_block *block = rtos_snapshot_find(&rtos->snapshot, address, size);
+
+	if (!block) {
+		target_addr_t start = address & ~(target_addr_t)(RTOS_SNAPSHOT_BLOCK_SIZE - 1);
+		target_addr_t end = ALIGN_UP(address + size, RTOS_SNAPSHOT_BLOCK_SIZE);
+
+		/* the aligned block may run into unmapped memory; fall back to
+		 * the exact range */
+		if (rtos_snapshot_add(rtos, start, end - start, &block) != ERROR_OK) {
+			int retval = rtos_snapshot_add(rtos, address, size, &block);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+	}
+
+	memcpy(buffer, block->data + (address - block->address), size);
+	return ERROR_OK;
+}
+
+int rtos_snapshot_read_u32(struct rtos *rtos, target_addr_t address, uint32_t *value)
+{
+	uint8_t buf[4];
+	int retval = rtos_snapshot_read(rtos, address, sizeof(buf), buf);
+
+	if (retval == ERROR_OK)
+		*value = target_buffer_get_u32(rtos->target, buf);
+	return retval;
+}
+
+bool rtos_snapshot_unchanged(struct rtos *rtos, const void *key, size_t size)
+{
+	return rtos->thread_details && rtos->snapshot.key
+		&& rtos->snapshot.key_size == size
+		&& !memcmp(rtos->snapshot.key, key, size);
+}
+
+void rtos_snapshot_commit(struct rtos *rtos, const void *key, size_t size)
+{
+	free(rtos->snapshot.key);
+	rtos->snapshot.key = malloc(size);
+	rtos->snapshot.key_size = rtos->snapshot.key ? size : 0;
+	if (rtos->snapshot.key)
+		memcpy(rtos->snapshot.key, key, size);
 }
 
 int rtos_read_buffer(struct target *target, target_addr_t address,
@@ -44,6 +44,33 @@ struct thread_detail {
 	char *extra_info_str;
 };
 
+struct rtos_snapshot_block {
+	target_addr_t address;
+	uint32_t size;
+	uint8_t *data;
+};
+
+/**
+ * Target memory read in blocks while the thread list is updated, so that the
+ * RTOS data structures are parsed on the host instead of being walked with
+ * one target access per pointer.
+ */
+struct rtos_snapshot {
+	struct rtos_snapshot_block *blocks;
+	unsigned int num_blocks;
+	unsigned int max_blocks;
+	/** State of the RTOS the thread list was built from, or NULL */
+	uint8_t *key;
+	size_t key_size;
+};
+
+/** Registers of a thread, as returned by rtos_type::get_thread_reg_list */
+struct rtos_thread_regs {
+	threadid_t threadid;
+	struct rtos_reg *reg_list;
+	int num_regs;
+};
+
 struct rtos {
 	const struct rtos_type *type;
 
@@ -59,6 +86,10 @@ struct rtos {
 	int (*gdb_thread_packet)(struct connection *connection, char const *packet, int packet_size);
 	int (*gdb_target_for_threadid)(struct connection *connection, int64_t thread_id, struct target **p_target);
 	void *rtos_specific_params;
+	struct rtos_snapshot snapshot;
+	/* Registers of the threads GDB asked for since the target halted */
+	struct rtos_thread_regs *thread_regs;
+	unsigned int num_thread_regs;
 };
 
 struct rtos_reg {
@@ -132,6 +163,49 @@ int rtos_get_gdb_reg_list(struct connection *connection);
 int rtos_update_threads(struct target *target);
 void rtos_free_threadlist(struct rtos *rtos);
 int rtos_smp_init(struct target *target);
+
+/**
+ * Start a thread list update: forget the target memory read previously.
+ * rtos_update_threads() does it before calling the driver, and the snapshot
+ * is kept until the target resumes, so that the thread register reads of
+ * the same halt are served from it too.
+ */
+void rtos_snapshot_begin(struct rtos *rtos);
+/**
+ * Free the memory read from the target, done when the target resumes.
+ */
+void rtos_snapshot_end(struct rtos *rtos);
+/**
+ * Drop the snapshot and the thread registers of every RTOS after target
+ * memory was written or an algorithm ran while halted, so that the next
+ * accesses and the next thread list update read the memory again.
+ */
+void rtos_memory_changed(void);
+/**
+ * Read a range of target memory, e.g. an array of list heads, in a single
+ * access and keep it for the following rtos_snapshot_read() calls.
+ */
+int rtos_snapshot_prefetch(struct rtos *rtos, target_addr_t address, uint32_t size);
+/**
+ * Read target memory from the snapshot. Memory not read yet is fetched with
+ * the surrounding aligned block, so that neighbouring fields of the same
+ * structure come for free.
+ */
+int rtos_snapshot_read(struct rtos *rtos, target_addr_t address, uint32_t size,
+		uint8_t *buffer);
+int rtos_snapshot_read_u32(struct rtos *rtos, target_addr_t address, uint32_t *value);
+/**
+ * Check whether the current thread list was built from an RTOS in the state
+ * described by @a key, e.g. a thread count and a thread creation counter,
+ * in which case it can be kept instead of walking the RTOS lists again.
+ */
+bool rtos_snapshot_unchanged(struct rtos *rtos, const void *key, size_t size);
+/**
+ * Record the state of the RTOS the thread list has just been built from.
+ * rtos_free_threadlist() forgets it.
+ */
+void rtos_snapshot_commit(struct rtos *rtos, const void *key, size_t size);
+
 /*  function for handling symbol access */
 int rtos_qsymbol(struct connection *connection, char const *packet, int packet_size);
 int rtos_read_buffer(struct target *target, target_addr_t address,
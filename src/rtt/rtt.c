@@ -25,11 +25,22 @@
 
 #include <helper/log.h>
 #include <helper/list.h>
+#include <helper/time_support.h>
 #include <target/target.h>
 #include <target/rtt.h>
 
 #include "rtt.h"
 
+/* Lower bound of the polling interval with adaptive polling, in milliseconds. */
+#define RTT_MIN_POLLING_INTERVAL	1
+
+/* Per up-channel state. */
+struct rtt_channel_state {
+	/** Bytes read within the current throughput window. */
+	uint64_t window;
+	struct rtt_channel_stats stats;
+};
+
 static struct {
 	struct rtt_source source;
 	/** Control block. */
@@ -49,11 +60,26 @@ static struct {
 	bool changed;
 	/** Whether the control block was found. */
 	bool found_cb;
+	/** Whether a control block address hint is available. */
+	bool hint_valid;
+	/** Control block address hint, for example from the ELF symbol table. */
+	target_addr_t hint;
 
 	struct rtt_sink_list **sink_list;
 	size_t sink_list_length;
-
+	/** Bytes read from each up-channel during the last poll. */
+	size_t *lengths;
+	/** Per up-channel state, same length as the sink list. */
+	struct rtt_channel_state *channels;
+	/** Start of the current throughput window. */
+	int64_t window_start;
+
+	/** Configured polling interval in milliseconds. */
 	unsigned int polling_interval;
+	/** Polling interval currently in use, in milliseconds. */
+	unsigned int current_interval;
+	/** Whether the polling interval adapts to the data rate. */
+	bool adaptive_polling;
 } rtt;
 
 int rtt_init(void)
@@ -65,10 +91,19 @@ int rtt_init(void)
 	if (!rtt.sink_list)
 		return ERROR_FAIL;
 
+	rtt.lengths = calloc(rtt.sink_list_length, sizeof(size_t));
+	rtt.channels = calloc(rtt.sink_list_length,
+		sizeof(struct rtt_channel_state));
+
+	if (!rtt.lengths || !rtt.channels)
+		return ERROR_FAIL;
+
 	rtt.sink_list[0] = NULL;
 	rtt.started = false;
 
 	rtt.polling_interval = 100;
+	rtt.current_interval = rtt.polling_interval;
+	rtt.adaptive_polling = true;
 
 	return ERROR_OK;
 }
@@ -76,23 +111,89 @@ int rtt_init(void)
 int rtt_exit(void)
 {
 	free(rtt.sink_list);
+	free(rtt.lengths);
+	free(rtt.channels);
 
 	return ERROR_OK;
 }
 
+static int read_channel_callback(void *user_data);
+
+static void set_current_interval(unsigned int interval)
+{
+	if (interval == rtt.current_interval)
+		return;
+
+	rtt.current_interval = interval;
+
+	if (!rtt.started)
+		return;
+
+	target_unregister_timer_callback(&read_channel_callback, NULL);
+	target_register_timer_callback(&read_channel_callback, interval, 1, NULL);
+}
+
+static void update_statistics(bool *received)
+{
+	int64_t now = timeval_ms();
+	int64_t elapsed;
+
+	*received = false;
+
+	for (size_t i = 0; i < rtt.sink_list_length; i++) {
+		if (!rtt.lengths[i])
+			continue;
+
+		rtt.channels[i].stats.total += rtt.lengths[i];
+		rtt.channels[i].window += rtt.lengths[i];
+		*received = true;
+	}
+
+	elapsed = now - rtt.window_start;
+
+	if (elapsed < 1000)
+		return;
+
+	for (size_t i = 0; i < rtt.sink_list_length; i++) {
+		rtt.channels[i].stats.throughput =
+			rtt.channels[i].window * 1000 / elapsed;
+		rtt.channels[i].window = 0;
+	}
+
+	rtt.window_start = now;
+}
+
 static int read_channel_callback(void *user_data)
 {
 	int ret;
+	bool received;
 
 	ret = rtt.source.read(rtt.target, &rtt.ctrl, rtt.sink_list,
-		rtt.sink_list_length, NULL);
+		rtt.sink_list_length, rtt.lengths, NULL);
 
 	if (ret != ERROR_OK) {
 		target_unregister_timer_callback(&read_channel_callback, NULL);
 		rtt.source.stop(rtt.target, NULL);
+		rtt.started = false;
 		return ret;
 	}
 
+	update_statistics(&received);
+
+	if (!rtt.adaptive_polling)
+		return ERROR_OK;
+
+	/*
+	 * Poll faster while data is flowing, so that the target buffers do not
+	 * fill up, and back off to the configured interval once idle.
+	 */
+	if (received)
+		set_current_interval(MAX(RTT_MIN_POLLING_INTERVAL,
+			rtt.current_interval / 2));
+	else
+		set_current_interval(MIN(rtt.polling_interval,
+			rtt.current_interval * 2));
+
 	return ERROR_OK;
 }
 
@@ -114,6 +215,34 @@ int rtt_setup(target_addr_t address, size_t size, const char *id)
 	return ERROR_OK;
 }
 
+int rtt_set_address_hint(target_addr_t address)
+{
+	rtt.hint = address;
+	rtt.hint_valid = true;
+	rtt.changed = true;
+
+	return ERROR_OK;
+}
+
+static bool check_address_hint(void)
+{
+	int ret;
+	struct rtt_control ctrl;
+
+	ret = rtt.source.read_cb(rtt.target, rtt.hint, &ctrl, NULL);
+
+	if (ret != ERROR_OK)
+		return false;
+
+	if (strncmp(ctrl.id, rtt.id, sizeof(rtt.id)) != 0) {
+		LOG_INFO("rtt: No control block at hinted address 0x%"
+			TARGET_PRIxADDR ", searching", rtt.hint);
+		return false;
+	}
+
+	return true;
+}
+
 int rtt_register_source(const struct rtt_source source,
 		struct target *target)
 {
@@ -141,8 +270,13 @@ int rtt_start(void)
 		return ERROR_OK;
 
 	if (!rtt.found_cb || rtt.changed) {
-		rtt.source.find_cb(rtt.target, &addr, rtt.size, rtt.id,
-			&rtt.found_cb, NULL);
+		if (rtt.hint_valid && check_address_hint()) {
+			addr = rtt.hint;
+			rtt.found_cb = true;
+		} else {
+			rtt.source.find_cb(rtt.target, &addr, rtt.size, rtt.id,
+				&rtt.found_cb, NULL);
+		}
 
 		rtt.changed = false;
 
@@ -166,8 +300,14 @@ int rtt_start(void)
 	if (ret != ERROR_OK)
 		return ret;
 
+	for (size_t i = 0; i < rtt.sink_list_length; i++)
+		rtt.channels[i] = (struct rtt_channel_state){ 0 };
+
+	rtt.window_start = timeval_ms();
+	rtt.current_interval = rtt.polling_interval;
+
 	target_register_timer_callback(&read_channel_callback,
-		rtt.polling_interval, 1, NULL);
+		rtt.current_interval, 1, NULL);
 	rtt.started = true;
 
 	return ERROR_OK;
@@ -196,6 +336,8 @@ int rtt_stop(void)
 static int adjust_sink_list(size_t length)
 {
 	struct rtt_sink_list **tmp;
+	size_t *tmp_lengths;
+	struct rtt_channel_state *tmp_channels;
 
 	if (length <= rtt.sink_list_length)
 		return ERROR_OK;
@@ -205,10 +347,29 @@ static int adjust_sink_list(size_t length)
 	if (!tmp)
 		return ERROR_FAIL;
 
-	for (size_t i = rtt.sink_list_length; i < length; i++)
-		tmp[i] = NULL;
-
 	rtt.sink_list = tmp;
+
+	tmp_lengths = realloc(rtt.lengths, sizeof(size_t) * length);
+
+	if (!tmp_lengths)
+		return ERROR_FAIL;
+
+	rtt.lengths = tmp_lengths;
+
+	tmp_channels = realloc(rtt.channels,
+		sizeof(struct rtt_channel_state) * length);
+
+	if (!tmp_channels)
+		return ERROR_FAIL;
+
+	rtt.channels = tmp_channels;
+
+	for (size_t i = rtt.sink_list_length; i < length; i++) {
+		rtt.sink_list[i] = NULL;
+		rtt.lengths[i] = 0;
+		rtt.channels[i] = (struct rtt_channel_state){ 0 };
+	}
+
 	rtt.sink_list_length = length;
 
 	return ERROR_OK;
@@ -285,13 +446,39 @@ int rtt_set_polling_interval(unsigned int interval)
 	if (!interval)
 		return ERROR_FAIL;
 
-	if (rtt.polling_interval != interval) {
-		target_unregister_timer_callback(&read_channel_callback, NULL);
-		target_register_timer_callback(&read_channel_callback, interval, 1,
-			NULL);
+	rtt.polling_interval = interval;
+	set_current_interval(interval);
+
+	return ERROR_OK;
+}
+
+bool rtt_get_adaptive_polling(void)
+{
+	return rtt.adaptive_polling;
+}
+
+int rtt_set_adaptive_polling(bool enable)
+{
+	rtt.adaptive_polling = enable;
+
+	if (!enable)
+		set_current_interval(rtt.polling_interval);
+
+	return ERROR_OK;
+}
+
+int rtt_get_channel_stats(unsigned int channel_index,
+		struct rtt_channel_stats *stats)
+{
+	if (!stats)
+		return ERROR_FAIL;
+
+	if (channel_index >= rtt.sink_list_length) {
+		*stats = (struct rtt_channel_stats){ 0 };
+		return ERROR_OK;
 	}
 
-	rtt.polling_interval = interval;
+	*stats = rtt.channels[channel_index].stats;
 
 	return ERROR_OK;
 }
@@ -88,6 +88,14 @@ struct rtt_channel_info {
 	uint32_t flags;
 };
 
+/** RTT up-channel statistics. */
+struct rtt_channel_stats {
+	/** Number of bytes read since RTT was started. */
+	uint64_t total;
+	/** Throughput in bytes per second, averaged over the last second. */
+	uint32_t throughput;
+};
+
 typedef int (*rtt_sink_read)(unsigned int channel, const uint8_t *buffer,
 		size_t length, void *user_data);
 
@@ -121,7 +129,7 @@ typedef int (*rtt_source_start)(struct target *target,
 typedef int (*rtt_source_stop)(struct target *target, void *user_data);
 typedef int (*rtt_source_read)(struct target *target,
 		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data);
+		size_t num_channels, size_t *lengths, void *user_data);
 typedef int (*rtt_source_write)(struct target *target,
 		struct rtt_control *ctrl, unsigned int channel,
 		const uint8_t *buffer, size_t *length, void *user_data);
@@ -173,6 +181,18 @@ int rtt_register_source(const struct rtt_source source,
  */
 int rtt_setup(target_addr_t address, size_t size, const char *id);
 
+/**
+ * Set the expected control block address.
+ *
+ * When RTT is started, the control block is first looked for at this address
+ * and the search area is only scanned if it is not there.
+ *
+ * @param[in] address Expected control block address.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_set_address_hint(target_addr_t address);
+
 /**
  * Start Real-Time Transfer (RTT).
  *
@@ -205,6 +225,37 @@ int rtt_get_polling_interval(unsigned int *interval);
  */
 int rtt_set_polling_interval(unsigned int interval);
 
+/**
+ * Get whether adaptive polling is enabled.
+ *
+ * @returns Whether adaptive polling is enabled.
+ */
+bool rtt_get_adaptive_polling(void);
+
+/**
+ * Enable or disable adaptive polling.
+ *
+ * With adaptive polling enabled, the polling interval is reduced while data
+ * is received and increased up to the configured polling interval again when
+ * the up-channels are idle.
+ *
+ * @param[in] enable Whether adaptive polling is enabled.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_set_adaptive_polling(bool enable);
+
+/**
+ * Get the statistics of an up-channel.
+ *
+ * @param[in] channel_index Channel index.
+ * @param[out] stats Channel statistics.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_get_channel_stats(unsigned int channel_index,
+		struct rtt_channel_stats *stats);
+
 /**
  * Get whether RTT is started.
  *
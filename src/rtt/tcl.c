@@ -20,12 +20,16 @@
 #endif
 
 #include <helper/log.h>
+#include <target/image.h>
 #include <target/rtt.h>
 
 #include "rtt.h"
 
 #define CHANNEL_NAME_SIZE	128
 
+/* Default symbol name of the SEGGER RTT control block. */
+#define DEFAULT_CB_SYMBOL	"_SEGGER_RTT"
+
 COMMAND_HANDLER(handle_rtt_setup_command)
 {
 struct rtt_source source;
@@ -55,6 +59,38 @@ struct rtt_source source;
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_rtt_symbol_command)
+{
+	int ret;
+	struct image image;
+	target_addr_t address;
+	const char *symbol = DEFAULT_CB_SYMBOL;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 2)
+		symbol = CMD_ARGV[1];
+
+	ret = image_open(&image, CMD_ARGV[0], "elf");
+
+	if (ret != ERROR_OK)
+		return ret;
+
+	ret = image_find_symbol(&image, symbol, &address);
+	image_close(&image);
+
+	if (ret != ERROR_OK) {
+		command_print(CMD, "Symbol '%s' not found", symbol);
+		return ret;
+	}
+
+	command_print(CMD, "rtt: Control block expected at 0x%" TARGET_PRIxADDR,
+		address);
+
+	return rtt_set_address_hint(address);
+}
+
 COMMAND_HANDLER(handle_rtt_start_command)
 {
 	if (CMD_ARGC > 0)
@@ -108,6 +144,24 @@ COMMAND_HANDLER(handle_rtt_polling_interval_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_rtt_adaptive_polling_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		rtt_set_adaptive_polling(enable);
+	}
+
+	command_print(CMD, "adaptive polling is %s",
+		rtt_get_adaptive_polling() ? "on" : "off");
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_rtt_channels_command)
 {
 	int ret;
@@ -158,6 +212,23 @@ COMMAND_HANDLER(handle_rtt_channels_command)
 			info.flags);
 	}
 
+	command_print(CMD, "Up-channel throughput:");
+
+	for (unsigned int i = 0; i < ctrl->num_up_channels; i++) {
+		struct rtt_channel_stats stats;
+
+		ret = rtt_get_channel_stats(i, &stats);
+
+		if (ret != ERROR_OK)
+			return ret;
+
+		if (!stats.total)
+			continue;
+
+		command_print(CMD, "%u: %" PRIu64 " bytes, %" PRIu32 " bytes/s", i,
+			stats.total, stats.throughput);
+	}
+
 	return ERROR_OK;
 }
 
@@ -265,6 +336,13 @@ static const struct command_registration rtt_subcommand_handlers[] = {
 		.help = "setup RTT",
 		.usage = "<address> <size> <ID>"
 	},
+	{
+		.name = "symbol",
+		.handler = handle_rtt_symbol_command,
+		.mode = COMMAND_ANY,
+		.help = "take the control block address from an ELF symbol",
+		.usage = "<elf_file> [symbol]"
+	},
 	{
 		.name = "start",
 		.handler = handle_rtt_start_command,
@@ -286,6 +364,13 @@ static const struct command_registration rtt_subcommand_handlers[] = {
 		.help = "show or set polling interval in ms",
 		.usage = "[interval]"
 	},
+	{
+		.name = "adaptive_polling",
+		.handler = handle_rtt_adaptive_polling_command,
+		.mode = COMMAND_ANY,
+		.help = "show or set adaptive polling",
+		.usage = "[on|off]"
+	},
 	{
 		.name = "channels",
 		.handler = handle_rtt_channels_command,
@@ -49,6 +49,8 @@
 #include "gdb_server.h"
 #include <target/image.h>
 #include <jtag/jtag.h>
+#include <helper/crc32.h>
+#include <helper/list.h>
 #include "rtos/rtos.h"
 #include "target/smp.h"
 
@@ -68,14 +70,31 @@ enum gdb_output_flag {
 	GDB_OUTPUT_ALL,
 };
 
-struct target_desc_format {
-	char *tdesc;
-	uint32_t tdesc_length;
+/* XML document generated for GDB, together with a CRC of the target state
+ * it was generated from. The document is rebuilt when that CRC changes. */
+struct gdb_xml_doc {
+	char *xml;
+	int length;
+	uint32_t fingerprint;
+};
+
+/* target description and memory map, cached per target */
+struct gdb_xml_cache {
+	struct target *target;
+	struct gdb_xml_doc tdesc;
+	struct gdb_xml_doc memory_map;
+	struct list_head lh;
 };
 
 /* private connection data for GDB */
 struct gdb_connection {
 	char buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
+	/* received packet, GDB_BUFFER_SIZE + 1 bytes (extra byte for null-termination) */
+	char *packet_buffer;
+	/* scratch memory for memory packets, grown on demand and reused for
+	 * every packet instead of allocating per packet */
+	uint8_t *arena;
+	size_t arena_size;
 	char *buf_p;
 	int buf_cnt;
 	bool ctrl_c;
@@ -100,8 +119,6 @@ struct gdb_connection {
 	bool attached;
 	/* set when extended protocol is used */
 	bool extended_protocol;
-	/* temporarily used for target description support */
-	struct target_desc_format target_desc;
 	/* temporarily used for thread list support */
 	char *thread_list;
 	/* flag to mask the output from gdb_log_callback() */
@@ -114,6 +131,8 @@ struct gdb_connection {
 
 static struct gdb_connection *current_gdb_connection;
 
+static LIST_HEAD(gdb_xml_cache_list);
+
 static int gdb_breakpoint_override;
 static enum breakpoint_type gdb_breakpoint_override_type;
 
@@ -1014,10 +1033,17 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->mem_write_error = false;
 	gdb_connection->attached = true;
 	gdb_connection->extended_protocol = false;
-	gdb_connection->target_desc.tdesc = NULL;
-	gdb_connection->target_desc.tdesc_length = 0;
 	gdb_connection->thread_list = NULL;
 	gdb_connection->output_flag = GDB_OUTPUT_NO;
+	gdb_connection->arena = NULL;
+	gdb_connection->arena_size = 0;
+	gdb_connection->packet_buffer = malloc(GDB_BUFFER_SIZE + 1);
+	if (!gdb_connection->packet_buffer) {
+		LOG_ERROR("Out of memory");
+		free(gdb_connection);
+		connection->priv = NULL;
+		return ERROR_FAIL;
+	}
 
 	/* send ACK to GDB for debug request */
 	gdb_write(connection, "+", 1);
@@ -1135,6 +1161,8 @@ static int gdb_connection_closed(struct connection *connection)
 	/* if this connection registered a debug-message receiver delete it */
 	delete_debug_msg_receiver(connection->cmd_ctx, target);
 
+	free(gdb_connection->packet_buffer);
+	free(gdb_connection->arena);
 	free(connection->priv);
 	connection->priv = NULL;
 
@@ -1492,6 +1520,25 @@ static int gdb_error(struct connection *connection, int retval)
 	return ERROR_OK;
 }
 
+/* Return at least size bytes of scratch memory owned by the connection. The
+ * memory is only valid until the next call. */
+static void *gdb_arena_get(struct connection *connection, size_t size)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+
+	if (size > gdb_con->arena_size) {
+		uint8_t *arena = realloc(gdb_con->arena, size);
+		if (!arena) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		gdb_con->arena = arena;
+		gdb_con->arena_size = size;
+	}
+
+	return gdb_con->arena;
+}
+
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
  */
@@ -1526,7 +1573,11 @@ static int gdb_read_memory_packet(struct connection *connection,
 		return ERROR_OK;
 	}
 
-	buffer = malloc(len);
+	/* the reply is hexified in front of the binary data, both in the arena */
+	hex_buffer = gdb_arena_get(connection, (size_t)len * 3 + 1);
+	if (!hex_buffer)
+		return gdb_error(connection, ERROR_FAIL);
+	buffer = (uint8_t *)hex_buffer + (size_t)len * 2 + 1;
 
 	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1555,18 +1606,12 @@ static int gdb_read_memory_packet(struct connection *connection,
 	}
 
 	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
-
 		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
 
 		gdb_put_packet(connection, hex_buffer, pkt_len);
-
-		free(hex_buffer);
 	} else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
-
 	return retval;
 }
 
@@ -1598,7 +1643,9 @@ static int gdb_write_memory_packet(struct connection *connection,
 		return ERROR_SERVER_REMOTE_CLOSED;
 	}
 
-	buffer = malloc(len);
+	buffer = gdb_arena_get(connection, len);
+	if (!buffer)
+		return gdb_error(connection, ERROR_FAIL);
 
 	LOG_DEBUG("addr: 0x%" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1616,8 +1663,6 @@ static int gdb_write_memory_packet(struct connection *connection,
 	else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
-
 	return retval;
 }
 
@@ -1825,34 +1870,39 @@ static __attribute__ ((format (PRINTF_ATTRIBUTE_FORMAT, 5, 6))) void xml_printf(
 {
 	if (*retval != ERROR_OK)
 		return;
-	int first = 1;
 
 	for (;; ) {
-		if ((!*xml) || (!first)) {
-			/* start by 0 to exercise all the code paths.
-			 * Need minimum 2 bytes to fit 1 char and 0 terminator. */
-
-			*size = *size * 2 + 2;
-			char *t = *xml;
-			*xml = realloc(*xml, *size);
-			if (!*xml) {
-				free(t);
-				*retval = ERROR_SERVER_REMOTE_CLOSED;
+		int needed = 4096;
+
+		if (*xml) {
+			va_list ap;
+			int ret;
+			va_start(ap, fmt);
+			ret = vsnprintf(*xml + *pos, *size - *pos, fmt, ap);
+			va_end(ap);
+			if (ret < 0) {
+				*retval = ERROR_FAIL;
 				return;
 			}
+			if (ret < *size - *pos) {
+				*pos += ret;
+				return;
+			}
+			/* not enough space, vsnprintf() told us how much is needed */
+			needed = *pos + ret + 1;
 		}
 
-		va_list ap;
-		int ret;
-		va_start(ap, fmt);
-		ret = vsnprintf(*xml + *pos, *size - *pos, fmt, ap);
-		va_end(ap);
-		if ((ret > 0) && ((ret + 1) < *size - *pos)) {
-			*pos += ret;
+		/* grow geometrically, so a document needs few reallocations */
+		int new_size = MAX(*size * 2, needed);
+		char *t = realloc(*xml, new_size);
+		if (!t) {
+			free(*xml);
+			*xml = NULL;
+			*retval = ERROR_SERVER_REMOTE_CLOSED;
 			return;
 		}
-		/* there was just enough or not enough space, allocate more. */
-		first = 0;
+		*xml = t;
+		*size = new_size;
 	}
 }
 
@@ -1897,42 +1947,59 @@ static int compare_bank(const void *a, const void *b)
 		return -1;
 }
 
-static int gdb_memory_map(struct connection *connection,
-		char const *packet, int packet_size)
+static struct gdb_xml_cache *gdb_xml_cache_get(struct target *target)
 {
-	/* We get away with only specifying flash here. Regions that are not
-	 * specified are treated as if we provided no memory map(if not we
-	 * could detect the holes and mark them as RAM).
-	 * Normally we only execute this code once, but no big deal if we
-	 * have to regenerate it a couple of times.
-	 */
+	struct gdb_xml_cache *cache;
 
-	struct target *target = get_target_from_connection(connection);
-	struct flash_bank *p;
-	char *xml = NULL;
-	int size = 0;
-	int pos = 0;
-	int retval = ERROR_OK;
-	struct flash_bank **banks;
-	int offset;
-	int length;
-	char *separator;
-	target_addr_t ram_start = 0;
-	unsigned int target_flash_banks = 0;
+	list_for_each_entry(cache, &gdb_xml_cache_list, lh)
+		if (cache->target == target)
+			return cache;
 
-	/* skip command character */
-	packet += 23;
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		LOG_ERROR("Out of memory");
+		return NULL;
+	}
 
-	offset = strtoul(packet, &separator, 16);
-	length = strtoul(separator + 1, &separator, 16);
+	cache->target = target;
+	list_add_tail(&cache->lh, &gdb_xml_cache_list);
 
-	xml_printf(&retval, &xml, &pos, &size, "<memory-map>\n");
+	return cache;
+}
 
-	/* Sort banks in ascending order.  We need to report non-flash
-	 * memory as ram (or rather read/write) by default for GDB, since
-	 * it has no concept of non-cacheable read/write memory (i/o etc).
-	 */
-	banks = malloc(sizeof(struct flash_bank *)*flash_get_bank_count());
+static void gdb_xml_doc_set(struct gdb_xml_doc *doc, char *xml, int length,
+		uint32_t fingerprint)
+{
+	free(doc->xml);
+	doc->xml = xml;
+	doc->length = length;
+	doc->fingerprint = fingerprint;
+}
+
+static void gdb_xml_cache_free_all(void)
+{
+	struct gdb_xml_cache *cache, *tmp;
+
+	list_for_each_entry_safe(cache, tmp, &gdb_xml_cache_list, lh) {
+		list_del(&cache->lh);
+		free(cache->tdesc.xml);
+		free(cache->memory_map.xml);
+		free(cache);
+	}
+}
+
+/* Collect the (probed) flash banks of a target, sorted in ascending order. */
+static int gdb_get_flash_banks(struct target *target,
+		struct flash_bank ***banks_out, unsigned int *num_banks)
+{
+	struct flash_bank **banks;
+	struct flash_bank *p;
+	unsigned int target_flash_banks = 0;
+	int retval;
+
+	banks = malloc(sizeof(struct flash_bank *) * MAX(flash_get_bank_count(), 1u));
+	if (!banks)
+		return ERROR_FAIL;
 
 	for (unsigned int i = 0; i < flash_get_bank_count(); i++) {
 		p = get_flash_bank_by_num_noprobe(i);
@@ -1941,7 +2008,6 @@ static int gdb_memory_map(struct connection *connection,
 		retval = get_flash_bank_by_num(i, &p);
 		if (retval != ERROR_OK) {
 			free(banks);
-			gdb_error(connection, retval);
 			return retval;
 		}
 		banks[target_flash_banks++] = p;
@@ -1950,6 +2016,58 @@ static int gdb_memory_map(struct connection *connection,
 	qsort(banks, target_flash_banks, sizeof(struct flash_bank *),
 		compare_bank);
 
+	*banks_out = banks;
+	*num_banks = target_flash_banks;
+
+	return ERROR_OK;
+}
+
+/* CRC over everything the memory map is generated from */
+static uint32_t gdb_memory_map_fingerprint(struct target *target,
+		struct flash_bank **banks, unsigned int num_banks)
+{
+	target_addr_t address_max = target_address_max(target);
+	uint32_t crc = crc32_update(CRC32_INIT, &address_max, sizeof(address_max));
+
+	for (unsigned int i = 0; i < num_banks; i++) {
+		struct flash_bank *p = banks[i];
+
+		crc = crc32_update(crc, &p->base, sizeof(p->base));
+		crc = crc32_update(crc, &p->size, sizeof(p->size));
+		crc = crc32_update(crc, &p->num_sectors, sizeof(p->num_sectors));
+
+		for (unsigned int j = 0; j < p->num_sectors; j++) {
+			crc = crc32_update(crc, &p->sectors[j].offset,
+				sizeof(p->sectors[j].offset));
+			crc = crc32_update(crc, &p->sectors[j].size,
+				sizeof(p->sectors[j].size));
+		}
+	}
+
+	return crc;
+}
+
+static int gdb_generate_memory_map(struct target *target,
+		struct flash_bank **banks, unsigned int target_flash_banks,
+		char **xml_out, int *length_out)
+{
+	/* We get away with only specifying flash here. Regions that are not
+	 * specified are treated as if we provided no memory map(if not we
+	 * could detect the holes and mark them as RAM).
+	 */
+	struct flash_bank *p;
+	char *xml = NULL;
+	int size = 0;
+	int pos = 0;
+	int retval = ERROR_OK;
+	target_addr_t ram_start = 0;
+
+	xml_printf(&retval, &xml, &pos, &size, "<memory-map>\n");
+
+	/* The banks are sorted in ascending order.  We need to report non-flash
+	 * memory as ram (or rather read/write) by default for GDB, since
+	 * it has no concept of non-cacheable read/write memory (i/o etc).
+	 */
 	for (unsigned int i = 0; i < target_flash_banks; i++) {
 		unsigned sector_size = 0;
 		unsigned group_len = 0;
@@ -2021,26 +2139,92 @@ static int gdb_memory_map(struct connection *connection,
 	/* ELSE a flash chip could be at the very end of the address space, in
 	 * which case ram_start will be precisely 0 */
 
-	free(banks);
-
 	xml_printf(&retval, &xml, &pos, &size, "</memory-map>\n");
 
 	if (retval != ERROR_OK) {
 		free(xml);
-		gdb_error(connection, retval);
 		return retval;
 	}
 
-	if (offset + length > pos)
-		length = pos - offset;
+	*xml_out = xml;
+	*length_out = pos;
+
+	return ERROR_OK;
+}
+
+static int gdb_memory_map(struct connection *connection,
+		char const *packet, int packet_size)
+{
+	/* The memory map is cached per target and only regenerated when the
+	 * flash bank layout changed, e.g. after probing.
+	 */
+	struct target *target = get_target_from_connection(connection);
+	struct gdb_xml_cache *cache;
+	int retval;
+	int offset;
+	int length;
+	char *separator;
+
+	/* skip command character */
+	packet += 23;
+
+	offset = strtoul(packet, &separator, 16);
+	length = strtoul(separator + 1, &separator, 16);
+
+	cache = gdb_xml_cache_get(target);
+	if (!cache) {
+		gdb_error(connection, ERROR_FAIL);
+		return ERROR_FAIL;
+	}
+
+	/* validate the cached document when a new transfer starts */
+	if (offset == 0 || !cache->memory_map.xml) {
+		struct flash_bank **banks;
+		unsigned int num_banks;
+		uint32_t fingerprint;
+
+		retval = gdb_get_flash_banks(target, &banks, &num_banks);
+		if (retval != ERROR_OK) {
+			gdb_error(connection, retval);
+			return retval;
+		}
+
+		fingerprint = gdb_memory_map_fingerprint(target, banks, num_banks);
+
+		if (!cache->memory_map.xml || cache->memory_map.fingerprint != fingerprint) {
+			char *xml;
+			int xml_length;
+
+			retval = gdb_generate_memory_map(target, banks, num_banks,
+					&xml, &xml_length);
+			if (retval != ERROR_OK) {
+				free(banks);
+				gdb_error(connection, retval);
+				return retval;
+			}
+
+			gdb_xml_doc_set(&cache->memory_map, xml, xml_length, fingerprint);
+		}
+
+		free(banks);
+	}
+
+	if (offset > cache->memory_map.length)
+		offset = cache->memory_map.length;
+
+	if (offset + length > cache->memory_map.length)
+		length = cache->memory_map.length - offset;
 
 	char *t = malloc(length + 1);
+	if (!t) {
+		gdb_error(connection, ERROR_FAIL);
+		return ERROR_FAIL;
+	}
 	t[0] = 'l';
-	memcpy(t + 1, xml + offset, length);
+	memcpy(t + 1, cache->memory_map.xml + offset, length);
 	gdb_put_packet(connection, t, length + 1);
 
 	free(t);
-	free(xml);
 	return ERROR_OK;
 }
 
@@ -2543,27 +2727,101 @@ error:
 	return retval;
 }
 
-static int gdb_get_target_description_chunk(struct target *target, struct target_desc_format *target_desc,
+/* CRC over everything the target description is generated from */
+static int gdb_target_description_fingerprint(struct target *target,
+		uint32_t *fingerprint)
+{
+	struct reg **reg_list = NULL;
+	int reg_list_size;
+	char const *architecture = target_get_gdb_arch(target);
+	uint32_t crc = CRC32_INIT;
+
+	int retval = smp_reg_list_noread(target, &reg_list, &reg_list_size,
+			REG_CLASS_ALL);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (architecture)
+		crc = crc32_update(crc, architecture, strlen(architecture));
+
+	for (int i = 0; i < reg_list_size; i++) {
+		const struct reg *reg = reg_list[i];
+		struct {
+			const void *reg;
+			const void *feature;
+			const void *data_type;
+			const void *group;
+			uint32_t number;
+			uint32_t size;
+			bool exist;
+			bool hidden;
+			bool caller_save;
+		} key;
+
+		/* clear the padding, it is part of the CRC */
+		memset(&key, 0, sizeof(key));
+		key.reg = reg;
+		key.feature = reg->feature;
+		key.data_type = reg->reg_data_type;
+		key.group = reg->group;
+		key.number = reg->number;
+		key.size = reg->size;
+		key.exist = reg->exist;
+		key.hidden = reg->hidden;
+		key.caller_save = reg->caller_save;
+
+		crc = crc32_update(crc, &key, sizeof(key));
+		crc = crc32_update(crc, reg->name, strlen(reg->name));
+	}
+
+	free(reg_list);
+
+	*fingerprint = crc;
+
+	return ERROR_OK;
+}
+
+static int gdb_get_target_description_chunk(struct target *target,
 		char **chunk, int32_t offset, uint32_t length)
 {
-	if (!target_desc) {
+	struct gdb_xml_cache *cache = gdb_xml_cache_get(target);
+
+	if (!cache) {
 		LOG_ERROR("Unable to Generate Target Description");
 		return ERROR_FAIL;
 	}
 
-	char *tdesc = target_desc->tdesc;
-	uint32_t tdesc_length = target_desc->tdesc_length;
+	/* The description is cached per target. It is validated when a new
+	 * transfer starts and only regenerated if the register list changed.
+	 */
+	if (offset == 0 || !cache->tdesc.xml) {
+		uint32_t fingerprint;
 
-	if (!tdesc) {
-		int retval = gdb_generate_target_description(target, &tdesc);
+		int retval = gdb_target_description_fingerprint(target, &fingerprint);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("Unable to Generate Target Description");
 			return ERROR_FAIL;
 		}
 
-		tdesc_length = strlen(tdesc);
+		if (!cache->tdesc.xml || cache->tdesc.fingerprint != fingerprint) {
+			char *tdesc;
+
+			retval = gdb_generate_target_description(target, &tdesc);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Unable to Generate Target Description");
+				return ERROR_FAIL;
+			}
+
+			gdb_xml_doc_set(&cache->tdesc, tdesc, strlen(tdesc), fingerprint);
+		}
 	}
 
+	const char *tdesc = cache->tdesc.xml;
+	uint32_t tdesc_length = cache->tdesc.length;
+
+	if (offset < 0 || (uint32_t)offset > tdesc_length)
+		offset = tdesc_length;
+
 	char transfer_type;
 
 	if (length < (tdesc_length - offset))
@@ -2584,16 +2842,8 @@ static int gdb_get_target_description_chunk(struct target *target, struct target
 	} else {
 		strncpy((*chunk) + 1, tdesc + offset, tdesc_length - offset);
 		(*chunk)[1 + (tdesc_length - offset)] = '\0';
-
-		/* After gdb-server sends out last chunk, invalidate tdesc. */
-		free(tdesc);
-		tdesc = NULL;
-		tdesc_length = 0;
 	}
 
-	target_desc->tdesc = tdesc;
-	target_desc->tdesc_length = tdesc_length;
-
 	return ERROR_OK;
 }
 
@@ -2920,8 +3170,7 @@ static int gdb_query_packet(struct connection *connection,
 		 * there are *more* chunks to transfer. 'l' for it is the *last*
 		 * chunk of target description.
 		 */
-		retval = gdb_get_target_description_chunk(target, &gdb_connection->target_desc,
-				&xml, offset, length);
+		retval = gdb_get_target_description_chunk(target, &xml, offset, length);
 		if (retval != ERROR_OK) {
 			gdb_error(connection, retval);
 			return retval;
@@ -3489,14 +3738,12 @@ static void gdb_sig_halted(struct connection *connection)
 
 static int gdb_input_inner(struct connection *connection)
 {
-	/* Do not allocate this on the stack */
-	static char gdb_packet_buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
-
+	struct gdb_connection *gdb_con = connection->priv;
+	char *gdb_packet_buffer = gdb_con->packet_buffer;
 	struct target *target;
 	char const *packet = gdb_packet_buffer;
 	int packet_size;
 	int retval;
-	struct gdb_connection *gdb_con = connection->priv;
 	static bool warn_use_ext;
 
 	target = get_target_from_connection(connection);
@@ -4104,4 +4351,5 @@ void gdb_service_free(void)
 {
 	free(gdb_port);
 	free(gdb_port_next);
+	gdb_xml_cache_free_all();
 }
@@ -45,6 +45,10 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 static struct service *services;
 
 enum shutdown_reason {
@@ -64,6 +68,46 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll instance watching all service and connection fds, or -1 when
+ * server_loop() has to fall back to select() */
+static int epoll_fd = -1;
+#endif
+
+/* Start watching fd for input; the event loop sets *ready when it fires. */
+static void server_watch_fd(int fd, bool *ready)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd == -1 || fd < 0)
+		return;
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = ready,
+	};
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		/* e.g. stdin redirected from a regular file, which epoll rejects */
+		LOG_DEBUG("epoll_ctl() failed on fd %d (%s), falling back to select()",
+			fd, strerror(errno));
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+#endif
+}
+
+static void server_unwatch_fd(int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd == -1 || fd < 0)
+		return;
+
+	/* the event argument is ignored but must be non-NULL on old kernels */
+	struct epoll_event ev = { 0 };
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+}
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -78,6 +122,7 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	c->cmd_ctx = copy_command_context(cmd_ctx);
 	c->service = service;
 	c->input_pending = false;
+	c->fd_ready = false;
 	c->priv = NULL;
 	c->next = NULL;
 
@@ -152,6 +197,11 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		}
 	}
 
+	/* pipes hand their fd over from the service to the connection */
+	if (service->type != CONNECTION_TCP)
+		server_unwatch_fd(c->fd);
+	server_watch_fd(c->fd, &c->fd_ready);
+
 	/* add to the end of linked list */
 	for (p = &service->connections; *p; p = &(*p)->next)
 		;
@@ -172,11 +222,13 @@ static int remove_connection(struct service *service, struct connection *connect
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
 			service->connection_closed(c);
+			server_unwatch_fd(c->fd);
 			if (service->type == CONNECTION_TCP)
 				close_socket(c->fd);
 			else if (service->type == CONNECTION_PIPE) {
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
+				server_watch_fd(c->fd, &c->service->fd_ready);
 			}
 
 			command_done(c->cmd_ctx);
@@ -218,6 +270,7 @@ int add_service(const struct service_driver *driver, const char *port,
 	c->port = strdup(port);
 	c->max_connections = 1;	/* Only TCP/IP ports can support more than one connection */
 	c->fd = -1;
+	c->fd_ready = false;
 	c->connections = NULL;
 	c->new_connection_during_keep_alive = driver->new_connection_during_keep_alive_handler;
 	c->new_connection = driver->new_connection_handler;
@@ -339,6 +392,8 @@ int add_service(const struct service_driver *driver, const char *port,
 #endif
 	}
 
+	server_watch_fd(c->fd, &c->fd_ready);
+
 	/* add to the end of linked list */
 	for (p = &services; *p; p = &(*p)->next)
 		;
@@ -378,6 +433,7 @@ int remove_service(const char *name, const char *port)
 			else
 				prev->next = tmp->next;
 
+			server_unwatch_fd(tmp->fd);
 			if (tmp->type != CONNECTION_STDINOUT)
 				close_socket(tmp->fd);
 
@@ -403,6 +459,7 @@ static int remove_services(void)
 
 		free(c->name);
 
+		server_unwatch_fd(c->fd);
 		if (c->type == CONNECTION_PIPE) {
 			if (c->fd != -1)
 				close(c->fd);
@@ -429,103 +486,147 @@ void server_keep_clients_alive(void)
 				s->keep_client_alive(c);
 }
 
-int server_loop(struct command_context *command_context)
+/* Wait for input with select(), rebuilding the fd set from the service list.
+ * Returns the number of ready fds, 0 on timeout or signal, -1 on error. */
+static int server_wait_select(int timeout_ms)
 {
-	struct service *service;
+	fd_set read_fds;
+	int fd_max = 0;
+	int retval;
 
-	bool poll_ok = true;
+	FD_ZERO(&read_fds);
 
-	/* used in select() */
-	fd_set read_fds;
-	int fd_max;
+	/* add service and connection fds to read_fds */
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1) {
+			/* listen for new connections */
+			FD_SET(service->fd, &read_fds);
 
-	/* used in accept() */
-	int retval;
+			if (service->fd > fd_max)
+				fd_max = service->fd;
+		}
 
-	int64_t next_event = timeval_ms() + polling_period;
+		for (struct connection *c = service->connections; c; c = c->next) {
+			/* check for activity on the connection */
+			FD_SET(c->fd, &read_fds);
+			if (c->fd > fd_max)
+				fd_max = c->fd;
+		}
+	}
 
-#ifndef _WIN32
-	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
-		LOG_ERROR("couldn't set SIGPIPE to SIG_IGN");
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+
+	if (retval == -1) {
+#ifdef _WIN32
+		errno = WSAGetLastError();
+
+		if (errno == WSAEINTR)
+			return 0;
+#else
+		if (errno == EINTR)
+			return 0;
 #endif
+		LOG_ERROR("error during select: %s", strerror(errno));
+		return -1;
+	}
 
-	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
+	/* eCos leaves read_fds unchanged on timeout */
+	if (retval == 0)
+		return 0;
 
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next) {
-			if (service->fd != -1) {
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1 && FD_ISSET(service->fd, &read_fds))
+			service->fd_ready = true;
 
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
+		for (struct connection *c = service->connections; c; c = c->next)
+			if (FD_ISSET(c->fd, &read_fds))
+				c->fd_ready = true;
+	}
 
-			if (service->connections) {
-				struct connection *c;
+	return retval;
+}
 
-				for (c = service->connections; c; c = c->next) {
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
-				}
-			}
-		}
+#ifdef HAVE_SYS_EPOLL_H
+/* Wait for input on the fds registered by server_watch_fd().
+ * Returns the number of ready fds, 0 on timeout or signal, -1 on error. */
+static int server_wait_epoll(int timeout_ms)
+{
+	struct epoll_event events[16];
+
+	int retval = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), timeout_ms);
+	if (retval == -1) {
+		if (errno == EINTR)
+			return 0;
+		LOG_ERROR("error during epoll_wait: %s", strerror(errno));
+		return -1;
+	}
 
-		struct timeval tv;
-		tv.tv_sec = 0;
-		if (poll_ok) {
-			/* we're just polling this iteration, this is faster on embedded
-			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
-		} else {
-			/* Every 100ms, can be changed with "poll_period" command */
-			int timeout_ms = next_event - timeval_ms();
-			if (timeout_ms < 0)
-				timeout_ms = 0;
-			else if (timeout_ms > polling_period)
-				timeout_ms = polling_period;
-			tv.tv_usec = timeout_ms * 1000;
-			/* Only while we're sleeping we'll let others run */
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
-		}
+	for (int i = 0; i < retval; i++) {
+		bool *ready = events[i].data.ptr;
+		*ready = true;
+	}
 
-		if (retval == -1) {
-#ifdef _WIN32
+	return retval;
+}
+#endif
+
+/* How long server_loop() may sleep: until the next timer callback is due,
+ * but never longer than the polling period. */
+static int server_wait_timeout(void)
+{
+	for (struct service *service = services; service; service = service->next)
+		for (struct connection *c = service->connections; c; c = c->next)
+			if (c->input_pending)
+				return 0;
 
-			errno = WSAGetLastError();
+	int64_t timeout_ms = target_timer_next_event() - timeval_ms();
+	if (timeout_ms < 0)
+		return 0;
+	if (timeout_ms > polling_period)
+		return polling_period;
+	return timeout_ms;
+}
 
-			if (errno == WSAEINTR)
-				FD_ZERO(&read_fds);
-			else {
-				LOG_ERROR("error during select: %s", strerror(errno));
-				return ERROR_FAIL;
-			}
-#else
+int server_loop(struct command_context *command_context)
+{
+	struct service *service;
 
-			if (errno == EINTR)
-				FD_ZERO(&read_fds);
-			else {
-				LOG_ERROR("error during select: %s", strerror(errno));
-				return ERROR_FAIL;
-			}
+	bool poll_ok = true;
+
+	int retval;
+
+#ifndef _WIN32
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		LOG_ERROR("couldn't set SIGPIPE to SIG_IGN");
 #endif
-		}
+
+	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
+		/* we're just polling if there was something to do last iteration,
+		 * this is faster on embedded hosts; otherwise only while we're
+		 * sleeping we'll let others run */
+		int timeout_ms = poll_ok ? 0 : server_wait_timeout();
+
+#ifdef HAVE_SYS_EPOLL_H
+		if (epoll_fd != -1)
+			retval = server_wait_epoll(timeout_ms);
+		else
+#endif
+			retval = server_wait_select(timeout_ms);
+
+		if (retval == -1)
+			return ERROR_FAIL;
+
+		/* Timer callbacks run when their deadline has passed, whether or
+		 * not there was socket activity in the meantime. */
+		if (timeval_ms() >= target_timer_next_event())
+			target_call_timer_callbacks();
 
 		if (retval == 0) {
-			/* We only execute these callbacks when there was nothing to do or we timed
-			 *out */
-			target_call_timer_callbacks_now();
-			next_event = target_timer_next_event();
 			process_jim_events(command_context);
 
-			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
-
 			/* We timed out/there was nothing to do, timeout rather than poll next time
 			 **/
 			poll_ok = false;
@@ -543,8 +644,11 @@ int server_loop(struct command_context *command_context)
 
 		for (service = services; service; service = service->next) {
 			/* handle new connections on listeners */
-			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds))) {
+			if (service->fd_ready) {
+				service->fd_ready = false;
+				if (service->fd == -1)
+					continue;
+
 				if (service->max_connections != 0)
 					add_connection(service, command_context);
 				else {
@@ -568,7 +672,9 @@ int server_loop(struct command_context *command_context)
 				struct connection *c;
 
 				for (c = service->connections; c; ) {
-					if ((c->fd >= 0 && FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
+					bool ready = c->fd_ready;
+					c->fd_ready = false;
+					if ((c->fd >= 0 && ready) || c->input_pending) {
 						retval = service->input(c);
 						if (retval != ERROR_OK) {
 							struct connection *next = c->next;
@@ -654,6 +760,13 @@ int server_host_os_entry(void)
 		return ERROR_FAIL;
 	}
 #endif
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* without epoll, server_loop() uses select() */
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		LOG_DEBUG("epoll_create1() failed (%s), using select()", strerror(errno));
+#endif
 	return ERROR_OK;
 }
 
@@ -662,6 +775,13 @@ int server_host_os_close(void)
 #ifdef _WIN32
 	WSACleanup();
 #endif
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+#endif
 	return ERROR_OK;
 }
 
@@ -51,6 +51,7 @@ struct connection {
 	struct command_context *cmd_ctx;
 	struct service *service;
 	bool input_pending;
+	bool fd_ready;	/* set by server_loop() when fd has data to read */
 	void *priv;
 	struct connection *next;
 };
@@ -81,6 +82,7 @@ struct service {
 	char *port;
 	unsigned short portnumber;
 	int fd;
+	bool fd_ready;	/* set by server_loop() when fd has a pending connection */
 	struct sockaddr_in sin;
 	int max_connections;
 	struct connection *connections;
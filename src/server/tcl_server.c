@@ -28,15 +28,44 @@
 #define TCL_LINE_INITIAL		(4*1024)
 #define TCL_LINE_MAX			(4*1024*1024)
 
+/*
+ * Framed binary mode, enabled per connection by "tcl_binary on".
+ * Every request and reply starts with a little endian header:
+ *   u32 payload length, u8 type, u8 status, u16 tag
+ * followed by the payload. The tag of a request is copied to its reply,
+ * the status is 0 on success, 1 on error with the error message as payload.
+ */
+#define TCL_FRAME_HEADER_SIZE	8
+#define TCL_FRAME_MAX			(64*1024*1024)
+
+#define TCL_FRAME_EVAL			0x01
+#define TCL_FRAME_READ_MEMORY	0x02
+#define TCL_FRAME_WRITE_MEMORY	0x03
+#define TCL_FRAME_NOTIFY		0x80
+#define TCL_FRAME_TRACE			0x81
+
+#define TCL_FRAME_STATUS_OK		0
+#define TCL_FRAME_STATUS_ERROR	1
+
+/*
+ * Payload of the memory requests:
+ *   u64 address, u32 byte count, u16 reserved (0), u16 target name length
+ * followed by the target name (current target if empty) and, for writes,
+ * the data.
+ */
+#define TCL_MEMORY_HEADER_SIZE	16
+
 struct tcl_connection {
 	int tc_linedrop;
 	int tc_lineoffset;
 	int tc_line_size;
+	int tc_linescan;/* bytes of the line already searched for ctrl-z */
 	char *tc_line;
 	int tc_outerror;/* flag an output error */
 	enum target_state tc_laststate;
 	bool tc_notify;
 	bool tc_trace;
+	bool tc_binary;
 };
 
 static char *tcl_port;
@@ -47,6 +76,38 @@ static int tcl_input(struct connection *connection);
 static int tcl_output(struct connection *connection, const void *buf, ssize_t len);
 static int tcl_closed(struct connection *connection);
 
+static int tcl_output_frame(struct connection *connection, uint8_t type,
+		uint8_t status, uint16_t tag, const void *data, uint32_t len)
+{
+	uint8_t header[TCL_FRAME_HEADER_SIZE];
+	int retval;
+
+	h_u32_to_le(header, len);
+	header[4] = type;
+	header[5] = status;
+	h_u16_to_le(header + 6, tag);
+
+	retval = tcl_output(connection, header, sizeof(header));
+	if (retval != ERROR_OK)
+		return retval;
+
+	return tcl_output(connection, data, len);
+}
+
+static int tcl_notify(struct connection *connection, const char *msg)
+{
+	struct tcl_connection *tclc = connection->priv;
+	int retval;
+
+	if (tclc->tc_binary)
+		return tcl_output_frame(connection, TCL_FRAME_NOTIFY, TCL_FRAME_STATUS_OK, 0, msg, strlen(msg));
+
+	retval = tcl_output(connection, msg, strlen(msg));
+	if (retval != ERROR_OK)
+		return retval;
+	return tcl_output(connection, "\r\n\x1a", 3);
+}
+
 static int tcl_target_callback_event_handler(struct target *target,
 		enum target_event event, void *priv)
 {
@@ -57,15 +118,15 @@ static int tcl_target_callback_event_handler(struct target *target,
 	tclc = connection->priv;
 
 	if (tclc->tc_notify) {
-		snprintf(buf, sizeof(buf), "type target_event event %s\r\n\x1a", target_event_name(event));
-		tcl_output(connection, buf, strlen(buf));
+		snprintf(buf, sizeof(buf), "type target_event event %s", target_event_name(event));
+		tcl_notify(connection, buf);
 	}
 
 	if (tclc->tc_laststate != target->state) {
 		tclc->tc_laststate = target->state;
 		if (tclc->tc_notify) {
-			snprintf(buf, sizeof(buf), "type target_state state %s\r\n\x1a", target_state_name(target));
-			tcl_output(connection, buf, strlen(buf));
+			snprintf(buf, sizeof(buf), "type target_state state %s", target_state_name(target));
+			tcl_notify(connection, buf);
 		}
 	}
 
@@ -82,8 +143,8 @@ static int tcl_target_callback_reset_handler(struct target *target,
 	tclc = connection->priv;
 
 	if (tclc->tc_notify) {
-		snprintf(buf, sizeof(buf), "type target_reset mode %s\r\n\x1a", target_reset_mode_name(reset_mode));
-		tcl_output(connection, buf, strlen(buf));
+		snprintf(buf, sizeof(buf), "type target_reset mode %s", target_reset_mode_name(reset_mode));
+		tcl_notify(connection, buf);
 	}
 
 	return ERROR_OK;
@@ -102,7 +163,10 @@ static int tcl_target_callback_trace_handler(struct target *target,
 
 	tclc = connection->priv;
 
-	if (tclc->tc_trace) {
+	if (tclc->tc_trace && tclc->tc_binary) {
+		/* raw trace data, no hex encoding */
+		tcl_output_frame(connection, TCL_FRAME_TRACE, TCL_FRAME_STATUS_OK, 0, data, len);
+	} else if (tclc->tc_trace) {
 		hex = malloc(hex_len);
 		buf = malloc(max_len);
 		hexify(hex, data, len, hex_len);
@@ -117,11 +181,12 @@ static int tcl_target_callback_trace_handler(struct target *target,
 
 /* write data out to a socket.
  *
- * this is a blocking write, so the return value must equal the length, if
+ * this is a blocking write, so the whole buffer must be written, if
  * that is not the case then flag the connection with an output error.
  */
 int tcl_output(struct connection *connection, const void *data, ssize_t len)
 {
+	const uint8_t *p = data;
 	ssize_t wlen;
 	struct tcl_connection *tclc;
 
@@ -129,12 +194,19 @@ int tcl_output(struct connection *connection, const void *data, ssize_t len)
 	if (tclc->tc_outerror)
 		return ERROR_SERVER_REMOTE_CLOSED;
 
-	wlen = connection_write(connection, data, len);
+	/* large replies can be accepted in pieces */
+	while (len > 0) {
+		wlen = connection_write(connection, p, len);
+		if (wlen <= 0)
+			break;
+		p += wlen;
+		len -= wlen;
+	}
 
-	if (wlen == len)
+	if (len == 0)
 		return ERROR_OK;
 
-	LOG_ERROR("error during write: %d != %d", (int)wlen, (int)len);
+	LOG_ERROR("error during write: %d bytes not written", (int)len);
 	tclc->tc_outerror = 1;
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
@@ -171,87 +243,256 @@ static int tcl_new_connection(struct connection *connection)
 	return ERROR_OK;
 }
 
-static int tcl_input(struct connection *connection)
+/* grow the input buffer to at least size bytes, but not above max */
+static int tcl_line_reserve(struct tcl_connection *tclc, int size, int max)
+{
+	int tc_line_size_new = tclc->tc_line_size;
+	char *tc_line_new;
+
+	if (size <= tclc->tc_line_size)
+		return ERROR_OK;
+	if (size > max)
+		return ERROR_FAIL;
+
+	/* exponential below 1 MB, linear above */
+	while (tc_line_size_new < size) {
+		if (tc_line_size_new <= 1*1024*1024)
+			tc_line_size_new *= 2;
+		else
+			tc_line_size_new += 1*1024*1024;
+	}
+
+	if (tc_line_size_new > max)
+		tc_line_size_new = max;
+
+	tc_line_new = realloc(tclc->tc_line, tc_line_size_new);
+	if (!tc_line_new)
+		return ERROR_FAIL;
+
+	tclc->tc_line = tc_line_new;
+	tclc->tc_line_size = tc_line_size_new;
+	return ERROR_OK;
+}
+
+static int tcl_run_line(struct connection *connection, char *line)
 {
+	struct tcl_connection *tclc = connection->priv;
 	Jim_Interp *interp = (Jim_Interp *)connection->cmd_ctx->interp;
+	const char *result;
+	int reslen;
 	int retval;
-	int i;
-	ssize_t rlen;
+
+	if (tclc->tc_linedrop) {
+#define ESTR "line too long\n"
+		return tcl_output(connection, ESTR, sizeof(ESTR));
+#undef ESTR
+	}
+
+	command_run_line(connection->cmd_ctx, line);
+	result = Jim_GetString(Jim_GetResult(interp), &reslen);
+	retval = tcl_output(connection, result, reslen);
+	if (retval != ERROR_OK)
+		return retval;
+	/* Always output ctrl-z as end of line to allow multiline results */
+	return tcl_output(connection, "\x1a", 1);
+}
+
+static int tcl_frame_error(struct connection *connection, uint8_t type,
+		uint16_t tag, const char *msg)
+{
+	return tcl_output_frame(connection, type, TCL_FRAME_STATUS_ERROR, tag, msg, strlen(msg));
+}
+
+static int tcl_frame_eval(struct connection *connection, uint16_t tag,
+		const uint8_t *payload, uint32_t len)
+{
+	Jim_Interp *interp = (Jim_Interp *)connection->cmd_ctx->interp;
 	const char *result;
 	int reslen;
+	char *line;
+	int retval;
+
+	line = malloc(len + 1);
+	if (!line)
+		return tcl_frame_error(connection, TCL_FRAME_EVAL, tag, "out of memory");
+	memcpy(line, payload, len);
+	line[len] = '\0';
+
+	retval = command_run_line(connection->cmd_ctx, line);
+	free(line);
+
+	result = Jim_GetString(Jim_GetResult(interp), &reslen);
+	return tcl_output_frame(connection, TCL_FRAME_EVAL,
+			retval == ERROR_OK ? TCL_FRAME_STATUS_OK : TCL_FRAME_STATUS_ERROR,
+			tag, result, reslen);
+}
+
+static struct target *tcl_frame_target(struct connection *connection,
+		const uint8_t *name, uint16_t name_len)
+{
+	char buf[128];
+
+	if (!name_len)
+		return get_current_target_or_null(connection->cmd_ctx);
+
+	if (name_len >= sizeof(buf))
+		return NULL;
+	memcpy(buf, name, name_len);
+	buf[name_len] = '\0';
+	return get_target(buf);
+}
+
+static int tcl_frame_memory(struct connection *connection, uint8_t type,
+		uint16_t tag, const uint8_t *payload, uint32_t len)
+{
+	char msg[128];
+	int retval;
+
+	if (len < TCL_MEMORY_HEADER_SIZE)
+		return tcl_frame_error(connection, type, tag, "request too short");
+
+	target_addr_t address = le_to_h_u64(payload);
+	uint32_t count = le_to_h_u32(payload + 8);
+	uint16_t name_len = le_to_h_u16(payload + 14);
+	const uint8_t *data = payload + TCL_MEMORY_HEADER_SIZE + name_len;
+
+	if (le_to_h_u16(payload + 12) || len < TCL_MEMORY_HEADER_SIZE + (uint32_t)name_len)
+		return tcl_frame_error(connection, type, tag, "malformed request");
+
+	uint32_t data_len = len - TCL_MEMORY_HEADER_SIZE - name_len;
+	if (type == TCL_FRAME_READ_MEMORY ? data_len != 0 : data_len != count)
+		return tcl_frame_error(connection, type, tag, "malformed request");
+
+	struct target *target = tcl_frame_target(connection, payload + TCL_MEMORY_HEADER_SIZE, name_len);
+	if (!target)
+		return tcl_frame_error(connection, type, tag, "no such target");
+
+	if (type == TCL_FRAME_WRITE_MEMORY) {
+		/* written straight from the input buffer */
+		retval = target_write_buffer(target, address, count, data);
+		if (retval != ERROR_OK) {
+			snprintf(msg, sizeof(msg), "failed to write %" PRIu32 " bytes at " TARGET_ADDR_FMT,
+					count, address);
+			return tcl_frame_error(connection, type, tag, msg);
+		}
+		return tcl_output_frame(connection, type, TCL_FRAME_STATUS_OK, tag, NULL, 0);
+	}
+
+	if (count > TCL_FRAME_MAX)
+		return tcl_frame_error(connection, type, tag, "read too large");
+
+	uint8_t *buffer = malloc(count);
+	if (!buffer)
+		return tcl_frame_error(connection, type, tag, "out of memory");
+
+	retval = target_read_buffer(target, address, count, buffer);
+	if (retval != ERROR_OK) {
+		free(buffer);
+		snprintf(msg, sizeof(msg), "failed to read %" PRIu32 " bytes at " TARGET_ADDR_FMT,
+				count, address);
+		return tcl_frame_error(connection, type, tag, msg);
+	}
+
+	retval = tcl_output_frame(connection, type, TCL_FRAME_STATUS_OK, tag, buffer, count);
+	free(buffer);
+	return retval;
+}
+
+static int tcl_run_frame(struct connection *connection, const uint8_t *frame, uint32_t len)
+{
+	uint8_t type = frame[4];
+	uint16_t tag = le_to_h_u16(frame + 6);
+	const uint8_t *payload = frame + TCL_FRAME_HEADER_SIZE;
+	char msg[64];
+
+	switch (type) {
+	case TCL_FRAME_EVAL:
+		return tcl_frame_eval(connection, tag, payload, len);
+	case TCL_FRAME_READ_MEMORY:
+	case TCL_FRAME_WRITE_MEMORY:
+		return tcl_frame_memory(connection, type, tag, payload, len);
+	default:
+		snprintf(msg, sizeof(msg), "unknown request type 0x%02x", type);
+		return tcl_frame_error(connection, type, tag, msg);
+	}
+}
+
+static int tcl_input(struct connection *connection)
+{
+	int retval;
+	ssize_t rlen;
 	struct tcl_connection *tclc;
-	unsigned char in[256];
-	char *tc_line_new;
-	int tc_line_size_new;
+	int consumed;
+
+	tclc = connection->priv;
+	if (!tclc)
+		return ERROR_CONNECTION_REJECTED;
 
-	rlen = connection_read(connection, &in, sizeof(in));
+	/* read straight into the free space of the line buffer */
+	rlen = connection_read(connection, tclc->tc_line + tclc->tc_lineoffset,
+			tclc->tc_line_size - tclc->tc_lineoffset);
 	if (rlen <= 0) {
 		if (rlen < 0)
 			LOG_ERROR("error during read: %s", strerror(errno));
 		return ERROR_SERVER_REMOTE_CLOSED;
 	}
+	tclc->tc_lineoffset += rlen;
+
+	/* the mode is checked again after each request, as the request
+	 * can be the "tcl_binary" command itself */
+	for (;;) {
+		if (tclc->tc_binary) {
+			if (tclc->tc_lineoffset < TCL_FRAME_HEADER_SIZE)
+				break;
+
+			uint32_t len = le_to_h_u32((uint8_t *)tclc->tc_line);
+			if (len > TCL_FRAME_MAX) {
+				LOG_ERROR("tcl: frame too large (%" PRIu32 " bytes)", len);
+				return ERROR_SERVER_REMOTE_CLOSED;
+			}
 
-	tclc = connection->priv;
-	if (!tclc)
-		return ERROR_CONNECTION_REJECTED;
+			int frame_size = TCL_FRAME_HEADER_SIZE + len;
+			if (tclc->tc_lineoffset < frame_size) {
+				if (tcl_line_reserve(tclc, frame_size, TCL_FRAME_HEADER_SIZE + TCL_FRAME_MAX) != ERROR_OK) {
+					LOG_ERROR("tcl: out of memory");
+					return ERROR_SERVER_REMOTE_CLOSED;
+				}
+				break;
+			}
 
-	/* push as much data into the line as possible */
-	for (i = 0; i < rlen; i++) {
-		/* buffer the data */
-		tclc->tc_line[tclc->tc_lineoffset] = in[i];
-		if (tclc->tc_lineoffset + 1 < tclc->tc_line_size) {
-			tclc->tc_lineoffset++;
-		} else if (tclc->tc_line_size >= TCL_LINE_MAX) {
-			/* maximum line size reached, drop line */
-			tclc->tc_linedrop = 1;
+			retval = tcl_run_frame(connection, (uint8_t *)tclc->tc_line, len);
+			consumed = frame_size;
 		} else {
-			/* grow line buffer: exponential below 1 MB, linear above */
-			if (tclc->tc_line_size <= 1*1024*1024)
-				tc_line_size_new = tclc->tc_line_size * 2;
-			else
-				tc_line_size_new = tclc->tc_line_size + 1*1024*1024;
-
-			if (tc_line_size_new > TCL_LINE_MAX)
-				tc_line_size_new = TCL_LINE_MAX;
-
-			tc_line_new = realloc(tclc->tc_line, tc_line_size_new);
-			if (!tc_line_new) {
-				tclc->tc_linedrop = 1;
-			} else {
-				tclc->tc_line = tc_line_new;
-				tclc->tc_line_size = tc_line_size_new;
-				tclc->tc_lineoffset++;
+			/* ctrl-z is end of command. When testing from telnet, just
+			 * press ctrl-z a couple of times first to put telnet into the
+			 * mode where it will send 0x1a in response to pressing ctrl-z
+			 */
+			char *end = memchr(tclc->tc_line + tclc->tc_linescan, '\x1a',
+					tclc->tc_lineoffset - tclc->tc_linescan);
+			if (!end) {
+				tclc->tc_linescan = tclc->tc_lineoffset;
+				if (tclc->tc_lineoffset == tclc->tc_line_size &&
+						tcl_line_reserve(tclc, tclc->tc_line_size + 1, TCL_LINE_MAX) != ERROR_OK) {
+					/* maximum line size reached, drop line */
+					tclc->tc_linedrop = 1;
+					tclc->tc_lineoffset = 0;
+					tclc->tc_linescan = 0;
+				}
+				break;
 			}
 
+			*end = '\0';
+			retval = tcl_run_line(connection, tclc->tc_line);
+			consumed = end - tclc->tc_line + 1;
+			tclc->tc_linedrop = 0;
 		}
 
-		/* ctrl-z is end of command. When testing from telnet, just
-		 * press ctrl-z a couple of times first to put telnet into the
-		 * mode where it will send 0x1a in response to pressing ctrl-z
-		 */
-		if (in[i] != '\x1a')
-			continue;
+		if (retval != ERROR_OK)
+			return retval;
 
-		/* process the line */
-		if (tclc->tc_linedrop) {
-#define ESTR "line too long\n"
-			retval = tcl_output(connection, ESTR, sizeof(ESTR));
-			if (retval != ERROR_OK)
-				return retval;
-#undef ESTR
-		} else {
-			tclc->tc_line[tclc->tc_lineoffset-1] = '\0';
-			command_run_line(connection->cmd_ctx, tclc->tc_line);
-			result = Jim_GetString(Jim_GetResult(interp), &reslen);
-			retval = tcl_output(connection, result, reslen);
-			if (retval != ERROR_OK)
-				return retval;
-			/* Always output ctrl-z as end of line to allow multiline results */
-			tcl_output(connection, "\x1a", 1);
-		}
-
-		tclc->tc_lineoffset = 0;
-		tclc->tc_linedrop = 0;
+		tclc->tc_lineoffset -= consumed;
+		memmove(tclc->tc_line, tclc->tc_line + consumed, tclc->tc_lineoffset);
+		tclc->tc_linescan = 0;
 	}
 
 	return ERROR_OK;
@@ -317,6 +558,23 @@ COMMAND_HANDLER(handle_tcl_notifications_command)
 	}
 }
 
+COMMAND_HANDLER(handle_tcl_binary_command)
+{
+	struct connection *connection = NULL;
+	struct tcl_connection *tclc = NULL;
+
+	if (CMD_CTX->output_handler_priv)
+		connection = CMD_CTX->output_handler_priv;
+
+	if (connection && !strcmp(connection->service->name, "tcl")) {
+		tclc = connection->priv;
+		return CALL_COMMAND_HANDLER(handle_command_parse_bool, &tclc->tc_binary, "Framed binary protocol ");
+	} else {
+		LOG_ERROR("%s: can only be called from the tcl server", CMD_NAME);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+}
+
 COMMAND_HANDLER(handle_tcl_trace_command)
 {
 	struct connection *connection = NULL;
@@ -358,6 +616,13 @@ static const struct command_registration tcl_command_handlers[] = {
 		.help = "Target trace output",
 		.usage = "[on|off]",
 	},
+	{
+		.name = "tcl_binary",
+		.handler = handle_tcl_binary_command,
+		.mode = COMMAND_EXEC,
+		.help = "Switch the connection to the framed binary protocol",
+		.usage = "[on|off]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
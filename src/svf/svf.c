@@ -33,6 +33,18 @@
 #include "svf.h"
 #include "helper/system.h"
 #include <helper/time_support.h>
+#include <helper/bits.h>
+#include <helper/crc32.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /* SVF command */
 enum svf_command {
@@ -211,19 +223,30 @@ struct svf_check_tdo_para {
 static struct svf_check_tdo_para *svf_check_tdo_para;
 static int svf_check_tdo_para_index;
 
-static int svf_read_command_from_file(FILE *fd);
+static int svf_read_command_from_file(void);
 static int svf_check_tdo(void);
 static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len);
 static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str);
 static int svf_execute_tap(void);
+static void svf_queue_tlr(void);
+static void svf_queue_pathmove(int num_states, const tap_state_t *path);
+
+/* A file made available in memory, mapped if the host supports it */
+struct svf_mapping {
+	const char *data;
+	size_t size;
+	bool mapped;
+};
 
-static FILE *svf_fd;
+/* Contents of the SVF file and parse position */
+static struct svf_mapping svf_file;
+static size_t svf_file_pos;
 static char *svf_read_line;
 static size_t svf_read_line_size;
 static char *svf_command_buffer;
 static size_t svf_command_buffer_size;
 static int svf_line_number;
-static int svf_getline(char **lineptr, size_t *n, FILE *stream);
+static int svf_getline(char **lineptr, size_t *n);
 
 #define SVF_MAX_BUFFER_SIZE_TO_COMMIT   (1024 * 1024)
 static uint8_t *svf_tdi_buffer, *svf_tdo_buffer, *svf_mask_buffer;
@@ -232,6 +255,55 @@ static int svf_quiet;
 static int svf_nil;
 static int svf_ignore_error;
 
+/*
+ * Compiled SVF files.
+ *
+ * While an SVF file is run with "-cache", every JTAG operation it queues,
+ * along with the packed scan data and TDO check data, is appended to
+ * svf_cache_ops. If the run succeeds, the result is saved in the cache
+ * directory under the CRC-32 and size of the SVF file, and later runs of
+ * the same file replay it without parsing anything.
+ *
+ * The operations are sequences of 32-bit words, starting with one of the
+ * codes below. The files are only meant for the host that created them,
+ * so the words are in host byte order.
+ */
+enum svf_cache_op {
+	SVF_OP_TLR = 1,			/* */
+	SVF_OP_PATHMOVE,		/* num_states, states... */
+	SVF_OP_SCAN,			/* flags, num_bits, end_state, line, tdi [, tdo, mask] */
+	SVF_OP_CLOCKS,			/* num_cycles */
+	SVF_OP_SLEEP,			/* us */
+	SVF_OP_RESET,			/* trst */
+	SVF_OP_SPEED,			/* khz */
+	SVF_OP_FLUSH,			/* */
+};
+
+#define SVF_OP_SCAN_IR		BIT(0)
+#define SVF_OP_SCAN_CHECK	BIT(1)
+
+#define SVF_CACHE_MAGIC		0x43465653	/* "SVFC" */
+#define SVF_CACHE_VERSION	1
+
+struct svf_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	/* CRC-32 of the SVF file and of the padding set up by "-tap" */
+	uint32_t crc;
+	/* number of SVF commands, for the final message */
+	uint32_t commands;
+	uint64_t file_size;
+	/* number of 32-bit words following the header */
+	uint64_t num_words;
+};
+
+static const char *svf_cache_dir;
+static bool svf_cache_recording;
+static uint32_t *svf_cache_ops;
+static size_t svf_cache_num_words;
+static size_t svf_cache_size;
+static struct svf_mapping svf_cache_file;
+
 /* Targeting particular tap */
 static int svf_tap_is_specified;
 static int svf_set_padding(struct svf_xxr_para *para, int len, unsigned char tdi);
@@ -280,6 +352,10 @@ static int svf_realloc_buffers(size_t len)
 	if (svf_execute_tap() != ERROR_OK)
 		return ERROR_FAIL;
 
+	/* grow geometrically, long scans tend to be followed by more of them */
+	if (len < 2 * (size_t)svf_buffer_size)
+		len = 2 * (size_t)svf_buffer_size;
+
 	ptr = realloc(svf_tdi_buffer, len);
 	if (!ptr)
 		return ERROR_FAIL;
@@ -327,7 +403,7 @@ int svf_add_statemove(tap_state_t state_to)
 		if (svf_nil)
 			return ERROR_OK;
 
-		jtag_add_tlr();
+		svf_queue_tlr();
 		return ERROR_OK;
 	}
 
@@ -339,10 +415,10 @@ int svf_add_statemove(tap_state_t state_to)
 						/* recorded path includes current state ... avoid
 						 *extra TCKs! */
 			if (svf_statemoves[index_var].num_of_moves > 1)
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves - 1,
+				svf_queue_pathmove(svf_statemoves[index_var].num_of_moves - 1,
 					svf_statemoves[index_var].paths + 1);
 			else
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves,
+				svf_queue_pathmove(svf_statemoves[index_var].num_of_moves,
 					svf_statemoves[index_var].paths);
 			return ERROR_OK;
 		}
@@ -351,12 +427,413 @@ int svf_add_statemove(tap_state_t state_to)
 	return ERROR_FAIL;
 }
 
+static void svf_unmap_file(struct svf_mapping *map)
+{
+	if (!map->data)
+		return;
+
+#ifdef HAVE_SYS_MMAN_H
+	if (map->mapped)
+		munmap((void *)map->data, map->size);
+	else
+#endif
+		free((void *)map->data);
+
+	map->data = NULL;
+	map->size = 0;
+	map->mapped = false;
+}
+
+/*
+ * Make the whole file available at map->data. Mapping it avoids copying
+ * SVF files of hundreds of MB; if that's not possible the file is read into
+ * memory instead.
+ */
+static int svf_map_file(const char *name, struct svf_mapping *map)
+{
+	svf_unmap_file(map);
+
+	FILE *fd = fopen(name, "rb");
+	if (!fd)
+		return ERROR_FAIL;
+
+	if (fseek(fd, 0, SEEK_END) != 0) {
+		fclose(fd);
+		return ERROR_FAIL;
+	}
+	long size = ftell(fd);
+	if (size < 0 || fseek(fd, 0, SEEK_SET) != 0) {
+		fclose(fd);
+		return ERROR_FAIL;
+	}
+	map->size = size;
+
+#ifdef HAVE_SYS_MMAN_H
+	if (map->size > 0) {
+		void *ptr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+		if (ptr != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+			madvise(ptr, map->size, MADV_SEQUENTIAL);
+#endif
+			fclose(fd);
+			map->data = ptr;
+			map->mapped = true;
+			return ERROR_OK;
+		}
+	}
+#endif
+
+	/* one extra byte so that an empty file still gets a buffer */
+	char *data = malloc(map->size + 1);
+	if (!data) {
+		fclose(fd);
+		return ERROR_FAIL;
+	}
+	if (fread(data, 1, map->size, fd) != map->size) {
+		free(data);
+		fclose(fd);
+		return ERROR_FAIL;
+	}
+	fclose(fd);
+
+	map->data = data;
+	return ERROR_OK;
+}
+
+static int svf_cache_grow(size_t num_words)
+{
+	if (svf_cache_num_words + num_words <= svf_cache_size)
+		return ERROR_OK;
+
+	size_t size = MAX(svf_cache_num_words + num_words, 2 * svf_cache_size);
+	uint32_t *ops = realloc(svf_cache_ops, size * sizeof(*ops));
+	if (!ops) {
+		LOG_WARNING("not enough memory to compile the SVF file");
+		svf_cache_recording = false;
+		return ERROR_FAIL;
+	}
+	svf_cache_ops = ops;
+	svf_cache_size = size;
+
+	return ERROR_OK;
+}
+
+static void svf_cache_record(enum svf_cache_op op, size_t num_args, const uint32_t *args)
+{
+	if (svf_cache_grow(num_args + 1) != ERROR_OK)
+		return;
+
+	svf_cache_ops[svf_cache_num_words++] = op;
+	if (num_args)
+		memcpy(&svf_cache_ops[svf_cache_num_words], args, num_args * sizeof(*args));
+	svf_cache_num_words += num_args;
+}
+
+/* Append num_bits bits of buf, padded to whole words. */
+static void svf_cache_record_bits(const uint8_t *buf, int num_bits)
+{
+	size_t num_bytes = DIV_ROUND_UP(num_bits, 8);
+	size_t num_words = DIV_ROUND_UP(num_bytes, 4);
+
+	if (svf_cache_grow(num_words) != ERROR_OK)
+		return;
+
+	svf_cache_ops[svf_cache_num_words + num_words - 1] = 0;
+	memcpy(&svf_cache_ops[svf_cache_num_words], buf, num_bytes);
+	svf_cache_num_words += num_words;
+}
+
+/*
+ * JTAG operations of the SVF player. They are recorded for the cache if
+ * enabled, and not queued at all in "nil" mode.
+ */
+static void svf_queue_tlr(void)
+{
+	if (svf_cache_recording)
+		svf_cache_record(SVF_OP_TLR, 0, NULL);
+
+	if (!svf_nil)
+		jtag_add_tlr();
+}
+
+static void svf_queue_pathmove(int num_states, const tap_state_t *path)
+{
+	if (svf_cache_recording) {
+		uint32_t arg = num_states;
+
+		svf_cache_record(SVF_OP_PATHMOVE, 1, &arg);
+		for (int i = 0; i < num_states && svf_cache_grow(1) == ERROR_OK; i++)
+			svf_cache_ops[svf_cache_num_words++] = path[i];
+	}
+
+	if (!svf_nil)
+		jtag_add_pathmove(num_states, path);
+}
+
+static void svf_queue_scan(bool ir, int num_bits, const uint8_t *out_bits,
+		uint8_t *in_bits, tap_state_t end_state)
+{
+	if (svf_nil)
+		return;
+
+	if (ir)
+		jtag_add_plain_ir_scan(num_bits, out_bits, in_bits, end_state);
+	else
+		jtag_add_plain_dr_scan(num_bits, out_bits, in_bits, end_state);
+}
+
+static void svf_queue_clocks(int num_cycles)
+{
+	if (svf_cache_recording) {
+		uint32_t arg = num_cycles;
+		svf_cache_record(SVF_OP_CLOCKS, 1, &arg);
+	}
+
+	if (!svf_nil)
+		jtag_add_clocks(num_cycles);
+}
+
+static void svf_queue_sleep(uint32_t us)
+{
+	if (svf_cache_recording)
+		svf_cache_record(SVF_OP_SLEEP, 1, &us);
+
+	if (!svf_nil)
+		jtag_add_sleep(us);
+}
+
+static void svf_queue_reset(int trst)
+{
+	if (svf_cache_recording) {
+		uint32_t arg = trst;
+		svf_cache_record(SVF_OP_RESET, 1, &arg);
+	}
+
+	if (!svf_nil)
+		jtag_add_reset(trst, 0);
+}
+
+/* Record a scan assembled at svf_buffer_index of the scan buffers. */
+static void svf_cache_record_scan(bool ir, int num_bits, bool check, tap_state_t end_state)
+{
+	uint32_t args[] = {
+		(ir ? SVF_OP_SCAN_IR : 0) | (check ? SVF_OP_SCAN_CHECK : 0),
+		num_bits,
+		end_state,
+		svf_line_number,
+	};
+
+	svf_cache_record(SVF_OP_SCAN, ARRAY_SIZE(args), args);
+	svf_cache_record_bits(&svf_tdi_buffer[svf_buffer_index], num_bits);
+	if (check) {
+		svf_cache_record_bits(&svf_tdo_buffer[svf_buffer_index], num_bits);
+		svf_cache_record_bits(&svf_mask_buffer[svf_buffer_index], num_bits);
+	}
+}
+
+/* CRC-32 of the SVF file and of the options changing its compiled form. */
+static uint32_t svf_cache_crc(void)
+{
+	uint32_t crc = crc32_update(CRC32_INIT, svf_file.data, svf_file.size);
+	uint32_t padding[] = {
+		svf_tap_is_specified,
+		svf_para.hdr_para.len,
+		svf_para.hir_para.len,
+		svf_para.tdr_para.len,
+		svf_para.tir_para.len,
+	};
+
+	return crc32_update(crc, padding, sizeof(padding));
+}
+
+static char *svf_cache_path(uint32_t crc)
+{
+	return alloc_printf("%s/%08" PRIx32 "-%" PRIx64 ".svfc", svf_cache_dir, crc,
+		(uint64_t)svf_file.size);
+}
+
+/* Map the compiled form of the SVF file, if it is in the cache. */
+static int svf_cache_load(uint32_t crc)
+{
+	char *path = svf_cache_path(crc);
+	if (!path)
+		return ERROR_FAIL;
+
+	int retval = svf_map_file(path, &svf_cache_file);
+	if (retval != ERROR_OK) {
+		LOG_DEBUG("no compiled SVF file %s", path);
+		free(path);
+		return retval;
+	}
+
+	const struct svf_cache_header *header = (const void *)svf_cache_file.data;
+	if (svf_cache_file.size < sizeof(*header) ||
+			header->magic != SVF_CACHE_MAGIC ||
+			header->version != SVF_CACHE_VERSION ||
+			header->crc != crc ||
+			header->file_size != svf_file.size ||
+			header->num_words != (svf_cache_file.size - sizeof(*header)) / 4 ||
+			(svf_cache_file.size - sizeof(*header)) % 4) {
+		LOG_WARNING("ignoring invalid compiled SVF file %s", path);
+		svf_unmap_file(&svf_cache_file);
+		free(path);
+		return ERROR_FAIL;
+	}
+
+	LOG_USER("svf using compiled file \"%s\"", path);
+	free(path);
+	return ERROR_OK;
+}
+
+static void svf_cache_save(uint32_t crc, int commands)
+{
+	char *path = svf_cache_path(crc);
+	char *tmp = alloc_printf("%s.tmp", path ? path : "");
+	if (!path || !tmp) {
+		free(path);
+		free(tmp);
+		return;
+	}
+
+	struct svf_cache_header header = {
+		.magic = SVF_CACHE_MAGIC,
+		.version = SVF_CACHE_VERSION,
+		.crc = crc,
+		.commands = commands,
+		.file_size = svf_file.size,
+		.num_words = svf_cache_num_words,
+	};
+
+	/* write to a temporary file first, so that the cache never holds
+	 * a partial file */
+	FILE *fd = fopen(tmp, "wb");
+	bool ok = fd &&
+		fwrite(&header, sizeof(header), 1, fd) == 1 &&
+		fwrite(svf_cache_ops, sizeof(*svf_cache_ops), svf_cache_num_words, fd) ==
+			svf_cache_num_words;
+	if (fd && fclose(fd) != 0)
+		ok = false;
+	if (ok && rename(tmp, path) != 0)
+		ok = false;
+
+	if (ok) {
+		LOG_INFO("svf compiled to \"%s\"", path);
+	} else {
+		LOG_WARNING("failed to write compiled SVF file %s", path);
+		remove(tmp);
+	}
+
+	free(tmp);
+	free(path);
+}
+
+/* Queue the operations of the compiled SVF file. */
+static int svf_cache_run(struct command_context *cmd_ctx)
+{
+	const uint32_t *op = (const void *)(svf_cache_file.data + sizeof(struct svf_cache_header));
+	const uint32_t *end = (const void *)(svf_cache_file.data + svf_cache_file.size);
+
+	while (op < end) {
+		uint32_t code = *op++;
+		size_t left = end - op;
+		tap_state_t path[256];
+
+		switch (code) {
+		case SVF_OP_TLR:
+			svf_queue_tlr();
+			break;
+		case SVF_OP_PATHMOVE:
+			if (left < 1 || op[0] > ARRAY_SIZE(path) || left < op[0] + 1)
+				goto corrupt;
+			for (uint32_t i = 0; i < op[0]; i++)
+				path[i] = op[i + 1];
+			svf_queue_pathmove(op[0], path);
+			op += op[0] + 1;
+			break;
+		case SVF_OP_SCAN: {
+			if (left < 4)
+				goto corrupt;
+
+			bool ir = op[0] & SVF_OP_SCAN_IR;
+			bool check = op[0] & SVF_OP_SCAN_CHECK;
+			int num_bits = op[1];
+			tap_state_t end_state = op[2];
+			int num_bytes = DIV_ROUND_UP(num_bits, 8);
+			size_t num_words = DIV_ROUND_UP(num_bytes, 4);
+			const uint8_t *tdi = (const uint8_t *)(op + 4);
+
+			if (num_bits <= 0 || left - 4 < num_words * (check ? 3 : 1))
+				goto corrupt;
+			svf_line_number = op[3];
+			op += 4;
+
+			if (!check) {
+				/* the queue makes its own copy of the data */
+				svf_queue_scan(ir, num_bits, tdi, NULL, end_state);
+				op += num_words;
+				break;
+			}
+
+			if (svf_buffer_size - svf_buffer_index < num_bytes &&
+					svf_realloc_buffers(svf_buffer_index + num_bytes) != ERROR_OK) {
+				LOG_ERROR("not enough memory");
+				return ERROR_FAIL;
+			}
+			memcpy(&svf_tdi_buffer[svf_buffer_index], tdi, num_bytes);
+			memcpy(&svf_tdo_buffer[svf_buffer_index], op + num_words, num_bytes);
+			memcpy(&svf_mask_buffer[svf_buffer_index], op + 2 * num_words, num_bytes);
+			svf_add_check_para(1, svf_buffer_index, num_bits);
+			svf_queue_scan(ir, num_bits, &svf_tdi_buffer[svf_buffer_index],
+				&svf_tdi_buffer[svf_buffer_index], end_state);
+			svf_buffer_index += num_bytes;
+			op += 3 * num_words;
+			break;
+		}
+		case SVF_OP_CLOCKS:
+			if (left < 1)
+				goto corrupt;
+			svf_queue_clocks(*op++);
+			break;
+		case SVF_OP_SLEEP:
+			if (left < 1)
+				goto corrupt;
+			svf_queue_sleep(*op++);
+			break;
+		case SVF_OP_RESET:
+			if (left < 1)
+				goto corrupt;
+			svf_queue_reset(*op++);
+			break;
+		case SVF_OP_SPEED:
+			if (left < 1)
+				goto corrupt;
+			command_run_linef(cmd_ctx, "adapter speed %" PRIu32, *op++);
+			break;
+		case SVF_OP_FLUSH:
+			if (svf_execute_tap() != ERROR_OK) {
+				LOG_ERROR("fail to run command at line %d", svf_line_number);
+				return ERROR_FAIL;
+			}
+			break;
+		default:
+			goto corrupt;
+		}
+	}
+
+	return ERROR_OK;
+
+corrupt:
+	LOG_ERROR("corrupt compiled SVF file");
+	return ERROR_FAIL;
+}
+
 COMMAND_HANDLER(handle_svf_command)
 {
 #define SVF_MIN_NUM_OF_OPTIONS 1
-#define SVF_MAX_NUM_OF_OPTIONS 5
+#define SVF_MAX_NUM_OF_OPTIONS 7
 	int command_num = 0;
 	int ret = ERROR_OK;
+	uint32_t cache_crc = 0;
 	int64_t time_measure_ms;
 	int time_measure_s, time_measure_m;
 
@@ -374,8 +851,13 @@ COMMAND_HANDLER(handle_svf_command)
 	svf_nil = 0;
 	svf_progress_enabled = 0;
 	svf_ignore_error = 0;
+	svf_cache_dir = NULL;
 	for (unsigned int i = 0; i < CMD_ARGC; i++) {
-		if (strcmp(CMD_ARGV[i], "-tap") == 0) {
+		if (strcmp(CMD_ARGV[i], "-cache") == 0) {
+			if (i + 1 >= CMD_ARGC)
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			svf_cache_dir = CMD_ARGV[++i];
+		} else if (strcmp(CMD_ARGV[i], "-tap") == 0) {
 			tap = jtag_tap_by_string(CMD_ARGV[i+1]);
 			if (!tap) {
 				command_print(CMD, "Tap: %s unknown", CMD_ARGV[i+1]);
@@ -394,8 +876,7 @@ COMMAND_HANDLER(handle_svf_command)
 				  "ignore_error") == 0) || (strcmp(CMD_ARGV[i], "-ignore_error") == 0))
 			svf_ignore_error = 1;
 		else {
-			svf_fd = fopen(CMD_ARGV[i], "r");
-			if (!svf_fd) {
+			if (svf_map_file(CMD_ARGV[i], &svf_file) != ERROR_OK) {
 				int err = errno;
 				command_print(CMD, "open(\"%s\"): %s", CMD_ARGV[i], strerror(err));
 				/* no need to free anything now */
@@ -405,7 +886,7 @@ COMMAND_HANDLER(handle_svf_command)
 		}
 	}
 
-	if (!svf_fd)
+	if (!svf_file.data)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
 	/* get time */
@@ -440,6 +921,8 @@ COMMAND_HANDLER(handle_svf_command)
 		jtag_add_tlr();
 	}
 
+	svf_tap_is_specified = 0;
+
 	if (tap) {
 		/* Tap is specified, set header/trailer paddings */
 		int header_ir_len = 0, header_dr_len = 0, trailer_ir_len = 0, trailer_dr_len = 0;
@@ -484,15 +967,34 @@ COMMAND_HANDLER(handle_svf_command)
 		}
 	}
 
+	if (svf_cache_dir) {
+		cache_crc = svf_cache_crc();
+		if (svf_cache_load(cache_crc) == ERROR_OK) {
+			const struct svf_cache_header *header = (const void *)svf_cache_file.data;
+
+			command_num = header->commands;
+			if (svf_cache_run(CMD_CTX) != ERROR_OK)
+				ret = ERROR_FAIL;
+			goto done;
+		}
+
+		/* compile while running, unless nothing actually runs */
+		svf_cache_recording = !svf_nil;
+		svf_cache_num_words = 0;
+	}
+
 	if (svf_progress_enabled) {
 		/* Count total lines in file. */
-		while (!feof(svf_fd)) {
-			svf_getline(&svf_command_buffer, &svf_command_buffer_size, svf_fd);
+		const char *p = svf_file.data;
+		const char *end = svf_file.data + svf_file.size;
+
+		svf_total_lines = 1;
+		while ((p = memchr(p, '\n', end - p))) {
 			svf_total_lines++;
+			p++;
 		}
-		rewind(svf_fd);
 	}
-	while (svf_read_command_from_file(svf_fd) == ERROR_OK) {
+	while (svf_read_command_from_file() == ERROR_OK) {
 		/* Log Output */
 		if (svf_quiet) {
 			if (svf_progress_enabled) {
@@ -518,11 +1020,20 @@ COMMAND_HANDLER(handle_svf_command)
 		command_num++;
 	}
 
+done:
 	if ((!svf_nil) && (jtag_execute_queue() != ERROR_OK))
 		ret = ERROR_FAIL;
 	else if (svf_check_tdo() != ERROR_OK)
 		ret = ERROR_FAIL;
 
+	/* only keep the compiled form of a fully successful run: with
+	 * -ignore_error, svf_check_tdo() counts each ignored TDO mismatch
+	 * on top of the initial 1 */
+	bool tdo_errors_ignored = svf_ignore_error > 1;
+	if (svf_cache_recording && ret == ERROR_OK && !tdo_errors_ignored)
+		svf_cache_save(cache_crc, command_num);
+	svf_cache_recording = false;
+
 	/* print time */
 	time_measure_ms = timeval_ms() - time_measure_ms;
 	time_measure_s = time_measure_ms / 1000;
@@ -538,8 +1049,14 @@ COMMAND_HANDLER(handle_svf_command)
 
 free_all:
 
-	fclose(svf_fd);
-	svf_fd = 0;
+	svf_unmap_file(&svf_file);
+	svf_file_pos = 0;
+	svf_unmap_file(&svf_cache_file);
+
+	free(svf_cache_ops);
+	svf_cache_ops = NULL;
+	svf_cache_num_words = 0;
+	svf_cache_size = 0;
 
 	/* free buffers */
 	free(svf_command_buffer);
@@ -582,45 +1099,49 @@ free_all:
 	return ret;
 }
 
-static int svf_getline(char **lineptr, size_t *n, FILE *stream)
+/*
+ * Copy the next line of the file, including its '\n', to *lineptr.
+ * A last line without '\n' is ignored.
+ */
+static int svf_getline(char **lineptr, size_t *n)
 {
-#define MIN_CHUNK 16	/* Buffer is increased by this size each time as required */
-	size_t i = 0;
+	const char *line = svf_file.data + svf_file_pos;
+	const char *nl = memchr(line, '\n', svf_file.size - svf_file_pos);
 
-	if (!*lineptr) {
-		*n = MIN_CHUNK;
-		*lineptr = malloc(*n);
-		if (!*lineptr)
-			return -1;
+	if (!nl) {
+		svf_file_pos = svf_file.size;
+		if (*lineptr)
+			(*lineptr)[0] = 0;
+		return -1;
 	}
 
-	(*lineptr)[0] = fgetc(stream);
-	while ((*lineptr)[i] != '\n') {
-		(*lineptr)[++i] = fgetc(stream);
-		if (feof(stream)) {
-			(*lineptr)[0] = 0;
+	size_t len = nl - line + 1;
+
+	if (!*lineptr || len + 1 > *n) {
+		size_t size = MAX(len + 1, 2 * *n);
+		char *ptr = realloc(*lineptr, size);
+		if (!ptr)
 			return -1;
-		}
-		if ((i + 2) > *n) {
-			*n += MIN_CHUNK;
-			*lineptr = realloc(*lineptr, *n);
-		}
+		*lineptr = ptr;
+		*n = size;
 	}
 
-	(*lineptr)[++i] = 0;
+	memcpy(*lineptr, line, len);
+	(*lineptr)[len] = 0;
+	svf_file_pos += len;
 
-	return sizeof(*lineptr);
+	return len;
 }
 
 #define SVFP_CMD_INC_CNT 1024
-static int svf_read_command_from_file(FILE *fd)
+static int svf_read_command_from_file(void)
 {
 	unsigned char ch;
 	int i = 0;
 	size_t cmd_pos = 0;
 	int cmd_ok = 0, slash = 0;
 
-	if (svf_getline(&svf_read_line, &svf_read_line_size, svf_fd) <= 0)
+	if (svf_getline(&svf_read_line, &svf_read_line_size) <= 0)
 		return ERROR_FAIL;
 	svf_line_number++;
 	ch = svf_read_line[0];
@@ -628,7 +1149,7 @@ static int svf_read_command_from_file(FILE *fd)
 		switch (ch) {
 			case '!':
 				slash = 0;
-				if (svf_getline(&svf_read_line, &svf_read_line_size, svf_fd) <= 0)
+				if (svf_getline(&svf_read_line, &svf_read_line_size) <= 0)
 					return ERROR_FAIL;
 				svf_line_number++;
 				i = -1;
@@ -636,8 +1157,7 @@ static int svf_read_command_from_file(FILE *fd)
 			case '/':
 				if (++slash == 2) {
 					slash = 0;
-					if (svf_getline(&svf_read_line, &svf_read_line_size,
-						svf_fd) <= 0)
+					if (svf_getline(&svf_read_line, &svf_read_line_size) <= 0)
 						return ERROR_FAIL;
 					svf_line_number++;
 					i = -1;
@@ -649,7 +1169,7 @@ static int svf_read_command_from_file(FILE *fd)
 				break;
 			case '\n':
 				svf_line_number++;
-				if (svf_getline(&svf_read_line, &svf_read_line_size, svf_fd) <= 0)
+				if (svf_getline(&svf_read_line, &svf_read_line_size) <= 0)
 					return ERROR_FAIL;
 				i = -1;
 				/* fallthrough */
@@ -673,12 +1193,14 @@ static int svf_read_command_from_file(FILE *fd)
 				 *  - terminating NUL ('\0')
 				 */
 				if (cmd_pos + 3 > svf_command_buffer_size) {
-					svf_command_buffer = realloc(svf_command_buffer, cmd_pos + 3);
-					svf_command_buffer_size = cmd_pos + 3;
-					if (!svf_command_buffer) {
+					size_t size = MAX(cmd_pos + 3, 2 * svf_command_buffer_size);
+					char *ptr = realloc(svf_command_buffer, size);
+					if (!ptr) {
 						LOG_ERROR("not enough memory");
 						return ERROR_FAIL;
 					}
+					svf_command_buffer = ptr;
+					svf_command_buffer_size = size;
 				}
 
 				/* insert a space before '(' */
@@ -785,10 +1307,79 @@ static int svf_set_padding(struct svf_xxr_para *para, int len, unsigned char tdi
 	return error;
 }
 
+static inline int svf_hex_digit(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+/*
+ * Decode the 16 hex digits at str, most significant first, to the 8 bytes
+ * at bin, least significant first. Nothing is written and false is returned
+ * if any of the characters is not an (upper case) hex digit.
+ */
+static inline bool svf_hex_decode16(const char *str, uint8_t *bin)
+{
+#if defined(__SSE2__)
+	const __m128i v = _mm_loadu_si128((const __m128i *)str);
+	const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('F' + 1)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+		return false;
+
+	__m128i n = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+			_mm_and_si128(alpha, _mm_sub_epi8(v, _mm_set1_epi8('A' - 10))));
+	/* str[2 * k] is the high nibble of byte k, str[2 * k + 1] the low one */
+	n = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0x00f0)),
+			_mm_srli_epi16(n, 8));
+	n = _mm_packus_epi16(n, n);
+
+	uint64_t bytes;
+	_mm_storel_epi64((__m128i *)&bytes, n);
+	bytes = __builtin_bswap64(bytes);
+	memcpy(bin, &bytes, sizeof(bytes));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	const uint8x16_t v = vld1q_u8((const uint8_t *)str);
+	const uint8x16_t d = vsubq_u8(v, vdupq_n_u8('0'));
+	const uint8x16_t a = vsubq_u8(v, vdupq_n_u8('A'));
+	const uint8x16_t digit = vcltq_u8(d, vdupq_n_u8(10));
+	const uint8x16_t alpha = vcltq_u8(a, vdupq_n_u8(6));
+
+	if (vminvq_u8(vorrq_u8(digit, alpha)) != 0xff)
+		return false;
+
+	const uint8x16_t n = vbslq_u8(digit, d, vaddq_u8(a, vdupq_n_u8(10)));
+	/* str[2 * k] is the high nibble of byte k, str[2 * k + 1] the low one */
+	const uint8x8_t hi = vget_low_u8(vuzp1q_u8(n, n));
+	const uint8x8_t lo = vget_low_u8(vuzp2q_u8(n, n));
+
+	vst1_u8(bin, vrev64_u8(vorr_u8(vshl_n_u8(hi, 4), lo)));
+#else
+	uint8_t bytes[8];
+
+	for (unsigned int k = 0; k < 8; k++) {
+		int hi = svf_hex_digit(str[2 * k]);
+		int lo = svf_hex_digit(str[2 * k + 1]);
+
+		if (hi < 0 || lo < 0)
+			return false;
+		bytes[7 - k] = hi << 4 | lo;
+	}
+	memcpy(bin, bytes, sizeof(bytes));
+#endif
+	return true;
+}
+
 static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_len, int bit_len)
 {
 	int i, str_len = strlen(str), str_hbyte_len = (bit_len + 3) >> 2;
-	uint8_t ch = 0;
+	int ch = 0;
 
 	if (svf_adjust_array_length(bin, orig_bit_len, bit_len) != ERROR_OK) {
 		LOG_ERROR("fail to adjust length of array");
@@ -797,9 +1388,19 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 
 	/* fill from LSB (end of str) to MSB (beginning of str) */
 	for (i = 0; i < str_hbyte_len; i++) {
+		/* Convert whole bytes, 16 digits at a time, as long as there
+		 * is no whitespace in between. */
+		if (!(i % 2) && str_hbyte_len - i >= 16 && str_len >= 16 &&
+				svf_hex_decode16(&str[str_len - 16], &(*bin)[i / 2])) {
+			str_len -= 16;
+			ch = svf_hex_digit(str[str_len]);
+			i += 15;
+			continue;
+		}
+
 		ch = 0;
 		while (str_len > 0) {
-			ch = str[--str_len];
+			char c = str[--str_len];
 
 			/* Skip whitespace.  The SVF specification (rev E) is
 			 * deficient in terms of basic lexical issues like
@@ -807,17 +1408,13 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 			 * require line ends for correctness, since there is
 			 * a hard limit on line length.
 			 */
-			if (!isspace(ch)) {
-				if ((ch >= '0') && (ch <= '9')) {
-					ch = ch - '0';
+			if (!isspace((int)c)) {
+				ch = svf_hex_digit(c);
+				if (ch >= 0)
 					break;
-				} else if ((ch >= 'A') && (ch <= 'F')) {
-					ch = ch - 'A' + 10;
-					break;
-				} else {
-					LOG_ERROR("invalid hex string");
-					return ERROR_FAIL;
-				}
+
+				LOG_ERROR("invalid hex string");
+				return ERROR_FAIL;
 			}
 
 			ch = 0;
@@ -829,8 +1426,7 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 			(*bin)[i / 2] |= ch << 4;
 		} else {
 			/* LSB */
-			(*bin)[i / 2] = 0;
-			(*bin)[i / 2] |= ch;
+			(*bin)[i / 2] = ch;
 		}
 	}
 
@@ -893,6 +1489,9 @@ static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 
 static int svf_execute_tap(void)
 {
+	if (svf_cache_recording)
+		svf_cache_record(SVF_OP_FLUSH, 0, NULL);
+
 	if ((!svf_nil) && (jtag_execute_queue() != ERROR_OK))
 		return ERROR_FAIL;
 	else if (svf_check_tdo() != ERROR_OK)
@@ -979,6 +1578,10 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 					command_run_linef(cmd_ctx,
 							"adapter speed %d",
 							(int)svf_para.frequency / 1000);
+					if (svf_cache_recording) {
+						uint32_t khz = (int)svf_para.frequency / 1000;
+						svf_cache_record(SVF_OP_SPEED, 1, &khz);
+					}
 					LOG_DEBUG("\tfrequency = %f", svf_para.frequency);
 				}
 			}
@@ -1192,13 +1795,12 @@ xxr_common:
 				field.num_bits = i;
 				field.out_value = &svf_tdi_buffer[svf_buffer_index];
 				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
-				if (!svf_nil) {
-					/* NOTE:  doesn't use SVF-specified state paths */
-					jtag_add_plain_dr_scan(field.num_bits,
-							field.out_value,
-							field.in_value,
-							svf_para.dr_end_state);
-				}
+				if (svf_cache_recording)
+					svf_cache_record_scan(false, field.num_bits, field.in_value,
+						svf_para.dr_end_state);
+				/* NOTE:  doesn't use SVF-specified state paths */
+				svf_queue_scan(false, field.num_bits, field.out_value,
+						field.in_value, svf_para.dr_end_state);
 
 				svf_buffer_index += (i + 7) >> 3;
 			} else if (command == SIR) {
@@ -1282,13 +1884,12 @@ xxr_common:
 				field.num_bits = i;
 				field.out_value = &svf_tdi_buffer[svf_buffer_index];
 				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
-				if (!svf_nil) {
-					/* NOTE:  doesn't use SVF-specified state paths */
-					jtag_add_plain_ir_scan(field.num_bits,
-							field.out_value,
-							field.in_value,
-							svf_para.ir_end_state);
-				}
+				if (svf_cache_recording)
+					svf_cache_record_scan(true, field.num_bits, field.in_value,
+						svf_para.ir_end_state);
+				/* NOTE:  doesn't use SVF-specified state paths */
+				svf_queue_scan(true, field.num_bits, field.out_value,
+						field.in_value, svf_para.ir_end_state);
 
 				svf_buffer_index += (i + 7) >> 3;
 			}
@@ -1380,15 +1981,11 @@ xxr_common:
 					svf_add_statemove(svf_para.runtest_run_state);
 
 				/* add clocks and/or min wait */
-				if (run_count > 0) {
-					if (!svf_nil)
-						jtag_add_clocks(run_count);
-				}
+				if (run_count > 0)
+					svf_queue_clocks(run_count);
 
-				if (min_usec > 0) {
-					if (!svf_nil)
-						jtag_add_sleep(min_usec);
-				}
+				if (min_usec > 0)
+					svf_queue_sleep(min_usec);
 
 				/* move to end_state if necessary */
 				if (svf_para.runtest_end_state != svf_para.runtest_run_state)
@@ -1436,12 +2033,9 @@ xxr_common:
 					/* OpenOCD refuses paths containing TAP_RESET */
 					if (path[i] == TAP_RESET) {
 						/* FIXME last state MUST be stable! */
-						if (i > 0) {
-							if (!svf_nil)
-								jtag_add_pathmove(i, path);
-						}
-						if (!svf_nil)
-							jtag_add_tlr();
+						if (i > 0)
+							svf_queue_pathmove(i, path);
+						svf_queue_tlr();
 						num_of_argu -= i + 1;
 						i = -1;
 					}
@@ -1450,8 +2044,7 @@ xxr_common:
 					/* execute last path if necessary */
 					if (svf_tap_state_is_stable(path[num_of_argu - 1])) {
 						/* last state MUST be stable state */
-						if (!svf_nil)
-							jtag_add_pathmove(num_of_argu, path);
+						svf_queue_pathmove(num_of_argu, path);
 						LOG_DEBUG("\tmove to %s by path_move",
 								tap_state_name(path[num_of_argu - 1]));
 					} else {
@@ -1494,13 +2087,11 @@ xxr_common:
 						ARRAY_SIZE(svf_trst_mode_name));
 				switch (i_tmp) {
 				case TRST_ON:
-					if (!svf_nil)
-						jtag_add_reset(1, 0);
+					svf_queue_reset(1);
 					break;
 				case TRST_Z:
 				case TRST_OFF:
-					if (!svf_nil)
-						jtag_add_reset(0, 0);
+					svf_queue_reset(0);
 					break;
 				case TRST_ABSENT:
 					break;
@@ -1556,7 +2147,7 @@ static const struct command_registration svf_command_handlers[] = {
 		.handler = handle_svf_command,
 		.mode = COMMAND_EXEC,
 		.help = "Runs a SVF file.",
-		.usage = "[-tap device.tap] <file> [quiet] [nil] [progress] [ignore_error]",
+		.usage = "[-tap device.tap] [-cache directory] <file> [quiet] [nil] [progress] [ignore_error]",
 	},
 	COMMAND_REGISTRATION_DONE
 };
@@ -2542,6 +2542,67 @@ static int aarch64_handle_target_request(void *priv)
 	return ERROR_OK;
 }
 
+/*
+ * Non-intrusive profiling through the external debug PC sample register.
+ * Reading EDPCSRlo samples the PC of the running PE, so batches of reads
+ * to the same address are queued on the APB-AP in one go.  Only the low
+ * 32 bits of the PC end up in the gmon histogram.
+ */
+static int aarch64_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
+{
+	struct armv8_common *armv8 = target_to_armv8(target);
+	uint32_t samples[1024];
+	uint32_t eddevid;
+	int retval;
+
+	retval = mem_ap_read_atomic_u32(armv8->debug_ap,
+			armv8->debug_base + CPUV8_DBG_EDDEVID, &eddevid);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (!(eddevid & EDDEVID_PCSAMPLE_MASK)) {
+		LOG_TARGET_INFO(target, "EDPCSR sampling not supported on this processor.");
+		return target_profiling_default(target, profile, seconds);
+	}
+
+	LOG_TARGET_INFO(target, "Starting AArch64 profiling. Sampling EDPCSR as fast as we can...");
+
+	/* Make sure the target is running */
+	target_poll(target);
+	if (target->state == TARGET_HALTED) {
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while resuming target");
+			return retval;
+		}
+	}
+
+	int64_t timeout = timeval_ms() + seconds * 1000;
+	do {
+		retval = mem_ap_read_buf_noincr(armv8->debug_ap, (uint8_t *)samples, 4,
+				ARRAY_SIZE(samples), armv8->debug_base + CPUV8_DBG_EDPCSR);
+		if (retval != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while reading EDPCSR");
+			return retval;
+		}
+
+		uint32_t count = 0;
+		for (unsigned int i = 0; i < ARRAY_SIZE(samples); i++) {
+			uint32_t pcsr = le_to_h_u32((uint8_t *)&samples[i]);
+
+			/* PE halted or sampling prohibited */
+			if (pcsr != 0xffffffff)
+				samples[count++] = pcsr;
+		}
+
+		retval = target_profile_add_samples(profile, samples, count);
+	} while (retval == ERROR_OK && timeval_ms() < timeout);
+
+	LOG_TARGET_INFO(target, "Profiling completed. %" PRIu64 " samples.", profile->num_samples);
+	return retval;
+}
+
 static int aarch64_examine_first(struct target *target)
 {
 	struct aarch64_common *aarch64 = target_to_aarch64(target);
@@ -3195,6 +3256,8 @@ struct target_type aarch64_target = {
 	.remove_watchpoint = aarch64_remove_watchpoint,
 	.hit_watchpoint = aarch64_hit_watchpoint,
 
+	.profiling = aarch64_profiling,
+
 	.commands = aarch64_command_handlers,
 	.target_create = aarch64_target_create,
 	.target_jim_configure = aarch64_jim_configure,
@@ -725,9 +725,12 @@ static int jtag_ap_q_bankselect(struct adiv5_ap *ap, unsigned reg)
 	struct adiv5_dap *dap = ap->dap;
 	uint32_t sel = ((uint32_t)ap->ap_num << 24) | (reg & 0x000000F0);
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		dap->select_hits++;
 		return ERROR_OK;
+	}
 
+	dap->select_misses++;
 	dap->select = sel;
 
 	return jtag_dp_q_write(dap, DP_SELECT, sel);
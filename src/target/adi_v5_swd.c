@@ -120,9 +120,12 @@ static int swd_queue_dp_bankselect(struct adiv5_dap *dap, unsigned int reg)
 	uint32_t sel = select_dp_bank
 			| (dap->select & (DP_SELECT_APSEL | DP_SELECT_APBANK));
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		dap->select_hits++;
 		return ERROR_OK;
+	}
 
+	dap->select_misses++;
 	dap->select = sel;
 
 	int retval = swd_queue_dp_write_inner(dap, DP_SELECT, sel);
@@ -478,9 +481,12 @@ static int swd_queue_ap_bankselect(struct adiv5_ap *ap, unsigned reg)
 			| (reg & 0x000000F0)
 			| (dap->select & DP_SELECT_DPBANK);
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		dap->select_hits++;
 		return ERROR_OK;
+	}
 
+	dap->select_misses++;
 	dap->select = sel;
 
 	int retval = swd_queue_dp_write_inner(dap, DP_SELECT, sel);
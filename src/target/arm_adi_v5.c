@@ -105,7 +105,10 @@ static int mem_ap_setup_csw(struct adiv5_ap *ap, uint32_t csw)
 {
 	csw |= ap->csw_default;
 
-	if (csw != ap->csw_value) {
+	if (csw == ap->csw_value) {
+		ap->csw_hits++;
+	} else {
+		ap->csw_misses++;
 		/* LOG_DEBUG("DAP: Set CSW %x",csw); */
 		int retval = dap_queue_ap_write(ap, MEM_AP_REG_CSW, csw);
 		if (retval != ERROR_OK) {
@@ -119,7 +122,10 @@ static int mem_ap_setup_csw(struct adiv5_ap *ap, uint32_t csw)
 
 static int mem_ap_setup_tar(struct adiv5_ap *ap, target_addr_t tar)
 {
-	if (!ap->tar_valid || tar != ap->tar_value) {
+	if (ap->tar_valid && tar == ap->tar_value) {
+		ap->tar_hits++;
+	} else {
+		ap->tar_misses++;
 		/* LOG_DEBUG("DAP: Set TAR %x",tar); */
 		int retval = dap_queue_ap_write(ap, MEM_AP_REG_TAR, (uint32_t)(tar & 0xffffffffUL));
 		if (retval == ERROR_OK && is_64bit_ap(ap)) {
@@ -641,6 +647,19 @@ int mem_ap_write_buf_noincr(struct adiv5_ap *ap,
 
 /*--------------------------------------------------------------------------*/
 
+/**
+ * Invalidate cached TAR and CSW of a MEM-AP, forcing them to be written
+ * on the next memory access.
+ *
+ * The cache survives dap_run(); call this only when the registers may
+ * have changed behind our back.
+ */
+void mem_ap_invalidate_cache(struct adiv5_ap *ap)
+{
+	ap->tar_valid = false;
+	ap->csw_value = 0;
+}
+
 /**
  * Invalidate cached DP select and cached TAR and CSW of all APs
  */
@@ -649,12 +668,8 @@ void dap_invalidate_cache(struct adiv5_dap *dap)
 	dap->select = DP_SELECT_INVALID;
 	dap->last_read = NULL;
 
-	int i;
-	for (i = 0; i <= DP_APSEL_MAX; i++) {
-		/* force csw and tar write on the next mem-ap access */
-		dap->ap[i].tar_valid = false;
-		dap->ap[i].csw_value = 0;
-	}
+	for (int i = 0; i <= DP_APSEL_MAX; i++)
+		mem_ap_invalidate_cache(&dap->ap[i]);
 }
 
 /**
@@ -789,8 +804,7 @@ int mem_ap_init(struct adiv5_ap *ap)
 		return retval;
 
 	ap->cfg_reg = cfg;
-	ap->tar_valid = false;
-	ap->csw_value = 0;      /* force csw and tar write */
+	mem_ap_invalidate_cache(ap);
 	retval = mem_ap_setup_transfer(ap, CSW_8BIT | CSW_ADDRINC_PACKED, 0);
 	if (retval != ERROR_OK)
 		return retval;
@@ -2363,6 +2377,9 @@ COMMAND_HANDLER(dap_apreg_command)
 	} else {
 		retval = dap_queue_ap_read(ap, reg, &value);
 	}
+	/* a DRW access may auto-increment TAR */
+	if (reg == MEM_AP_REG_DRW)
+		mem_ap_update_tar_cache(ap);
 	if (retval == ERROR_OK)
 		retval = dap_run(dap);
 
@@ -2399,6 +2416,11 @@ COMMAND_HANDLER(dap_dpreg_command)
 	if (retval == ERROR_OK)
 		retval = dap_run(dap);
 
+	/* A raw DP write can change SELECT, abort a transfer or power down
+	 * the debug domain: don't trust the cached registers any more. */
+	if (CMD_ARGC == 2)
+		dap_invalidate_cache(dap);
+
 	if (retval != ERROR_OK)
 		return retval;
 
@@ -2408,6 +2430,51 @@ COMMAND_HANDLER(dap_dpreg_command)
 	return retval;
 }
 
+COMMAND_HANDLER(dap_cache_stats_command)
+{
+	struct adiv5_dap *dap = adiv5_get_dap(CMD_DATA);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset"))
+			return ERROR_COMMAND_SYNTAX_ERROR;
+
+		dap->select_hits = 0;
+		dap->select_misses = 0;
+		for (int i = 0; i <= DP_APSEL_MAX; i++) {
+			struct adiv5_ap *ap = dap_ap(dap, i);
+			ap->csw_hits = 0;
+			ap->csw_misses = 0;
+			ap->tar_hits = 0;
+			ap->tar_misses = 0;
+		}
+		return ERROR_OK;
+	}
+
+	uint64_t saved = dap->select_hits;
+
+	command_print(CMD, "SELECT: %" PRIu64 " hits, %" PRIu64 " misses",
+		dap->select_hits, dap->select_misses);
+
+	for (int i = 0; i <= DP_APSEL_MAX; i++) {
+		struct adiv5_ap *ap = dap_ap(dap, i);
+
+		if (!ap->csw_hits && !ap->csw_misses && !ap->tar_hits && !ap->tar_misses)
+			continue;
+
+		command_print(CMD, "AP %d: CSW %" PRIu64 " hits, %" PRIu64 " misses, "
+			"TAR %" PRIu64 " hits, %" PRIu64 " misses", i,
+			ap->csw_hits, ap->csw_misses, ap->tar_hits, ap->tar_misses);
+		saved += ap->csw_hits + ap->tar_hits;
+	}
+
+	command_print(CMD, "saved register writes: %" PRIu64, saved);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(dap_ti_be_32_quirks_command)
 {
 	struct adiv5_dap *dap = adiv5_get_dap(CMD_DATA);
@@ -2480,6 +2547,14 @@ const struct command_registration dap_instance_commands[] = {
 			"bus access [0-255]",
 		.usage = "[cycles]",
 	},
+	{
+		.name = "cache_stats",
+		.handler = dap_cache_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or reset statistics of the cached "
+			"SELECT, CSW and TAR registers",
+		.usage = "[reset]",
+	},
 	{
 		.name = "ti_be_32_quirks",
 		.handler = dap_ti_be_32_quirks_command,
@@ -259,6 +259,13 @@ struct adiv5_ap {
 
 	/* MEM AP configuration register indicating LPAE support */
 	uint32_t cfg_reg;
+
+	/* Number of CSW and TAR writes avoided (hits) and done (misses) thanks
+	 * to csw_value and tar_value, see "$dap_name cache_stats" */
+	uint64_t csw_hits;
+	uint64_t csw_misses;
+	uint64_t tar_hits;
+	uint64_t tar_misses;
 };
 
 
@@ -305,6 +312,10 @@ struct adiv5_dap {
 	 */
 	uint32_t select;
 
+	/* Number of DP_SELECT writes avoided (hits) and done (misses) */
+	uint64_t select_hits;
+	uint64_t select_misses;
+
 	/* information about current pending SWjDP-AHBAP transaction */
 	uint8_t  ack;
 
@@ -522,6 +533,9 @@ static inline int dap_queue_ap_abort(struct adiv5_dap *dap, uint8_t *ack)
 	return dap->ops->queue_ap_abort(dap, ack);
 }
 
+/* Invalidate cached DP select and cached TAR and CSW of all APs */
+void dap_invalidate_cache(struct adiv5_dap *dap);
+
 /**
  * Perform all queued DAP operations, and clear any errors posted in the
  * CTRL_STAT register when they are done.  Note that if more than one AP
@@ -535,7 +549,14 @@ static inline int dap_queue_ap_abort(struct adiv5_dap *dap, uint8_t *ack)
 static inline int dap_run(struct adiv5_dap *dap)
 {
 	assert(dap->ops);
-	return dap->ops->run(dap);
+	int retval = dap->ops->run(dap);
+
+	/* After a fault (sticky error, WAIT timeout, lost power) part of the
+	 * queue was not executed, so the cached registers can't be trusted. */
+	if (retval != ERROR_OK)
+		dap_invalidate_cache(dap);
+
+	return retval;
 }
 
 static inline int dap_sync(struct adiv5_dap *dap)
@@ -616,8 +637,8 @@ int dap_dp_init(struct adiv5_dap *dap);
 int dap_dp_init_or_reconnect(struct adiv5_dap *dap);
 int mem_ap_init(struct adiv5_ap *ap);
 
-/* Invalidate cached DP select and cached TAR and CSW of all APs */
-void dap_invalidate_cache(struct adiv5_dap *dap);
+/* Invalidate cached TAR and CSW of a MEM-AP */
+void mem_ap_invalidate_cache(struct adiv5_ap *ap);
 
 /* Probe Access Ports to find a particular type */
 int dap_find_ap(struct adiv5_dap *dap,
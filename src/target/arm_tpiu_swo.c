@@ -30,6 +30,7 @@
 #include <helper/jim-nvp.h>
 #include <helper/list.h>
 #include <helper/log.h>
+#include <helper/time_support.h>
 #include <helper/types.h>
 #include <jtag/interface.h>
 #include <server/server.h>
@@ -112,6 +113,15 @@ struct arm_tpiu_swo_object {
 	char *out_filename;
 	/** track TCP connections */
 	struct list_head connections;
+	/** captured trace data, ARM_TPIU_SWO_RING_SIZE bytes */
+	uint8_t *ring;
+	/** bytes captured since the output was opened */
+	uint64_t captured;
+	/** number of polls that returned trace data */
+	uint64_t polls;
+	/** the file has data not flushed yet */
+	bool file_dirty;
+	int64_t file_flush_time;
 	/* START_DEPRECATED_TPIU */
 	bool recheck_ap_cur_target;
 	/* END_DEPRECATED_TPIU */
@@ -120,6 +130,11 @@ struct arm_tpiu_swo_object {
 struct arm_tpiu_swo_connection {
 	struct list_head lh;
 	struct connection *connection;
+	/** position in the captured data of the next byte to send */
+	uint64_t cursor;
+	uint64_t sent;
+	/** bytes overwritten in the ring before they could be sent */
+	uint64_t dropped;
 };
 
 struct arm_tpiu_swo_priv_connection {
@@ -130,32 +145,87 @@ static LIST_HEAD(all_tpiu_swo);
 
 #define ARM_TPIU_SWO_TRACE_BUF_SIZE	4096
 
+/*
+ * The captured trace data is kept in a ring buffer, read by each sink at its
+ * own pace. OpenOCD runs in a single thread, so the capture position and the
+ * cursor of each sink are plain byte counters since the capture started and
+ * no locking is needed. A TCP client that falls more than the ring size
+ * behind loses the oldest data instead of stalling the capture.
+ */
+#define ARM_TPIU_SWO_RING_SIZE		(1024 * 1024)
+
+/* The output file is flushed at most this often */
+#define ARM_TPIU_SWO_FILE_FLUSH_MS	500
+
+static void arm_tpiu_swo_connection_send(struct arm_tpiu_swo_object *obj,
+	struct arm_tpiu_swo_connection *c)
+{
+	if (obj->captured - c->cursor > ARM_TPIU_SWO_RING_SIZE) {
+		uint64_t lost = obj->captured - ARM_TPIU_SWO_RING_SIZE - c->cursor;
+		if (!c->dropped)
+			LOG_WARNING("TPIU/SWO %s: trace client too slow, dropping data", obj->name);
+		c->dropped += lost;
+		c->cursor += lost;
+	}
+
+	while (c->cursor != obj->captured) {
+		size_t offset = c->cursor % ARM_TPIU_SWO_RING_SIZE;
+		size_t len = MIN(obj->captured - c->cursor, ARM_TPIU_SWO_RING_SIZE - offset);
+
+		/* the socket is non-blocking: send what fits, the rest waits for
+		 * the next poll */
+		int written = connection_write(c->connection, obj->ring + offset, len);
+		if (written < 0 && !socket_would_block())
+			LOG_DEBUG("TPIU/SWO %s: error writing to trace client", obj->name);
+		if (written <= 0)
+			break;
+
+		c->cursor += written;
+		c->sent += written;
+	}
+}
+
 static int arm_tpiu_swo_poll_trace(void *priv)
 {
 	struct arm_tpiu_swo_object *obj = priv;
-	uint8_t buf[ARM_TPIU_SWO_TRACE_BUF_SIZE];
-	size_t size = sizeof(buf);
+	size_t offset = obj->captured % ARM_TPIU_SWO_RING_SIZE;
+	/* capture straight into the ring, up to its end */
+	uint8_t *buf = obj->ring + offset;
+	size_t size = MIN(ARM_TPIU_SWO_TRACE_BUF_SIZE, ARM_TPIU_SWO_RING_SIZE - offset);
 	struct arm_tpiu_swo_connection *c;
 
 	int retval = adapter_poll_trace(buf, &size);
-	if (retval != ERROR_OK || !size)
+	if (retval != ERROR_OK)
 		return retval;
 
-	target_call_trace_callbacks(/*target*/NULL, size, buf);
+	if (size) {
+		obj->captured += size;
+		obj->polls++;
 
-	if (obj->file) {
-		if (fwrite(buf, 1, size, obj->file) == size) {
+		target_call_trace_callbacks(/*target*/NULL, size, buf);
+
+		if (obj->file) {
+			if (fwrite(buf, 1, size, obj->file) != size) {
+				LOG_ERROR("Error writing to the SWO trace destination file");
+				return ERROR_FAIL;
+			}
+			obj->file_dirty = true;
+		}
+	}
+
+	if (obj->file_dirty) {
+		int64_t now = timeval_ms();
+		if (now - obj->file_flush_time >= ARM_TPIU_SWO_FILE_FLUSH_MS) {
 			fflush(obj->file);
-		} else {
-			LOG_ERROR("Error writing to the SWO trace destination file");
-			return ERROR_FAIL;
+			obj->file_dirty = false;
+			obj->file_flush_time = now;
 		}
 	}
 
+	/* also when nothing new came in, for the clients still catching up */
 	if (obj->out_filename && obj->out_filename[0] == ':')
 		list_for_each_entry(c, &obj->connections, lh)
-			if (connection_write(c->connection, buf, size) != (int)size)
-				LOG_ERROR("Error writing to connection"); /* FIXME: which connection? */
+			arm_tpiu_swo_connection_send(obj, c);
 
 	return ERROR_OK;
 }
@@ -200,8 +270,11 @@ static void arm_tpiu_swo_close_output(struct arm_tpiu_swo_object *obj)
 		fclose(obj->file);
 		obj->file = NULL;
 	}
+	obj->file_dirty = false;
 	if (obj->out_filename && obj->out_filename[0] == ':')
 		remove_service(TCP_SERVICE_NAME, &obj->out_filename[1]);
+	free(obj->ring);
+	obj->ring = NULL;
 }
 
 int arm_tpiu_swo_cleanup_all(void)
@@ -251,7 +324,13 @@ static int arm_tpiu_swo_service_new_connection(struct connection *connection)
 		return ERROR_FAIL;
 	}
 	c->connection = connection;
-	list_add(&c->lh, &obj->connections);
+	/* accepted sockets are blocking, a slow client would stall the capture */
+	socket_nonblock(connection->fd);
+	/* new clients get the live trace, not the backlog */
+	c->cursor = obj->captured;
+	c->sent = 0;
+	c->dropped = 0;
+	list_add_tail(&c->lh, &obj->connections);
 	return ERROR_OK;
 }
 
@@ -287,6 +366,32 @@ static int arm_tpiu_swo_service_connection_closed(struct connection *connection)
 	return ERROR_FAIL;
 }
 
+COMMAND_HANDLER(handle_arm_tpiu_swo_stats)
+{
+	struct arm_tpiu_swo_object *obj = CMD_DATA;
+	struct arm_tpiu_swo_connection *c;
+	unsigned int i = 0;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!obj->ring) {
+		command_print(CMD, "TPIU/SWO %s is not capturing trace data", obj->name);
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "captured %" PRIu64 " bytes in %" PRIu64 " polls, ring buffer %u bytes",
+		obj->captured, obj->polls, ARM_TPIU_SWO_RING_SIZE);
+
+	list_for_each_entry(c, &obj->connections, lh) {
+		uint64_t pending = MIN(obj->captured - c->cursor, ARM_TPIU_SWO_RING_SIZE);
+		command_print(CMD, "client %u: sent %" PRIu64 ", pending %" PRIu64 ", dropped %" PRIu64,
+			i++, c->sent, pending, c->dropped + (obj->captured - c->cursor - pending));
+	}
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_arm_tpiu_swo_event_list)
 {
 	struct arm_tpiu_swo_object *obj = CMD_DATA;
@@ -699,10 +804,21 @@ static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const
 	unsigned int swo_pin_freq = obj->swo_pin_freq; /* could be replaced */
 
 	if (obj->out_filename && strcmp(obj->out_filename, "external") && obj->out_filename[0]) {
+		obj->ring = malloc(ARM_TPIU_SWO_RING_SIZE);
+		if (!obj->ring) {
+			LOG_ERROR("Out of memory");
+			return JIM_ERR;
+		}
+		obj->captured = 0;
+		obj->polls = 0;
+		obj->file_flush_time = timeval_ms();
+
 		if (obj->out_filename[0] == ':') {
 			struct arm_tpiu_swo_priv_connection *priv = malloc(sizeof(*priv));
 			if (!priv) {
 				LOG_ERROR("Out of memory");
+				free(obj->ring);
+				obj->ring = NULL;
 				return JIM_ERR;
 			}
 			priv->obj = obj;
@@ -711,12 +827,16 @@ static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const
 				CONNECTION_LIMIT_UNLIMITED, priv);
 			if (retval != ERROR_OK) {
 				LOG_ERROR("Can't configure trace TCP port %s", &obj->out_filename[1]);
+				free(obj->ring);
+				obj->ring = NULL;
 				return JIM_ERR;
 			}
 		} else if (strcmp(obj->out_filename, "-")) {
 			obj->file = fopen(obj->out_filename, "ab");
 			if (!obj->file) {
 				LOG_ERROR("Can't open trace destination file \"%s\"", obj->out_filename);
+				free(obj->ring);
+				obj->ring = NULL;
 				return JIM_ERR;
 			}
 		}
@@ -873,6 +993,13 @@ static const struct command_registration arm_tpiu_swo_instance_command_handlers[
 		.help = "displays a table of events defined for this TPIU/SWO",
 		.usage = "",
 	},
+	{
+		.name = "stats",
+		.mode = COMMAND_EXEC,
+		.handler = handle_arm_tpiu_swo_stats,
+		.help = "displays the trace capture statistics of this TPIU/SWO",
+		.usage = "",
+	},
 	{
 		.name = "enable",
 		.mode = COMMAND_ANY,
@@ -178,6 +178,18 @@ static inline bool is_armv7a(struct armv7a_common *armv7a)
 /* See ARMv7a arch spec section C10.8 */
 #define CPUDBG_AUTHSTATUS	0xFB8
 
+/* See ARMv7a arch spec DDI 0406C C11.11 */
+#define CPUDBG_PCSR_LEGACY	0x084
+#define CPUDBG_PCSR		0x0A0
+#define CPUDBG_DEVID1		0xFC4
+#define CPUDBG_DEVID		0xFC8
+
+#define DIDR_PCSR_IMP		(1 << 13)
+#define DIDR_DEVID_IMP		(1 << 15)
+#define DEVID_PCSAMPLE_MASK	0xF
+#define DEVID1_PCSROFFSET_MASK	0xF
+#define DEVID1_PCSROFFSET_NONE	0x2
+
 /* See ARMv7a arch spec DDI 0406C C11.10 */
 #define CPUDBG_ID_PFR1		0xD24
 
@@ -46,6 +46,7 @@
 #include "semihosting_common.h"
 #include <helper/log.h>
 #include <helper/binarybuffer.h>
+#include <helper/crc32.h>
 
 #if 0
 #define _DEBUG_INSTRUCTION_EXECUTION_
@@ -875,190 +876,211 @@ int armv7m_init_arch_info(struct target *target, struct armv7m_common *armv7m)
 	return arm_init_arch_info(target, arm);
 }
 
-/** Generates a CRC32 checksum of a memory region. */
-int armv7m_checksum_memory(struct target *target,
-	target_addr_t address, uint32_t count, uint32_t *checksum)
+static const uint8_t armv7m_mem_check_code[] = {
+#include "../../contrib/loaders/checksum/armv7m_mem_check.inc"
+};
+
+/* Download the memory check algorithm. Its working area stays allocated
+ * until the working areas are reclaimed, when the target resumes or is
+ * reset, which clears mem_check_algorithm. The code itself is written again
+ * on every call: a host write while halted (load_image, GDB load, mww) may
+ * have overwritten it, and it is only a few words. */
+static int armv7m_load_mem_check(struct target *target)
 {
-	struct working_area *crc_algorithm;
-	struct armv7m_algorithm armv7m_info;
-	struct reg_param reg_params[2];
+	struct armv7m_common *armv7m = target_to_armv7m(target);
 	int retval;
 
-	static const uint8_t cortex_m_crc_code[] = {
-#include "../../contrib/loaders/checksum/armv7m_crc.inc"
-	};
-
-	retval = target_alloc_working_area(target, sizeof(cortex_m_crc_code), &crc_algorithm);
-	if (retval != ERROR_OK)
-		return retval;
-
-	retval = target_write_buffer(target, crc_algorithm->address,
-			sizeof(cortex_m_crc_code), (uint8_t *)cortex_m_crc_code);
-	if (retval != ERROR_OK)
-		goto cleanup;
-
-	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
-	armv7m_info.core_mode = ARM_MODE_THREAD;
-
-	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);
-	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
-
-	buf_set_u32(reg_params[0].value, 0, 32, address);
-	buf_set_u32(reg_params[1].value, 0, 32, count);
-
-	int timeout = 20000 * (1 + (count / (1024 * 1024)));
-
-	retval = target_run_algorithm(target, 0, NULL, 2, reg_params, crc_algorithm->address,
-			crc_algorithm->address + (sizeof(cortex_m_crc_code) - 6),
-			timeout, &armv7m_info);
-
-	if (retval == ERROR_OK)
-		*checksum = buf_get_u32(reg_params[0].value, 0, 32);
-	else
-		LOG_ERROR("error executing cortex_m crc algorithm");
+	if (!armv7m->mem_check_algorithm) {
+		retval = target_alloc_working_area(target, sizeof(armv7m_mem_check_code),
+				&armv7m->mem_check_algorithm);
+		if (retval != ERROR_OK)
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 
-	destroy_reg_param(&reg_params[0]);
-	destroy_reg_param(&reg_params[1]);
+		LOG_DEBUG("memory check algorithm at " TARGET_ADDR_FMT,
+			armv7m->mem_check_algorithm->address);
+	}
 
-cleanup:
-	target_free_working_area(target, crc_algorithm);
+	retval = target_write_buffer(target, armv7m->mem_check_algorithm->address,
+			sizeof(armv7m_mem_check_code), armv7m_mem_check_code);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, armv7m->mem_check_algorithm);
+		return retval;
+	}
 
-	return retval;
+	return ERROR_OK;
 }
 
-/** Checks an array of memory regions whether they are erased. */
-int armv7m_blank_check_memory(struct target *target,
-	struct target_memory_check_block *blocks, int num_blocks, uint8_t erased_value)
+/** Blank checks, checksums and compares a list of memory regions in one run. */
+int armv7m_check_memory_regions(struct target *target,
+	struct target_memory_check_region *regions, unsigned int num_regions)
 {
-	struct working_area *erase_check_algorithm;
-	struct working_area *erase_check_params;
-	struct reg_param reg_params[2];
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct working_area *params_area;
 	struct armv7m_algorithm armv7m_info;
+	struct reg_param reg_params[1];
 	int retval;
 
 	static bool timed_out;
 
-	static const uint8_t erase_check_code[] = {
-#include "../../contrib/loaders/erase_check/armv7m_erase_check.inc"
+	/* must match struct region of armv7m_mem_check.s */
+	struct algo_region {
+		uint32_t op;
+		uint32_t address;
+		uint32_t size;
+		uint32_t arg_result;
 	};
 
-	const uint32_t code_size = sizeof(erase_check_code);
+	retval = armv7m_load_mem_check(target);
+	if (retval != ERROR_OK)
+		return retval;
 
-	/* make sure we have a working area */
-	if (target_alloc_working_area(target, code_size,
-		&erase_check_algorithm) != ERROR_OK)
+	uint32_t avail = target_get_working_area_avail(target);
+	if (avail < 2 * sizeof(struct algo_region))
 		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	unsigned int to_check = MIN(num_regions, avail / sizeof(struct algo_region) - 1);
 
-	retval = target_write_buffer(target, erase_check_algorithm->address,
-			code_size, erase_check_code);
-	if (retval != ERROR_OK)
-		goto cleanup1;
-
-	/* prepare blocks array for algo */
-	struct algo_block {
-		union {
-			uint32_t size;
-			uint32_t result;
-		};
-		uint32_t address;
-	};
+	struct algo_region *params = calloc(to_check + 1, sizeof(*params));
+	if (!params)
+		return ERROR_FAIL;
 
-	uint32_t avail = target_get_working_area_avail(target);
-	int blocks_to_check = avail / sizeof(struct algo_block) - 1;
-	if (num_blocks < blocks_to_check)
-		blocks_to_check = num_blocks;
-
-	struct algo_block *params = malloc((blocks_to_check+1)*sizeof(struct algo_block));
-	if (!params) {
-		retval = ERROR_FAIL;
-		goto cleanup1;
-	}
+	uint64_t crc_bytes = 0, other_bytes = 0;
+	for (unsigned int i = 0; i < to_check; i++) {
+		struct target_memory_check_region *r = &regions[i];
+		uint32_t arg;
 
-	int i;
-	uint32_t total_size = 0;
-	for (i = 0; i < blocks_to_check; i++) {
-		total_size += blocks[i].size;
-		target_buffer_set_u32(target, (uint8_t *)&(params[i].size),
-						blocks[i].size / sizeof(uint32_t));
-		target_buffer_set_u32(target, (uint8_t *)&(params[i].address),
-						blocks[i].address);
+		switch (r->op) {
+		case TARGET_MEMORY_BLANK_CHECK:
+			arg = r->erased_value * 0x01010101u;
+			other_bytes += r->size;
+			break;
+		case TARGET_MEMORY_CRC32:
+			arg = CRC32_INIT;
+			crc_bytes += r->size;
+			break;
+		case TARGET_MEMORY_COMPARE:
+			arg = r->compare_address;
+			other_bytes += r->size;
+			break;
+		default:
+			free(params);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		target_buffer_set_u32(target, (uint8_t *)&params[i].op, r->op);
+		target_buffer_set_u32(target, (uint8_t *)&params[i].address, r->address);
+		/* the blank check runs over whole words */
+		target_buffer_set_u32(target, (uint8_t *)&params[i].size,
+				r->op == TARGET_MEMORY_BLANK_CHECK ? r->size & ~3u : r->size);
+		target_buffer_set_u32(target, (uint8_t *)&params[i].arg_result, arg);
 	}
-	target_buffer_set_u32(target, (uint8_t *)&(params[blocks_to_check].size), 0);
 
-	uint32_t param_size = (blocks_to_check + 1) * sizeof(struct algo_block);
-	if (target_alloc_working_area(target, param_size,
-			&erase_check_params) != ERROR_OK) {
-		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
-		goto cleanup2;
+	uint32_t params_size = (to_check + 1) * sizeof(struct algo_region);
+	retval = target_alloc_working_area(target, params_size, &params_area);
+	if (retval != ERROR_OK) {
+		free(params);
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 	}
 
-	retval = target_write_buffer(target, erase_check_params->address,
-				param_size, (uint8_t *)params);
+	retval = target_write_buffer(target, params_area->address, params_size,
+			(uint8_t *)params);
 	if (retval != ERROR_OK)
-		goto cleanup3;
-
-	uint32_t erased_word = erased_value | (erased_value << 8)
-			       | (erased_value << 16) | (erased_value << 24);
+		goto cleanup;
 
-	LOG_DEBUG("Starting erase check of %d blocks, parameters@"
-		 TARGET_ADDR_FMT, blocks_to_check, erase_check_params->address);
+	LOG_DEBUG("checking %u memory regions, parameters@" TARGET_ADDR_FMT,
+		to_check, params_area->address);
 
 	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
 	armv7m_info.core_mode = ARM_MODE_THREAD;
 
 	init_reg_param(&reg_params[0], "r0", 32, PARAM_OUT);
-	buf_set_u32(reg_params[0].value, 0, 32, erase_check_params->address);
-
-	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
-	buf_set_u32(reg_params[1].value, 0, 32, erased_word);
+	buf_set_u32(reg_params[0].value, 0, 32, params_area->address);
 
 	/* assume CPU clk at least 1 MHz */
-	int timeout = (timed_out ? 30000 : 2000) + total_size * 3 / 1000;
+	int timeout = (timed_out ? 30000 : 2000) + crc_bytes / 50 + other_bytes * 3 / 1000;
 
-	retval = target_run_algorithm(target,
-				0, NULL,
-				ARRAY_SIZE(reg_params), reg_params,
-				erase_check_algorithm->address,
-				erase_check_algorithm->address + (code_size - 2),
-				timeout,
-				&armv7m_info);
+	struct working_area *code = armv7m->mem_check_algorithm;
+	retval = target_run_algorithm(target, 0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			code->address, code->address + sizeof(armv7m_mem_check_code) - 2,
+			timeout, &armv7m_info);
+	destroy_reg_param(&reg_params[0]);
 
 	timed_out = retval == ERROR_TARGET_TIMEOUT;
-	if (retval != ERROR_OK && !timed_out)
-		goto cleanup4;
+	if (retval != ERROR_OK && !timed_out) {
+		LOG_ERROR("error executing cortex_m memory check algorithm");
+		goto cleanup;
+	}
 
-	retval = target_read_buffer(target, erase_check_params->address,
-				param_size, (uint8_t *)params);
+	retval = target_read_buffer(target, params_area->address, params_size,
+			(uint8_t *)params);
 	if (retval != ERROR_OK)
-		goto cleanup4;
+		goto cleanup;
 
-	for (i = 0; i < blocks_to_check; i++) {
-		uint32_t result = target_buffer_get_u32(target,
-					(uint8_t *)&(params[i].result));
-		if (result != 0 && result != 1)
+	/* the algorithm clears the op of the regions it is done with */
+	unsigned int i;
+	for (i = 0; i < to_check; i++) {
+		if (target_buffer_get_u32(target, (uint8_t *)&params[i].op) != 0)
 			break;
-
-		blocks[i].result = result;
+		regions[i].result = target_buffer_get_u32(target,
+				(uint8_t *)&params[i].arg_result);
 	}
-	if (i && timed_out)
-		LOG_INFO("Slow CPU clock: %d blocks checked, %d remain. Continuing...", i, num_blocks-i);
-
-	retval = i;		/* return number of blocks really checked */
+	if (timed_out)
+		LOG_INFO("Slow CPU clock: %u memory regions checked, %u remain. Continuing...",
+			i, num_regions - i);
 
-cleanup4:
-	destroy_reg_param(&reg_params[0]);
-	destroy_reg_param(&reg_params[1]);
+	retval = i ? (int)i : ERROR_TARGET_TIMEOUT;
 
-cleanup3:
-	target_free_working_area(target, erase_check_params);
-cleanup2:
+cleanup:
+	target_free_working_area(target, params_area);
 	free(params);
-cleanup1:
-	target_free_working_area(target, erase_check_algorithm);
 
 	return retval;
 }
 
+/** Generates a CRC32 checksum of a memory region. */
+int armv7m_checksum_memory(struct target *target,
+	target_addr_t address, uint32_t count, uint32_t *checksum)
+{
+	struct target_memory_check_region region = {
+		.op = TARGET_MEMORY_CRC32,
+		.address = address,
+		.size = count,
+	};
+
+	int retval = armv7m_check_memory_regions(target, &region, 1);
+	if (retval < 0)
+		return retval;
+
+	*checksum = region.result;
+	return ERROR_OK;
+}
+
+/** Checks an array of memory regions whether they are erased. */
+int armv7m_blank_check_memory(struct target *target,
+	struct target_memory_check_block *blocks, int num_blocks, uint8_t erased_value)
+{
+	if (num_blocks < 1)
+		return 0;
+
+	struct target_memory_check_region *regions = calloc(num_blocks, sizeof(*regions));
+	if (!regions)
+		return ERROR_FAIL;
+
+	for (int i = 0; i < num_blocks; i++) {
+		regions[i].op = TARGET_MEMORY_BLANK_CHECK;
+		regions[i].address = blocks[i].address;
+		regions[i].size = blocks[i].size;
+		regions[i].erased_value = erased_value;
+	}
+
+	int retval = armv7m_check_memory_regions(target, regions, num_blocks);
+	for (int i = 0; i < retval; i++)
+		blocks[i].result = regions[i].result;
+	free(regions);
+
+	return retval;	/* number of blocks really checked */
+}
+
 int armv7m_maybe_skip_bkpt_inst(struct target *target, bool *inst_found)
 {
 	struct armv7m_common *armv7m = target_to_armv7m(target);
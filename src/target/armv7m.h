@@ -245,6 +245,10 @@ struct armv7m_common {
 
 	struct armv7m_trace_config trace_config;
 
+	/* working area of the memory check algorithm, kept allocated between
+	 * runs and cleared when the working areas are reclaimed */
+	struct working_area *mem_check_algorithm;
+
 	/* Direct processor core register read and writes */
 	int (*load_core_reg_u32)(struct target *target, uint32_t regsel, uint32_t *value);
 	int (*store_core_reg_u32)(struct target *target, uint32_t regsel, uint32_t value);
@@ -351,6 +355,8 @@ int armv7m_checksum_memory(struct target *target,
 		target_addr_t address, uint32_t count, uint32_t *checksum);
 int armv7m_blank_check_memory(struct target *target,
 		struct target_memory_check_block *blocks, int num_blocks, uint8_t erased_value);
+int armv7m_check_memory_regions(struct target *target,
+		struct target_memory_check_region *regions, unsigned int num_regions);
 
 int armv7m_maybe_skip_bkpt_inst(struct target *target, bool *inst_found);
 
@@ -24,7 +24,9 @@
 #include <target/cortex_m.h>
 #include <target/armv7m_trace.h>
 #include <jtag/interface.h>
+#include <helper/list.h>
 #include <helper/time_support.h>
+#include <server/server.h>
 
 int armv7m_trace_itm_config(struct target *target)
 {
@@ -83,6 +85,431 @@ int armv7m_trace_itm_config(struct target *target)
 	return ERROR_OK;
 }
 
+/* ITM/DWT packet headers, see ARMv7-M ARM, Appendix D4 */
+#define ITM_PKT_OVERFLOW		0x70
+#define ITM_PKT_SIZE_MASK		0x03
+#define ITM_PKT_HW_SOURCE		BIT(2)
+#define ITM_PKT_DISC(header)	(((header) >> 3) & 0x1f)
+#define ITM_PKT_CONTINUATION	BIT(7)
+#define ITM_PKT_GTS1			0x94
+#define ITM_PKT_GTS2			0xb4
+#define DWT_DISC_EXCEPTION		1
+#define DWT_DISC_PC_SAMPLE		2
+#define DWT_DISC_DATA_TRACE_FIRST	8
+#define DWT_DISC_DATA_VALUE_FIRST	16
+#define DWT_DISC_DATA_TRACE_LAST	23
+
+void armv7m_itm_decoder_init(struct armv7m_itm_decoder *decoder)
+{
+	decoder->local_time = 0;
+	decoder->global_time = 0;
+	decoder->packets = 0;
+	decoder->overflows = 0;
+	decoder->syncs = 0;
+	decoder->payload_len = 0;
+	decoder->payload_pos = 0;
+	decoder->in_continuation = false;
+	decoder->zeros = 0;
+	decoder->page = 0;
+}
+
+static void armv7m_itm_source_packet(struct armv7m_itm_decoder *decoder)
+{
+	unsigned int disc = ITM_PKT_DISC(decoder->header);
+
+	decoder->packets++;
+
+	if (!(decoder->header & ITM_PKT_HW_SOURCE)) {
+		if (decoder->stimulus)
+			decoder->stimulus(decoder->priv, decoder->page * 32 + disc,
+					decoder->payload, decoder->payload_len);
+		return;
+	}
+
+	if (disc == DWT_DISC_EXCEPTION) {
+		if (decoder->exception && decoder->payload_len == 2)
+			decoder->exception(decoder->priv,
+					decoder->payload[0] | (decoder->payload[1] & 1) << 8,
+					(decoder->payload[1] >> 4) & 3);
+	} else if (disc == DWT_DISC_PC_SAMPLE) {
+		if (decoder->pc_sample) {
+			if (decoder->payload_len == 4)
+				decoder->pc_sample(decoder->priv, le_to_h_u32(decoder->payload), false);
+			else
+				decoder->pc_sample(decoder->priv, 0, true);
+		}
+	} else if (disc >= DWT_DISC_DATA_TRACE_FIRST && disc <= DWT_DISC_DATA_TRACE_LAST) {
+		if (!decoder->data_trace)
+			return;
+
+		uint32_t value = 0;
+		for (unsigned int i = 0; i < decoder->payload_len; i++)
+			value |= (uint32_t)decoder->payload[i] << (8 * i);
+
+		enum armv7m_itm_data_trace type;
+		if (disc < DWT_DISC_DATA_VALUE_FIRST)
+			type = (disc & 1) ? ITM_DATA_TRACE_ADDRESS : ITM_DATA_TRACE_PC;
+		else
+			type = (disc & 1) ? ITM_DATA_TRACE_WRITE : ITM_DATA_TRACE_READ;
+		decoder->data_trace(decoder->priv, type, (disc >> 1) & 3, value);
+	}
+}
+
+/* Timestamp and extension packets, once their last byte arrived */
+static void armv7m_itm_continuation_packet(struct armv7m_itm_decoder *decoder)
+{
+	uint8_t header = decoder->header;
+	uint64_t value = decoder->continuation_value;
+
+	decoder->packets++;
+
+	if ((header & 0xcf) == 0xc0) {
+		/* local timestamp, format 1 */
+		decoder->local_time += value;
+	} else if (header == ITM_PKT_GTS1) {
+		/* bits [25:0] of the global timestamp */
+		decoder->global_time = (decoder->global_time & ~0x3ffffffULL) | (value & 0x3ffffff);
+	} else if (header == ITM_PKT_GTS2) {
+		/* the upper bits */
+		decoder->global_time = (decoder->global_time & 0x3ffffff) | (value << 26);
+	} else if ((header & 0x0f) == 0x08) {
+		/* stimulus port page for the following instrumentation packets */
+		decoder->page = (header >> 4) & 7;
+	}
+}
+
+void armv7m_itm_decode(struct armv7m_itm_decoder *decoder,
+		const uint8_t *data, size_t len)
+{
+	static const unsigned int payload_size[] = { 0, 1, 2, 4 };
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t byte = data[i];
+
+		if (decoder->payload_pos < decoder->payload_len) {
+			decoder->payload[decoder->payload_pos++] = byte;
+			if (decoder->payload_pos == decoder->payload_len)
+				armv7m_itm_source_packet(decoder);
+			continue;
+		}
+
+		/* timestamp and extension payloads end with a byte without C bit */
+		if (decoder->in_continuation) {
+			if (decoder->continuation_shift < 64)
+				decoder->continuation_value |= (uint64_t)(byte & 0x7f) << decoder->continuation_shift;
+			decoder->continuation_shift += 7;
+			decoder->in_continuation = byte & ITM_PKT_CONTINUATION;
+			if (!decoder->in_continuation)
+				armv7m_itm_continuation_packet(decoder);
+			continue;
+		}
+
+		/* synchronization: at least 47 zero bits followed by a one */
+		if (byte == 0) {
+			decoder->zeros++;
+			continue;
+		}
+		if (byte == 0x80 && decoder->zeros >= 5) {
+			decoder->zeros = 0;
+			decoder->syncs++;
+			continue;
+		}
+		decoder->zeros = 0;
+
+		decoder->header = byte;
+		decoder->payload_len = 0;
+		decoder->payload_pos = 0;
+
+		if (byte & ITM_PKT_SIZE_MASK) {
+			/* instrumentation or hardware source packet */
+			decoder->payload_len = payload_size[byte & ITM_PKT_SIZE_MASK];
+		} else if (byte == ITM_PKT_OVERFLOW) {
+			LOG_DEBUG("ITM overflow");
+			decoder->packets++;
+			decoder->overflows++;
+			if (decoder->overflow)
+				decoder->overflow(decoder->priv);
+		} else if ((byte & 0x8f) == 0) {
+			/* local timestamp, format 2: the delta is in the header */
+			decoder->packets++;
+			decoder->local_time += (byte >> 4) & 7;
+		} else if ((byte & 0x0f) == 0 || (byte & 0xdf) == ITM_PKT_GTS1 || (byte & 0x0b) == 0x08) {
+			/* local/global timestamp or extension */
+			decoder->continuation_value = 0;
+			decoder->continuation_shift = 0;
+			decoder->in_continuation = byte & ITM_PKT_CONTINUATION;
+			if (!decoder->in_continuation)
+				armv7m_itm_continuation_packet(decoder);
+		}
+	}
+}
+
+/* Destination of a demultiplexed stream */
+struct armv7m_itm_sink {
+	/** file name, or ':' followed by a TCP port */
+	char *output;
+	FILE *file;
+	/** clients of the TCP port, list of struct armv7m_itm_connection */
+	struct list_head connections;
+	uint64_t bytes;
+	uint64_t dropped;
+};
+
+struct armv7m_itm_connection {
+	struct list_head lh;
+	struct connection *connection;
+};
+
+#define ITM_DEMUX_SERVICE_NAME	"itm_demux"
+
+static void armv7m_itm_sink_write(struct armv7m_itm_sink *sink, const void *data, size_t size)
+{
+	struct armv7m_itm_connection *c;
+
+	sink->bytes += size;
+
+	if (sink->file) {
+		if (fwrite(data, 1, size, sink->file) != size)
+			sink->dropped += size;
+		return;
+	}
+
+	/* the sockets are non-blocking, a slow client loses data instead of
+	 * stalling the trace capture */
+	list_for_each_entry(c, &sink->connections, lh) {
+		int written = connection_write(c->connection, data, size);
+		if (written < 0) {
+			if (!socket_would_block())
+				LOG_DEBUG("itm demux: error writing to client");
+			written = 0;
+		}
+		sink->dropped += size - written;
+	}
+}
+
+static void armv7m_itm_sink_printf(struct armv7m_itm_sink *sink, const char *format, ...)
+	__attribute__ ((format (PRINTF_ATTRIBUTE_FORMAT, 2, 3)));
+
+static void armv7m_itm_sink_printf(struct armv7m_itm_sink *sink, const char *format, ...)
+{
+	char line[80];
+	va_list ap;
+
+	va_start(ap, format);
+	int len = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+
+	if (len > 0)
+		armv7m_itm_sink_write(sink, line, MIN((size_t)len, sizeof(line) - 1));
+}
+
+static void armv7m_itm_demux_stimulus(void *priv, unsigned int port, const uint8_t *data,
+		unsigned int size)
+{
+	struct armv7m_itm_demux *demux = priv;
+
+	if (port < ARRAY_SIZE(demux->stimulus_sinks) && demux->stimulus_sinks[port])
+		armv7m_itm_sink_write(demux->stimulus_sinks[port], data, size);
+}
+
+static void armv7m_itm_demux_pc_sample(void *priv, uint32_t pc, bool sleeping)
+{
+	struct armv7m_itm_demux *demux = priv;
+
+	if (!demux->dwt_sink)
+		return;
+
+	if (sleeping)
+		armv7m_itm_sink_printf(demux->dwt_sink, "%" PRIu64 " pc sleeping\n",
+				demux->decoder.local_time);
+	else
+		armv7m_itm_sink_printf(demux->dwt_sink, "%" PRIu64 " pc 0x%08" PRIx32 "\n",
+				demux->decoder.local_time, pc);
+}
+
+static void armv7m_itm_demux_exception(void *priv, unsigned int number, unsigned int function)
+{
+	static const char * const function_str[] = { "?", "entry", "exit", "return" };
+	struct armv7m_itm_demux *demux = priv;
+
+	if (demux->dwt_sink)
+		armv7m_itm_sink_printf(demux->dwt_sink, "%" PRIu64 " exception %u %s\n",
+				demux->decoder.local_time, number, function_str[function & 3]);
+}
+
+static void armv7m_itm_demux_data_trace(void *priv, enum armv7m_itm_data_trace type,
+		unsigned int comparator, uint32_t value)
+{
+	static const char * const type_str[] = {
+		[ITM_DATA_TRACE_PC] = "pc",
+		[ITM_DATA_TRACE_ADDRESS] = "address",
+		[ITM_DATA_TRACE_READ] = "read",
+		[ITM_DATA_TRACE_WRITE] = "write",
+	};
+	struct armv7m_itm_demux *demux = priv;
+
+	if (demux->dwt_sink)
+		armv7m_itm_sink_printf(demux->dwt_sink, "%" PRIu64 " data %u %s 0x%08" PRIx32 "\n",
+				demux->decoder.local_time, comparator, type_str[type], value);
+}
+
+static void armv7m_itm_demux_overflow(void *priv)
+{
+	struct armv7m_itm_demux *demux = priv;
+
+	if (demux->dwt_sink)
+		armv7m_itm_sink_printf(demux->dwt_sink, "%" PRIu64 " overflow\n",
+				demux->decoder.local_time);
+}
+
+static int armv7m_itm_demux_trace(struct target *target, size_t len, uint8_t *data, void *priv)
+{
+	struct armv7m_itm_demux *demux = priv;
+
+	armv7m_itm_decode(&demux->decoder, data, len);
+	return ERROR_OK;
+}
+
+static int armv7m_itm_service_new_connection(struct connection *connection)
+{
+	struct armv7m_itm_sink *sink = connection->service->priv;
+	struct armv7m_itm_connection *c = malloc(sizeof(*c));
+
+	if (!c) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	c->connection = connection;
+	/* accepted sockets are blocking, a slow client would stall the decoder */
+	socket_nonblock(connection->fd);
+	list_add_tail(&c->lh, &sink->connections);
+	return ERROR_OK;
+}
+
+static int armv7m_itm_service_input(struct connection *connection)
+{
+	/* read a dummy buffer to check if the connection is still active */
+	long dummy;
+	int bytes_read = connection_read(connection, &dummy, sizeof(dummy));
+
+	if (bytes_read == 0) {
+		return ERROR_SERVER_REMOTE_CLOSED;
+	} else if (bytes_read == -1) {
+		LOG_ERROR("error during read: %s", strerror(errno));
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	return ERROR_OK;
+}
+
+static int armv7m_itm_service_connection_closed(struct connection *connection)
+{
+	struct armv7m_itm_sink *sink = connection->service->priv;
+	struct armv7m_itm_connection *c, *tmp;
+
+	list_for_each_entry_safe(c, tmp, &sink->connections, lh)
+		if (c->connection == connection) {
+			list_del(&c->lh);
+			free(c);
+			return ERROR_OK;
+		}
+	LOG_ERROR("Failed to find connection to close!");
+	return ERROR_FAIL;
+}
+
+static const struct service_driver armv7m_itm_service_driver = {
+	.name = ITM_DEMUX_SERVICE_NAME,
+	.new_connection_during_keep_alive_handler = NULL,
+	.new_connection_handler = armv7m_itm_service_new_connection,
+	.input_handler = armv7m_itm_service_input,
+	.connection_closed_handler = armv7m_itm_service_connection_closed,
+	.keep_client_alive_handler = NULL,
+};
+
+static struct armv7m_itm_sink *armv7m_itm_sink_open(const char *output)
+{
+	struct armv7m_itm_sink *sink = calloc(1, sizeof(*sink));
+	if (!sink) {
+		LOG_ERROR("Out of memory");
+		return NULL;
+	}
+	INIT_LIST_HEAD(&sink->connections);
+
+	sink->output = strdup(output);
+	if (!sink->output) {
+		LOG_ERROR("Out of memory");
+		free(sink);
+		return NULL;
+	}
+
+	if (output[0] == ':') {
+		if (add_service(&armv7m_itm_service_driver, &output[1],
+					CONNECTION_LIMIT_UNLIMITED, sink) != ERROR_OK) {
+			LOG_ERROR("Can't open ITM TCP port %s", &output[1]);
+			free(sink->output);
+			free(sink);
+			return NULL;
+		}
+	} else {
+		sink->file = fopen(output, "ab");
+		if (!sink->file) {
+			LOG_ERROR("Can't open ITM destination file \"%s\"", output);
+			free(sink->output);
+			free(sink);
+			return NULL;
+		}
+		/* stimulus ports mostly carry text, keep the file readable
+		 * while it grows without flushing on every poll */
+		setvbuf(sink->file, NULL, _IOLBF, 0);
+	}
+
+	return sink;
+}
+
+static void armv7m_itm_sink_close(struct armv7m_itm_sink *sink)
+{
+	if (!sink)
+		return;
+
+	if (sink->file)
+		fclose(sink->file);
+	else
+		remove_service(ITM_DEMUX_SERVICE_NAME, &sink->output[1]);
+
+	free(sink->output);
+	free(sink);
+}
+
+static bool armv7m_itm_demux_empty(struct armv7m_itm_demux *demux)
+{
+	if (demux->dwt_sink)
+		return false;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(demux->stimulus_sinks); i++)
+		if (demux->stimulus_sinks[i])
+			return false;
+
+	return true;
+}
+
+void armv7m_trace_free(struct target *target)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_itm_demux *demux = armv7m->trace_config.itm_demux;
+
+	if (!demux)
+		return;
+
+	target_unregister_trace_callback(armv7m_itm_demux_trace, demux);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(demux->stimulus_sinks); i++)
+		armv7m_itm_sink_close(demux->stimulus_sinks[i]);
+	armv7m_itm_sink_close(demux->dwt_sink);
+
+	free(demux);
+	armv7m->trace_config.itm_demux = NULL;
+}
+
 COMMAND_HANDLER(handle_itm_port_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -130,6 +557,102 @@ COMMAND_HANDLER(handle_itm_ports_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_itm_profiling_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], armv7m->trace_config.itm_profiling);
+
+	command_print(CMD, "ITM profiling %s",
+		armv7m->trace_config.itm_profiling ? "on" : "off");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_itm_demux_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_itm_demux *demux = armv7m->trace_config.itm_demux;
+	struct armv7m_itm_sink *sink;
+	unsigned int port = 0;
+	int retval = ERROR_OK;
+
+	if (CMD_ARGC == 0) {
+		if (!demux) {
+			command_print(CMD, "ITM demultiplexer off");
+			return ERROR_OK;
+		}
+
+		command_print(CMD, "%" PRIu64 " packets, %" PRIu64 " overflows, %" PRIu64 " syncs",
+			demux->decoder.packets, demux->decoder.overflows, demux->decoder.syncs);
+		for (port = 0; port < ARRAY_SIZE(demux->stimulus_sinks); port++) {
+			sink = demux->stimulus_sinks[port];
+			if (sink)
+				command_print(CMD, "port %u: %s, %" PRIu64 " bytes, %" PRIu64 " dropped",
+					port, sink->output, sink->bytes, sink->dropped);
+		}
+		sink = demux->dwt_sink;
+		if (sink)
+			command_print(CMD, "dwt: %s, %" PRIu64 " bytes, %" PRIu64 " dropped",
+				sink->output, sink->bytes, sink->dropped);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	bool dwt = !strcmp(CMD_ARGV[0], "dwt");
+	if (!dwt) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], port);
+		if (port >= ARRAY_SIZE(demux->stimulus_sinks)) {
+			command_print(CMD, "invalid stimulus port %u", port);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+	}
+	bool off = !strcmp(CMD_ARGV[1], "off");
+
+	if (!demux) {
+		if (off)
+			return ERROR_OK;
+
+		demux = calloc(1, sizeof(*demux));
+		if (!demux) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		demux->decoder.stimulus = armv7m_itm_demux_stimulus;
+		demux->decoder.pc_sample = armv7m_itm_demux_pc_sample;
+		demux->decoder.exception = armv7m_itm_demux_exception;
+		demux->decoder.data_trace = armv7m_itm_demux_data_trace;
+		demux->decoder.overflow = armv7m_itm_demux_overflow;
+		demux->decoder.priv = demux;
+		armv7m_itm_decoder_init(&demux->decoder);
+
+		armv7m->trace_config.itm_demux = demux;
+		target_register_trace_callback(armv7m_itm_demux_trace, demux);
+	}
+
+	struct armv7m_itm_sink **slot = dwt ? &demux->dwt_sink : &demux->stimulus_sinks[port];
+	armv7m_itm_sink_close(*slot);
+	*slot = NULL;
+
+	if (!off) {
+		*slot = armv7m_itm_sink_open(CMD_ARGV[1]);
+		if (!*slot)
+			retval = ERROR_FAIL;
+	}
+
+	if (armv7m_itm_demux_empty(demux))
+		armv7m_trace_free(target);
+
+	return retval;
+}
+
 static const struct command_registration itm_command_handlers[] = {
 	{
 		.name = "port",
@@ -145,6 +668,22 @@ static const struct command_registration itm_command_handlers[] = {
 		.help = "Enable or disable all ITM stimulus ports",
 		.usage = "(0|1|on|off)",
 	},
+	{
+		.name = "profiling",
+		.handler = handle_itm_profiling_command,
+		.mode = COMMAND_ANY,
+		.help = "Take profile samples from DWT PC sample packets on SWO "
+			"instead of reading DWT_PCSR",
+		.usage = "[(0|1|on|off)]",
+	},
+	{
+		.name = "demux",
+		.handler = handle_itm_demux_command,
+		.mode = COMMAND_EXEC,
+		.help = "Decode the SWO trace and send the data of an ITM stimulus "
+			"port, or a log of the DWT packets, to a file or a TCP port",
+		.usage = "[(port|'dwt') (filename|:tcp_port|'off')]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
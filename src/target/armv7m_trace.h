@@ -48,10 +48,87 @@ struct armv7m_trace_config {
 	bool itm_synchro_packets;
 	/** Config ITM after target examine */
 	bool itm_deferred_config;
+	/** Profile with DWT PC sample packets received over SWO */
+	bool itm_profiling;
+	/** Destinations of the decoded SWO trace, see armv7m_itm_demux */
+	struct armv7m_itm_demux *itm_demux;
 };
 
+enum armv7m_itm_data_trace {
+	ITM_DATA_TRACE_PC,		/**< PC of a data access matching a comparator */
+	ITM_DATA_TRACE_ADDRESS,	/**< low 16 bits of the address of the access */
+	ITM_DATA_TRACE_READ,	/**< value read */
+	ITM_DATA_TRACE_WRITE,	/**< value written */
+};
+
+/**
+ * Streaming decoder for the ITM/DWT packet protocol as it arrives over SWO
+ * with the TPIU formatter bypassed.  Data may be fed in arbitrary pieces;
+ * packets split across calls are reassembled.
+ */
+struct armv7m_itm_decoder {
+	/** Called for each DWT periodic PC sample packet; @a sleeping is set
+	 * for the packet a core sends instead of a PC while it sleeps */
+	void (*pc_sample)(void *priv, uint32_t pc, bool sleeping);
+	/** Called for each instrumentation packet, @a size bytes of @a data
+	 * written by the software to stimulus @a port */
+	void (*stimulus)(void *priv, unsigned int port, const uint8_t *data,
+			unsigned int size);
+	/** Called for each exception trace packet; @a function is 1 for
+	 * entry, 2 for exit and 3 for return */
+	void (*exception)(void *priv, unsigned int number, unsigned int function);
+	/** Called for each DWT data trace packet of @a comparator */
+	void (*data_trace)(void *priv, enum armv7m_itm_data_trace type,
+			unsigned int comparator, uint32_t value);
+	/** Called when the ITM reports lost packets */
+	void (*overflow)(void *priv);
+	void *priv;
+
+	/** Sum of the local timestamp deltas received */
+	uint64_t local_time;
+	/** Last global timestamp received */
+	uint64_t global_time;
+	uint64_t packets;
+	uint64_t overflows;
+	uint64_t syncs;
+
+	/* parser state */
+	uint8_t header;
+	uint8_t payload[4];
+	unsigned int payload_len;
+	unsigned int payload_pos;
+	bool in_continuation;
+	uint64_t continuation_value;
+	unsigned int continuation_shift;
+	unsigned int zeros;
+	/** stimulus port page, from extension packets */
+	unsigned int page;
+};
+
+/**
+ * Decoding stage plugged in the trace callbacks, writing the payload of
+ * selected stimulus ports and a text log of the DWT packets to files or
+ * TCP ports.
+ */
+struct armv7m_itm_demux {
+	struct armv7m_itm_decoder decoder;
+	/** destination of each stimulus port, NULL to drop its data */
+	struct armv7m_itm_sink *stimulus_sinks[256];
+	/** destination of the DWT packet log, or NULL */
+	struct armv7m_itm_sink *dwt_sink;
+};
+
+void armv7m_itm_decoder_init(struct armv7m_itm_decoder *decoder);
+void armv7m_itm_decode(struct armv7m_itm_decoder *decoder,
+		const uint8_t *data, size_t len);
+
 extern const struct command_registration armv7m_trace_command_handlers[];
 
+/**
+ * Close the sinks of the ITM demultiplexer, if any
+ */
+void armv7m_trace_free(struct target *target);
+
 /**
  * Configure hardware accordingly to the current ITM target settings
  */
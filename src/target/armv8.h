@@ -280,6 +280,10 @@ static inline bool is_armv8(struct armv8_common *armv8)
 
 #define CPUV8_DBG_AUTHSTATUS	0xFB8
 
+#define CPUV8_DBG_EDPCSR	0x0A0
+#define CPUV8_DBG_EDDEVID	0xFC8
+#define EDDEVID_PCSAMPLE_MASK	0xF
+
 #define PAGE_SIZE_4KB				0x1000
 #define PAGE_SIZE_4KB_LEVEL0_BITS	39
 #define PAGE_SIZE_4KB_LEVEL1_BITS	30
@@ -2870,6 +2870,92 @@ static int cortex_a_handle_target_request(void *priv)
 	return ERROR_OK;
 }
 
+/*
+ * Non-intrusive profiling through the debug unit's PC sample register.
+ * Every read of DBGPCSR samples the PC of the running core, so batches
+ * of reads to the same address are queued on the APB-AP in one go.
+ */
+static int cortex_a_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
+{
+	struct cortex_a_common *cortex_a = target_to_cortex_a(target);
+	struct armv7a_common *armv7a = &cortex_a->armv7a_common;
+	uint32_t samples[1024];
+	uint32_t pcsr_offset = 0;
+	bool pcsr_has_offset = true;
+	int retval;
+
+	if (cortex_a->didr & DIDR_DEVID_IMP) {
+		uint32_t devid, devid1;
+
+		retval = mem_ap_read_atomic_u32(armv7a->debug_ap,
+				armv7a->debug_base + CPUDBG_DEVID, &devid);
+		if (retval == ERROR_OK)
+			retval = mem_ap_read_atomic_u32(armv7a->debug_ap,
+					armv7a->debug_base + CPUDBG_DEVID1, &devid1);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (devid & DEVID_PCSAMPLE_MASK) {
+			pcsr_offset = CPUDBG_PCSR;
+			pcsr_has_offset = (devid1 & DEVID1_PCSROFFSET_MASK) != DEVID1_PCSROFFSET_NONE;
+		}
+	}
+	if (!pcsr_offset && (cortex_a->didr & DIDR_PCSR_IMP))
+		pcsr_offset = CPUDBG_PCSR_LEGACY;
+
+	if (!pcsr_offset) {
+		LOG_TARGET_INFO(target, "PCSR sampling not supported on this processor.");
+		return target_profiling_default(target, profile, seconds);
+	}
+
+	LOG_TARGET_INFO(target, "Starting Cortex-A profiling. Sampling DBGPCSR as fast as we can...");
+
+	/* Make sure the target is running */
+	target_poll(target);
+	if (target->state == TARGET_HALTED) {
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while resuming target");
+			return retval;
+		}
+	}
+
+	int64_t timeout = timeval_ms() + seconds * 1000;
+	do {
+		retval = mem_ap_read_buf_noincr(armv7a->debug_ap, (uint8_t *)samples, 4,
+				ARRAY_SIZE(samples), armv7a->debug_base + pcsr_offset);
+		if (retval != ERROR_OK) {
+			LOG_TARGET_ERROR(target, "Error while reading PCSR");
+			return retval;
+		}
+
+		uint32_t count = 0;
+		for (unsigned int i = 0; i < ARRAY_SIZE(samples); i++) {
+			uint32_t pcsr = le_to_h_u32((uint8_t *)&samples[i]);
+
+			/* core halted or sampling prohibited */
+			if (pcsr == 0xffffffff)
+				continue;
+
+			if (!pcsr_has_offset)
+				/* bit 0 flags Thumb state */
+				samples[count++] = pcsr & ~1;
+			else if (pcsr & 2)
+				/* Thumb, PC + 4 */
+				samples[count++] = pcsr - 4;
+			else
+				/* most likely ARM, PC + 8 */
+				samples[count++] = pcsr - 8;
+		}
+
+		retval = target_profile_add_samples(profile, samples, count);
+	} while (retval == ERROR_OK && timeval_ms() < timeout);
+
+	LOG_TARGET_INFO(target, "Profiling completed. %" PRIu64 " samples.", profile->num_samples);
+	return retval;
+}
+
 /*
  * Cortex-A target information and configuration
  */
@@ -3390,6 +3476,8 @@ struct target_type cortexa_target = {
 	.add_watchpoint = cortex_a_add_watchpoint,
 	.remove_watchpoint = cortex_a_remove_watchpoint,
 
+	.profiling = cortex_a_profiling,
+
 	.commands = cortex_a_command_handlers,
 	.target_create = cortex_a_target_create,
 	.target_jim_configure = adiv5_jim_configure,
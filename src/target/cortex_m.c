@@ -1989,19 +1989,118 @@ void cortex_m_deinit_target(struct target *target)
 
 	cortex_m_dwt_free(target);
 	armv7m_free_reg_cache(target);
+	armv7m_trace_free(target);
+
+	/* the resident memory check algorithm refers to cortex_m */
+	target_free_all_working_areas(target);
 
 	free(target->private_config);
 	free(cortex_m);
 }
 
-int cortex_m_profiling(struct target *target, uint32_t *samples,
-			      uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+struct cortex_m_itm_profile {
+	struct armv7m_itm_decoder decoder;
+	struct target_profile *profile;
+	int retval;
+};
+
+static void cortex_m_itm_pc_sample(void *priv, uint32_t pc, bool sleeping)
+{
+	struct cortex_m_itm_profile *itm_profile = priv;
+
+	if (sleeping || itm_profile->retval != ERROR_OK)
+		return;
+
+	itm_profile->retval = target_profile_add_samples(itm_profile->profile, &pc, 1);
+}
+
+static int cortex_m_itm_profile_trace(struct target *target, size_t len,
+		uint8_t *data, void *priv)
+{
+	struct cortex_m_itm_profile *itm_profile = priv;
+
+	armv7m_itm_decode(&itm_profile->decoder, data, len);
+	return ERROR_OK;
+}
+
+/* Let the DWT emit periodic PC sample packets and collect them from the
+ * SWO capture, without any DAP traffic while sampling. */
+static int cortex_m_profiling_itm(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
+{
+	struct cortex_m_itm_profile itm_profile = {
+		.decoder = {
+			.pc_sample = cortex_m_itm_pc_sample,
+			.priv = &itm_profile,
+		},
+		.profile = profile,
+		.retval = ERROR_OK,
+	};
+	uint32_t dwt_ctrl, itm_tcr;
+
+	int retval = target_read_u32(target, DWT_CTRL, &dwt_ctrl);
+	if (retval == ERROR_OK)
+		retval = target_read_u32(target, ITM_TCR, &itm_tcr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if ((itm_tcr & (ITM_TCR_ITMENA_BIT | ITM_TCR_DWTENA_BIT)) !=
+			(ITM_TCR_ITMENA_BIT | ITM_TCR_DWTENA_BIT)) {
+		LOG_TARGET_ERROR(target, "ITM is not forwarding DWT packets, configure ITM first");
+		return ERROR_FAIL;
+	}
+
+	/* one sample every 16 * 1024 core clocks */
+	retval = target_write_u32(target, DWT_CTRL, dwt_ctrl | DWT_CTRL_PCSAMPLENA |
+			DWT_CTRL_CYCCNTENA | DWT_CTRL_CYCTAP | DWT_CTRL_POSTPRESET(15));
+	if (retval != ERROR_OK)
+		return retval;
+
+	armv7m_itm_decoder_init(&itm_profile.decoder);
+	target_register_trace_callback(cortex_m_itm_profile_trace, &itm_profile);
+
+	LOG_TARGET_INFO(target, "Starting Cortex-M profiling. Collecting DWT PC samples from SWO...");
+
+	target_poll(target);
+	if (target->state == TARGET_HALTED)
+		retval = target_resume(target, 1, 0, 0, 0);
+
+	int64_t timeout = timeval_ms() + seconds * 1000;
+	while (retval == ERROR_OK && itm_profile.retval == ERROR_OK &&
+			timeval_ms() < timeout) {
+		/* the SWO capture is polled from a timer callback */
+		target_call_timer_callbacks();
+		alive_sleep(1);
+	}
+
+	target_unregister_trace_callback(cortex_m_itm_profile_trace, &itm_profile);
+
+	int restore_retval = target_write_u32(target, DWT_CTRL, dwt_ctrl);
+	if (retval == ERROR_OK)
+		retval = itm_profile.retval;
+	if (retval == ERROR_OK)
+		retval = restore_retval;
+
+	if (profile->num_samples == 0)
+		LOG_TARGET_WARNING(target, "No PC samples received, is SWO trace capture enabled?");
+	else
+		LOG_TARGET_INFO(target, "Profiling completed. %" PRIu64 " samples.", profile->num_samples);
+
+	return retval;
+}
+
+int cortex_m_profiling(struct target *target, struct target_profile *profile,
+		uint32_t seconds)
 {
 	struct timeval timeout, now;
 	struct armv7m_common *armv7m = target_to_armv7m(target);
+	uint32_t samples[1024];
 	uint32_t reg_value;
 	int retval;
 
+	if (armv7m->trace_config.itm_profiling)
+		return cortex_m_profiling_itm(target, profile, seconds);
+
 	retval = target_read_u32(target, DWT_PCSR, &reg_value);
 	if (retval != ERROR_OK) {
 		LOG_TARGET_ERROR(target, "Error while reading PCSR");
@@ -2009,7 +2108,7 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	}
 	if (reg_value == 0) {
 		LOG_TARGET_INFO(target, "PCSR sampling not supported on this processor.");
-		return target_profiling_default(target, samples, max_num_samples, num_samples, seconds);
+		return target_profiling_default(target, profile, seconds);
 	}
 
 	gettimeofday(&timeout, NULL);
@@ -2027,20 +2126,15 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 		return retval;
 	}
 
-	uint32_t sample_count = 0;
-
 	for (;;) {
-		if (armv7m && armv7m->debug_ap) {
-			uint32_t read_count = max_num_samples - sample_count;
-			if (read_count > 1024)
-				read_count = 1024;
+		uint32_t read_count = 1;
 
+		if (armv7m && armv7m->debug_ap) {
+			read_count = ARRAY_SIZE(samples);
 			retval = mem_ap_read_buf_noincr(armv7m->debug_ap,
-						(void *)&samples[sample_count],
-						4, read_count, DWT_PCSR);
-			sample_count += read_count;
+						(void *)samples, 4, read_count, DWT_PCSR);
 		} else {
-			target_read_u32(target, DWT_PCSR, &samples[sample_count++]);
+			retval = target_read_u32(target, DWT_PCSR, &samples[0]);
 		}
 
 		if (retval != ERROR_OK) {
@@ -2048,15 +2142,17 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 			return retval;
 		}
 
+		retval = target_profile_add_samples(profile, samples, read_count);
+		if (retval != ERROR_OK)
+			return retval;
 
 		gettimeofday(&now, NULL);
-		if (sample_count >= max_num_samples || timeval_compare(&now, &timeout) > 0) {
-			LOG_TARGET_INFO(target, "Profiling completed. %" PRIu32 " samples.", sample_count);
+		if (timeval_compare(&now, &timeout) > 0) {
+			LOG_TARGET_INFO(target, "Profiling completed. %" PRIu64 " samples.", profile->num_samples);
 			break;
 		}
 	}
 
-	*num_samples = sample_count;
 	return retval;
 }
 
@@ -2842,6 +2938,7 @@ struct target_type cortexm_target = {
 	.write_memory = cortex_m_write_memory,
 	.checksum_memory = armv7m_checksum_memory,
 	.blank_check_memory = armv7m_blank_check_memory,
+	.check_memory_regions = armv7m_check_memory_regions,
 
 	.run_algorithm = armv7m_run_algorithm,
 	.start_algorithm = armv7m_start_algorithm,
@@ -36,6 +36,7 @@
 #define ITM_TPR		0xE0000E40
 #define ITM_TCR		0xE0000E80
 #define ITM_TCR_ITMENA_BIT	BIT(0)
+#define ITM_TCR_DWTENA_BIT	BIT(3)
 #define ITM_TCR_BUSY_BIT	BIT(23)
 #define ITM_LAR		0xE0000FB0
 #define ITM_LAR_KEY	0xC5ACCE55
@@ -81,6 +82,10 @@ struct cortex_m_part_info {
 #define DCRSR_WNR	BIT(16)
 
 #define DWT_CTRL	0xE0001000
+#define DWT_CTRL_CYCCNTENA		BIT(0)
+#define DWT_CTRL_POSTPRESET(n)	(((n) & 0xf) << 1)
+#define DWT_CTRL_CYCTAP			BIT(9)
+#define DWT_CTRL_PCSAMPLENA		BIT(12)
 #define DWT_CYCCNT	0xE0001004
 #define DWT_PCSR	0xE000101C
 #define DWT_COMP0	0xE0001020
@@ -322,7 +327,7 @@ int cortex_m_remove_watchpoint(struct target *target, struct watchpoint *watchpo
 void cortex_m_enable_breakpoints(struct target *target);
 void cortex_m_enable_watchpoints(struct target *target);
 void cortex_m_deinit_target(struct target *target);
-int cortex_m_profiling(struct target *target, uint32_t *samples,
-	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
+int cortex_m_profiling(struct target *target, struct target_profile *profile,
+	uint32_t seconds);
 
 #endif /* OPENOCD_TARGET_CORTEX_M_H */
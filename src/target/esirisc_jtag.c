@@ -114,6 +114,8 @@ static int esirisc_jtag_send(struct esirisc_jtag *jtag_info, uint8_t command,
 {
 	int num_fields = 2 + num_out_fields;
 	struct scan_field *fields = cmd_queue_alloc(num_fields * sizeof(struct scan_field));
+	if (!fields)
+		return ERROR_FAIL;
 
 	esirisc_jtag_set_instr(jtag_info, INSTR_DEBUG);
 
@@ -127,7 +129,8 @@ static int esirisc_jtag_send(struct esirisc_jtag *jtag_info, uint8_t command,
 
 	/* append command data */
 	for (int i = 0; i < num_out_fields; ++i)
-		jtag_scan_field_clone(&fields[2+i], &out_fields[i]);
+		if (jtag_scan_field_clone(&fields[2+i], &out_fields[i]) != ERROR_OK)
+			return ERROR_FAIL;
 
 	jtag_add_dr_scan(jtag_info->tap, num_fields, fields, TAP_IDLE);
 
@@ -34,6 +34,7 @@
 
 #include "image.h"
 #include "target.h"
+#include <helper/crc32.h>
 #include <helper/log.h>
 
 /* convert ELF header field to host endianness */
@@ -1205,6 +1206,178 @@ int image_add_section(struct image *image, target_addr_t base, uint32_t size, ui
 	return ERROR_OK;
 }
 
+static int image_elf_read_at(struct image_elf *elf, uint64_t offset,
+	size_t size, void *buffer)
+{
+	size_t read_bytes;
+	int retval;
+
+	retval = fileio_seek(elf->fileio, offset);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = fileio_read(elf->fileio, size, buffer, &read_bytes);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (read_bytes != size)
+		return ERROR_FILEIO_OPERATION_FAILED;
+
+	return ERROR_OK;
+}
+
+/* section header fields needed for the symbol lookup, in host endianness */
+struct image_elf_shdr {
+	uint32_t type;
+	uint32_t link;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t entsize;
+};
+
+static void image_elf_get_shdr(struct image_elf *elf, const uint8_t *raw,
+	struct image_elf_shdr *shdr)
+{
+	if (elf->is_64_bit) {
+		Elf64_Shdr s;
+		memcpy(&s, raw, sizeof(s));
+		shdr->type = field32(elf, s.sh_type);
+		shdr->link = field32(elf, s.sh_link);
+		shdr->offset = field64(elf, s.sh_offset);
+		shdr->size = field64(elf, s.sh_size);
+		shdr->entsize = field64(elf, s.sh_entsize);
+	} else {
+		Elf32_Shdr s;
+		memcpy(&s, raw, sizeof(s));
+		shdr->type = field32(elf, s.sh_type);
+		shdr->link = field32(elf, s.sh_link);
+		shdr->offset = field32(elf, s.sh_offset);
+		shdr->size = field32(elf, s.sh_size);
+		shdr->entsize = field32(elf, s.sh_entsize);
+	}
+}
+
+/* match symbol at @a raw against @a name, return its value in @a value */
+static bool image_elf_match_sym(struct image_elf *elf, const uint8_t *raw,
+	const char *strtab, uint64_t strtab_size, const char *name,
+	target_addr_t *value)
+{
+	uint32_t st_name;
+	uint16_t st_shndx;
+
+	if (elf->is_64_bit) {
+		Elf64_Sym sym;
+		memcpy(&sym, raw, sizeof(sym));
+		st_name = field32(elf, sym.st_name);
+		st_shndx = field16(elf, sym.st_shndx);
+		*value = field64(elf, sym.st_value);
+	} else {
+		Elf32_Sym sym;
+		memcpy(&sym, raw, sizeof(sym));
+		st_name = field32(elf, sym.st_name);
+		st_shndx = field16(elf, sym.st_shndx);
+		*value = field32(elf, sym.st_value);
+	}
+
+	if (st_shndx == SHN_UNDEF || st_name >= strtab_size)
+		return false;
+
+	return strncmp(strtab + st_name, name, strtab_size - st_name) == 0;
+}
+
+int image_find_symbol(struct image *image, const char *name,
+	target_addr_t *address)
+{
+	struct image_elf *elf = image->type_private;
+	uint8_t *shdrs = NULL;
+	uint8_t *symtab = NULL;
+	char *strtab = NULL;
+	uint64_t shoff;
+	unsigned int shnum;
+	size_t shentsize, symentsize;
+	int retval;
+
+	if (image->type != IMAGE_ELF) {
+		LOG_ERROR("symbol lookup is only supported for ELF images");
+		return ERROR_IMAGE_TYPE_UNKNOWN;
+	}
+
+	if (elf->is_64_bit) {
+		shoff = field64(elf, elf->header64->e_shoff);
+		shnum = field16(elf, elf->header64->e_shnum);
+		shentsize = sizeof(Elf64_Shdr);
+		symentsize = sizeof(Elf64_Sym);
+	} else {
+		shoff = field32(elf, elf->header32->e_shoff);
+		shnum = field16(elf, elf->header32->e_shnum);
+		shentsize = sizeof(Elf32_Shdr);
+		symentsize = sizeof(Elf32_Sym);
+	}
+
+	if (!shoff || !shnum) {
+		LOG_ERROR("ELF file has no section headers");
+		return ERROR_IMAGE_FORMAT_ERROR;
+	}
+
+	shdrs = malloc(shnum * shentsize);
+	if (!shdrs) {
+		LOG_ERROR("insufficient memory to perform operation");
+		return ERROR_FAIL;
+	}
+
+	retval = image_elf_read_at(elf, shoff, shnum * shentsize, shdrs);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("cannot read ELF section headers");
+		goto done;
+	}
+
+	retval = ERROR_FAIL;
+
+	for (unsigned int i = 0; i < shnum; i++) {
+		struct image_elf_shdr sh, strsh;
+
+		image_elf_get_shdr(elf, shdrs + i * shentsize, &sh);
+		if (sh.type != SHT_SYMTAB || sh.link >= shnum)
+			continue;
+		if (sh.entsize < symentsize)
+			continue;
+
+		image_elf_get_shdr(elf, shdrs + sh.link * shentsize, &strsh);
+
+		free(symtab);
+		free(strtab);
+		symtab = malloc(sh.size);
+		strtab = malloc(strsh.size);
+		if (!symtab || !strtab) {
+			LOG_ERROR("insufficient memory to perform operation");
+			goto done;
+		}
+
+		if (image_elf_read_at(elf, sh.offset, sh.size, symtab) != ERROR_OK ||
+				image_elf_read_at(elf, strsh.offset, strsh.size, strtab) != ERROR_OK) {
+			LOG_ERROR("cannot read ELF symbol table");
+			goto done;
+		}
+
+		for (uint64_t off = 0; off + symentsize <= sh.size; off += sh.entsize) {
+			if (image_elf_match_sym(elf, symtab + off, strtab, strsh.size,
+					name, address)) {
+				retval = ERROR_OK;
+				goto done;
+			}
+		}
+	}
+
+	LOG_DEBUG("symbol '%s' not found", name);
+
+done:
+	free(strtab);
+	free(symtab);
+	free(shdrs);
+
+	return retval;
+}
+
 void image_close(struct image *image)
 {
 	if (image->type == IMAGE_BINARY) {
@@ -1264,34 +1437,14 @@ void image_close(struct image *image)
 
 int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
 {
-	uint32_t crc = 0xffffffff;
+	uint32_t crc = CRC32_INIT;
 	LOG_DEBUG("Calculating checksum");
 
-	static uint32_t crc32_table[256];
-
-	static bool first_init;
-	if (!first_init) {
-		/* Initialize the CRC table and the decoding table.  */
-		unsigned int i, j, c;
-		for (i = 0; i < 256; i++) {
-			/* as per gdb */
-			for (c = i << 24, j = 8; j > 0; --j)
-				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
-		}
-
-		first_init = true;
-	}
-
 	while (nbytes > 0) {
-		int run = nbytes;
-		if (run > 32768)
-			run = 32768;
+		uint32_t run = MIN(nbytes, 1024 * 1024);
+		crc = crc32_update(crc, buffer, run);
+		buffer += run;
 		nbytes -= run;
-		while (run--) {
-			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
-		}
 		keep_alive();
 	}
 
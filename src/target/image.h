@@ -107,6 +107,17 @@ int image_read_section(struct image *image, int section, target_addr_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
 void image_close(struct image *image);
 
+/**
+ * Look up a symbol in the symbol table of an ELF image.
+ *
+ * @param image The ELF image.
+ * @param name Symbol name.
+ * @param address Symbol value, i.e. its address, on success.
+ * @returns ERROR_OK if the symbol was found, ERROR_FAIL otherwise.
+ */
+int image_find_symbol(struct image *image, const char *name,
+		target_addr_t *address);
+
 int image_add_section(struct image *image, target_addr_t base, uint32_t size,
 		uint64_t flags, uint8_t const *data);
 
@@ -2482,8 +2482,8 @@ int nds32_gdb_fileio_end(struct target *target, int retcode, int fileio_errno, b
 	return ERROR_OK;
 }
 
-int nds32_profiling(struct target *target, uint32_t *samples,
-			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+int nds32_profiling(struct target *target,
+			struct target_profile *profile, uint32_t seconds)
 {
 	/* sample $PC every 10 milliseconds */
 	uint32_t iteration = seconds * 100;
@@ -2496,15 +2496,21 @@ int nds32_profiling(struct target *target, uint32_t *samples,
 		return ERROR_TARGET_NOT_HALTED;
 	}
 
-	if (max_num_samples < iteration)
-		iteration = max_num_samples;
+	/* AICE collects all samples in one go */
+	uint32_t *samples = malloc(iteration * sizeof(uint32_t));
+	if (!samples)
+		return ERROR_FAIL;
 
+	uint32_t num_samples = 0;
 	int pc_regnum = nds32->register_map(nds32, PC);
-	aice_profiling(aice, 10, iteration, pc_regnum, samples, num_samples);
+	aice_profiling(aice, 10, iteration, pc_regnum, samples, &num_samples);
 
 	register_cache_invalidate(nds32->core_cache);
 
-	return ERROR_OK;
+	int retval = target_profile_add_samples(profile, samples, num_samples);
+	free(samples);
+
+	return retval;
 }
 
 int nds32_gdb_fileio_write_memory(struct nds32 *nds32, uint32_t address,
@@ -1211,8 +1211,8 @@ static int or1k_checksum_memory(struct target *target, target_addr_t address,
 	return ERROR_FAIL;
 }
 
-static int or1k_profiling(struct target *target, uint32_t *samples,
-		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+static int or1k_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
 {
 	struct timeval timeout, now;
 	struct or1k_common *or1k = target_to_or1k(target);
@@ -1234,8 +1234,6 @@ static int or1k_profiling(struct target *target, uint32_t *samples,
 		return retval;
 	}
 
-	uint32_t sample_count = 0;
-
 	for (;;) {
 		uint32_t reg_value;
 		retval = du_core->or1k_jtag_read_cpu(&or1k->jtag, GROUP0 + 16 /* NPC */, 1, &reg_value);
@@ -1244,16 +1242,17 @@ static int or1k_profiling(struct target *target, uint32_t *samples,
 			return retval;
 		}
 
-		samples[sample_count++] = reg_value;
+		retval = target_profile_add_samples(profile, &reg_value, 1);
+		if (retval != ERROR_OK)
+			return retval;
 
 		gettimeofday(&now, NULL);
-		if ((sample_count >= max_num_samples) || timeval_compare(&now, &timeout) > 0) {
-			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+		if (timeval_compare(&now, &timeout) > 0) {
+			LOG_INFO("Profiling completed. %" PRIu64 " samples.", profile->num_samples);
 			break;
 		}
 	}
 
-	*num_samples = sample_count;
 	return retval;
 }
 
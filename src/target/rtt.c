@@ -28,6 +28,18 @@
 
 #include "target.h"
 
+static void parse_rtt_channel(const uint8_t *buf, target_addr_t address,
+		struct rtt_channel *channel)
+{
+	channel->address = address;
+	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
+	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
+	channel->size = buf_get_u32(buf + 8, 0, 32);
+	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
+	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
+	channel->flags = buf_get_u32(buf + 20, 0, 32);
+}
+
 static int read_rtt_channel(struct target *target,
 		const struct rtt_control *ctrl, unsigned int channel_index,
 		enum rtt_channel_type type, struct rtt_channel *channel)
@@ -46,17 +58,29 @@ static int read_rtt_channel(struct target *target,
 	if (ret != ERROR_OK)
 		return ret;
 
-	channel->address = address;
-	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
-	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
-	channel->size = buf_get_u32(buf + 8, 0, 32);
-	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
-	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
-	channel->flags = buf_get_u32(buf + 20, 0, 32);
+	parse_rtt_channel(buf, address, channel);
 
 	return ERROR_OK;
 }
 
+/* Maximum number of bytes read from a single up-channel per poll. */
+#define RTT_READ_CHUNK_SIZE	1024
+
+/* Up-channel with pending data, collected during a batched read. */
+struct rtt_pending_read {
+	unsigned int index;
+	struct rtt_channel channel;
+	uint8_t *data;
+	uint32_t length;
+};
+
+/* Buffers for batched reads, sized for the highest polled channel. */
+static struct {
+	struct rtt_pending_read *pending;
+	uint8_t *data;
+	size_t size;
+} poll_state;
+
 int target_rtt_start(struct target *target, const struct rtt_control *ctrl,
 		void *user_data)
 {
@@ -65,6 +89,12 @@ int target_rtt_start(struct target *target, const struct rtt_control *ctrl,
 
 int target_rtt_stop(struct target *target, void *user_data)
 {
+	free(poll_state.pending);
+	free(poll_state.data);
+	poll_state.pending = NULL;
+	poll_state.data = NULL;
+	poll_state.size = 0;
+
 	return ERROR_OK;
 }
 
@@ -248,54 +278,86 @@ int target_rtt_read_control_block(struct target *target,
 	return ERROR_OK;
 }
 
+/* Size of a single memory read while searching for the control block. */
+#define RTT_SEARCH_CHUNK_SIZE	(32 * 1024)
+
 int target_rtt_find_control_block(struct target *target,
 		target_addr_t *address, size_t size, const char *id, bool *found,
 		void *user_data)
 {
-	uint8_t buf[1024];
+	const uint8_t *pattern = (const uint8_t *)id;
+	const size_t id_length = strlen(id);
+	size_t skip[256];
+	uint8_t *buf;
+	size_t carry = 0;
+	int ret = ERROR_OK;
 
 	*found = false;
 
-	size_t j = 0;
-	size_t cb_offset = 0;
-	const size_t id_length = strlen(id);
+	if (!id_length || size < id_length)
+		return ERROR_OK;
+
+	/*
+	 * Boyer-Moore-Horspool: on a mismatch, shift the window by the distance
+	 * of the window's last byte from the end of the ID.
+	 */
+	for (size_t i = 0; i < ARRAY_SIZE(skip); i++)
+		skip[i] = id_length;
+
+	for (size_t i = 0; i < id_length - 1; i++)
+		skip[pattern[i]] = id_length - 1 - i;
+
+	/*
+	 * The last (id_length - 1) bytes of a chunk are carried over to the
+	 * front of the buffer so that IDs spanning two chunks are found.
+	 */
+	buf = malloc(RTT_SEARCH_CHUNK_SIZE + id_length);
+
+	if (!buf) {
+		LOG_ERROR("rtt: Failed to allocate search buffer");
+		return ERROR_FAIL;
+	}
 
 	LOG_INFO("rtt: Searching for control block '%s'", id);
 
-	for (target_addr_t addr = 0; addr < size; addr = addr + sizeof(buf)) {
-		int ret;
+	for (size_t offset = 0; offset < size; ) {
+		const size_t read_size = MIN(RTT_SEARCH_CHUNK_SIZE, size - offset);
 
-		const size_t buf_size = MIN(sizeof(buf), size - addr);
-		ret = target_read_buffer(target, *address + addr, buf_size, buf);
+		ret = target_read_buffer(target, *address + offset, read_size,
+			buf + carry);
 
 		if (ret != ERROR_OK)
-			return ret;
-
-		size_t start = 0;
-		size_t i = 0;
+			break;
 
-		while (i < buf_size) {
-			if (buf[i] != id[j]) {
-				start++;
-				cb_offset++;
-				i = start;
-				j = 0;
+		/* Target address of buf[0]. */
+		const target_addr_t base = *address + offset - carry;
+		const size_t length = carry + read_size;
+		size_t pos = 0;
 
-				continue;
-			}
-
-			i++;
-			j++;
+		while (pos + id_length <= length) {
+			const uint8_t last = buf[pos + id_length - 1];
 
-			if (j == id_length) {
-				*address = *address + cb_offset;
+			if (last == pattern[id_length - 1] &&
+					!memcmp(buf + pos, pattern, id_length - 1)) {
+				*address = base + pos;
 				*found = true;
-				return ERROR_OK;
+				goto out;
 			}
+
+			pos += skip[last];
 		}
+
+		offset += read_size;
+		carry = MIN(id_length - 1, length);
+		memmove(buf, buf + length - carry, carry);
+
+		keep_alive();
 	}
 
-	return ERROR_OK;
+out:
+	free(buf);
+
+	return ret;
 }
 
 int target_rtt_read_channel_info(struct target *target,
@@ -326,16 +388,17 @@ int target_rtt_read_channel_info(struct target *target,
 	return ERROR_OK;
 }
 
-static int read_from_channel(struct target *target,
+/*
+ * Read up to @a length bytes of pending data from @a channel without
+ * updating its read position.
+ */
+static int read_channel_data(struct target *target,
 		const struct rtt_channel *channel, uint8_t *buffer,
-		size_t *length)
+		uint32_t *length)
 {
 	int ret;
 	uint32_t len;
 
-	if (!*length)
-		return ERROR_OK;
-
 	if (channel->read_pos == channel->write_pos) {
 		len = 0;
 	} else if (channel->read_pos < channel->write_pos) {
@@ -366,62 +429,140 @@ static int read_from_channel(struct target *target,
 			return ret;
 	}
 
-	if (len > 0) {
-		ret = target_write_u32(target, channel->address + 16,
-			(channel->read_pos + len) % channel->size);
-
-		if (ret != ERROR_OK)
-			return ret;
-	}
-
 	*length = len;
 
 	return ERROR_OK;
 }
 
+/*
+ * Poll all up-channels with registered sinks in three phases:
+ *
+ *  1. one read of all channel descriptors, which are contiguous in the
+ *     control block,
+ *  2. data reads for the channels that actually have pending data,
+ *  3. read position write-back for those channels.
+ *
+ * Idle channels therefore cost no extra target accesses, and the sinks are
+ * only fed once the target's read positions were updated.
+ */
 int target_rtt_read_callback(struct target *target,
 		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data)
+		size_t num_channels, size_t *lengths, void *user_data)
 {
+	struct rtt_pending_read *pending = poll_state.pending;
+	size_t num_pending = 0;
+	size_t last_channel = 0;
+	uint8_t *desc;
+	int ret;
+
 	num_channels = MIN(num_channels, ctrl->num_up_channels);
 
 	for (size_t i = 0; i < num_channels; i++) {
-		int ret;
-		struct rtt_channel channel;
-		uint8_t buffer[1024];
-		size_t length;
+		lengths[i] = 0;
+
+		if (sinks[i])
+			last_channel = i + 1;
+	}
+
+	if (!last_channel)
+		return ERROR_OK;
+
+	if (poll_state.size < last_channel) {
+		struct rtt_pending_read *tmp_pending;
+		uint8_t *tmp_data;
+
+		tmp_pending = realloc(poll_state.pending,
+			last_channel * sizeof(*tmp_pending));
+
+		if (!tmp_pending)
+			return ERROR_FAIL;
+
+		poll_state.pending = pending = tmp_pending;
+
+		tmp_data = realloc(poll_state.data,
+			last_channel * RTT_READ_CHUNK_SIZE);
+
+		if (!tmp_data)
+			return ERROR_FAIL;
+
+		poll_state.data = tmp_data;
+		poll_state.size = last_channel;
+	}
+
+	desc = malloc(last_channel * RTT_CHANNEL_SIZE);
+
+	if (!desc)
+		return ERROR_FAIL;
+
+	ret = target_read_buffer(target, ctrl->address + RTT_CB_SIZE,
+		last_channel * RTT_CHANNEL_SIZE, desc);
+
+	if (ret != ERROR_OK) {
+		LOG_ERROR("rtt: Failed to read up-channel descriptions");
+		free(desc);
+		return ret;
+	}
+
+	for (size_t i = 0; i < last_channel; i++) {
+		struct rtt_pending_read *p = &pending[num_pending];
 
 		if (!sinks[i])
 			continue;
 
-		ret = read_rtt_channel(target, ctrl, i, RTT_CHANNEL_TYPE_UP,
-			&channel);
-
-		if (ret != ERROR_OK) {
-			LOG_ERROR("rtt: Failed to read up-channel %zu description", i);
-			return ret;
-		}
+		parse_rtt_channel(desc + i * RTT_CHANNEL_SIZE,
+			ctrl->address + RTT_CB_SIZE + i * RTT_CHANNEL_SIZE, &p->channel);
 
-		if (!channel_is_active(&channel)) {
+		if (!channel_is_active(&p->channel)) {
 			LOG_WARNING("rtt: Up-channel %zu is not active", i);
 			continue;
 		}
 
-		if (channel.size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
+		if (p->channel.size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
 			LOG_WARNING("rtt: Up-channel %zu is not large enough", i);
 			continue;
 		}
 
-		length = sizeof(buffer);
-		ret = read_from_channel(target, &channel, buffer, &length);
+		if (p->channel.read_pos == p->channel.write_pos)
+			continue;
+
+		p->index = i;
+		p->data = poll_state.data + num_pending * RTT_READ_CHUNK_SIZE;
+		p->length = RTT_READ_CHUNK_SIZE;
+
+		ret = read_channel_data(target, &p->channel, p->data, &p->length);
 
 		if (ret != ERROR_OK) {
 			LOG_ERROR("rtt: Failed to read from up-channel %zu", i);
+			free(desc);
+			return ret;
+		}
+
+		num_pending++;
+	}
+
+	free(desc);
+
+	for (size_t i = 0; i < num_pending; i++) {
+		const struct rtt_channel *channel = &pending[i].channel;
+
+		ret = target_write_u32(target, channel->address + 16,
+			(channel->read_pos + pending[i].length) % channel->size);
+
+		if (ret != ERROR_OK) {
+			LOG_ERROR("rtt: Failed to update up-channel %u",
+				pending[i].index);
 			return ret;
 		}
+	}
+
+	for (size_t i = 0; i < num_pending; i++) {
+		const unsigned int index = pending[i].index;
+
+		lengths[index] = pending[i].length;
 
-		for (struct rtt_sink_list *sink = sinks[i]; sink; sink = sink->next)
-			sink->read(i, buffer, length, sink->user_data);
+		for (struct rtt_sink_list *sink = sinks[index]; sink; sink = sink->next)
+			sink->read(index, pending[i].data, pending[i].length,
+				sink->user_data);
 	}
 
 	return ERROR_OK;
@@ -1223,8 +1223,8 @@ static int rv32m1_checksum_memory(struct target *target, target_addr_t address,
 	return ERROR_FAIL;
 }
 
-static int rv32m1_profiling(struct target *target, uint32_t *samples,
-		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+static int rv32m1_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
 {
 	struct timeval timeout, now;
 	struct rv32m1_info *rv32m1 = target_to_rv32m1(target);
@@ -1246,8 +1246,6 @@ static int rv32m1_profiling(struct target *target, uint32_t *samples,
 		return retval;
 	}
 
-	uint32_t sample_count = 0;
-
 	for (;;) {
 		uint32_t reg_value;
 		retval = du_core->rv32m1_jtag_read_cpu(&rv32m1->jtag, RV32M1_DEBUG_REG_ADDR(coreIdx, DBG_NPC) /* NPC */, 1, &reg_value);
@@ -1256,17 +1254,17 @@ static int rv32m1_profiling(struct target *target, uint32_t *samples,
 			return retval;
 		}
 
-		samples[sample_count++] = reg_value;
+		retval = target_profile_add_samples(profile, &reg_value, 1);
+		if (retval != ERROR_OK)
+			return retval;
 
 		gettimeofday(&now, NULL);
-		if ((sample_count >= max_num_samples) ||
-				((now.tv_sec >= timeout.tv_sec) && (now.tv_usec >= timeout.tv_usec))) {
-			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+		if ((now.tv_sec >= timeout.tv_sec) && (now.tv_usec >= timeout.tv_usec)) {
+			LOG_INFO("Profiling completed. %" PRIu64 " samples.", profile->num_samples);
 			break;
 		}
 	}
 
-	*num_samples = sample_count;
 	return retval;
 }
 
@@ -42,6 +42,7 @@
 #endif
 
 #include <helper/align.h>
+#include <helper/crc32.h>
 #include <helper/time_support.h>
 #include <jtag/jtag.h>
 #include <flash/nor/core.h>
@@ -859,6 +860,8 @@ int target_run_algorithm(struct target *target,
 		goto done;
 	}
 
+	rtos_memory_changed();
+
 	target->running_alg = true;
 	retval = target->type->run_algorithm(target,
 			num_mem_params, mem_params,
@@ -904,6 +907,8 @@ int target_start_algorithm(struct target *target,
 		goto done;
 	}
 
+	rtos_memory_changed();
+
 	target->running_alg = true;
 	retval = target->type->start_algorithm(target,
 			num_mem_params, mem_params,
@@ -1340,6 +1345,7 @@ int target_write_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	rtos_memory_changed();
 	return target->type->write_memory(target, address, size, count, buffer);
 }
 
@@ -1354,6 +1360,7 @@ int target_write_phys_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	rtos_memory_changed();
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
@@ -1531,11 +1538,10 @@ unsigned int target_data_bits(struct target *target)
 	return 32;
 }
 
-static int target_profiling(struct target *target, uint32_t *samples,
-			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+static int target_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
 {
-	return target->type->profiling(target, samples, max_num_samples,
-			num_samples, seconds);
+	return target->type->profiling(target, profile, seconds);
 }
 
 /**
@@ -1828,7 +1834,7 @@ int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 
 	for (struct target_timer_callback *c = target_timer_callbacks;
 	     c; c = c->next) {
-		if ((c->callback == callback) && (c->priv == priv)) {
+		if (!c->removed && (c->callback == callback) && (c->priv == priv)) {
 			c->removed = true;
 			return ERROR_OK;
 		}
@@ -2361,8 +2367,46 @@ static int target_gdb_fileio_end_default(struct target *target,
 	return ERROR_OK;
 }
 
-int target_profiling_default(struct target *target, uint32_t *samples,
-		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+int target_profile_add_samples(struct target_profile *profile,
+		const uint32_t *samples, uint32_t count)
+{
+	if (profile->with_range) {
+		uint64_t address_space = profile->end_address - profile->start_address;
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t address = samples[i];
+
+			if (address < profile->start_address || address >= profile->end_address)
+				continue;
+
+			uint64_t index = ((uint64_t)(address - profile->start_address) *
+					profile->num_buckets) / address_space;
+			profile->buckets[index]++;
+		}
+	} else {
+		if (profile->num_samples + count > profile->samples_size) {
+			size_t size = MAX(profile->samples_size * 2, 64 * 1024);
+			while (size < profile->num_samples + count)
+				size *= 2;
+
+			uint32_t *new_samples = realloc(profile->samples, size * sizeof(uint32_t));
+			if (!new_samples) {
+				LOG_ERROR("No memory to store %zu samples.", size);
+				return ERROR_FAIL;
+			}
+			profile->samples = new_samples;
+			profile->samples_size = size;
+		}
+
+		memcpy(&profile->samples[profile->num_samples], samples, count * sizeof(uint32_t));
+	}
+
+	profile->num_samples += count;
+	return ERROR_OK;
+}
+
+int target_profiling_default(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
 {
 	struct timeval timeout, now;
 
@@ -2372,7 +2416,6 @@ int target_profiling_default(struct target *target, uint32_t *samples,
 	LOG_INFO("Starting profiling. Halting and resuming the"
 			" target as often as we can...");
 
-	uint32_t sample_count = 0;
 	/* hopefully it is safe to cache! We want to stop/restart as quickly as possible. */
 	struct reg *reg = register_get_by_name(target->reg_cache, "pc", true);
 
@@ -2381,7 +2424,9 @@ int target_profiling_default(struct target *target, uint32_t *samples,
 		target_poll(target);
 		if (target->state == TARGET_HALTED) {
 			uint32_t t = buf_get_u32(reg->value, 0, 32);
-			samples[sample_count++] = t;
+			retval = target_profile_add_samples(profile, &t, 1);
+			if (retval != ERROR_OK)
+				break;
 			/* current pc, addr = 0, do not handle breakpoints, not debugging */
 			retval = target_resume(target, 1, 0, 0, 0);
 			target_poll(target);
@@ -2399,13 +2444,12 @@ int target_profiling_default(struct target *target, uint32_t *samples,
 			break;
 
 		gettimeofday(&now, NULL);
-		if ((sample_count >= max_num_samples) || timeval_compare(&now, &timeout) >= 0) {
-			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+		if (timeval_compare(&now, &timeout) >= 0) {
+			LOG_INFO("Profiling completed. %" PRIu64 " samples.", profile->num_samples);
 			break;
 		}
 	}
 
-	*num_samples = sample_count;
 	return retval;
 }
 
@@ -2434,6 +2478,7 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
+	rtos_memory_changed();
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
@@ -2542,7 +2587,6 @@ int target_checksum_memory(struct target *target, target_addr_t address, uint32_
 {
 	uint8_t *buffer;
 	int retval;
-	uint32_t i;
 	uint32_t checksum = 0;
 	if (!target_was_examined(target)) {
 		LOG_ERROR("Target not examined yet");
@@ -2555,25 +2599,29 @@ int target_checksum_memory(struct target *target, target_addr_t address, uint32_
 
 	retval = target->type->checksum_memory(target, address, size, &checksum);
 	if (retval != ERROR_OK) {
-		buffer = malloc(size);
+		/* read back and checksum on the host, a chunk at a time */
+		uint32_t chunk_size = MAX(MIN(size, 64 * 1024), 1);
+		buffer = malloc(chunk_size);
 		if (!buffer) {
-			LOG_ERROR("error allocating buffer for section (%" PRIu32 " bytes)", size);
+			LOG_ERROR("error allocating buffer for section (%" PRIu32 " bytes)", chunk_size);
 			return ERROR_COMMAND_SYNTAX_ERROR;
 		}
-		retval = target_read_buffer(target, address, size, buffer);
-		if (retval != ERROR_OK) {
-			free(buffer);
-			return retval;
-		}
 
-		/* convert to target endianness */
-		for (i = 0; i < (size/sizeof(uint32_t)); i++) {
-			uint32_t target_data;
-			target_data = target_buffer_get_u32(target, &buffer[i*sizeof(uint32_t)]);
-			target_buffer_set_u32(target, &buffer[i*sizeof(uint32_t)], target_data);
-		}
+		checksum = CRC32_INIT;
+		retval = ERROR_OK;
+		while (size > 0) {
+			uint32_t run = MIN(size, chunk_size);
+			retval = target_read_buffer(target, address, run, buffer);
+			if (retval != ERROR_OK) {
+				free(buffer);
+				return retval;
+			}
 
-		retval = image_calculate_checksum(buffer, size, &checksum);
+			checksum = crc32_update(checksum, buffer, run);
+			address += run;
+			size -= run;
+			keep_alive();
+		}
 		free(buffer);
 	}
 
@@ -2597,6 +2645,144 @@ int target_blank_check_memory(struct target *target,
 	return target->type->blank_check_memory(target, blocks, num_blocks, erased_value);
 }
 
+/* Process a memory check region reading the memory back to the host */
+static int target_check_memory_region_on_host(struct target *target,
+	struct target_memory_check_region *region)
+{
+	uint32_t chunk_size = MAX(MIN(region->size, 64 * 1024), 1);
+	uint8_t *buffer = malloc(2 * chunk_size);
+	if (!buffer) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	uint32_t crc = CRC32_INIT;
+	uint32_t result = region->op == TARGET_MEMORY_BLANK_CHECK ? 1 : 0;
+	uint32_t offset = 0;
+	int retval = ERROR_OK;
+
+	while (offset < region->size) {
+		uint32_t run = MIN(region->size - offset, chunk_size);
+		retval = target_read_buffer(target, region->address + offset, run, buffer);
+		if (retval != ERROR_OK)
+			break;
+
+		switch (region->op) {
+		case TARGET_MEMORY_BLANK_CHECK:
+			for (uint32_t i = 0; i < run; i++)
+				if (buffer[i] != region->erased_value)
+					result = 0;
+			break;
+		case TARGET_MEMORY_CRC32:
+			crc = crc32_update(crc, buffer, run);
+			break;
+		case TARGET_MEMORY_COMPARE:
+			retval = target_read_buffer(target, region->compare_address + offset,
+					run, buffer + chunk_size);
+			if (retval != ERROR_OK)
+				break;
+			for (uint32_t i = 0; i < run && !result; i++)
+				if (buffer[i] != buffer[chunk_size + i])
+					result = offset + i + 1;
+			break;
+		}
+		if (retval != ERROR_OK)
+			break;
+
+		/* the result is known once a difference is found */
+		if ((region->op == TARGET_MEMORY_BLANK_CHECK && !result) ||
+				(region->op == TARGET_MEMORY_COMPARE && result))
+			break;
+
+		offset += run;
+		keep_alive();
+	}
+	free(buffer);
+
+	if (retval != ERROR_OK)
+		return retval;
+
+	region->result = region->op == TARGET_MEMORY_CRC32 ? crc : result;
+	return ERROR_OK;
+}
+
+/* Process a memory check region with the checksum or blank check
+ * algorithm of the target, reading the memory back only as a last resort */
+static int target_check_memory_region_single(struct target *target,
+	struct target_memory_check_region *region)
+{
+	uint32_t crc, compare_crc;
+	int retval;
+
+	switch (region->op) {
+	case TARGET_MEMORY_CRC32:
+		/* falls back to the host itself */
+		if (target->type->checksum_memory)
+			return target_checksum_memory(target, region->address, region->size,
+					&region->result);
+		break;
+	case TARGET_MEMORY_BLANK_CHECK:
+		if (target->type->blank_check_memory) {
+			struct target_memory_check_block block = {
+				.address = region->address,
+				.size = region->size,
+				.result = UINT32_MAX,
+			};
+			retval = target_blank_check_memory(target, &block, 1, region->erased_value);
+			if (retval == 1 && block.result != UINT32_MAX) {
+				region->result = block.result;
+				return ERROR_OK;
+			}
+		}
+		break;
+	case TARGET_MEMORY_COMPARE:
+		/* matching checksums are taken as equal contents, as verify_image
+		 * does; the offset of a difference can only be found on the host */
+		if (target->type->checksum_memory &&
+				target_checksum_memory(target, region->address, region->size, &crc) == ERROR_OK &&
+				target_checksum_memory(target, region->compare_address, region->size,
+						&compare_crc) == ERROR_OK &&
+				crc == compare_crc) {
+			region->result = 0;
+			return ERROR_OK;
+		}
+		break;
+	}
+
+	return target_check_memory_region_on_host(target, region);
+}
+
+int target_check_memory_regions(struct target *target,
+	struct target_memory_check_region *regions, unsigned int num_regions)
+{
+	unsigned int done = 0;
+
+	if (!target_was_examined(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+
+	if (target->type->check_memory_regions) {
+		while (done < num_regions) {
+			int retval = target->type->check_memory_regions(target,
+					regions + done, num_regions - done);
+			if (retval < 1)
+				break;
+			done += retval;
+		}
+		if (done < num_regions)
+			LOG_DEBUG("checking %u memory regions one by one", num_regions - done);
+	}
+
+	for (; done < num_regions; done++) {
+		int retval = target_check_memory_region_single(target, &regions[done]);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
 int target_read_u64(struct target *target, target_addr_t address, uint64_t *value)
 {
 	uint8_t value_buf[8];
@@ -3856,6 +4042,22 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 	if (retval != ERROR_OK)
 		return retval;
 
+	/* checksum all the sections of the target memory in one go */
+	struct target_memory_check_region *regions = NULL;
+	if (verify >= IMAGE_VERIFY && image.num_sections > 0)
+		regions = calloc(image.num_sections, sizeof(*regions));
+	if (regions) {
+		for (unsigned int i = 0; i < image.num_sections; i++) {
+			regions[i].op = TARGET_MEMORY_CRC32;
+			regions[i].address = image.sections[i].base_address;
+			regions[i].size = image.sections[i].size;
+		}
+		if (target_check_memory_regions(target, regions, image.num_sections) != ERROR_OK) {
+			free(regions);
+			regions = NULL;
+		}
+	}
+
 	image_size = 0x0;
 	int diffs = 0;
 	retval = ERROR_OK;
@@ -3881,7 +4083,11 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 				break;
 			}
 
-			retval = target_checksum_memory(target, image.sections[i].base_address, buf_cnt, &mem_checksum);
+			if (regions && buf_cnt == regions[i].size)
+				mem_checksum = regions[i].result;
+			else
+				retval = target_checksum_memory(target, image.sections[i].base_address,
+						buf_cnt, &mem_checksum);
 			if (retval != ERROR_OK) {
 				free(buffer);
 				break;
@@ -3944,6 +4150,7 @@ done:
 				duration_elapsed(&bench), duration_kbps(&bench, image_size));
 	}
 
+	free(regions);
 	image_close(&image);
 
 	return retval;
@@ -4224,9 +4431,69 @@ static void write_string(FILE *f, char *s)
 
 typedef unsigned char UNIT[2];  /* unit of profiling */
 
+/* Maximum number of gmon histogram buckets.
+ * FIXME: What is the reasonable number of buckets?
+ * The profiling result will be more accurate if there are enough buckets. */
+#define PROFILE_MAX_BUCKETS	(128 * 1024)
+
+static int profile_init_buckets(struct target_profile *profile,
+		uint32_t start_address, uint32_t end_address)
+{
+	uint32_t address_space = end_address - start_address;
+	assert(address_space >= 2);
+
+	profile->start_address = start_address;
+	profile->end_address = end_address;
+	profile->num_buckets = MIN(address_space / sizeof(UNIT), PROFILE_MAX_BUCKETS);
+	profile->buckets = calloc(profile->num_buckets, sizeof(uint32_t));
+	if (!profile->buckets)
+		return ERROR_FAIL;
+
+	return ERROR_OK;
+}
+
+/* Bin the samples kept by a profile without address range. */
+static int profile_bin_samples(struct target_profile *profile)
+{
+	if (profile->with_range)
+		return ERROR_OK;
+
+	uint32_t min = profile->samples[0];
+	uint32_t max = profile->samples[0];
+	for (uint64_t i = 0; i < profile->num_samples; i++) {
+		if (min > profile->samples[i])
+			min = profile->samples[i];
+		if (max < profile->samples[i])
+			max = profile->samples[i];
+	}
+
+	/* max should be (largest sample + 1)
+	 * Refer to binutils/gprof/hist.c (find_histogram_for_pc) */
+	max++;
+
+	/* a single distinct sample still needs a minimal histogram */
+	if (max - min < 2)
+		max = min + 2;
+
+	if (profile_init_buckets(profile, min, max) != ERROR_OK)
+		return ERROR_FAIL;
+
+	uint64_t num_samples = profile->num_samples;
+	profile->with_range = true;
+	int retval = target_profile_add_samples(profile, profile->samples, num_samples);
+	profile->num_samples = num_samples;
+	return retval;
+}
+
+static void profile_free(struct target_profile *profile)
+{
+	free(profile->samples);
+	free(profile->buckets);
+}
+
 /* Dump a gmon.out histogram file. */
-static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filename, bool with_range,
-			uint32_t start_address, uint32_t end_address, struct target *target, uint32_t duration_ms)
+static void write_gmon(struct target_profile *profile, const char *filename,
+			struct target *target, uint32_t duration_ms)
 {
 	uint32_t i;
 	FILE *f = fopen(filename, "w");
@@ -4241,60 +4508,11 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 	uint8_t zero = 0;  /* GMON_TAG_TIME_HIST */
 	write_data(f, &zero, 1);
 
-	/* figure out bucket size */
-	uint32_t min;
-	uint32_t max;
-	if (with_range) {
-		min = start_address;
-		max = end_address;
-	} else {
-		min = samples[0];
-		max = samples[0];
-		for (i = 0; i < sample_num; i++) {
-			if (min > samples[i])
-				min = samples[i];
-			if (max < samples[i])
-				max = samples[i];
-		}
-
-		/* max should be (largest sample + 1)
-		 * Refer to binutils/gprof/hist.c (find_histogram_for_pc) */
-		max++;
-	}
-
-	int address_space = max - min;
-	assert(address_space >= 2);
-
-	/* FIXME: What is the reasonable number of buckets?
-	 * The profiling result will be more accurate if there are enough buckets. */
-	static const uint32_t max_buckets = 128 * 1024; /* maximum buckets. */
-	uint32_t num_buckets = address_space / sizeof(UNIT);
-	if (num_buckets > max_buckets)
-		num_buckets = max_buckets;
-	int *buckets = malloc(sizeof(int) * num_buckets);
-	if (!buckets) {
-		fclose(f);
-		return;
-	}
-	memset(buckets, 0, sizeof(int) * num_buckets);
-	for (i = 0; i < sample_num; i++) {
-		uint32_t address = samples[i];
-
-		if ((address < min) || (max <= address))
-			continue;
-
-		long long a = address - min;
-		long long b = num_buckets;
-		long long c = address_space;
-		int index_t = (a * b) / c; /* danger!!!! int32 overflows */
-		buckets[index_t]++;
-	}
-
 	/* append binary memory gmon.out &profile_hist_hdr ((char*)&profile_hist_hdr + sizeof(struct gmon_hist_hdr)) */
-	write_long(f, min, target);			/* low_pc */
-	write_long(f, max, target);			/* high_pc */
-	write_long(f, num_buckets, target);	/* # of buckets */
-	float sample_rate = sample_num / (duration_ms / 1000.0);
+	write_long(f, profile->start_address, target);	/* low_pc */
+	write_long(f, profile->end_address, target);	/* high_pc */
+	write_long(f, profile->num_buckets, target);	/* # of buckets */
+	float sample_rate = profile->num_samples / (duration_ms / 1000.0);
 	write_long(f, sample_rate, target);
 	write_string(f, "seconds");
 	for (i = 0; i < (15-strlen("seconds")); i++)
@@ -4303,21 +4521,19 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 
 	/*append binary memory gmon.out profile_hist_data (profile_hist_data + profile_hist_hdr.hist_size) */
 
-	char *data = malloc(2 * num_buckets);
+	char *data = malloc(2 * profile->num_buckets);
 	if (data) {
-		for (i = 0; i < num_buckets; i++) {
-			int val;
-			val = buckets[i];
+		for (i = 0; i < profile->num_buckets; i++) {
+			uint32_t val;
+			val = profile->buckets[i];
 			if (val > 65535)
 				val = 65535;
 			data[i * 2] = val&0xff;
 			data[i * 2 + 1] = (val >> 8) & 0xff;
 		}
-		free(buckets);
-		write_data(f, data, num_buckets * 2);
+		write_data(f, data, profile->num_buckets * 2);
 		free(data);
-	} else
-		free(buckets);
+	}
 
 	fclose(f);
 }
@@ -4331,18 +4547,28 @@ COMMAND_HANDLER(handle_profile_command)
 	if ((CMD_ARGC != 2) && (CMD_ARGC != 4))
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	const uint32_t MAX_PROFILE_SAMPLE_NUM = 10000;
 	uint32_t offset;
-	uint32_t num_of_samples;
 	int retval = ERROR_OK;
 	bool halted_before_profiling = target->state == TARGET_HALTED;
+	struct target_profile profile = { 0 };
 
 	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], offset);
 
-	uint32_t *samples = malloc(sizeof(uint32_t) * MAX_PROFILE_SAMPLE_NUM);
-	if (!samples) {
-		LOG_ERROR("No memory to store samples.");
-		return ERROR_FAIL;
+	if (CMD_ARGC == 4) {
+		uint32_t start_address, end_address;
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], start_address);
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], end_address);
+		if (end_address < start_address + 2) {
+			command_print(CMD, "address range too small");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		/* samples are binned as they arrive, nothing is kept */
+		profile.with_range = true;
+		if (profile_init_buckets(&profile, start_address, end_address) != ERROR_OK) {
+			LOG_ERROR("No memory to store samples.");
+			return ERROR_FAIL;
+		}
 	}
 
 	uint64_t timestart_ms = timeval_ms();
@@ -4351,19 +4577,16 @@ COMMAND_HANDLER(handle_profile_command)
 	 * annoying halt/resume step; for example, ARMv7 PCSR.
 	 * Provide a way to use that more efficient mechanism.
 	 */
-	retval = target_profiling(target, samples, MAX_PROFILE_SAMPLE_NUM,
-				&num_of_samples, offset);
+	retval = target_profiling(target, &profile, offset);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_free(&profile);
 		return retval;
 	}
 	uint32_t duration_ms = timeval_ms() - timestart_ms;
 
-	assert(num_of_samples <= MAX_PROFILE_SAMPLE_NUM);
-
 	retval = target_poll(target);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_free(&profile);
 		return retval;
 	}
 
@@ -4372,7 +4595,7 @@ COMMAND_HANDLER(handle_profile_command)
 		 * for consistency. */
 		retval = target_halt(target);
 		if (retval != ERROR_OK) {
-			free(samples);
+			profile_free(&profile);
 			return retval;
 		}
 	} else if (target->state == TARGET_HALTED && !halted_before_profiling) {
@@ -4380,31 +4603,33 @@ COMMAND_HANDLER(handle_profile_command)
 		 * it, for consistency. */
 		retval = target_resume(target, 1, 0, 0, 0);
 		if (retval != ERROR_OK) {
-			free(samples);
+			profile_free(&profile);
 			return retval;
 		}
 	}
 
 	retval = target_poll(target);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_free(&profile);
 		return retval;
 	}
 
-	uint32_t start_address = 0;
-	uint32_t end_address = 0;
-	bool with_range = false;
-	if (CMD_ARGC == 4) {
-		with_range = true;
-		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], start_address);
-		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], end_address);
+	if (profile.num_samples == 0) {
+		command_print(CMD, "No samples collected");
+		profile_free(&profile);
+		return ERROR_FAIL;
+	}
+
+	if (profile_bin_samples(&profile) != ERROR_OK) {
+		LOG_ERROR("No memory to bin samples.");
+		profile_free(&profile);
+		return ERROR_FAIL;
 	}
 
-	write_gmon(samples, num_of_samples, CMD_ARGV[1],
-		   with_range, start_address, end_address, target, duration_ms);
-	command_print(CMD, "Wrote %s", CMD_ARGV[1]);
+	write_gmon(&profile, CMD_ARGV[1], target, duration_ms);
+	command_print(CMD, "Wrote %s (%" PRIu64 " samples)", CMD_ARGV[1], profile.num_samples);
 
-	free(samples);
+	profile_free(&profile);
 	return retval;
 }
 
@@ -355,6 +355,30 @@ struct target_memory_check_block {
 	uint32_t result;
 };
 
+enum target_memory_check_op {
+	TARGET_MEMORY_BLANK_CHECK = 1,
+	TARGET_MEMORY_CRC32 = 2,
+	TARGET_MEMORY_COMPARE = 3,
+};
+
+/** One region of a target_check_memory_regions() request. */
+struct target_memory_check_region {
+	enum target_memory_check_op op;
+	target_addr_t address;
+	uint32_t size;
+	/** Value of the erased bytes, for TARGET_MEMORY_BLANK_CHECK. */
+	uint8_t erased_value;
+	/** Start of the region compared with this one, for TARGET_MEMORY_COMPARE. */
+	target_addr_t compare_address;
+	/**
+	 * TARGET_MEMORY_BLANK_CHECK: 1 if the region is erased, 0 otherwise.
+	 * TARGET_MEMORY_CRC32: the CRC of the region, as target_checksum_memory().
+	 * TARGET_MEMORY_COMPARE: 0 if the regions are equal, otherwise the
+	 * offset of the first difference plus one.
+	 */
+	uint32_t result;
+};
+
 int target_register_commands(struct command_context *cmd_ctx);
 int target_examine(void);
 
@@ -672,6 +696,15 @@ int target_checksum_memory(struct target *target,
 int target_blank_check_memory(struct target *target,
 		struct target_memory_check_block *blocks, int num_blocks,
 		uint8_t erased_value);
+/**
+ * Blank check, checksum or compare a list of memory regions, with as few
+ * runs of a target algorithm as possible. The regions the target cannot
+ * handle in a batch go one by one through target_checksum_memory() or
+ * target_blank_check_memory(), and are read back and processed on the host
+ * only if those are not available either.
+ */
+int target_check_memory_regions(struct target *target,
+		struct target_memory_check_region *regions, unsigned int num_regions);
 int target_wait_state(struct target *target, enum target_state state, int ms);
 
 /**
@@ -794,8 +827,36 @@ void target_handle_md_output(struct command_invocation *cmd,
 	struct target *target, target_addr_t address, unsigned size,
 	unsigned count, const uint8_t *buffer);
 
-int target_profiling_default(struct target *target, uint32_t *samples, uint32_t
-		max_num_samples, uint32_t *num_samples, uint32_t seconds);
+/**
+ * PC samples collected by the "profile" command.
+ *
+ * Profiling backends push samples with target_profile_add_samples() as they
+ * arrive instead of filling a preallocated array.  If an address range was
+ * given, samples are binned into the gmon histogram straight away and not
+ * kept; otherwise they are stored in a growing buffer until the range is
+ * known.
+ */
+struct target_profile {
+	/** Total number of samples taken */
+	uint64_t num_samples;
+
+	/** Raw samples, only kept when @a with_range is false */
+	uint32_t *samples;
+	size_t samples_size;
+
+	/** Histogram address range, [start_address, end_address) */
+	bool with_range;
+	uint32_t start_address;
+	uint32_t end_address;
+	uint32_t num_buckets;
+	uint32_t *buckets;
+};
+
+int target_profile_add_samples(struct target_profile *profile,
+		const uint32_t *samples, uint32_t count);
+
+int target_profiling_default(struct target *target,
+		struct target_profile *profile, uint32_t seconds);
 
 #define ERROR_TARGET_INVALID	(-300)
 #define ERROR_TARGET_INIT_FAILED (-301)
@@ -28,6 +28,7 @@
 #include <helper/jim-nvp.h>
 
 struct target;
+struct target_profile;
 
 /**
  * This holds methods shared between all instances of a given target
@@ -148,6 +149,12 @@ struct target_type {
 	int (*blank_check_memory)(struct target *target,
 			struct target_memory_check_block *blocks, int num_blocks,
 			uint8_t erased_value);
+	/**
+	 * Process the first regions of the list in a single target run
+	 * (optional). Returns the number of regions done, or an error code.
+	 */
+	int (*check_memory_regions)(struct target *target,
+			struct target_memory_check_region *regions, unsigned int num_regions);
 
 	/*
 	 * target break-/watchpoint control
@@ -297,10 +304,11 @@ struct target_type {
 	 */
 	int (*gdb_fileio_end)(struct target *target, int retcode, int fileio_errno, bool ctrl_c);
 
-	/* do target profiling
+	/* do target profiling, passing each PC sample to
+	 * target_profile_add_samples() until @a seconds have elapsed
 	 */
-	int (*profiling)(struct target *target, uint32_t *samples,
-			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
+	int (*profiling)(struct target *target, struct target_profile *profile,
+			uint32_t seconds);
 
 	/* Return the number of address bits this target supports. This will
 	 * typically be 32 for 32-bit targets, and 64 for 64-bit targets. If not